@@ -0,0 +1,102 @@
+"""
+Compares the libev and io_uring backends with many TCP
+connections. Starts ./statsite once per backend, opens the
+connections, and sends small chunks round robin across them,
+so every read only finds a few lines. Reports lines per second.
+
+Usage: python bench_conns.py [connections] [lines per connection]
+"""
+import multiprocessing
+import os
+import resource
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+PORT = 18127
+LINES_PER_SEND = 8
+SENDERS = 4
+CONFIG = """[statsite]
+port = %d
+udp_port = 0
+flush_interval = 1
+log_level = ERROR
+input_counter = bench.lines
+use_io_uring = %d
+
+[sink_stream_default]
+command = cat >> %s
+"""
+
+
+def sender(num_conns, num_lines, barrier, results):
+    "Sends the lines over a share of the connections"
+    conns = [socket.create_connection(("localhost", PORT)) for _ in range(num_conns)]
+    chunk = b"".join(b"bench.conn:1|c\n" for _ in range(LINES_PER_SEND))
+    barrier.wait()
+    start = time.time()
+    for _ in range(num_lines // LINES_PER_SEND):
+        for s in conns:
+            s.sendall(chunk)
+    for s in conns:
+        s.shutdown(socket.SHUT_WR)
+    for s in conns:
+        s.recv(1)  # Wait for statsite to drain and close
+        s.close()
+    results.put(time.time() - start)
+
+
+def run(use_io_uring, num_conns, num_lines):
+    "Runs a single backend, returns (lines/sec, lines received)"
+    tmpdir = tempfile.mkdtemp()
+    out = os.path.join(tmpdir, "output")
+    conf = os.path.join(tmpdir, "config.ini")
+    with open(conf, "w") as f:
+        f.write(CONFIG % (PORT, use_io_uring, out))
+
+    proc = subprocess.Popen(["./statsite", "-f", conf])
+    time.sleep(0.5)
+
+    barrier = multiprocessing.Barrier(SENDERS)
+    results = multiprocessing.Queue()
+    senders = [multiprocessing.Process(target=sender,
+                                       args=(num_conns // SENDERS, num_lines, barrier, results))
+               for _ in range(SENDERS)]
+    for p in senders:
+        p.start()
+    diff = max(results.get() for _ in senders)
+    for p in senders:
+        p.join()
+
+    # Wait for the last flush
+    time.sleep(1.5)
+    proc.terminate()
+    proc.wait()
+
+    received = 0
+    with open(out) as f:
+        for line in f:
+            key, val, _ = line.split("|")
+            if key == "counts.bench.lines":
+                received += int(float(val))
+    total = (num_conns // SENDERS) * SENDERS * (num_lines // LINES_PER_SEND) * LINES_PER_SEND
+    return total / diff, received
+
+
+def main():
+    num_conns = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+    num_lines = int(sys.argv[2]) if len(sys.argv) > 2 else 512
+
+    # Each connection needs a file on both ends
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (min(hard, max(soft, 2 * num_conns + 64)), hard))
+
+    for name, use_io_uring in (("libev", 0), ("io_uring", 1)):
+        rate, received = run(use_io_uring, num_conns, num_lines)
+        print("%s\t - %d conns %.0f lines/sec\t %d lines received" % (name, num_conns, rate, received))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,97 @@
+"""
+Compares the ingest rate of the ASCII and binary protocols.
+Starts ./statsite, streams the same counters and timers over
+TCP in each protocol, and reports lines per second. TCP
+backpressure keeps the sender at the rate statsite parses.
+
+Usage: python bench_protocol.py [lines]
+"""
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+PORT = 18126
+CHUNK = 1024
+KEYS = ["test", "foobar", "zipzap", "service.api.latency", "service.db.latency"]
+VALS = [32, 100, 82, 101, 5, 6, 42, 73]
+CONFIG = """[statsite]
+port = %d
+udp_port = 0
+flush_interval = 1
+log_level = ERROR
+input_counter = bench.lines
+
+[sink_stream_default]
+command = cat >> %s
+"""
+
+BINARY_HEADER = struct.Struct("<BBHd")
+BIN_TYPES = {"c": 2, "ms": 3}
+
+
+def ascii_line(key, type, val):
+    return ("%s:%d|%s\n" % (key, val, type)).encode("ascii")
+
+
+def binary_line(key, type, val):
+    key = key.encode("ascii") + b"\0"
+    return BINARY_HEADER.pack(0xaa, BIN_TYPES[type], len(key), float(val)) + key
+
+
+def build(num, encoder):
+    "Builds chunks of encoded messages"
+    random.seed(42)
+    msgs = [encoder(random.choice(KEYS), random.choice(["c", "ms"]), random.choice(VALS))
+            for _ in range(num)]
+    return [b"".join(msgs[i:i + CHUNK]) for i in range(0, num, CHUNK)]
+
+
+def run(name, chunks, num):
+    "Runs a single protocol, returns (lines/sec, lines received)"
+    tmpdir = tempfile.mkdtemp()
+    out = os.path.join(tmpdir, "output")
+    conf = os.path.join(tmpdir, "config.ini")
+    with open(conf, "w") as f:
+        f.write(CONFIG % (PORT, out))
+
+    proc = subprocess.Popen(["./statsite", "-f", conf])
+    time.sleep(0.5)
+
+    s = socket.create_connection(("localhost", PORT))
+    start = time.time()
+    for chunk in chunks:
+        s.sendall(chunk)
+    s.shutdown(socket.SHUT_WR)
+    s.recv(1)  # Wait for statsite to drain and close
+    diff = time.time() - start
+    s.close()
+
+    # Wait for the last flush
+    time.sleep(1.5)
+    proc.terminate()
+    proc.wait()
+
+    received = 0
+    with open(out) as f:
+        for line in f:
+            key, val, _ = line.split("|")
+            if key == "counts.bench.lines":
+                received += int(float(val))
+    return num / diff, received
+
+
+def main():
+    num = int(sys.argv[1]) if len(sys.argv) > 1 else 1024 * 1024
+    for name, encoder in (("ascii", ascii_line), ("binary", binary_line)):
+        chunks = build(num, encoder)
+        rate, received = run(name, chunks, num)
+        print("%s\t - %.0f lines/sec\t %d lines received" % (name, rate, received))
+
+
+if __name__ == "__main__":
+    main()
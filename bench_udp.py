@@ -0,0 +1,93 @@
+"""
+Benchmarks UDP ingest with a varying number of ingest threads.
+Starts ./statsite for each thread count, floods it from several
+sender processes, and reports how many lines were aggregated.
+
+Usage: python bench_udp.py [threads ...]
+"""
+import multiprocessing
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+PORT = 18125
+SENDERS = 4
+DURATION = 5
+KEYS = ["test", "foobar", "zipzap", "timer.%d"]
+CONFIG = """[statsite]
+port = 0
+udp_port = %d
+flush_interval = 1
+log_level = ERROR
+ingest_threads = %d
+
+[sink_stream_default]
+command = cat >> %s
+"""
+
+
+def sender(port, until, sent):
+    "Sends batches of counters until the deadline"
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    pid = os.getpid()
+    lines = ["%s:1|c" % (k % pid if "%" in k else k) for k in KEYS]
+    msg = ("\n".join(lines * 64)).encode("ascii")
+    count = 0
+    while time.time() < until:
+        try:
+            s.sendto(msg, ("127.0.0.1", port))
+            count += len(lines) * 64
+        except socket.error:
+            pass
+    sent.value += count
+
+
+def run(threads):
+    "Runs a single benchmark, returns (sent, received, seconds)"
+    tmpdir = tempfile.mkdtemp()
+    out = os.path.join(tmpdir, "output")
+    conf = os.path.join(tmpdir, "config.ini")
+    with open(conf, "w") as f:
+        f.write(CONFIG % (PORT, threads, out))
+
+    proc = subprocess.Popen(["./statsite", "-f", conf])
+    time.sleep(0.5)
+
+    sent = multiprocessing.Value("l", 0)
+    until = time.time() + DURATION
+    procs = [multiprocessing.Process(target=sender, args=(PORT, until, sent))
+             for _ in range(SENDERS)]
+    start = time.time()
+    for p in procs:
+        p.start()
+    for p in procs:
+        p.join()
+    diff = time.time() - start
+
+    # Wait for the last flush
+    time.sleep(1.5)
+    proc.terminate()
+    proc.wait()
+
+    received = 0
+    with open(out) as f:
+        for line in f:
+            key, val, _ = line.split("|")
+            if key.startswith("counts."):
+                received += float(val)
+    return sent.value, received, diff
+
+
+def main():
+    threads = [int(t) for t in sys.argv[1:]] or [1, 2, 4]
+    for t in threads:
+        sent, received, diff = run(t)
+        print("%d threads\t - %.0f sent/sec\t %.0f recv/sec\t %.1f%% dropped" % (
+            t, sent / diff, received / diff, 100.0 * (sent - received) / max(sent, 1)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+"""
+Compares UDP over loopback with the unix datagram socket for
+local emitters. Starts ./statsite listening on both, then blasts
+datagrams of batched lines at each transport in turn. Reports the
+send rate and how many lines statsite actually received, since
+UDP silently drops what the unix socket would push back on.
+
+Usage: python bench_unix.py [datagrams] [lines per datagram]
+"""
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+PORT = 18128
+CONFIG = """[statsite]
+port = 0
+udp_port = %d
+flush_interval = 1
+log_level = ERROR
+input_counter = bench.lines
+unix_dgram_path = %s
+unix_rcvbuf = 4194304
+
+[sink_stream_default]
+command = cat >> %s
+"""
+
+
+def count_lines(out):
+    "Sums the input counter over all the flushes so far"
+    received = 0
+    if not os.path.exists(out):
+        return received
+    with open(out) as f:
+        for line in f:
+            key, val, _ = line.split("|")
+            if key == "counts.bench.lines":
+                received += int(float(val))
+    return received
+
+
+def blast(sock, addr, num_dgrams, payload):
+    "Sends the datagrams, returns the elapsed time"
+    start = time.time()
+    for _ in range(num_dgrams):
+        while True:
+            try:
+                sock.sendto(payload, addr)
+                break
+            except BlockingIOError:
+                # Only the unix socket pushes back, wait for statsite
+                time.sleep(0.0001)
+    return time.time() - start
+
+
+def main():
+    num_dgrams = int(sys.argv[1]) if len(sys.argv) > 1 else 200000
+    num_lines = int(sys.argv[2]) if len(sys.argv) > 2 else 16
+    payload = b"".join(b"bench.unix:1|c\n" for _ in range(num_lines))
+
+    tmpdir = tempfile.mkdtemp()
+    out = os.path.join(tmpdir, "output")
+    path = os.path.join(tmpdir, "statsite.dgram")
+    conf = os.path.join(tmpdir, "config.ini")
+    with open(conf, "w") as f:
+        f.write(CONFIG % (PORT, path, out))
+
+    proc = subprocess.Popen(["./statsite", "-f", conf])
+    time.sleep(0.5)
+    try:
+        transports = (
+            ("udp", socket.AF_INET, ("127.0.0.1", PORT)),
+            ("unix", socket.AF_UNIX, path),
+        )
+        for name, family, addr in transports:
+            sock = socket.socket(family, socket.SOCK_DGRAM)
+            sock.setblocking(False)
+            before = count_lines(out)
+            diff = blast(sock, addr, num_dgrams, payload)
+            sock.close()
+
+            # Wait for the lines to be flushed
+            time.sleep(2.5)
+            received = count_lines(out) - before
+            sent = num_dgrams * num_lines
+            print("%s\t - %.0f lines/sec sent\t %d of %d lines received (%.1f%%)" %
+                  (name, sent / diff, received, sent, 100.0 * received / sent))
+    finally:
+        proc.terminate()
+        proc.wait()
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+    main()
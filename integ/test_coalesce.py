@@ -0,0 +1,119 @@
+import os
+import os.path
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import random
+
+try:
+    import pytest
+except ImportError:
+    print >> sys.stderr, "Integ tests require pytests!"
+    sys.exit(1)
+
+
+def start_server(request, coalesce):
+    "Starts a server with a cardinality limit, returns a connection and the output"
+    # Create tmpdir and delete after
+    tmpdir = tempfile.mkdtemp()
+
+    # Make the command
+    output = "%s/output" % tmpdir
+    cmd = "cat >> %s" % output
+
+    # Write the configuration
+    port = random.randrange(10000, 65000)
+    config_path = os.path.join(tmpdir, "config.cfg")
+    conf = """[statsite]
+flush_interval = 1
+port = %d
+udp_port = 0
+coalesce_batches = %s
+
+[sink_stream_default]
+command = %s
+
+[cardinality_api]
+prefix = api.
+max_keys = 1
+""" % (port, "true" if coalesce else "false", cmd)
+    open(config_path, "w").write(conf)
+
+    # Start the process
+    proc = subprocess.Popen(['./statsite', '-f', config_path])
+    proc.poll()
+    assert proc.returncode is None
+
+    # Define a cleanup handler
+    def cleanup():
+        try:
+            proc.kill()
+            proc.wait()
+            shutil.rmtree(tmpdir)
+        except:
+            print proc
+            pass
+    request.addfinalizer(cleanup)
+
+    # Make a connection to the server
+    connected = False
+    for x in xrange(3):
+        try:
+            conn = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            conn.settimeout(1)
+            conn.connect(("localhost", port))
+            connected = True
+            break
+        except Exception, e:
+            print e
+            time.sleep(0.5)
+
+    # Die now
+    if not connected:
+        raise EnvironmentError("Failed to connect!")
+    return conn, output
+
+
+@pytest.fixture
+def servers(request):
+    "Returns an uncoalesced and a coalesced server"
+    return start_server(request, False), start_server(request, True)
+
+
+def wait_file(path, timeout=15):
+    "Waits on a file to be make"
+    start = time.time()
+    while not os.path.isfile(path) and time.time() - start < timeout:
+        time.sleep(0.1)
+    if not os.path.isfile(path):
+        raise Exception("Timed out waiting for file %s" % path)
+    while os.path.getsize(path) == 0 and time.time() - start < timeout:
+        time.sleep(0.1)
+
+
+def read_metrics(path):
+    "Returns the sorted output lines, without the timestamps"
+    lines = open(path).read().strip().split("\n")
+    return sorted(line.rsplit("|", 1)[0] for line in lines)
+
+
+class TestCoalesce(object):
+    def test_overflow_order(self, servers):
+        "Tests names folded into an overflow metric keep their order"
+        msg = "api.a:1|g\napi.b:2|g\napi.a:3|g\napi.c:4|g\napi.b:5|g\n" \
+              "api.c:6|c\napi.b:7|c\napi.c:8|ms\napi.b:9|ms\napi.c:10|ms\n"
+        for server, _ in servers:
+            server.sendall(msg)
+
+        outputs = []
+        for _, output in servers:
+            wait_file(output)
+            outputs.append(read_metrics(output))
+
+        assert outputs[0] == outputs[1]
+        assert "gauges.api.__overflow__|5.000000" in outputs[1]
+        assert "gauges.api.a|3.000000" in outputs[1]
+        assert "counts.api.__rejected__|8.000000" in outputs[1]
@@ -9,6 +9,7 @@ import sys
 import tempfile
 import time
 import random
+import struct
 
 try:
     import pytest
@@ -211,7 +212,7 @@ class TestInteg(object):
         assert "timers.val.upper|99.000000" in out
         assert "timers.val.count|100" in out
         assert "timers.val.median|49.000000" in out
-        assert "timers.val.p90|90.000000" in out
+        assert "timers.val.p90|89.000000" in out
         assert "timers.val.p95|95.000000" in out
         assert "timers.val.p99|99.000000" in out
         assert "timers.val.p999|99.000000" in out
@@ -233,7 +234,7 @@ class TestInteg(object):
         assert "timers.noobs.upper|99.000000" in out
         assert "timers.noobs.count|100" in out
         assert "timers.noobs.median|49.000000" in out
-        assert "timers.noobs.p90|90.000000" in out
+        assert "timers.noobs.p90|89.000000" in out
         assert "timers.noobs.p95|95.000000" in out
         assert "timers.noobs.p99|99.000000" in out
         assert "timers.noobs.p999|99.000000" in out
@@ -273,6 +274,18 @@ class TestInteg(object):
         out = open(output).read()
         assert out in ("sets.zip|3|%d\n" % now, "sets.zip|3|%d\n" % (now - 1))
 
+    def test_binary_empty_key(self, servers):
+        "Tests a binary header with an empty key closes the connection"
+        server, _, output = servers
+        server.sendall("\xaa\x02\x00\x00" + struct.pack("<d", 1.0))
+        assert server.recv(1) == ""
+
+    def test_binary_empty_set_key(self, servers):
+        "Tests a binary set header with an empty set key closes the connection"
+        server, _, output = servers
+        server.sendall("\xaa\x04\x04\x00\x00\x00zip\x00foo\x00")
+        assert server.recv(1) == ""
+
     def test_double_parsing(self, servers):
         "Tests string to double parsing"
         server, _, output = servers
@@ -362,6 +375,16 @@ class TestIntegUDP(object):
         out = open(output).read()
         assert out in ("kv.tubez|100.000000|%d\n" % now, "kv.tubez|100.000000|%d\n" % (now - 1))
 
+    def test_bad_binary_type(self, servers):
+        "Tests a binary message of unknown type, followed by a valid kv pair"
+        _, server, output = servers
+        server.sendall("\xaa\x00")
+        server.sendall("tubez:100|kv\n")
+        wait_file(output)
+        now = time.time()
+        out = open(output).read()
+        assert out in ("kv.tubez|100.000000|%d\n" % now, "kv.tubez|100.000000|%d\n" % (now - 1))
+
     def test_counters(self, servers):
         "Tests adding kv pairs"
         _, server, output = servers
@@ -424,7 +447,7 @@ class TestIntegUDP(object):
         assert "timers.noobs.upper|99.000000" in out
         assert "timers.noobs.count|100" in out
         assert "timers.noobs.median|49.000000" in out
-        assert "timers.noobs.p90|90.000000" in out
+        assert "timers.noobs.p90|89.000000" in out
         assert "timers.noobs.p95|95.000000" in out
         assert "timers.noobs.p99|99.000000" in out
         assert "timers.noobs.p999|99.000000" in out
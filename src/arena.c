@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+/*
+ * The arena holds the per interval state of the metrics. The
+ * chunks are mapped directly rather than taken from the heap,
+ * so that each interval gives its memory back to the system
+ * and the heap does not fragment as intervals come and go.
+ * Chunks double in size, so an interval with many metrics
+ * only needs a handful of them.
+ */
+
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define MAX_CHUNK_SIZE (4 * 1024 * 1024)
+#define ARENA_ALIGN 8
+
+struct arena_chunk {
+    arena_chunk *next;
+    size_t size;            // Size of the mapping, with this header
+};
+
+// The header is padded so the memory after it is aligned
+#define CHUNK_HEADER ((sizeof(arena_chunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/**
+ * Initializes the arena. No memory is allocated
+ * until the first allocation.
+ * @return 0 on success.
+ */
+int arena_init(arena *a) {
+    memset(a, 0, sizeof(arena));
+    a->next_size = MIN_CHUNK_SIZE;
+    return 0;
+}
+
+/**
+ * Destroys the arena, freeing everything allocated from it.
+ * @return 0 on success.
+ */
+int arena_destroy(arena *a) {
+    arena_chunk *c = a->chunks, *next;
+    while (c) {
+        next = c->next;
+        munmap(c, c->size);
+        c = next;
+    }
+    return arena_init(a);
+}
+
+/**
+ * Internal method to map a new chunk with room for an allocation
+ * @return 0 on success.
+ */
+static int arena_grow(arena *a, size_t size) {
+    size_t chunk_size = a->next_size;
+    while (chunk_size < size + CHUNK_HEADER)
+        chunk_size *= 2;
+
+    arena_chunk *c = mmap(NULL, chunk_size, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) return -1;
+    c->size = chunk_size;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->pos = (char*)c + CHUNK_HEADER;
+    a->end = (char*)c + chunk_size;
+
+    if (a->next_size < MAX_CHUNK_SIZE)
+        a->next_size *= 2;
+    return 0;
+}
+
+/**
+ * Allocates memory from the arena, aligned for any
+ * of the metric types.
+ * @arg size The number of bytes
+ * @return The memory, or NULL if out of memory.
+ */
+void* arena_alloc(arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->pos) < size && arena_grow(a, size))
+        return NULL;
+    void *mem = a->pos;
+    a->pos += size;
+    a->used += size;
+    return mem;
+}
+
+/**
+ * Allocates zeroed memory from the arena
+ * @arg num The number of elements
+ * @arg size The size of each element
+ * @return The memory, or NULL if out of memory.
+ */
+void* arena_calloc(arena *a, size_t num, size_t size) {
+    // Mappings start zeroed, and memory is never handed out twice
+    return arena_alloc(a, num * size);
+}
+
+/**
+ * Copies a string into the arena
+ * @arg str The string to copy
+ * @arg len The length of the string
+ * @return The null terminated copy, or NULL if out of memory.
+ */
+char* arena_strndup(arena *a, const char *str, size_t len) {
+    char *copy = arena_alloc(a, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/**
+ * Moves the memory of another arena into this one, so
+ * that it lives as long as this arena.
+ * @arg a The arena to move into
+ * @arg other The arena to take from. Empty on return.
+ * @return 0 on success.
+ */
+int arena_merge(arena *a, arena *other) {
+    if (!other->chunks) return 0;
+
+    // Splice the other chunks in behind the newest one,
+    // so new allocations keep using its free space
+    arena_chunk *last = other->chunks;
+    while (last->next) last = last->next;
+    if (a->chunks) {
+        last->next = a->chunks->next;
+        a->chunks->next = other->chunks;
+    } else {
+        last->next = NULL;
+        a->chunks = other->chunks;
+        a->pos = other->pos;
+        a->end = other->end;
+    }
+    a->used += other->used;
+    return arena_init(other);
+}
@@ -0,0 +1,65 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+typedef struct arena_chunk arena_chunk;
+
+/**
+ * A bump allocator for objects that all share a lifetime.
+ * Nothing is freed on its own, the whole arena goes at once.
+ */
+typedef struct {
+    arena_chunk *chunks;    // List of the chunks, newest first
+    char *pos;              // Next free byte of the newest chunk
+    char *end;              // End of the newest chunk
+    size_t next_size;       // Size of the next chunk
+    size_t used;            // Bytes handed out
+} arena;
+
+/**
+ * Initializes the arena. No memory is allocated
+ * until the first allocation.
+ * @return 0 on success.
+ */
+int arena_init(arena *a);
+
+/**
+ * Destroys the arena, freeing everything allocated from it.
+ * @return 0 on success.
+ */
+int arena_destroy(arena *a);
+
+/**
+ * Allocates memory from the arena, aligned for any
+ * of the metric types.
+ * @arg size The number of bytes
+ * @return The memory, or NULL if out of memory.
+ */
+void* arena_alloc(arena *a, size_t size);
+
+/**
+ * Allocates zeroed memory from the arena
+ * @arg num The number of elements
+ * @arg size The size of each element
+ * @return The memory, or NULL if out of memory.
+ */
+void* arena_calloc(arena *a, size_t num, size_t size);
+
+/**
+ * Copies a string into the arena
+ * @arg str The string to copy
+ * @arg len The length of the string
+ * @return The null terminated copy, or NULL if out of memory.
+ */
+char* arena_strndup(arena *a, const char *str, size_t len);
+
+/**
+ * Moves the memory of another arena into this one, so
+ * that it lives as long as this arena.
+ * @arg a The arena to move into
+ * @arg other The arena to take from. Empty on return.
+ * @return 0 on success.
+ */
+int arena_merge(arena *a, arena *other);
+
+#endif
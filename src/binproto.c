@@ -0,0 +1,183 @@
+#include <string.h>
+#include "binproto.h"
+
+/*
+ * All values are little endian on the wire. These are
+ * assembled byte-wise so they work on any host, the
+ * compiler reduces them to plain loads on x86.
+ */
+static uint16_t load_u16(const unsigned char *buf) {
+    return (uint16_t)buf[0] | ((uint16_t)buf[1] << 8);
+}
+
+static double load_double(const unsigned char *buf) {
+    uint64_t bits = 0;
+    for (int i=7; i >= 0; i--) {
+        bits = (bits << 8) | buf[i];
+    }
+    double val;
+    memcpy(&val, &bits, sizeof(double));
+    return val;
+}
+
+static void store_u16(unsigned char *buf, uint16_t val) {
+    buf[0] = val & 0xff;
+    buf[1] = val >> 8;
+}
+
+static void store_double(unsigned char *buf, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(double));
+    for (int i=0; i < 8; i++) {
+        buf[i] = bits & 0xff;
+        bits >>= 8;
+    }
+}
+
+/**
+ * Returns the size of the fixed header for a metric type byte
+ * @arg type_byte The second byte of the message
+ * @return The header size, or -1 for an unknown type.
+ */
+int binproto_header_size(unsigned char type_byte) {
+    int sampled = type_byte & BIN_FLAG_SAMPLE_RATE;
+    switch (type_byte & ~BIN_FLAG_SAMPLE_RATE) {
+        case BIN_TYPE_GAUGE_DIRECT:
+        case BIN_TYPE_GAUGE:
+        case BIN_TYPE_GAUGE_DELTA:
+        case BIN_TYPE_COUNTER:
+        case BIN_TYPE_TIMER:
+            return (sampled) ? BIN_RATE_HEADER_SIZE : BIN_VALUE_HEADER_SIZE;
+        case BIN_TYPE_SET:
+            return (sampled) ? -1 : BIN_SET_HEADER_SIZE;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Decodes a message header
+ * @arg buf The message, must hold the full header
+ * @arg header Output. The decoded header.
+ * @return The header size on success, -1 for a malformed header.
+ */
+int binproto_decode_header(const unsigned char *buf, binproto_header *header) {
+    if (buf[0] != BINARY_MAGIC_BYTE) return -1;
+    int size = binproto_header_size(buf[1]);
+    if (size < 0) return -1;
+
+    switch (buf[1] & ~BIN_FLAG_SAMPLE_RATE) {
+        case BIN_TYPE_GAUGE_DIRECT:
+            header->type = GAUGE_DIRECT;
+            break;
+        case BIN_TYPE_GAUGE:
+            header->type = GAUGE;
+            break;
+        case BIN_TYPE_GAUGE_DELTA:
+            header->type = GAUGE_DELTA;
+            break;
+        case BIN_TYPE_COUNTER:
+            header->type = COUNTER;
+            break;
+        case BIN_TYPE_TIMER:
+            header->type = TIMER;
+            break;
+        case BIN_TYPE_SET:
+            header->type = SET;
+            break;
+    }
+
+    // Keys must at least hold the null terminator
+    header->key_len = load_u16(buf + 2);
+    if (header->key_len == 0) return -1;
+
+    header->set_len = 0;
+    header->value = 0;
+    header->sample_rate = 1.0;
+    if (header->type == SET) {
+        header->set_len = load_u16(buf + 4);
+        if (header->set_len == 0) return -1;
+    } else {
+        header->value = load_double(buf + 4);
+        if (buf[1] & BIN_FLAG_SAMPLE_RATE)
+            header->sample_rate = load_double(buf + 12);
+    }
+    return size;
+}
+
+/**
+ * Encodes a message with a value. This is the reference
+ * encoder for clients.
+ * @arg buf The output buffer
+ * @arg buf_len The size of the output buffer
+ * @arg type The metric type, must not be SET
+ * @arg key The null terminated key
+ * @arg val The value
+ * @arg sample_rate The sample rate, 1.0 omits it from the message
+ * @return The encoded size on success, -1 if the message does not fit.
+ */
+int binproto_encode(char *buf, int buf_len, metric_type type, const char *key, double val, double sample_rate) {
+    unsigned char type_byte;
+    switch (type) {
+        case GAUGE_DIRECT:
+            type_byte = BIN_TYPE_GAUGE_DIRECT;
+            break;
+        case GAUGE:
+            type_byte = BIN_TYPE_GAUGE;
+            break;
+        case GAUGE_DELTA:
+            type_byte = BIN_TYPE_GAUGE_DELTA;
+            break;
+        case COUNTER:
+            type_byte = BIN_TYPE_COUNTER;
+            break;
+        case TIMER:
+            type_byte = BIN_TYPE_TIMER;
+            break;
+        default:
+            return -1;
+    }
+
+    int header_size = BIN_VALUE_HEADER_SIZE;
+    if (sample_rate != 1.0) {
+        type_byte |= BIN_FLAG_SAMPLE_RATE;
+        header_size = BIN_RATE_HEADER_SIZE;
+    }
+
+    size_t key_len = strlen(key) + 1;
+    if (key_len > UINT16_MAX || header_size + key_len > buf_len) return -1;
+
+    unsigned char *out = (unsigned char*)buf;
+    out[0] = BINARY_MAGIC_BYTE;
+    out[1] = type_byte;
+    store_u16(out + 2, key_len);
+    store_double(out + 4, val);
+    if (type_byte & BIN_FLAG_SAMPLE_RATE)
+        store_double(out + 12, sample_rate);
+    memcpy(out + header_size, key, key_len);
+    return header_size + key_len;
+}
+
+/**
+ * Encodes a set message. This is the reference encoder for clients.
+ * @arg buf The output buffer
+ * @arg buf_len The size of the output buffer
+ * @arg key The null terminated key of the set
+ * @arg set_key The null terminated value to add to the set
+ * @return The encoded size on success, -1 if the message does not fit.
+ */
+int binproto_encode_set(char *buf, int buf_len, const char *key, const char *set_key) {
+    size_t key_len = strlen(key) + 1;
+    size_t set_len = strlen(set_key) + 1;
+    if (key_len > UINT16_MAX || set_len > UINT16_MAX) return -1;
+    if (BIN_SET_HEADER_SIZE + key_len + set_len > buf_len) return -1;
+
+    unsigned char *out = (unsigned char*)buf;
+    out[0] = BINARY_MAGIC_BYTE;
+    out[1] = BIN_TYPE_SET;
+    store_u16(out + 2, key_len);
+    store_u16(out + 4, set_len);
+    memcpy(out + BIN_SET_HEADER_SIZE, key, key_len);
+    memcpy(out + BIN_SET_HEADER_SIZE + key_len, set_key, set_len);
+    return BIN_SET_HEADER_SIZE + key_len + set_len;
+}
@@ -0,0 +1,84 @@
+#ifndef BINPROTO_H
+#define BINPROTO_H
+#include <stdint.h>
+#include "config.h"
+
+/**
+ * The first byte of every binary message. It is never
+ * the start of a valid ASCII line, which lets both
+ * protocols share the same ports.
+ */
+#define BINARY_MAGIC_BYTE 0xaa
+
+// Metric types on the wire
+#define BIN_TYPE_GAUGE_DIRECT   0x1
+#define BIN_TYPE_COUNTER        0x2
+#define BIN_TYPE_TIMER          0x3
+#define BIN_TYPE_SET            0x4
+#define BIN_TYPE_GAUGE          0x5
+#define BIN_TYPE_GAUGE_DELTA    0x6
+
+/**
+ * Set on the metric type if a sample rate
+ * follows the value.
+ */
+#define BIN_FLAG_SAMPLE_RATE    0x80
+
+// Sizes of the fixed headers, including the magic byte
+#define BIN_HEADER_SIZE         4
+#define BIN_VALUE_HEADER_SIZE   12
+#define BIN_RATE_HEADER_SIZE    20
+#define BIN_SET_HEADER_SIZE     6
+
+/**
+ * A decoded binary message header. The key, and the
+ * set key for sets, follow the header. Both lengths
+ * include the null terminator.
+ */
+typedef struct {
+    metric_type type;
+    uint16_t key_len;
+    uint16_t set_len;
+    double value;
+    double sample_rate;
+} binproto_header;
+
+/**
+ * Returns the size of the fixed header for a metric type byte
+ * @arg type_byte The second byte of the message
+ * @return The header size, or -1 for an unknown type.
+ */
+int binproto_header_size(unsigned char type_byte);
+
+/**
+ * Decodes a message header
+ * @arg buf The message, must hold the full header
+ * @arg header Output. The decoded header.
+ * @return The header size on success, -1 for a malformed header.
+ */
+int binproto_decode_header(const unsigned char *buf, binproto_header *header);
+
+/**
+ * Encodes a message with a value. This is the reference
+ * encoder for clients.
+ * @arg buf The output buffer
+ * @arg buf_len The size of the output buffer
+ * @arg type The metric type, must not be SET
+ * @arg key The null terminated key
+ * @arg val The value
+ * @arg sample_rate The sample rate, 1.0 omits it from the message
+ * @return The encoded size on success, -1 if the message does not fit.
+ */
+int binproto_encode(char *buf, int buf_len, metric_type type, const char *key, double val, double sample_rate);
+
+/**
+ * Encodes a set message. This is the reference encoder for clients.
+ * @arg buf The output buffer
+ * @arg buf_len The size of the output buffer
+ * @arg key The null terminated key of the set
+ * @arg set_key The null terminated value to add to the set
+ * @return The encoded size on success, -1 if the message does not fit.
+ */
+int binproto_encode_set(char *buf, int buf_len, const char *key, const char *set_key);
+
+#endif
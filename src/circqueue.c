@@ -1,9 +1,16 @@
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "circqueue.h"
 
 /*
- * Methods for manipulating our circular buffers
+ * Methods for manipulating our circular buffers.
+ *
+ * The pages of each buffer are mapped twice, back to back.
+ * Reading or writing past the end of the first mapping
+ * continues at the start of the buffer, so the used and
+ * the available regions are always contiguous in memory.
  */
 
 /**
@@ -23,12 +30,67 @@
  */
 #define CONN_BUF_MULTIPLIER 2
 
-// Conditionally allocates if there is no buffer
-void circbuf_init(circular_buffer *buf) {
+/**
+ * Creates an anonymous file to back a buffer
+ * @arg size The size of the file
+ * @return The file descriptor, or -1 on error.
+ */
+static int create_buffer_file(uint32_t size) {
+#ifdef __linux__
+    int fd = memfd_create("statsite-circbuf", MFD_CLOEXEC);
+#else
+    char path[] = "/tmp/statsite-circbuf-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+#endif
+    if (fd < 0) return -1;
+    if (ftruncate(fd, size)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Maps a file twice, back to back
+ * @arg fd The file to map
+ * @arg size The size of the file, a multiple of the page size
+ * @return The start of the mapping, or NULL on error.
+ */
+static char* map_mirrored(int fd, uint32_t size) {
+    // Reserve the address space for both mappings
+    char *base = mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * (size_t)size);
+        return NULL;
+    }
+    return base;
+}
+
+// Initializes the buffer, returns 0 on success
+int circbuf_init(circular_buffer *buf) {
     buf->read_cursor = 0;
     buf->write_cursor = 0;
+
+    // The mappings must cover whole pages
+    uint32_t page_size = sysconf(_SC_PAGESIZE);
     buf->buf_size = INIT_CONN_BUF_SIZE * sizeof(char);
-    buf->buffer = malloc(buf->buf_size);
+    if (buf->buf_size % page_size)
+        buf->buf_size += page_size - buf->buf_size % page_size;
+
+    buf->buffer = NULL;
+    buf->fd = create_buffer_file(buf->buf_size);
+    if (buf->fd < 0) return -1;
+    buf->buffer = map_mirrored(buf->fd, buf->buf_size);
+    if (!buf->buffer) {
+        close(buf->fd);
+        buf->fd = -1;
+        return -1;
+    }
+    return 0;
 }
 
 // Clears the circular buffer, reseting it.
@@ -39,8 +101,12 @@ void circbuf_clear(circular_buffer *buf) {
 
 // Frees a buffer
 void circbuf_free(circular_buffer *buf) {
-    if (buf->buffer) free(buf->buffer);
+    if (buf->buffer) {
+        munmap(buf->buffer, 2 * (size_t)buf->buf_size);
+        close(buf->fd);
+    }
     buf->buffer = NULL;
+    buf->fd = -1;
 }
 
 // Calculates the available buffer size
@@ -65,61 +131,39 @@ uint64_t circbuf_used_buf(circular_buffer *buf) {
     return used_buf;
 }
 
-// Grows the circular buffer to make room for more data
-void circbuf_grow_buf(circular_buffer *buf) {
-    int new_size = buf->buf_size * CONN_BUF_MULTIPLIER * sizeof(char);
-    char *new_buf = malloc(new_size);
-    int bytes_written = 0;
-
-    // Check if the write has wrapped around
+/**
+ * Grows the circular buffer to make room for more data.
+ * The file is extended in place, so only data that wrapped
+ * around to the start of the buffer has to move.
+ * @return 0 on success.
+ */
+int circbuf_grow_buf(circular_buffer *buf) {
+    uint32_t old_size = buf->buf_size;
+    uint32_t new_size = old_size * CONN_BUF_MULTIPLIER * sizeof(char);
+    if (ftruncate(buf->fd, new_size)) return -1;
+    char *new_buf = map_mirrored(buf->fd, new_size);
+    if (!new_buf) return -1;
+
+    // Move the wrapped data behind the old end of the buffer
     if (buf->write_cursor < buf->read_cursor) {
-        // Copy from the read cursor to the end of the buffer
-        bytes_written = buf->buf_size - buf->read_cursor;
-        memcpy(new_buf,
-               buf->buffer+buf->read_cursor,
-               bytes_written);
-
-        // Copy from the start to the write cursor
-        memcpy(new_buf+bytes_written,
-               buf->buffer,
-               buf->write_cursor);
-        bytes_written += buf->write_cursor;
-
-    // We haven't wrapped yet...
-    } else {
-        // Copy from the read cursor up to the write cursor
-        bytes_written = buf->write_cursor - buf->read_cursor;
-        memcpy(new_buf,
-               buf->buffer + buf->read_cursor,
-               bytes_written);
+        memcpy(new_buf + old_size, new_buf, buf->write_cursor);
+        buf->write_cursor += old_size;
     }
 
     // Update the buffer locations and everything
-    free(buf->buffer);
+    munmap(buf->buffer, 2 * (size_t)old_size);
     buf->buffer = new_buf;
     buf->buf_size = new_size;
-    buf->read_cursor = 0;
-    buf->write_cursor = bytes_written;
+    return 0;
 }
 
 
-// Initializes a pair of iovectors to be used for readv
+// Initializes the iovector to be used for readv. The
+// available space is contiguous, so one is enough.
 void circbuf_setup_readv_iovec(circular_buffer *buf, struct iovec *vectors, int *num_vectors) {
-    // Check if we've wrapped around
     *num_vectors = 1;
-    if (buf->write_cursor < buf->read_cursor) {
-        vectors[0].iov_base = buf->buffer + buf->write_cursor;
-        vectors[0].iov_len = buf->read_cursor - buf->write_cursor - 1;
-    } else {
-        vectors[0].iov_base = buf->buffer + buf->write_cursor;
-        vectors[0].iov_len = buf->buf_size - buf->write_cursor - 1;
-        if (buf->read_cursor > 0)  {
-            vectors[0].iov_len += 1;
-            vectors[1].iov_base = buf->buffer;
-            vectors[1].iov_len = buf->read_cursor - 1;
-            *num_vectors = 2;
-        }
-    }
+    vectors[0].iov_base = buf->buffer + buf->write_cursor;
+    vectors[0].iov_len = circbuf_avail_buf(buf);
 }
 
 // Advances the cursors
@@ -144,32 +188,11 @@ void circbuf_advance_read(circular_buffer *buf, uint64_t bytes) {
  */
 int circbuf_write(circular_buffer *buf, char *in, uint64_t bytes) {
     // Check for available space
-    uint64_t avail = circbuf_avail_buf(buf);
-    while (avail < bytes) {
-        circbuf_grow_buf(buf);
-        avail = circbuf_avail_buf(buf);
-    }
-
-    if (buf->write_cursor < buf->read_cursor) {
-        memcpy(buf->buffer+buf->write_cursor, in, bytes);
-        buf->write_cursor += bytes;
-
-    } else {
-        uint64_t end_size = buf->buf_size - buf->write_cursor;
-        if (end_size >= bytes) {
-            memcpy(buf->buffer+buf->write_cursor, in, bytes);
-            buf->write_cursor += bytes;
-
-        } else {
-            // Copy the first end_size bytes
-            memcpy(buf->buffer+buf->write_cursor, in, end_size);
-
-            // Copy the remaining data
-            memcpy(buf->buffer, in+end_size, (bytes - end_size));
-            buf->write_cursor = (bytes - end_size);
-        }
+    while (circbuf_avail_buf(buf) < bytes) {
+        if (circbuf_grow_buf(buf)) return -1;
     }
 
+    memcpy(buf->buffer+buf->write_cursor, in, bytes);
+    circbuf_advance_write(buf, bytes);
     return 0;
 }
-
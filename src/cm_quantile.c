@@ -11,35 +11,28 @@
 #include <math.h>
 #include <limits.h>
 #include <stdio.h>
-#include "heap.h"
 #include "cm_quantile.h"
 
+/*
+ * Samples are appended to a flat batch, which grows up to
+ * CM_BATCH_MAX values. A full batch is sorted and merged into
+ * the summary in one pass from the end, which also compresses
+ * it, so the steady state does not allocate.
+ */
+#define CM_BATCH_MIN 16
+#define CM_BATCH_MAX 512
+
+// Batches up to this size are insertion sorted
+#define CM_INSERTION_SORT 32
+
 /* Static declarations */
-static void cm_add_to_buffer(cm_quantile *cm, double value);
-static double cm_insert_point_value(cm_quantile *cm);
-static void cm_reset_insert_cursor(cm_quantile *cm);
-static int cm_cursor_increment(cm_quantile *cm);
-static void cm_insert_sample(cm_quantile *cm, cm_sample *position, cm_sample *new);
-static void cm_append_sample(cm_quantile *cm, cm_sample *new);
-static void cm_insert(cm_quantile *cm);
-static void cm_compress(cm_quantile *cm);
+static void cm_sort_batch(double *batch, uint32_t num, uint64_t *buf);
+static int cm_reserve(cm_quantile *cm, uint64_t num);
+static int cm_merge_batch(cm_quantile *cm);
+static int cm_merge_samples(cm_quantile *cm, double *values, uint64_t *widths,
+        uint64_t *deltas, uint64_t num, uint64_t num_values);
 static uint64_t cm_threshold(cm_quantile *cm, uint64_t rank);
 
-// This is a comparison function that treats keys as doubles
-static int compare_double_keys(register void* key1, register void* key2) {
-    // Cast them as double* and read them in
-    register double val1 = *((double*)key1);
-    register double val2 = *((double*)key2);
-
-    // Perform the comparison
-    if (val1 < val2)
-        return -1;
-    else if (val1 == val2)
-        return 0;
-    else
-        return 1;
-}
-
 /**
  * Initializes the CM quantile struct
  * @arg eps The maximum error for the quantiles
@@ -66,36 +59,22 @@ int init_cm_quantile(double eps, double *quantiles, uint32_t num_quants, cm_quan
     cm->eps = eps;
     cm->num_samples = 0;
     cm->num_values = 0;
-    cm->samples = NULL;
-    cm->end = NULL;
+    cm->values = NULL;
+    cm->widths = NULL;
+    cm->deltas = NULL;
+    cm->size = 0;
+    cm->batch = NULL;
+    cm->batch_len = 0;
+    cm->batch_size = 0;
 
     // Copy the quantiles
     cm->quantiles = malloc(num_quants * sizeof(double));
     memcpy(cm->quantiles, quantiles, num_quants * sizeof(double));
     cm->num_quantiles = num_quants;
 
-    // Initialize the buffers
-    heap *heaps = malloc(2*sizeof(heap));
-    cm->bufLess = heaps;
-    cm->bufMore = heaps+1;
-    heap_create(cm->bufLess, 0, compare_double_keys);
-    heap_create(cm->bufMore, 0, compare_double_keys);
-
-    // Setup the cursors
-    cm->insert.curs = NULL;
-    cm->compress.curs = NULL;
-
     return 0;
 }
 
-/*
- * Callback function to delete the sample inside the
- * heap buffer.
- */
-static void free_buffer_sample(void *key, void *val) {
-    free(val);
-}
-
 /**
  * Destroy the CM quantile struct.
  * @arg cm_quantile The cm_quantile to destroy
@@ -105,37 +84,37 @@ int destroy_cm_quantile(cm_quantile *cm) {
     // Free the quantiles
     free(cm->quantiles);
 
-    // Destroy everything in the buffer
-    heap_foreach(cm->bufLess, free_buffer_sample);
-    heap_destroy(cm->bufLess);
-    heap_foreach(cm->bufMore, free_buffer_sample);
-    heap_destroy(cm->bufMore);
-
-    // Free the lower address, since they are allocated to be adjacent
-    free((cm->bufLess < cm->bufMore) ? cm->bufLess : cm->bufMore);
-
-    // Iterate through the linked list, free all
-    cm_sample *next;
-    cm_sample *current = cm->samples;
-    while (current) {
-        next = current->next;
-        free(current);
-        current = next;
-    }
+    // Free the batch
+    free(cm->batch);
+
+    // Free the samples
+    free(cm->values);
+    free(cm->widths);
+    free(cm->deltas);
 
     return 0;
 }
 
 /**
- * Adds a new sample to the struct
+ * Adds a new sample to the struct. Samples are buffered
+ * and merged into the summary in sorted batches.
  * @arg cm_quantile The cm_quantile to add to
  * @arg sample The new sample value
  * @return 0 on success.
  */
 int cm_add_sample(cm_quantile *cm, double sample) {
-    cm_add_to_buffer(cm, sample);
-    cm_insert(cm);
-    cm_compress(cm);
+    if (cm->batch_len == cm->batch_size) {
+        if (cm->batch_size < CM_BATCH_MAX) {
+            uint32_t size = (cm->batch_size) ? cm->batch_size * 2 : CM_BATCH_MIN;
+            double *batch = realloc(cm->batch, size * sizeof(double));
+            if (!batch) return -1;
+            cm->batch = batch;
+            cm->batch_size = size;
+        } else if (cm_merge_batch(cm)) {
+            return -1;
+        }
+    }
+    cm->batch[cm->batch_len++] = sample;
     return 0;
 }
 
@@ -146,212 +125,228 @@ int cm_add_sample(cm_quantile *cm, double sample) {
  * @return 0 on success.
  */
 int cm_flush(cm_quantile *cm) {
-    int rounds = 0;
-    while (heap_size(cm->bufLess) or heap_size(cm->bufMore)) {
-        if (heap_size(cm->bufMore) == 0) cm_reset_insert_cursor(cm);
-        cm_insert(cm);
-        cm_compress(cm);
-        rounds++;
-    }
-    return 0;
+    return (cm->batch_len) ? cm_merge_batch(cm) : 0;
+}
+
+/**
+ * Merges the samples of another summary into this one.
+ * Each tuple is inserted with its rank width and uncertainty
+ * preserved, so the merged summary covers both streams with
+ * the combined error of the two summaries.
+ * @arg cm_quantile The cm_quantile to merge into
+ * @arg other The cm_quantile to merge from. Flushed, but otherwise unchanged.
+ * @return 0 on success.
+ */
+int cm_merge(cm_quantile *cm, cm_quantile *other) {
+    cm_flush(other);
+    cm_flush(cm);
+    return cm_merge_samples(cm, other->values, other->widths, other->deltas,
+            other->num_samples, other->num_values);
 }
 
 /**
- * Queries for a quantile value
+ * Queries for a quantile value. Merges any buffered
+ * samples first.
  * @arg cm_quantile The cm_quantile to query
  * @arg quantile The quantile to query
  * @return The value on success or 0.
  */
 double cm_query(cm_quantile *cm, double quantile) {
+    cm_flush(cm);
     uint64_t rank = ceil(quantile * cm->num_values);
 	uint64_t min_rank=0;
     uint64_t max_rank;
 	uint64_t threshold = ceil(cm_threshold(cm, rank) / 2.);
 
-    cm_sample *prev = cm->samples;
-    cm_sample *current = cm->samples;
-    while (current) {
-        max_rank = min_rank + current->width + current->delta;
+    // Only the ranks are read until the sample is found
+    uint64_t i;
+    for (i=0; i < cm->num_samples; i++) {
+        max_rank = min_rank + cm->widths[i] + cm->deltas[i];
         if (max_rank > rank + threshold) {
             break;
         }
-        min_rank += current->width;
-        prev = current;
-        current = current->next;
+        min_rank += cm->widths[i];
     }
-    return (prev) ? prev->value : 0;
+    if (!cm->num_samples) return 0;
+    return cm->values[(i) ? i - 1 : 0];
+}
+
+// Maps a double onto an integer with the same order
+static inline uint64_t double_key(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+// Maps an integer from double_key back onto its double
+static inline double key_double(uint64_t key) {
+    uint64_t bits = (key >> 63) ? key & ~(1ULL << 63) : ~key;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
 }
 
 /**
- * Adds a new sample to the buffer
+ * Sorts the batch. Small batches are insertion sorted, the
+ * rest are radix sorted on the bit patterns of the values,
+ * a byte at a time. Bytes shared by every value, such as the
+ * sign and most of the exponent, are skipped.
+ * @arg batch The values to sort
+ * @arg num The number of values
+ * @arg buf A buffer of num keys for the radix sort
  */
-static void cm_add_to_buffer(cm_quantile *cm, double value) {
-    // Allocate a new sample
-    cm_sample *s = calloc(1, sizeof(cm_sample));
-    s->value = value;
-
-    /*
-     * Check the cursor value.
-     * Only use bufLess if we have at least a single value.
-     */
-    if (cm->num_values && value < cm_insert_point_value(cm)) {
-        heap_insert(cm->bufLess, &s->value, s);
-    } else {
-        heap_insert(cm->bufMore, &s->value, s);
+static void cm_sort_batch(double *batch, uint32_t num, uint64_t *buf) {
+    if (num <= CM_INSERTION_SORT) {
+        for (uint32_t i=1; i < num; i++) {
+            double val = batch[i];
+            uint32_t j = i;
+            for (; j > 0 && batch[j-1] > val; j--)
+                batch[j] = batch[j-1];
+            batch[j] = val;
+        }
+        return;
     }
-}
 
-// Returns the value under the insertion cursor or 0
-static double cm_insert_point_value(cm_quantile *cm) {
-    return (cm->insert.curs) ? cm->insert.curs->value : 0;
-}
+    // The keys are sorted in place of the values
+    uint64_t *keys = (uint64_t*)batch;
+    uint32_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (uint32_t i=0; i < num; i++) {
+        keys[i] = double_key(batch[i]);
+        for (int b=0; b < 8; b++)
+            counts[b][(keys[i] >> (b * 8)) & 0xff]++;
+    }
 
-// Resets the insert cursor
-static void cm_reset_insert_cursor(cm_quantile *cm) {
-    // Swap the buffers, reset the cursor
-    heap *tmp = cm->bufLess;
-    cm->bufLess = cm->bufMore;
-    cm->bufMore = tmp;
-    cm->insert.curs = NULL;
-}
+    for (int b=0; b < 8; b++) {
+        int shift = b * 8;
+        if (counts[b][(keys[0] >> shift) & 0xff] == num) continue;
 
-// Computes the number of items to process in one iteration
-static int cm_cursor_increment(cm_quantile *cm) {
-    return ceil(cm->num_samples * cm->eps);
-}
+        uint32_t offset = 0;
+        for (int i=0; i < 256; i++) {
+            uint32_t count = counts[b][i];
+            counts[b][i] = offset;
+            offset += count;
+        }
+        for (uint32_t i=0; i < num; i++)
+            buf[counts[b][(keys[i] >> shift) & 0xff]++] = keys[i];
 
-/* Inserts a new sample before the position sample */
-static void cm_insert_sample(cm_quantile *cm, cm_sample *position, cm_sample *new) {
-    // Inserting at the head
-    if (!position->prev) {
-        position->prev = new;
-        cm->samples = new;
-        new->next = position;
-    } else {
-        cm_sample *prev = position->prev;
-        prev->next = new;
-        position->prev = new;
-        new->prev = prev;
-        new->next = position;
+        uint64_t *tmp = keys;
+        keys = buf;
+        buf = tmp;
     }
+
+    // Convert the keys back, from whichever half the last pass left them in
+    for (uint32_t i=0; i < num; i++)
+        batch[i] = key_double(keys[i]);
 }
 
-/* Inserts a new sample at the end */
-static void cm_append_sample(cm_quantile *cm, cm_sample *new) {
-    new->prev = cm->end;
-    cm->end->next = new;
-    cm->end = new;
+/**
+ * Sorts the batch and merges it into the samples
+ * @return 0 on success, -1 if the batch is kept.
+ */
+static int cm_merge_batch(cm_quantile *cm) {
+    // The room reserved for the merge is free to sort in
+    if (cm_reserve(cm, cm->num_samples + cm->batch_len)) return -1;
+    cm_sort_batch(cm->batch, cm->batch_len, cm->widths + cm->num_samples);
+    if (cm_merge_samples(cm, cm->batch, NULL, NULL, cm->batch_len, cm->batch_len)) return -1;
+    cm->batch_len = 0;
+    return 0;
 }
 
 /**
- * Incrementally processes inserts by moving
- * data from the buffer to the samples using a cursor
+ * Merges sorted samples into the summary and compresses it, in
+ * a single pass from the end. The arrays are grown to hold both
+ * sets, and the result is written from their end, which never
+ * overtakes the samples still to be read.
+ *
+ * A sample inherits the uncertainty of the next sample from the
+ * other set, as its rank within that set is only known up to
+ * it, and samples past the end of the other set have none. A
+ * batch of new values has none of its own. Each sample is
+ * folded into its successor while the combined width stays under
+ * the error threshold at its rank. The first and last samples are
+ * kept, so the minimum and maximum are exact.
+ * @arg values The sorted values to merge
+ * @arg widths The width of each value, or NULL for 1
+ * @arg deltas The delta of each value, or NULL for 0
+ * @arg num The number of values
+ * @arg num_values The sum of the widths
+ * @return 0 on success, -1 if the arrays could not grow.
  */
-static void cm_insert(cm_quantile *cm) {
-    // Check if this is the first element
-    cm_sample *samp;
-    if (!cm->samples) {
-        if (!heap_delmin(cm->bufMore, NULL, (void**)&samp)) return;
-        samp->width = 1;
-        samp->delta = 0;
-        cm->samples = samp;
-        cm->end = samp;
-        cm->num_values++;
-        cm->num_samples++;
-        cm->insert.curs = samp;
-		return;
-	}
-
-    // Check if we need to initialize the cursor
-    if (!cm->insert.curs) {
-        cm->insert.curs = cm->samples;
-    }
+static int cm_merge_samples(cm_quantile *cm, double *values, uint64_t *widths,
+        uint64_t *deltas, uint64_t num, uint64_t num_values) {
+    uint64_t total = cm->num_samples + num;
+    if (cm_reserve(cm, total)) return -1;
+    cm->num_values += num_values;
+
+    int64_t i = cm->num_samples - 1;
+    int64_t j = num - 1;
+    uint64_t out = total;       // Start of the merged samples
+    uint64_t after = 0;         // Ranks from the start of the merged samples
+    uint64_t existing_unc = 0;  // Inherited from the last existing sample read
+    uint64_t merged_unc = 0;    // Inherited from the last merged sample read
+    double value;
+    uint64_t width, delta;
+    while (i >= 0 || j >= 0) {
+        // Existing samples go after equal values
+        if (j < 0 || (i >= 0 && cm->values[i] >= values[j])) {
+            value = cm->values[i];
+            width = cm->widths[i];
+            delta = cm->deltas[i] + merged_unc;
+            existing_unc = width + cm->deltas[i] - 1;
+            i--;
+        } else {
+            value = values[j];
+            width = (widths) ? widths[j] : 1;
+            delta = ((deltas) ? deltas[j] : 0) + existing_unc;
+            merged_unc = width + ((deltas) ? deltas[j] : 0) - 1;
+            j--;
+        }
 
-    // Handle adding values in the middle
-    int incr_size = cm_cursor_increment(cm);
-    double *val;
-    for (int i=0; i < incr_size and cm->insert.curs; i++) {
-        while (heap_min(cm->bufMore, (void**)&val, NULL) && *val <= cm_insert_point_value(cm)) {
-            heap_delmin(cm->bufMore, NULL, (void**)&samp);
-            samp->width = 1;
-            samp->delta = cm->insert.curs->width + cm->insert.curs->delta - 1;
-            cm_insert_sample(cm, cm->insert.curs, samp);
-            cm->num_values++;
-            cm->num_samples++;
-
-            // Check if we need to update the compress cursor
-            if (cm->compress.curs && cm->compress.curs->value >= samp->value) {
-                cm->compress.min_rank++;
+        // Fold into the successor, unless this is the first or last
+        if (out < total && (i >= 0 || j >= 0) && total >= 3) {
+            uint64_t max_rank = cm->num_values - after + delta;
+            if (width + cm->widths[out] + cm->deltas[out] <= cm_threshold(cm, max_rank)) {
+                cm->widths[out] += width;
+                after += width;
+                continue;
             }
         }
-        // Increment the cursor
-        cm->insert.curs = cm->insert.curs->next;
-	}
-
-    // Handle adding values at the end
-    if (cm->insert.curs == NULL) {
-        while (heap_min(cm->bufMore, (void**)&val, NULL) && *val > cm->end->value) {
-            heap_delmin(cm->bufMore, NULL, (void**)&samp);
-            samp->width = 1;
-            samp->delta = 0;
-            cm_append_sample(cm, samp);
-            cm->num_values++;
-            cm->num_samples++;
-        }
-
-        // Reset the cursor
-        cm_reset_insert_cursor(cm);
-	}
-}
-
-/* Incrementally processes compression by using a cursor */
-static void cm_compress(cm_quantile *cm) {
-    // Bail early if there is nothing to really compress..
-    if (cm->num_samples < 3) return;
-
-    // Check if we need to initialize the cursor
-    if (!cm->compress.curs) {
-        cm->compress.curs = cm->end->prev;
-        cm->compress.min_rank = cm->num_values - 1 - cm->compress.curs->width;
-        cm->compress.curs = cm->compress.curs->prev;
+        out--;
+        cm->values[out] = value;
+        cm->widths[out] = width;
+        cm->deltas[out] = delta;
+        after += width;
     }
 
-    int incr_size = cm_cursor_increment(cm);
-    cm_sample *next, *prev;
-    uint64_t threshold;
-    uint64_t max_rank, test_val;
-    for (int i=0; i < incr_size and cm->compress.curs != cm->samples; i++) {
-        next = cm->compress.curs->next;
-        max_rank = cm->compress.min_rank + cm->compress.curs->width + cm->compress.curs->delta;
-        cm->compress.min_rank -= cm->compress.curs->width;
-
-        threshold = cm_threshold(cm, max_rank);
-        test_val = cm->compress.curs->width + next->width + next->delta;
-        if (test_val <= threshold) {
-            // Make sure we don't stomp the insertion cursor
-            if (cm->insert.curs == cm->compress.curs) {
-                cm->insert.curs = next;
-            }
-
-            // Combine the widths
-            next->width += cm->compress.curs->width;
-
-            // Remove the tuple
-            prev = cm->compress.curs->prev;
-            prev->next = next;
-            next->prev = prev;
-            free(cm->compress.curs);
-            cm->compress.curs = prev;
-
-            // Reduce the sample count
-            cm->num_samples--;
-        } else {
-            cm->compress.curs = cm->compress.curs->prev;
-        }
+    // Move the samples to the start of the arrays
+    cm->num_samples = total - out;
+    if (out) {
+        memmove(cm->values, cm->values + out, cm->num_samples * sizeof(double));
+        memmove(cm->widths, cm->widths + out, cm->num_samples * sizeof(uint64_t));
+        memmove(cm->deltas, cm->deltas + out, cm->num_samples * sizeof(uint64_t));
     }
+    return 0;
+}
 
-    // Reset the cursor if we hit the start
-    if (cm->compress.curs == cm->samples) cm->compress.curs = NULL;
+/**
+ * Grows the sample arrays to hold a number of samples
+ * @return 0 on success, -1 if the arrays could not grow.
+ */
+static int cm_reserve(cm_quantile *cm, uint64_t num) {
+    if (num <= cm->size) return 0;
+
+    // The summary hardly grows once it is hot, so keep it tight
+    uint64_t size = (num + CM_BATCH_MIN - 1) / CM_BATCH_MIN * CM_BATCH_MIN;
+    double *values = realloc(cm->values, size * sizeof(double));
+    if (values) cm->values = values;
+    uint64_t *widths = realloc(cm->widths, size * sizeof(uint64_t));
+    if (widths) cm->widths = widths;
+    uint64_t *deltas = realloc(cm->deltas, size * sizeof(uint64_t));
+    if (deltas) cm->deltas = deltas;
+    if (!values || !widths || !deltas) return -1;
+    cm->size = size;
+    return 0;
 }
 
 /* Computes the minimum threshold value */
@@ -7,25 +7,13 @@
 #ifndef CM_QUANTILE_H
 #define CM_QUANTILE_H
 #include <stdint.h>
-#include "heap.h"
-
-typedef struct cm_sample {
-    double value;       // The sampled value
-    uint64_t width;     // The number of ranks represented
-    uint64_t delta;     // Delta between min/max rank
-    struct cm_sample *next;
-    struct cm_sample *prev;
-} cm_sample;
-
-struct cm_insert_cursor {
-    cm_sample *curs;
-};
-
-struct cm_compress_cursor {
-    cm_sample *curs;
-    uint64_t min_rank;
-};
 
+/*
+ * The summary is a sorted array of tuples, each a value with
+ * the number of ranks it represents and the uncertainty of its
+ * rank. The fields are kept in separate arrays so that a query
+ * only reads the ranks.
+ */
 typedef struct {
     double eps;  // Desired epsilon
 
@@ -35,12 +23,14 @@ typedef struct {
     uint64_t num_samples;   // Number of samples
     uint64_t num_values;    // Number of values added
 
-    cm_sample *samples;     // Sorted linked list of samples
-    cm_sample *end;         // Pointer to the end of the sampels
-    heap *bufLess, *bufMore;// Sample buffer
+    double *values;         // Sorted values of the samples
+    uint64_t *widths;       // The number of ranks represented by each
+    uint64_t *deltas;       // Delta between min/max rank of each
+    uint64_t size;          // Capacity of the sample arrays
 
-    struct cm_insert_cursor insert;     // Insertion cursor
-    struct cm_compress_cursor compress; // Compression cursor
+    double *batch;          // Values not yet merged into the samples
+    uint32_t batch_len;     // Number of values in the batch
+    uint32_t batch_size;    // Capacity of the batch, grows on demand
 } cm_quantile;
 
 
@@ -62,7 +52,8 @@ int init_cm_quantile(double eps, double *quantiles, uint32_t num_quants, cm_quan
 int destroy_cm_quantile(cm_quantile *cm);
 
 /**
- * Adds a new sample to the struct
+ * Adds a new sample to the struct. Samples are buffered
+ * and merged into the summary in sorted batches.
  * @arg cm_quantile The cm_quantile to add to
  * @arg sample The new sample value
  * @return 0 on success.
@@ -70,7 +61,17 @@ int destroy_cm_quantile(cm_quantile *cm);
 int cm_add_sample(cm_quantile *cm, double sample);
 
 /**
- * Queries for a quantile value
+ * Merges the samples of another summary into this one.
+ * Both summaries must use the same epsilon and quantiles.
+ * @arg cm_quantile The cm_quantile to merge into
+ * @arg other The cm_quantile to merge from. Flushed, but otherwise unchanged.
+ * @return 0 on success.
+ */
+int cm_merge(cm_quantile *cm, cm_quantile *other);
+
+/**
+ * Queries for a quantile value. Merges any buffered
+ * samples first.
  * @arg cm_quantile The cm_quantile to query
  * @arg quantile The quantile to query
  * @return The value on success or 0.
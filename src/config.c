@@ -11,6 +11,8 @@
 #include "config.h"
 #include "ini.h"
 #include "hll.h"
+#include "hash.h"
+#include "timer.h"
 #include "utils.h"
 
 /**
@@ -32,6 +34,12 @@ static histogram_config *histogram_in_progress;
 static char* sink_section;
 static sink_config *sink_in_progress;
 
+static char* cardinality_section;
+static cardinality_config *cardinality_in_progress;
+
+static char* quantile_section;
+static quantile_config *quantile_in_progress;
+
 /**
  * Default statsite_config values. Should create
  * filters that are about 300KB initially, and suited
@@ -66,6 +74,31 @@ static const statsite_config DEFAULT_CONFIG = {
     sizeof(default_quantiles) / sizeof(double),
     default_quantiles,  // Quantiles
     default_percentiles, // Percentiles
+    1,                  // Single ingest thread
+    16,                 // Receive up to 16 datagrams per syscall
+    false,              // UDP GRO off by default
+    NULL,               // Do not track the UDP batch fill
+    false,              // Use libev for all sockets
+    NULL,               // No unix datagram socket
+    NULL,               // No unix stream socket
+    0660,               // Unix sockets are read-write for the owner and group
+    0,                  // Default receive buffer for unix sockets
+    3,                  // Forget names unused for 3 flush intervals
+    false,              // A map per metric type
+    "murmur",           // Murmur hashes by default
+    HASH_MURMUR,
+    NULL,               // No cardinality limits by default
+    NULL,
+    0,
+    false,              // Build timers and sets on their first sample
+    false,              // Apply each ASCII line on its own
+    NULL,               // Do not track the hot key cache
+    false,              // Look up every name in the maps
+    "cm",               // Timers use the CM quantiles by default
+    QUANTILE_CM,
+    NULL,               // No quantile engines by prefix
+    NULL,
+    true,               // Cache the hot names of each type
 };
 
 static const sink_config_stream DEFAULT_SINK = {
@@ -132,6 +165,23 @@ static int value_to_int(const char *val, int *result) {
     return 1;
 }
 
+/**
+ * Attempts to convert an octal string, such as
+ * file permissions, to an integer.
+ * @arg val The string value
+ * @arg result The destination for the result
+ * @return 1 on success, 0 on error.
+ */
+static int value_to_octal(const char *val, int *result) {
+    char *end;
+    long res = strtol(val, &end, 8);
+    if (end == val) {
+        return 0;
+    }
+    *result = res;
+    return 1;
+}
+
 /**
  * Attempts to convert a string to a double,
  * and write the value out.
@@ -430,6 +480,112 @@ static int histogram_callback(void* user, const char* section, const char* name,
     return res;
 }
 
+/**
+ * Callback function to use with INIH for parsing cardinality limits
+ * @arg user Opaque value. Actually a statsite_config pointer
+ * @arg name The config name
+ * @value = The config value
+ * @return 1 on success
+ */
+static int cardinality_callback(void* user, const char* section, const char* name, const char* value) {
+    // Make sure we don't change sections with an unfinished config
+    if (cardinality_in_progress && strcasecmp(cardinality_section, section)) {
+        syslog(LOG_WARNING, "Unfinished configuration for section: %s", cardinality_section);
+        return 0;
+    }
+
+    // Ensure we have something in progress
+    if (!cardinality_in_progress) {
+        cardinality_in_progress = calloc(1, sizeof(cardinality_config));
+        cardinality_section = strdup(section);
+    }
+
+    // Cast the user handle
+    statsite_config *config = (statsite_config*)user;
+
+    int res = 1;
+    if (NAME_MATCH("prefix")) {
+        cardinality_in_progress->parts |= 1;
+        cardinality_in_progress->prefix = strdup(value);
+
+    } else if (NAME_MATCH("max_keys")) {
+        cardinality_in_progress->parts |= 1 << 1;
+        res = value_to_int(value, &cardinality_in_progress->max_keys);
+
+    } else {
+        syslog(LOG_NOTICE, "Unrecognized cardinality config parameter: %s", value);
+    }
+
+    // Check if this config is done, and push into the list of configs
+    if (cardinality_in_progress->parts == 3) {
+        cardinality_in_progress->next = config->cardinality_configs;
+        config->cardinality_configs = cardinality_in_progress;
+        cardinality_in_progress = NULL;
+        free(cardinality_section);
+        cardinality_section = NULL;
+    }
+    return res;
+}
+
+/**
+ * Callback function to use with INIH for parsing quantile engines
+ * @arg user Opaque value. Actually a statsite_config pointer
+ * @arg name The config name
+ * @value = The config value
+ * @return 1 on success
+ */
+static int quantile_callback(void* user, const char* section, const char* name, const char* value) {
+    // Make sure we don't change sections with an unfinished config
+    if (quantile_in_progress && strcasecmp(quantile_section, section)) {
+        syslog(LOG_WARNING, "Unfinished configuration for section: %s", quantile_section);
+        return 0;
+    }
+
+    // Cast the user handle
+    statsite_config *config = (statsite_config*)user;
+
+    // The range is optional, so it may follow a finished section
+    quantile_config *current = quantile_in_progress;
+    if (!current && quantile_section && !strcasecmp(quantile_section, section))
+        current = config->quantile_configs;
+
+    // Ensure we have something in progress
+    if (!current) {
+        free(quantile_section);
+        current = quantile_in_progress = calloc(1, sizeof(quantile_config));
+        quantile_section = strdup(section);
+        current->min_val = HDR_DEFAULT_MIN;
+        current->max_val = HDR_DEFAULT_MAX;
+    }
+
+    int res = 1;
+    if (NAME_MATCH("prefix")) {
+        current->parts |= 1;
+        current->prefix = strdup(value);
+
+    } else if (NAME_MATCH("engine")) {
+        current->parts |= 1 << 1;
+        current->engine = strdup(value);
+
+    } else if (NAME_MATCH("min")) {
+        res = value_to_double(value, &current->min_val);
+
+    } else if (NAME_MATCH("max")) {
+        res = value_to_double(value, &current->max_val);
+
+    } else {
+        syslog(LOG_NOTICE, "Unrecognized quantile config parameter: %s", value);
+    }
+
+    // Check if this config is done, and push into the list of configs
+    if (current == quantile_in_progress && current->parts == 3) {
+        current->next = config->quantile_configs;
+        config->quantile_configs = current;
+        quantile_in_progress = NULL;
+    }
+    return res;
+}
+
 /**
  * Callback function to use with INI-H.
  * @arg user Opaque user value. We use the statsite_config pointer
@@ -448,6 +604,14 @@ static int config_callback(void* user, const char* section, const char* name, co
         return sink_callback(user, section, name, value);
     }
 
+    if (strncasecmp("cardinality", section, 11) == 0) {
+        return cardinality_callback(user, section, name, value);
+    }
+
+    if (strncasecmp("quantile", section, 8) == 0) {
+        return quantile_callback(user, section, name, value);
+    }
+
     // Ignore any non-statsite sections
     if (strcasecmp("statsite", section) != 0) {
         syslog(LOG_NOTICE, "Unknown values in section ignored: %s", section);
@@ -466,6 +630,30 @@ static int config_callback(void* user, const char* section, const char* name, co
         return value_to_int(value, &config->udp_port);
     } else if (NAME_MATCH("flush_interval")) {
          return value_to_int(value, &config->flush_interval);
+    } else if (NAME_MATCH("ingest_threads")) {
+        return value_to_int(value, &config->ingest_threads);
+    } else if (NAME_MATCH("udp_batch_size")) {
+        return value_to_int(value, &config->udp_batch_size);
+    } else if (NAME_MATCH("udp_gro")) {
+        return value_to_bool(value, &config->udp_gro);
+    } else if (NAME_MATCH("unix_socket_mode")) {
+        return value_to_octal(value, &config->unix_socket_mode);
+    } else if (NAME_MATCH("unix_rcvbuf")) {
+        return value_to_int(value, &config->unix_rcvbuf);
+    } else if (NAME_MATCH("name_idle_intervals")) {
+        return value_to_int(value, &config->name_idle_intervals);
+    } else if (NAME_MATCH("unified_store")) {
+        return value_to_bool(value, &config->unified_store);
+    } else if (NAME_MATCH("admission_filter")) {
+        return value_to_bool(value, &config->admission_filter);
+    } else if (NAME_MATCH("coalesce_batches")) {
+        return value_to_bool(value, &config->coalesce_batches);
+    } else if (NAME_MATCH("hot_key_cache")) {
+        return value_to_bool(value, &config->hot_key_cache);
+    } else if (NAME_MATCH("perfect_hash_index")) {
+        return value_to_bool(value, &config->perfect_hash_index);
+    } else if (NAME_MATCH("use_io_uring")) {
+        return value_to_bool(value, &config->use_io_uring);
     } else if (NAME_MATCH("parse_stdin")) {
         return value_to_bool(value, &config->parse_stdin);
     } else if (NAME_MATCH("daemonize")) {
@@ -492,10 +680,22 @@ static int config_callback(void* user, const char* section, const char* name, co
         config->log_level = strdup(value);
     } else if (NAME_MATCH("log_facility")) {
         config->log_facility = strdup(value);
+    } else if (NAME_MATCH("hash_function")) {
+        config->hash_function = strdup(value);
+    } else if (NAME_MATCH("quantile_engine")) {
+        config->quantile_engine = strdup(value);
     } else if (NAME_MATCH("pid_file")) {
         config->pid_file = strdup(value);
     } else if (NAME_MATCH("input_counter")) {
         config->input_counter = strdup(value);
+    } else if (NAME_MATCH("udp_batch_timer")) {
+        config->udp_batch_timer = strdup(value);
+    } else if (NAME_MATCH("hot_key_gauge")) {
+        config->hot_key_gauge = strdup(value);
+    } else if (NAME_MATCH("unix_dgram_path")) {
+        config->unix_dgram_path = strdup(value);
+    } else if (NAME_MATCH("unix_stream_path")) {
+        config->unix_stream_path = strdup(value);
     } else if (NAME_MATCH("bind_address")) {
         config->bind_address = strdup(value);
     } else if (NAME_MATCH("global_prefix")) {
@@ -589,6 +789,24 @@ exit:
         histogram_section = NULL;
     }
 
+    // Check for an unfinished cardinality limit
+    if (cardinality_in_progress) {
+        syslog(LOG_WARNING, "Unfinished configuration for section: %s", cardinality_section);
+        free(cardinality_section);
+        free(cardinality_in_progress);
+        cardinality_in_progress = NULL;
+        cardinality_section = NULL;
+    }
+
+    // Check for an unfinished quantile engine
+    if (quantile_in_progress) {
+        syslog(LOG_WARNING, "Unfinished configuration for section: %s", quantile_section);
+        free(quantile_in_progress);
+        quantile_in_progress = NULL;
+    }
+    free(quantile_section);
+    quantile_section = NULL;
+
     if (sink_in_progress)
         sink_commit(config);
 
@@ -703,6 +921,100 @@ int sane_flush_interval(int intv) {
     return 0;
 }
 
+int sane_ingest_threads(int threads) {
+    if (threads <= 0) {
+        syslog(LOG_ERR, "Must have at least one ingest thread!");
+        return 1;
+    } else if (threads > 64) {
+        syslog(LOG_ERR, "Cannot use more than 64 ingest threads!");
+        return 1;
+    }
+    return 0;
+}
+
+int sane_udp_batch_size(int batch_size) {
+    if (batch_size <= 0) {
+        syslog(LOG_ERR, "UDP batch size must be positive!");
+        return 1;
+    } else if (batch_size > 1024) {
+        syslog(LOG_ERR, "UDP batch size cannot exceed 1024!");
+        return 1;
+    } else if (batch_size > 64) {
+        syslog(LOG_WARNING,
+               "UDP batch size is large! Each socket reserves 64KB per datagram.");
+    }
+    return 0;
+}
+
+int sane_name_idle_intervals(int intervals) {
+    if (intervals < 0) {
+        syslog(LOG_ERR, "Name idle intervals cannot be negative!");
+        return 1;
+    }
+    return 0;
+}
+
+int sane_hash_function(char *hash_function, int *hash_algo) {
+    if (strcasecmp(hash_function, "murmur") == 0) {
+        *hash_algo = HASH_MURMUR;
+    } else if (strcasecmp(hash_function, "wyhash") == 0) {
+        *hash_algo = HASH_WYHASH;
+    } else {
+        syslog(LOG_ERR, "Unknown hash function!");
+        return 1;
+    }
+    return 0;
+}
+
+int sane_quantile_engine(char *quantile_engine, int *quantile_algo) {
+    if (strcasecmp(quantile_engine, "cm") == 0) {
+        *quantile_algo = QUANTILE_CM;
+    } else if (strcasecmp(quantile_engine, "ddsketch") == 0) {
+        *quantile_algo = QUANTILE_DDSKETCH;
+    } else if (strcasecmp(quantile_engine, "hdr") == 0) {
+        *quantile_algo = QUANTILE_HDR;
+    } else {
+        syslog(LOG_ERR, "Unknown quantile engine: %s", quantile_engine);
+        return 1;
+    }
+    return 0;
+}
+
+int sane_quantile_configs(quantile_config *config) {
+    while (config) {
+        if (sane_quantile_engine(config->engine, &config->algo)) {
+            syslog(LOG_ERR, "Bad quantile engine for prefix: %s", config->prefix);
+            return 1;
+        }
+
+        // Check the range of a histogram
+        if (config->algo == QUANTILE_HDR) {
+            if (config->min_val <= 0) {
+                syslog(LOG_ERR, "Quantile min value must be greater than 0! Prefix: %s", config->prefix);
+                return 1;
+            }
+            if (config->min_val >= config->max_val) {
+                syslog(LOG_ERR, "Quantile min value must be less than max value! Prefix: %s", config->prefix);
+                return 1;
+            }
+        }
+        config = config->next;
+    }
+    return 0;
+}
+
+int sane_cardinality_limits(cardinality_config *config) {
+    while (config) {
+        if (config->max_keys <= 0) {
+            syslog(LOG_ERR, "Cardinality limit must be positive for prefix: %s",
+                    config->prefix);
+            return 1;
+        }
+        config = config->next;
+    }
+    return 0;
+}
+
 int sane_histograms(histogram_config *config) {
     while (config) {
         // Ensure sane upper / lower
@@ -835,15 +1147,102 @@ int validate_config(statsite_config *config) {
     res |= sane_set_precision(config->set_eps, &config->set_precision);
     res |= sane_quantiles(config->num_quantiles, config->quantiles);
     res |= sane_percentiles(config->num_quantiles, config->percentiles);
+    res |= sane_ingest_threads(config->ingest_threads);
+    res |= sane_udp_batch_size(config->udp_batch_size);
+    res |= sane_name_idle_intervals(config->name_idle_intervals);
+    res |= sane_hash_function(config->hash_function, &config->hash_algo);
+    res |= sane_cardinality_limits(config->cardinality_configs);
+    res |= sane_quantile_engine(config->quantile_engine, &config->quantile_algo);
+    res |= sane_quantile_configs(config->quantile_configs);
 
     return res;
 }
 
+/**
+ * Builds the radix tree for the cardinality limits, and
+ * names the overflow metrics of each prefix
+ * @return 0 on success
+ */
+static int build_cardinality_tree(statsite_config *config) {
+    // Do nothing if there is no config
+    if (!config->cardinality_configs)
+        return 0;
+
+    // Initialize the radix tree
+    radix_tree *t = malloc(sizeof(radix_tree));
+    config->cardinality_limits = t;
+    int res = radix_init(t);
+    if (res) goto ERR;
+
+    // Add all the prefixes
+    cardinality_config *current = config->cardinality_configs;
+    void **val;
+    while (!res && current) {
+        // Keep a single separator between the prefix and the suffix
+        int len = strlen(current->prefix);
+        char *sep = (len && current->prefix[len-1] == '.') ? "" : ".";
+        current->overflow_len = asprintf(&current->overflow_name, "%s%s__overflow__",
+                current->prefix, sep);
+        current->rejected_len = asprintf(&current->rejected_name, "%s%s__rejected__",
+                current->prefix, sep);
+        assert(current->overflow_len != -1 && current->rejected_len != -1);
+        current->index = config->num_cardinality_limits++;
+
+        val = (void**)&current;
+        res = radix_insert(t, current->prefix, val);
+        current = current->next;
+    }
+
+    if (!res)
+        return res;
+ERR:
+    free(t);
+    config->cardinality_limits = NULL;
+    return 1;
+}
+
+/**
+ * Builds the radix tree for the quantile engines
+ * @return 0 on success
+ */
+static int build_quantile_tree(statsite_config *config) {
+    // Do nothing if there is no config
+    if (!config->quantile_configs)
+        return 0;
+
+    // Initialize the radix tree
+    radix_tree *t = malloc(sizeof(radix_tree));
+    config->quantile_engines = t;
+    int res = radix_init(t);
+    if (res) goto ERR;
+
+    // Add all the prefixes
+    quantile_config *current = config->quantile_configs;
+    void **val;
+    while (!res && current) {
+        val = (void**)&current;
+        res = radix_insert(t, current->prefix, val);
+        current = current->next;
+    }
+
+    if (!res)
+        return res;
+ERR:
+    free(t);
+    config->quantile_engines = NULL;
+    return 1;
+}
+
 /**
  * Builds the radix tree for prefix matching
  * @return 0 on success
  */
 int build_prefix_tree(statsite_config *config) {
+    if (build_cardinality_tree(config))
+        return 1;
+    if (build_quantile_tree(config))
+        return 1;
+
     // Do nothing if there is no config
     if (!config->hist_configs)
         return 0;
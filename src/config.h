@@ -84,6 +84,30 @@ typedef struct histogram_config {
     char parts;
 } histogram_config;
 
+// Represents a limit on the number of keys under a prefix
+typedef struct cardinality_config {
+    char *prefix;
+    int max_keys;           // Keys per interval, across the ingest threads
+    int index;              // Index of the limit in the per interval key counts
+    char *overflow_name;    // Metric that takes the samples of the keys past the limit
+    int overflow_len;
+    char *rejected_name;    // Counter of the samples folded into the overflow metric
+    int rejected_len;
+    struct cardinality_config *next;
+    char parts;
+} cardinality_config;
+
+// Represents the quantile engine of the timers under a prefix
+typedef struct quantile_config {
+    char *prefix;
+    char *engine;           // Name of the quantile engine
+    int algo;               // The quantile engine, set on validation
+    double min_val;         // Range of the values, for the hdr engine
+    double max_val;
+    struct quantile_config *next;
+    char parts;
+} quantile_config;
+
 
 /**
  * Stores our configuration
@@ -115,6 +139,31 @@ typedef struct {
     int num_quantiles;
     double* quantiles;
     int* percentiles;
+    int ingest_threads;
+    int udp_batch_size;
+    bool udp_gro;
+    char *udp_batch_timer;
+    bool use_io_uring;
+    char *unix_dgram_path;
+    char *unix_stream_path;
+    int unix_socket_mode;
+    int unix_rcvbuf;
+    int name_idle_intervals;
+    bool unified_store;
+    char *hash_function;
+    int hash_algo;
+    cardinality_config *cardinality_configs;
+    radix_tree *cardinality_limits;
+    int num_cardinality_limits;
+    bool admission_filter;
+    bool coalesce_batches;
+    char *hot_key_gauge;
+    bool perfect_hash_index;
+    char *quantile_engine;
+    int quantile_algo;
+    quantile_config *quantile_configs;
+    radix_tree *quantile_engines;
+    bool hot_key_cache;
 } statsite_config;
 
 /**
@@ -161,6 +210,13 @@ int sane_flush_interval(int intv);
 int sane_histograms(histogram_config *config);
 int sane_set_precision(double eps, unsigned char *precision);
 int sane_quantiles(int num_quantiles, double quantiles[]);
+int sane_ingest_threads(int threads);
+int sane_udp_batch_size(int batch_size);
+int sane_name_idle_intervals(int intervals);
+int sane_hash_function(char *hash_function, int *hash_algo);
+int sane_quantile_engine(char *quantile_engine, int *quantile_algo);
+int sane_quantile_configs(quantile_config *config);
+int sane_cardinality_limits(cardinality_config *config);
 
 /**
  * Joins two strings as part of a path,
@@ -11,54 +11,297 @@
 #include <math.h>
 
 #include "likely.h"
+#include "binproto.h"
 #include "metrics.h"
 #include "sink.h"
 #include "streaming.h"
+#include "numparse.h"
+#include "tokenizer.h"
 #include "conn_handler.h"
 
+/**
+ * The number of ASCII lines tokenized at a time
+ */
+#define ASCII_BATCH_SPANS 64
+
+/**
+ * Each line adds a sample, and another to the input
+ * counter, so this bounds the keys and samples of a batch
+ */
+#define BATCH_SAMPLES (2 * ASCII_BATCH_SPANS)
+
+/**
+ * The slots of the batch table, a power of two
+ * at least twice the number of keys
+ */
+#define BATCH_SLOTS 256
+
+/**
+ * A distinct key of a batch, with the chain of its samples
+ */
+typedef struct {
+    char *name;
+    int name_len;
+    uint64_t hash;
+    metric_type type;   // The metric type, GAUGE for gauge deltas
+    int first;          // The first and last sample of the chain
+    int last;
+    int num;            // The number of samples of the key
+} batch_key;
+
+/**
+ * A batch of ASCII lines grouped by key, so that each key
+ * is looked up in the metrics once per batch. The table is
+ * small enough to stay in the L1 cache.
+ */
+typedef struct {
+    uint16_t slots[BATCH_SLOTS];            // The key index + 1, 0 if empty
+    int num_keys;
+    int num_samples;
+    batch_key keys[BATCH_SAMPLES];          // The keys in order of first appearance
+    metric_sample samples[BATCH_SAMPLES];
+    int next[BATCH_SAMPLES];                // The next sample of the same key, or -1
+} ascii_batch;
+
+/**
+ * The number of interned names checked for expiry
+ * per hold of a shard lock
+ */
+#define EXPIRE_BATCH_IDS 4096
+
 /* Static method declarations */
-static int handle_ascii_client_connect(statsite_conn_handler *handle);
-static int buffer_after_terminator(char *buf, int buf_len, char terminator, char **after_term, int *after_len, bool reverse_lookup);
+static int handle_ascii_client_connect(statsite_conn_handler *handle, metrics *m);
+static int handle_binary_client_connect(statsite_conn_handler *handle, metrics *m);
+static metrics* new_metrics(intern_table *names, metrics *prev, name_index *index,
+        admitted_keys *admitted);
+static admitted_keys* new_admitted_keys();
+static int handle_ascii_line(statsite_conn_handler *handle, metrics *m, ascii_batch *batch,
+        statsd_span *span);
+static void batch_add_sample(ascii_batch *batch, metric_type type, char *name, int name_len,
+        uint64_t hash, double val, double sample_rate, char *set_value);
+static void batch_apply(ascii_batch *batch, metrics *m);
 
 /**
- * This is the current metrics object we are using
+ * These are the current metrics objects we are using.
+ * There is one shard per ingest thread, each guarded
+ * by a lock that is only contended during the swap.
  */
-static metrics *GLOBAL_METRICS;
+static metrics **GLOBAL_METRICS;
+static pthread_mutex_t *SHARD_LOCKS;
+static intern_table *SHARD_NAMES;
+static int NUM_SHARDS;
 static statsite_config *GLOBAL_CONFIG;
 
+/**
+ * The keys admitted under the cardinality limits in
+ * the current interval, shared by all the shards.
+ */
+static admitted_keys *ADMITTED_KEYS;
+
+/**
+ * The input counter is updated for every sample,
+ * so its name is only hashed once.
+ */
+static int INPUT_COUNTER_LEN;
+static uint64_t INPUT_COUNTER_HASH;
+
+/**
+ * The index of the names of the last flushed interval,
+ * built by the flush thread for the next swap.
+ */
+static name_index *NEXT_INDEX;
+static pthread_mutex_t INDEX_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * A flush thread that has not been joined yet. The flush
+ * threads take the shard locks, so they are all joined
+ * before the locks are torn down.
+ */
+typedef struct flush_handle {
+    pthread_t thread;
+    bool done;                  // Set by the thread once it is finished
+    struct flush_handle *next;
+} flush_handle;
+
+static flush_handle *FLUSH_THREADS;
+static pthread_mutex_t FLUSH_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Invoked to initialize the conn handler layer.
  */
 void init_conn_handler(statsite_config *config) {
-    // Make the initial metrics object
+    // Store the config
+    GLOBAL_CONFIG = config;
+    if (config->input_counter) {
+        INPUT_COUNTER_LEN = strlen(config->input_counter);
+        INPUT_COUNTER_HASH = hashmap_hash(config->input_counter, INPUT_COUNTER_LEN);
+    }
+
+    // Make the initial metrics objects
+    NUM_SHARDS = config->ingest_threads;
+    GLOBAL_METRICS = calloc(NUM_SHARDS, sizeof(metrics*));
+    SHARD_LOCKS = calloc(NUM_SHARDS, sizeof(pthread_mutex_t));
+    SHARD_NAMES = calloc(NUM_SHARDS, sizeof(intern_table));
+    ADMITTED_KEYS = new_admitted_keys();
+    for (int i=0; i < NUM_SHARDS; i++) {
+        init_intern_table(config->name_idle_intervals, SHARD_NAMES+i);
+        GLOBAL_METRICS[i] = new_metrics(SHARD_NAMES+i, NULL, NULL, ADMITTED_KEYS);
+        pthread_mutex_init(SHARD_LOCKS+i, NULL);
+    }
+}
+
+/**
+ * Allocates a new metrics object using the global config
+ * @arg names The intern table of the shard
+ * @arg prev The metrics of the previous interval, or NULL
+ * @arg index The index of the names of an earlier interval, or NULL
+ * @arg admitted The admitted keys of the interval, or NULL without limits
+ */
+static metrics* new_metrics(intern_table *names, metrics *prev, name_index *index,
+        admitted_keys *admitted) {
     metrics *m = malloc(sizeof(metrics));
-    int res = init_metrics(config->timer_eps, config->quantiles,
-            config->num_quantiles, config->histograms, config->set_precision, m);
+    int res = init_interval_metrics(GLOBAL_CONFIG->timer_eps, GLOBAL_CONFIG->quantiles,
+            GLOBAL_CONFIG->num_quantiles, GLOBAL_CONFIG->histograms,
+            GLOBAL_CONFIG->set_precision, names, prev,
+            GLOBAL_CONFIG->unified_store, GLOBAL_CONFIG->cardinality_limits,
+            admitted, GLOBAL_CONFIG->admission_filter, m);
     assert(res == 0);
-    GLOBAL_METRICS = m;
+    metrics_use_engines(m, GLOBAL_CONFIG->quantile_algo, GLOBAL_CONFIG->quantile_engines);
+    if (GLOBAL_CONFIG->hot_key_cache) metrics_use_hot_keys(m);
+    if (index) metrics_use_index(m, index);
+    return m;
+}
 
-    // Store the config
-    GLOBAL_CONFIG = config;
+/**
+ * Allocates the admitted keys of an interval
+ * @return The admitted keys, or NULL if there are no limits.
+ */
+static admitted_keys* new_admitted_keys() {
+    if (!GLOBAL_CONFIG->cardinality_limits) return NULL;
+    admitted_keys *a = malloc(sizeof(admitted_keys));
+    int res = init_admitted_keys(GLOBAL_CONFIG->num_cardinality_limits, a);
+    assert(res == 0);
+    return a;
 }
 
 /**
- * A struct passed to the flush thread which contains an instance of
- * metrics and any currently configured sinks.
+ * A struct passed to the flush thread which contains the
+ * metric shards of an interval and any currently configured sinks.
  */
 struct flush_op {
-    metrics* m;
+    metrics** shards;
+    int num_shards;
+    admitted_keys *admitted;
     sink* sinks;
+    bool expire_names;
+    bool index_names;
+    flush_handle *handle;   // The handle of the thread, NULL if flushed inline
 };
 
+/**
+ * Records the hit rate of the hot key caches of an
+ * interval into its first shard. The name may be interned
+ * into the table of the shard, which needs its lock.
+ * @arg ops The flush_op holding the shards of the interval
+ */
+static void record_hot_keys(struct flush_op *ops) {
+    uint64_t lookups = 0, hits = 0;
+    for (int i=0; i < ops->num_shards; i++) {
+        lookups += ops->shards[i]->hot_lookups;
+        hits += ops->shards[i]->hot_hits;
+    }
+    if (!lookups) return;
+
+    pthread_mutex_lock(SHARD_LOCKS);
+    metrics_add_sample(ops->shards[0], GAUGE, GLOBAL_CONFIG->hot_key_gauge,
+            (double)hits / lookups, 1.0);
+    pthread_mutex_unlock(SHARD_LOCKS);
+}
+
+/**
+ * Swaps out the metric shards, installing fresh ones.
+ * @return A flush_op holding the previous shards.
+ */
+static struct flush_op* swap_metrics(sink* sinks) {
+    struct flush_op* ops = calloc(1, sizeof(struct flush_op));
+    ops->shards = calloc(NUM_SHARDS, sizeof(metrics*));
+    ops->num_shards = NUM_SHARDS;
+    ops->sinks = sinks;
+    ops->expire_names = true;
+    ops->index_names = GLOBAL_CONFIG->perfect_hash_index;
+
+    // The shards of an interval must share an index
+    name_index *index = NULL;
+    if (ops->index_names) {
+        pthread_mutex_lock(&INDEX_LOCK);
+        index = NEXT_INDEX;
+        if (index) name_index_ref(index);
+        pthread_mutex_unlock(&INDEX_LOCK);
+    }
+
+    // The shards of the new interval admit keys together
+    ops->admitted = ADMITTED_KEYS;
+    ADMITTED_KEYS = new_admitted_keys();
+
+    // The new maps are sized from the old ones, which only
+    // allocates the tables, so it is done under the lock
+    for (int i=0; i < NUM_SHARDS; i++) {
+        pthread_mutex_lock(SHARD_LOCKS+i);
+        ops->shards[i] = GLOBAL_METRICS[i];
+        GLOBAL_METRICS[i] = new_metrics(SHARD_NAMES+i, ops->shards[i], index, ADMITTED_KEYS);
+        intern_next_interval(SHARD_NAMES+i);
+        pthread_mutex_unlock(SHARD_LOCKS+i);
+    }
+    if (index) name_index_release(index);
+
+    if (GLOBAL_CONFIG->hot_key_gauge)
+        record_hot_keys(ops);
+    return ops;
+}
+
+/**
+ * Expires the idle interned names of every shard. The
+ * names are checked in batches, so the shard locks are
+ * only held briefly.
+ */
+static void expire_names() {
+    for (int i=0; i < NUM_SHARDS; i++) {
+        uint32_t cursor = 0;
+        do {
+            pthread_mutex_lock(SHARD_LOCKS+i);
+            intern_expire(SHARD_NAMES+i, &cursor, EXPIRE_BATCH_IDS);
+            pthread_mutex_unlock(SHARD_LOCKS+i);
+        } while (cursor);
+    }
+}
+
 /**
  * This is the thread that is invoked to handle flushing metrics
  */
 static void* flush_thread(void *arg) {
     // Cast the args
     struct flush_op* ops = arg;
-    metrics *m = ops->m;
+    metrics *m = ops->shards[0];
     sink* sinks = ops->sinks;
 
+    // Fold the other shards into the first
+    for (int i=1; i < ops->num_shards; i++) {
+        if (metrics_merge(m, ops->shards[i])) {
+            syslog(LOG_ERR, "Failed to merge metrics shard %d, dropping its metrics!", i);
+            destroy_metrics(ops->shards[i]);
+        }
+        free(ops->shards[i]);
+    }
+
+    // Index the names for a later interval, off the ingest path
+    if (ops->index_names) {
+        name_index *index = metrics_build_index(m);
+        pthread_mutex_lock(&INDEX_LOCK);
+        if (NEXT_INDEX) name_index_release(NEXT_INDEX);
+        NEXT_INDEX = index;
+        pthread_mutex_unlock(&INDEX_LOCK);
+    }
+
     // Get the current time
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -70,48 +313,88 @@ static void* flush_thread(void *arg) {
         }
     }
 
-    // Cleanup
+    // Cleanup, which gives back the names of the interval
     destroy_metrics(m);
     free(m);
+    if (ops->admitted) {
+        destroy_admitted_keys(ops->admitted);
+        free(ops->admitted);
+    }
+    if (ops->expire_names)
+        expire_names();
+    if (ops->handle) {
+        pthread_mutex_lock(&FLUSH_LOCK);
+        ops->handle->done = true;
+        pthread_mutex_unlock(&FLUSH_LOCK);
+    }
+    free(ops->shards);
     free(ops);
     return NULL;
 }
 
+/**
+ * Joins the flush threads
+ * @arg all Joins every thread if true, otherwise only
+ * the threads that are finished
+ */
+static void join_flush_threads(bool all) {
+    flush_handle *joinable = NULL, *h, **prev;
+    pthread_mutex_lock(&FLUSH_LOCK);
+    for (prev = &FLUSH_THREADS; (h = *prev);) {
+        if (all || h->done) {
+            *prev = h->next;
+            h->next = joinable;
+            joinable = h;
+        } else {
+            prev = &h->next;
+        }
+    }
+    pthread_mutex_unlock(&FLUSH_LOCK);
+
+    while ((h = joinable)) {
+        joinable = h->next;
+        pthread_join(h->thread, NULL);
+        free(h);
+    }
+}
+
 /**
  * Invoked to when we've reached the flush interval timeout
  */
 void flush_interval_trigger(sink* sinks) {
-    // Make a new metrics object
-    metrics *m = malloc(sizeof(metrics));
-    init_metrics(GLOBAL_CONFIG->timer_eps, GLOBAL_CONFIG->quantiles,
-            GLOBAL_CONFIG->num_quantiles, GLOBAL_CONFIG->histograms,
-            GLOBAL_CONFIG->set_precision, m);
+    // Reap the finished flushes of earlier intervals
+    join_flush_threads(false);
 
-    // Swap with the new one
-    struct flush_op* ops = calloc(1, sizeof(struct flush_op));
-    ops->m = GLOBAL_METRICS;
-    ops->sinks = sinks;
+    // Swap in new metrics objects
+    struct flush_op* ops = swap_metrics(sinks);
 
-    GLOBAL_METRICS = m;
+    // Track the thread before it starts, so it can mark itself done
+    flush_handle *handle = calloc(1, sizeof(flush_handle));
+    ops->handle = handle;
+    pthread_mutex_lock(&FLUSH_LOCK);
+    handle->next = FLUSH_THREADS;
+    FLUSH_THREADS = handle;
 
     // Start a flush thread
-    pthread_t thread;
     sigset_t oldset;
     sigset_t newset;
     sigfillset(&newset);
     pthread_sigmask(SIG_BLOCK, &newset, &oldset);
-    int err = pthread_create(&thread, NULL, flush_thread, ops);
+    int err = pthread_create(&handle->thread, NULL, flush_thread, ops);
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 
     if (err == 0) {
-        pthread_detach(thread);
+        pthread_mutex_unlock(&FLUSH_LOCK);
         return;
     }
+    FLUSH_THREADS = handle->next;
+    pthread_mutex_unlock(&FLUSH_LOCK);
+    free(handle);
+    ops->handle = NULL;
 
+    // Flush inline rather than lose the interval
     syslog(LOG_WARNING, "Failed to spawn flush thread: %s", strerror(err));
-    GLOBAL_METRICS = ops->m;
-    destroy_metrics(m);
-    free(m);
+    flush_thread(ops);
 }
 
 /**
@@ -119,17 +402,41 @@ void flush_interval_trigger(sink* sinks) {
  * final set of metrics
  */
 void final_flush(sink* sinks) {
-    // Get the last set of metrics
-    metrics *old = GLOBAL_METRICS;
-    GLOBAL_METRICS = NULL;
+    // Wait for the flushes of earlier intervals
+    join_flush_threads(true);
 
+    // Get the last set of metrics
     /* We heap allocate this in order to allow it to be freed by the function */
     struct flush_op* ops = calloc(1, sizeof(struct flush_op));
-    ops->m = old;
+    ops->shards = GLOBAL_METRICS;
+    ops->num_shards = NUM_SHARDS;
+    ops->admitted = ADMITTED_KEYS;
     ops->sinks = sinks;
+    GLOBAL_METRICS = NULL;
+    ADMITTED_KEYS = NULL;
 
+    if (GLOBAL_CONFIG->hot_key_gauge)
+        record_hot_keys(ops);
     flush_thread(ops);
 
+    for (int i=0; i < NUM_SHARDS; i++) {
+        pthread_mutex_destroy(SHARD_LOCKS+i);
+    }
+    free(SHARD_LOCKS);
+    SHARD_LOCKS = NULL;
+
+    pthread_mutex_lock(&INDEX_LOCK);
+    if (NEXT_INDEX) name_index_release(NEXT_INDEX);
+    NEXT_INDEX = NULL;
+    pthread_mutex_unlock(&INDEX_LOCK);
+
+    // Every interval has given back its names
+    for (int i=0; i < NUM_SHARDS; i++) {
+        destroy_intern_table(SHARD_NAMES+i);
+    }
+    free(SHARD_NAMES);
+    SHARD_NAMES = NULL;
+
     for (sink* sink = sinks; sink != NULL; sink = sink->next) {
         if (sink->close)
             sink->close(sink);
@@ -143,149 +450,360 @@ void final_flush(sink* sinks) {
  * consume all the input possible, and generate responses
  * to all requests.
  * @arg handle The connection related information
- * @return 0 on success.
+ * @return 0 on success, 1 if a bad command was skipped and
+ * the rest of the input can be handled, -1 if the input
+ * can not be framed anymore.
  */
 int handle_client_connect(statsite_conn_handler *handle) {
     // Try to read the magic character, bail if no data
     unsigned char magic;
     if (unlikely(peek_client_byte(handle->conn, &magic) == -1)) return 0;
 
-    return handle_ascii_client_connect(handle);
+    // Hold our shard for the whole batch
+    pthread_mutex_lock(SHARD_LOCKS+handle->shard);
+    metrics *m = GLOBAL_METRICS[handle->shard];
+
+    // The handlers return 1 when the other protocol is next,
+    // which happens when a UDP batch mixes both.
+    int res;
+    do {
+        if (magic == BINARY_MAGIC_BYTE)
+            res = handle_binary_client_connect(handle, m);
+        else
+            res = handle_ascii_client_connect(handle, m);
+    } while (res == 1 && !peek_client_byte(handle->conn, &magic));
+
+    pthread_mutex_unlock(SHARD_LOCKS+handle->shard);
+    switch (res) {
+        case -1:
+            return 1;
+        case -2:
+            return -1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Invoked by the networking layer to record a sample
+ * about statsite itself, such as the fill of a batch.
+ * @arg handle The connection related information
+ * @arg type The metric type
+ * @arg name The name of the metric
+ * @arg val The sample value
+ */
+void record_internal_sample(statsite_conn_handler *handle, metric_type type, char *name, double val) {
+    pthread_mutex_lock(SHARD_LOCKS+handle->shard);
+    metrics_add_sample(GLOBAL_METRICS[handle->shard], type, name, val, 1.0);
+    pthread_mutex_unlock(SHARD_LOCKS+handle->shard);
 }
 
 /**
  * Invoked to handle ASCII commands. This is the default
- * mode for statsite, to be backwards compatible with statsd
+ * mode for statsite, to be backwards compatible with statsd.
+ * The readable input is split into lines in batches by the
+ * tokenizer, and each line is then handled in turn. If batches
+ * are coalesced, the lines are grouped by key first, and applied
+ * once the batch is parsed, before it is consumed.
  * @arg handle The connection related information
+ * @arg m The metrics shard to update
+ * @return 0 on success, 1 if a binary message is next,
+ * -1 if a bad line was skipped.
+ */
+static int handle_ascii_client_connect(statsite_conn_handler *handle, metrics *m) {
+    statsd_span spans[ASCII_BATCH_SPANS];
+    ascii_batch table, *batch = NULL;
+    char *buf;
+    int buf_len, num;
+    unsigned char magic;
+
+    if (GLOBAL_CONFIG->coalesce_batches) {
+        batch = &table;
+        batch->num_keys = 0;
+        batch->num_samples = 0;
+        memset(batch->slots, 0, sizeof(batch->slots));
+    }
+
+    while (1) {
+        // Hand off to the binary protocol
+        if (peek_client_byte(handle->conn, &magic) == -1) return 0;
+        if (unlikely(magic == BINARY_MAGIC_BYTE)) return 1;
+
+        // The region is contiguous, even across the end of the buffer
+        peek_client_region(handle->conn, &buf, &buf_len);
+        num = tokenize_lines(buf, buf_len, (statsd_span*)&spans, ASCII_BATCH_SPANS);
+
+        // Return if no command is complete
+        if (num == 0) return 0;
+
+        // Handle the batch, consuming up to a bad line
+        for (int i=0; i < num; i++) {
+            if (unlikely(handle_ascii_line(handle, m, batch, spans+i))) {
+                if (batch) batch_apply(batch, m);
+                seek_client_bytes(handle->conn, spans[i].key + spans[i].len - buf);
+                return -1;
+            }
+        }
+        if (batch) batch_apply(batch, m);
+        seek_client_bytes(handle->conn, spans[num-1].key + spans[num-1].len - buf);
+    }
+}
+
+/**
+ * Handles a single ASCII command
+ * @arg handle The connection related information
+ * @arg m The metrics shard to update
+ * @arg batch The batch to add the samples to, or NULL
+ * to update the metrics directly
+ * @arg span The tokenized line
  * @return 0 on success.
  */
-static int handle_ascii_client_connect(statsite_conn_handler *handle) {
-    // Look for the next command line
-    char *buf, *key, *val_str, *type_str, *sample_str, *endptr;
+static int handle_ascii_line(statsite_conn_handler *handle, metrics *m, ascii_batch *batch,
+        statsd_span *span) {
+    char *key = span->key, *val_str = span->value, *type_str = span->type;
+    char *sample_str = span->rate, *endptr;
     metric_type type;
-    int buf_len, should_free, status, i, after_len;
     double val;
     double sample_rate = 1.0;
 
-    while (1) {
-        sample_rate = 1.0;
-
-        status = extract_to_terminator(handle->conn, '\n', &buf, &buf_len, &should_free);
-        if (status == -1) return 0; // Return if no command is available
-
-        // Check for a valid metric
-        // Scan for the colon
-        status = buffer_after_terminator(buf, buf_len, ':', &val_str, &after_len, true);
-        if (likely(!status)) status |= buffer_after_terminator(val_str, after_len, '|', &type_str, &after_len, false);
-        if (unlikely(status)) {
-            syslog(LOG_WARNING, "Failed parse metric! Input: %s", buf);
-            goto ERR_RET;
-        }
+    // Check for a valid metric
+    if (unlikely(!val_str || !type_str)) {
+        syslog(LOG_WARNING, "Failed parse metric! Input: %s", key);
+        return -1;
+    }
 
-        // Convert the type
-        switch (*type_str) {
-            case 'c':
-                type = COUNTER;
-                break;
-            case 'h':
-            case 'm':
-                type = TIMER;
-                break;
-            case 'k': // Formerly K_V
-            case 'G':
-                type = GAUGE_DIRECT;
-                break;
-            case 'g':
-                type = GAUGE;
-
-                // Check if this is a delta update
-                switch (*val_str) {
-                    case '+':
-                    case '-':
-                        type = GAUGE_DELTA;
-                }
-                break;
-            case 's':
-                type = SET;
-                break;
-            default:
-                type = UNKNOWN;
-                syslog(LOG_WARNING, "Received unknown metric type! Input: %c", *type_str);
-                goto ERR_RET;
-        }
+    // Convert the type
+    switch (*type_str) {
+        case 'c':
+            type = COUNTER;
+            break;
+        case 'h':
+        case 'm':
+            type = TIMER;
+            break;
+        case 'k': // Formerly K_V
+        case 'G':
+            type = GAUGE_DIRECT;
+            break;
+        case 'g':
+            type = GAUGE;
+
+            // Check if this is a delta update
+            switch (*val_str) {
+                case '+':
+                case '-':
+                    type = GAUGE_DELTA;
+            }
+            break;
+        case 's':
+            type = SET;
+            break;
+        default:
+            syslog(LOG_WARNING, "Received unknown metric type! Input: %c", *type_str);
+            return -1;
+    }
 
-        // Increment the number of inputs received
-        if (GLOBAL_CONFIG->input_counter)
-            metrics_add_sample(GLOBAL_METRICS, COUNTER, GLOBAL_CONFIG->input_counter, 1, sample_rate);
+    // Increment the number of inputs received
+    if (GLOBAL_CONFIG->input_counter) {
+        if (batch)
+            batch_add_sample(batch, COUNTER, GLOBAL_CONFIG->input_counter,
+                    INPUT_COUNTER_LEN, INPUT_COUNTER_HASH, 1, sample_rate, NULL);
+        else
+            metrics_add_hashed_sample(m, COUNTER, GLOBAL_CONFIG->input_counter,
+                    INPUT_COUNTER_LEN, INPUT_COUNTER_HASH, 1, sample_rate);
+    }
 
-        // Fast track the set-updates
-        if (type == SET) {
-            metrics_set_update(GLOBAL_METRICS, buf, val_str);
-            goto END_LOOP;
-        }
+    // Hash the key once for the lookup and any insert
+    int key_len = val_str - key - 1;
+    uint64_t hash = hashmap_hash(key, key_len);
+
+    // Names under a cardinality limit may be folded into the same
+    // overflow metric, so they are applied in the order they arrived
+    void *limit;
+    if (batch && GLOBAL_CONFIG->cardinality_limits &&
+            !radix_longest_prefix(GLOBAL_CONFIG->cardinality_limits, key, &limit))
+        batch = NULL;
+
+    // Fast track the set-updates
+    if (type == SET) {
+        if (batch)
+            batch_add_sample(batch, SET, key, key_len, hash, 0, 1.0, val_str);
+        else
+            metrics_set_hashed_update(m, key, key_len, hash, val_str);
+        return 0;
+    }
 
-        // Convert the value to a double
-        val = strtod(val_str, &endptr);
-        if (unlikely(endptr == val_str)) {
-            syslog(LOG_WARNING, "Failed value conversion! Input: %s", val_str);
-            goto ERR_RET;
-        }
+    // Convert the value to a double
+    val = fast_parse_double(val_str, &endptr);
+    if (unlikely(endptr == val_str)) {
+        syslog(LOG_WARNING, "Failed value conversion! Input: %s", val_str);
+        return -1;
+    }
 
-        // Handle counter sampling if applicable
-        if ((type == COUNTER || type == TIMER) && !buffer_after_terminator(type_str, after_len, '@', &sample_str, &after_len, false)) {
-            double unchecked_rate = strtod(sample_str, &endptr);
-            if (unlikely(endptr == sample_str)) {
-                syslog(LOG_WARNING, "Failed sample rate conversion! Input: %s", sample_str);
-                goto ERR_RET;
-            }
-            if (likely(unchecked_rate > 0 && unchecked_rate <= 1)) {
-                sample_rate = unchecked_rate;
-                // Magnify the value
-                if (type == COUNTER) {
-                    val = val * (1.0 / sample_rate);
-                }
+    // Handle counter sampling if applicable
+    if ((type == COUNTER || type == TIMER) && sample_str) {
+        double unchecked_rate = fast_parse_double(sample_str, &endptr);
+        if (unlikely(endptr == sample_str)) {
+            syslog(LOG_WARNING, "Failed sample rate conversion! Input: %s", sample_str);
+            return -1;
+        }
+        if (likely(unchecked_rate > 0 && unchecked_rate <= 1)) {
+            sample_rate = unchecked_rate;
+            // Magnify the value
+            if (type == COUNTER) {
+                val = val * (1.0 / sample_rate);
             }
         }
+    }
 
-        // Store the sample
-        metrics_add_sample(GLOBAL_METRICS, type, buf, val, sample_rate);
+    // Store the sample
+    if (batch)
+        batch_add_sample(batch, type, key, key_len, hash, val, sample_rate, NULL);
+    else
+        metrics_add_hashed_sample(m, type, key, key_len, hash, val, sample_rate);
+    return 0;
+}
 
-END_LOOP:
-        // Make sure to free the command buffer if we need to
-        if (should_free) free(buf);
+/**
+ * Adds a sample to a batch, chained to the earlier
+ * samples of its key.
+ * @arg batch The batch to add to
+ * @arg type The sample type
+ * @arg name The name of the metric, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg val The sample value
+ * @arg sample_rate The sample rate of val
+ * @arg set_value The value of a set sample, or NULL
+ */
+static void batch_add_sample(ascii_batch *batch, metric_type type, char *name, int name_len,
+        uint64_t hash, double val, double sample_rate, char *set_value) {
+    metric_type key_type = (type == GAUGE_DELTA) ? GAUGE : type;
+
+    // Find the key with linear probing, the table is at most half full
+    uint32_t idx = (hash + key_type) & (BATCH_SLOTS - 1);
+    batch_key *key;
+    while (batch->slots[idx]) {
+        key = batch->keys + batch->slots[idx] - 1;
+        if (key->hash == hash && key->type == key_type && key->name_len == name_len &&
+                !memcmp(key->name, name, name_len))
+            break;
+        idx = (idx + 1) & (BATCH_SLOTS - 1);
     }
 
-    return 0;
-ERR_RET:
-    if (should_free) free(buf);
-    return -1;
+    // Store the sample
+    int s = batch->num_samples++;
+    batch->samples[s] = (metric_sample){type, val, sample_rate, set_value};
+    batch->next[s] = -1;
+
+    // New key, or chain to the last sample
+    if (!batch->slots[idx]) {
+        key = batch->keys + batch->num_keys++;
+        batch->slots[idx] = batch->num_keys;
+        *key = (batch_key){name, name_len, hash, key_type, s, s, 1};
+    } else {
+        batch->next[key->last] = s;
+        key->last = s;
+        key->num++;
+    }
 }
 
 /**
- * Scans the input buffer of a given length up to a terminator.
- * Then sets the start of the buffer after the terminator including
- * the length of the after buffer.
- * @arg buf The input buffer
- * @arg buf_len The length of the input buffer
- * @arg terminator The terminator to scan to. Replaced with the null terminator.
- * @arg after_term Output. Set to the byte after the terminator.
- * @arg after_len Output. Set to the length of the output buffer.
- * @arg reverse_lookup scan the input string in reverse order
- * @return 0 if terminator found. -1 otherwise.
+ * Applies a batch to the metrics, and resets it. The keys
+ * are applied in order of first appearance, each with its
+ * samples in the order they arrived. Names under a cardinality
+ * limit are never batched, so no two keys share a metric.
+ * @arg batch The batch to apply
+ * @arg m The metrics shard to update
  */
-static int buffer_after_terminator(char *buf, int buf_len, char terminator, char **after_term, int *after_len, bool reverse_lookup) {
-    char* term_addr = reverse_lookup ? memrchr(buf, terminator, buf_len)
-                                     : memchr(buf, terminator, buf_len);
-    if (!term_addr) {
-        *after_term = NULL;
-        return -1;
+static void batch_apply(ascii_batch *batch, metrics *m) {
+    metric_sample samples[BATCH_SAMPLES];
+    for (int i=0; i < batch->num_keys; i++) {
+        batch_key *key = batch->keys + i;
+        int num = 0;
+        for (int s=key->first; s != -1; s = batch->next[s])
+            samples[num++] = batch->samples[s];
+        metrics_add_hashed_samples(m, key->type, key->name, key->name_len, key->hash,
+                samples, num);
     }
+    batch->num_keys = 0;
+    batch->num_samples = 0;
+    memset(batch->slots, 0, sizeof(batch->slots));
+}
 
-    // Convert the space to a null-seperator
-    *term_addr = '\0';
+/**
+ * Invoked to handle binary commands. Each message is prefixed
+ * by the magic byte, so clients can mix them with ASCII
+ * commands on the same ports.
+ * @arg handle The connection related information
+ * @arg m The metrics shard to update
+ * @return 0 on success, 1 if an ASCII command is next,
+ * -1 if a bad message was skipped, -2 if a bad header was
+ * skipped and the messages can not be framed anymore.
+ */
+static int handle_binary_client_connect(statsite_conn_handler *handle, metrics *m) {
+    binproto_header header;
+    char *buf, *key, *set_key;
+    int header_size;
+    unsigned char magic;
 
-    // Provide the arg buffer, and arg_len
-    *after_term = term_addr+1;
-    *after_len = buf_len - (term_addr - buf + 1);
-    return 0;
+    while (1) {
+        // Hand off to the ASCII protocol
+        if (peek_client_byte(handle->conn, &magic) == -1) return 0;
+        if (magic != BINARY_MAGIC_BYTE) return 1;
+
+        // The type determines the size of the header
+        if (peek_client_bytes(handle->conn, 2, &buf) == -1) return 0;
+        header_size = binproto_header_size(buf[1]);
+        if (unlikely(header_size == -1)) {
+            syslog(LOG_WARNING, "Received unknown binary metric type!");
+            seek_client_bytes(handle->conn, 2);
+            return -2;
+        }
+
+        // Wait for the full message
+        if (peek_client_bytes(handle->conn, header_size, &buf) == -1) return 0;
+        if (unlikely(binproto_decode_header((unsigned char*)buf, &header) == -1)) {
+            syslog(LOG_WARNING, "Received malformed binary header!");
+            seek_client_bytes(handle->conn, header_size);
+            return -2;
+        }
+        if (available_bytes(handle->conn) < header_size + header.key_len + header.set_len) return 0;
+
+        seek_client_bytes(handle->conn, header_size);
+        read_client_bytes(handle->conn, header.key_len + header.set_len, &buf);
+
+        // Verify the keys are terminated
+        key = buf;
+        set_key = buf + header.key_len;
+        if (unlikely(key[header.key_len - 1] != '\0' ||
+                    (header.type == SET && set_key[header.set_len - 1] != '\0'))) {
+            syslog(LOG_WARNING, "Received binary key without a null terminator!");
+            return -1;
+        }
+
+        // Increment the number of inputs received
+        if (GLOBAL_CONFIG->input_counter)
+            metrics_add_hashed_sample(m, COUNTER, GLOBAL_CONFIG->input_counter,
+                    INPUT_COUNTER_LEN, INPUT_COUNTER_HASH, 1, 1.0);
+
+        // The key may be terminated before the end of its field
+        int key_len = strlen(key);
+        uint64_t hash = hashmap_hash(key, key_len);
+        if (header.type == SET) {
+            metrics_set_hashed_update(m, key, key_len, hash, set_key);
+        } else {
+            // Handle sampling the same way as ASCII commands
+            double sample_rate = 1.0;
+            if ((header.type == COUNTER || header.type == TIMER) &&
+                header.sample_rate > 0 && header.sample_rate <= 1) {
+                sample_rate = header.sample_rate;
+                if (header.type == COUNTER) {
+                    header.value = header.value * (1.0 / sample_rate);
+                }
+            }
+            metrics_add_hashed_sample(m, header.type, key, key_len, hash,
+                    header.value, sample_rate);
+        }
+    }
 }
@@ -12,6 +12,7 @@
 typedef struct {
     statsite_config *config;     // Global configuration
     statsite_conn_info *conn;    // Opaque handle into the networking stack
+    int shard;                   // Metrics shard of the ingest thread
 } statsite_conn_handler;
 
 /**
@@ -36,8 +37,21 @@ void final_flush();
  * consume all the input possible, and generate responses
  * to all requests.
  * @arg handle The connection related information
- * @return 0 on success.
+ * @return 0 on success, 1 if a bad command was skipped and
+ * the rest of the input can be handled, -1 if the input
+ * can not be framed anymore.
  */
 int handle_client_connect(statsite_conn_handler *handle);
 
+/**
+ * Invoked by the networking layer to record a sample
+ * about statsite itself, such as the fill of a batch.
+ * The sample is added to the metrics of the handle's shard.
+ * @arg handle The connection related information
+ * @arg type The metric type
+ * @arg name The name of the metric
+ * @arg val The sample value
+ */
+void record_internal_sample(statsite_conn_handler *handle, metric_type type, char *name, double val);
+
 #endif
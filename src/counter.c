@@ -38,6 +38,30 @@ int counter_add_sample(counter *counter, double sample, double sample_rate) {
     return 0;
 }
 
+/**
+ * Merges the samples of another counter into this one.
+ * @arg c The counter to merge into
+ * @arg other The counter to merge from. Left unchanged.
+ * @return 0 on success.
+ */
+int counter_merge(counter *c, counter *other) {
+    if (!other->actual_count) return 0;
+    if (!c->actual_count) {
+        c->min = other->min;
+        c->max = other->max;
+    } else {
+        if (c->min > other->min)
+            c->min = other->min;
+        if (c->max < other->max)
+            c->max = other->max;
+    }
+    c->actual_count += other->actual_count;
+    c->count += other->count;
+    c->sum += other->sum;
+    c->squared_sum += other->squared_sum;
+    return 0;
+}
+
 /**
  * Returns the number of samples in the counter
  * @arg counter The counter to query
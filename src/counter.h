@@ -27,6 +27,14 @@ int init_counter(counter *counter);
  */
 int counter_add_sample(counter *counter, double sample, double sample_rate);
 
+/**
+ * Merges the samples of another counter into this one.
+ * @arg c The counter to merge into
+ * @arg other The counter to merge from. Left unchanged.
+ * @return 0 on success.
+ */
+int counter_merge(counter *c, counter *other);
+
 /**
  * Returns the number of samples in the counter
  * @arg counter The counter to query
@@ -0,0 +1,257 @@
+/**
+ * This module implements DDSketch, a quantile sketch with
+ * relative error guarantees, from "DDSketch: A Fast and
+ * Fully-Mergeable Quantile Sketch with Relative-Error Guarantees"
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ddsketch.h"
+
+/*
+ * A positive value x falls in the bin with key ceil(log_gamma(x)),
+ * whose bounds are gamma^(key-1) and gamma^key. Reporting the
+ * midpoint of the bin is within alpha of any value in it. Negative
+ * values are binned by their magnitude in a second store, and
+ * zeros are only counted.
+ */
+
+// The smallest capacity of a store
+#define STORE_MIN_SIZE 16
+
+/* Static declarations */
+static int store_add(dd_store *s, int64_t key, uint64_t count, uint32_t max_bins);
+static int store_merge(dd_store *s, dd_store *other, uint32_t max_bins);
+static int store_extend(dd_store *s, int64_t lo, int64_t hi, uint32_t max_bins);
+
+/**
+ * Initializes the sketch
+ * @arg alpha The relative accuracy of the quantiles, on (0, 1)
+ * @arg max_bins The bound on the bins of each store
+ * @arg dd The ddsketch struct to initialize
+ * @return 0 on success.
+ */
+int init_ddsketch(double alpha, uint32_t max_bins, ddsketch *dd) {
+    if (alpha <= 0 || alpha >= 1) return -1;
+    if (!max_bins) return -1;
+
+    dd->alpha = alpha;
+    dd->gamma = (1 + alpha) / (1 - alpha);
+    dd->multiplier = 1 / log(dd->gamma);
+    dd->max_bins = max_bins;
+    dd->count = 0;
+    dd->zero_count = 0;
+    dd->min = 0;
+    dd->max = 0;
+    memset(&dd->positive, 0, sizeof(dd_store));
+    memset(&dd->negative, 0, sizeof(dd_store));
+    return 0;
+}
+
+/**
+ * Destroy the sketch
+ * @arg dd The ddsketch to destroy
+ * @return 0 on success.
+ */
+int destroy_ddsketch(ddsketch *dd) {
+    free(dd->positive.bins);
+    free(dd->negative.bins);
+    return 0;
+}
+
+// Returns the key of the bin of a positive value
+static inline int64_t dd_key(ddsketch *dd, double value) {
+    return (int64_t)ceil(log(value) * dd->multiplier);
+}
+
+// Returns the value reported for a bin
+static inline double dd_value(ddsketch *dd, int64_t key) {
+    return 2 * exp(key / dd->multiplier) / (dd->gamma + 1);
+}
+
+/**
+ * Adds a new sample to the sketch
+ * @arg dd The ddsketch to add to
+ * @arg sample The new sample value
+ * @return 0 on success.
+ */
+int dd_add_sample(ddsketch *dd, double sample) {
+    int res = 0;
+    if (sample > 0)
+        res = store_add(&dd->positive, dd_key(dd, sample), 1, dd->max_bins);
+    else if (sample < 0)
+        res = store_add(&dd->negative, dd_key(dd, -sample), 1, dd->max_bins);
+    else
+        dd->zero_count++;
+    if (res) return res;
+
+    if (!dd->count || sample < dd->min) dd->min = sample;
+    if (!dd->count || sample > dd->max) dd->max = sample;
+    dd->count++;
+    return 0;
+}
+
+/**
+ * Merges another sketch into this one. The merge is exact,
+ * and both sketches must use the same accuracy and bound.
+ * @arg dd The ddsketch to merge into
+ * @arg other The ddsketch to merge from, unchanged
+ * @return 0 on success, -1 if the sketches differ.
+ */
+int dd_merge(ddsketch *dd, ddsketch *other) {
+    if (dd->alpha != other->alpha || dd->max_bins != other->max_bins) return -1;
+    if (!other->count) return 0;
+    if (store_merge(&dd->positive, &other->positive, dd->max_bins)) return -1;
+    if (store_merge(&dd->negative, &other->negative, dd->max_bins)) return -1;
+
+    if (!dd->count || other->min < dd->min) dd->min = other->min;
+    if (!dd->count || other->max > dd->max) dd->max = other->max;
+    dd->zero_count += other->zero_count;
+    dd->count += other->count;
+    return 0;
+}
+
+/**
+ * Queries for a quantile value
+ * @arg dd The ddsketch to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double dd_query(ddsketch *dd, double quantile) {
+    if (!dd->count) return 0;
+    if (quantile <= 0) return dd->min;
+    if (quantile >= 1) return dd->max;
+
+    // Walk the negative values from the most negative, then the
+    // zeros, then the positive values from the smallest
+    double rank = quantile * (dd->count - 1);
+    double value = dd->max;
+    uint64_t seen = 0;
+    dd_store *s = &dd->negative;
+    int found = 0;
+    for (int64_t i=(int64_t)s->len - 1; i >= 0 && !found; i--) {
+        seen += s->bins[i];
+        if (seen > rank) {
+            value = -dd_value(dd, s->offset + i);
+            found = 1;
+        }
+    }
+    if (!found) {
+        seen += dd->zero_count;
+        if (seen > rank) {
+            value = 0;
+            found = 1;
+        }
+    }
+    s = &dd->positive;
+    for (uint32_t i=0; i < s->len && !found; i++) {
+        seen += s->bins[i];
+        if (seen > rank) {
+            value = dd_value(dd, s->offset + i);
+            found = 1;
+        }
+    }
+
+    // The bins may straddle the extremes, which are exact
+    if (value < dd->min) value = dd->min;
+    if (value > dd->max) value = dd->max;
+    return value;
+}
+
+/**
+ * Returns the memory used by the bins of the sketch, in bytes
+ */
+size_t dd_bytes(ddsketch *dd) {
+    return (dd->positive.size + dd->negative.size) * sizeof(uint64_t);
+}
+
+/**
+ * Adds a count to the bin of a key, extending the range of
+ * the store if needed. Keys below a collapsed range are
+ * counted in its lowest bin.
+ */
+static int store_add(dd_store *s, int64_t key, uint64_t count, uint32_t max_bins) {
+    if (s->len && key >= s->offset && key < s->offset + s->len) {
+        s->bins[key - s->offset] += count;
+        return 0;
+    }
+
+    int64_t lo = key, hi = key;
+    if (s->len) {
+        if (s->offset < lo) lo = s->offset;
+        if (s->offset + s->len - 1 > hi) hi = s->offset + s->len - 1;
+    }
+    if (store_extend(s, lo, hi, max_bins)) return -1;
+    s->bins[(key < s->offset) ? 0 : key - s->offset] += count;
+    return 0;
+}
+
+/**
+ * Adds the counts of another store, extending the range
+ * once to cover both.
+ */
+static int store_merge(dd_store *s, dd_store *other, uint32_t max_bins) {
+    if (!other->len) return 0;
+    int64_t lo = other->offset, hi = other->offset + other->len - 1;
+    if (s->len) {
+        if (s->offset < lo) lo = s->offset;
+        if (s->offset + s->len - 1 > hi) hi = s->offset + s->len - 1;
+    }
+    if (store_extend(s, lo, hi, max_bins)) return -1;
+    for (uint32_t i=0; i < other->len; i++) {
+        int64_t key = other->offset + i;
+        s->bins[(key < s->offset) ? 0 : key - s->offset] += other->bins[i];
+    }
+    return 0;
+}
+
+/**
+ * Changes the range of a store to cover the keys from lo to hi.
+ * If that is more than the bound, the lowest keys are collapsed
+ * into the lowest bin that is kept.
+ * @return 0 on success, -1 if the bins could not grow.
+ */
+static int store_extend(dd_store *s, int64_t lo, int64_t hi, uint32_t max_bins) {
+    if (hi - lo + 1 > max_bins) lo = hi - max_bins + 1;
+    uint32_t len = hi - lo + 1;
+
+    // Grow the bins, doubling up to the bound
+    if (len > s->size) {
+        uint32_t size = (s->size) ? s->size : STORE_MIN_SIZE;
+        while (size < len) size *= 2;
+        if (size > max_bins) size = max_bins;
+        uint64_t *bins = realloc(s->bins, size * sizeof(uint64_t));
+        if (!bins) return -1;
+        s->bins = bins;
+        s->size = size;
+    }
+    if (!s->len) {
+        memset(s->bins, 0, len * sizeof(uint64_t));
+        s->offset = lo;
+        s->len = len;
+        return 0;
+    }
+
+    // Sum the bins that are collapsed
+    uint64_t collapsed = 0;
+    int64_t old_hi = s->offset + s->len - 1;
+    for (int64_t key = s->offset; key < lo && key <= old_hi; key++)
+        collapsed += s->bins[key - s->offset];
+
+    // Move the bins that are kept into place, and clear the rest
+    int64_t first = (s->offset > lo) ? s->offset : lo;
+    uint32_t start = 0, kept = 0;
+    if (first <= old_hi) {
+        start = first - lo;
+        kept = old_hi - first + 1;
+        memmove(s->bins + start, s->bins + (first - s->offset), kept * sizeof(uint64_t));
+    }
+    memset(s->bins, 0, start * sizeof(uint64_t));
+    memset(s->bins + start + kept, 0, (len - start - kept) * sizeof(uint64_t));
+    s->bins[0] += collapsed;
+    s->offset = lo;
+    s->len = len;
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * This module implements DDSketch, a quantile sketch with
+ * relative error guarantees, from "DDSketch: A Fast and
+ * Fully-Mergeable Quantile Sketch with Relative-Error Guarantees"
+ *
+ */
+#ifndef DDSKETCH_H
+#define DDSKETCH_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The default bound on the bins of each store. At a relative
+ * error of 1% this covers more than 17 orders of magnitude.
+ */
+#define DD_DEFAULT_BINS 2048
+
+/*
+ * The counts of a contiguous range of bin keys. Once the range
+ * would exceed the bound, its lowest bins are collapsed into one.
+ */
+typedef struct {
+    int64_t offset;     // Key of the first bin
+    uint32_t len;       // Number of bins in the range
+    uint32_t size;      // Capacity of the bins
+    uint64_t *bins;     // Count of each bin
+} dd_store;
+
+typedef struct {
+    double alpha;           // Relative accuracy
+    double gamma;           // Ratio between the bounds of a bin
+    double multiplier;      // 1 / ln(gamma), maps a log onto a key
+    uint32_t max_bins;      // Bound on the bins of each store
+
+    uint64_t count;         // Number of values added
+    uint64_t zero_count;    // Number of values that are zero
+    double min;             // Smallest value added
+    double max;             // Largest value added
+
+    dd_store positive;      // Bins of the positive values
+    dd_store negative;      // Bins of the magnitudes of the negative values
+} ddsketch;
+
+/**
+ * Initializes the sketch
+ * @arg alpha The relative accuracy of the quantiles, on (0, 1)
+ * @arg max_bins The bound on the bins of each store
+ * @arg dd The ddsketch struct to initialize
+ * @return 0 on success.
+ */
+int init_ddsketch(double alpha, uint32_t max_bins, ddsketch *dd);
+
+/**
+ * Destroy the sketch
+ * @arg dd The ddsketch to destroy
+ * @return 0 on success.
+ */
+int destroy_ddsketch(ddsketch *dd);
+
+/**
+ * Adds a new sample to the sketch
+ * @arg dd The ddsketch to add to
+ * @arg sample The new sample value
+ * @return 0 on success.
+ */
+int dd_add_sample(ddsketch *dd, double sample);
+
+/**
+ * Merges another sketch into this one. The merge is exact,
+ * and both sketches must use the same accuracy and bound.
+ * @arg dd The ddsketch to merge into
+ * @arg other The ddsketch to merge from, unchanged
+ * @return 0 on success, -1 if the sketches differ.
+ */
+int dd_merge(ddsketch *dd, ddsketch *other);
+
+/**
+ * Queries for a quantile value
+ * @arg dd The ddsketch to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double dd_query(ddsketch *dd, double quantile);
+
+/**
+ * Returns the memory used by the bins of the sketch, in bytes
+ */
+size_t dd_bytes(ddsketch *dd);
+
+#endif
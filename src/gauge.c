@@ -8,6 +8,7 @@ int init_gauge(gauge_t *gauge) {
     gauge->value = 0;
     gauge->min = 0;
     gauge->max = 0;
+    gauge->absolute = false;
     return 0;
 }
 
@@ -16,6 +17,7 @@ int gauge_add_sample(gauge_t *gauge, double sample, bool delta) {
         gauge->value += sample;
     } else {
         gauge->value = sample;
+        gauge->absolute = true;
     }
 
     if (gauge->count == 0) {
@@ -31,6 +33,30 @@ int gauge_add_sample(gauge_t *gauge, double sample, bool delta) {
     return 0;
 }
 
+int gauge_merge(gauge_t *gauge, gauge_t *other) {
+    if (!other->count) return 0;
+    if (!gauge->count) {
+        *gauge = *other;
+        return 0;
+    }
+
+    if (other->absolute) {
+        gauge->value = other->value;
+        gauge->absolute = true;
+    } else {
+        gauge->value += other->value;
+    }
+
+    if (gauge->min > other->min)
+        gauge->min = other->min;
+    if (gauge->max < other->max)
+        gauge->max = other->max;
+
+    gauge->sum += other->sum;
+    gauge->count += other->count;
+    return 0;
+}
+
 uint64_t gauge_count(gauge_t *gauge) {
     return gauge->count;
 }
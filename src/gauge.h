@@ -9,6 +9,7 @@ typedef struct {
     double value;       // redundant if count == 1, keeping it to reduce footprint of changes
     double min;         // min of all of the gauge samples recieved
     double max;         // max of all of the gauge samples received
+    bool absolute;      // Was the value set by a non-delta sample
 } gauge_t;
 
 
@@ -28,6 +29,16 @@ int init_gauge(gauge_t *gauge);
  */
 int gauge_add_sample(gauge_t *gauge, double sample, bool delta);
 
+/**
+ * Merges the samples of another gauge into this one. If the
+ * other gauge was set to an absolute value, its value wins,
+ * otherwise its deltas are applied on top of ours.
+ * @arg gauge The gauge to merge into
+ * @arg other The gauge to merge from. Left unchanged.
+ * @return 0 on success.
+ */
+int gauge_merge(gauge_t *gauge, gauge_t *other);
+
 /**
  * Returns the number of samples in the gauge
  * @arg gauge The gauge to query
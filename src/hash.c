@@ -0,0 +1,129 @@
+#include <string.h>
+#include "hash.h"
+
+/*
+ * The hash layer used by the hashmaps, sets and HLLs. Murmur
+ * hashes 16 bytes per round into 128 bits, of which only 64
+ * are used. The wyhash style function does its rounds with
+ * a 64x64 -> 128 bit multiply, which is much cheaper on the
+ * 20 to 120 byte names metrics tend to have.
+ */
+
+// Link the external murmur hash in
+extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
+
+// The function is picked once at startup, so the branch predicts well
+static hash_algo HASH_ALGO = HASH_MURMUR;
+
+// The secret of the wyhash style function
+static const uint64_t WY_SECRET[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+/**
+ * Selects the hash function. The sketches and maps depend
+ * on it, so it may only be changed before any are built.
+ * The hashes are deterministic for a given function, so
+ * sketches agree across restarts and nodes that use it.
+ * @notes This method is not thread safe.
+ * @arg algo The hash function to use
+ * @return 0 on success.
+ */
+int hash_select(hash_algo algo) {
+    if (algo != HASH_MURMUR && algo != HASH_WYHASH) return -1;
+    HASH_ALGO = algo;
+    return 0;
+}
+
+/**
+ * Returns the selected hash function
+ */
+hash_algo hash_selected(void) {
+    return HASH_ALGO;
+}
+
+static inline uint64_t murmur_hash(const void *key, size_t len) {
+    uint64_t out[2];
+    MurmurHash3_x64_128(key, len, 0, &out);
+    return out[1];
+}
+
+static inline void wy_mum(uint64_t *a, uint64_t *b) {
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wy_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wy_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t wy_hash(const void *key, size_t len) {
+    const uint8_t *p = key;
+    uint64_t seed = wy_mix(WY_SECRET[0], WY_SECRET[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two overlapping reads cover anything from 4 to 16 bytes
+            size_t mid = (len >> 3) << 2;
+            a = (wy_read4(p) << 32) | wy_read4(p + mid);
+            b = (wy_read4(p + len - 4) << 32) | wy_read4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else
+            a = b = 0;
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            // Three independent lanes keep the multipliers busy
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_read8(p) ^ WY_SECRET[1], wy_read8(p + 8) ^ seed);
+                see1 = wy_mix(wy_read8(p + 16) ^ WY_SECRET[2], wy_read8(p + 24) ^ see1);
+                see2 = wy_mix(wy_read8(p + 32) ^ WY_SECRET[3], wy_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_read8(p) ^ WY_SECRET[1], wy_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // The last 16 bytes, overlapping the previous round if needed
+        a = wy_read8(p + i - 16);
+        b = wy_read8(p + i - 8);
+    }
+    a ^= WY_SECRET[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ WY_SECRET[0] ^ len, b ^ WY_SECRET[1]);
+}
+
+/**
+ * Hashes a key with the selected hash function
+ * @arg key The key to hash
+ * @arg len The key length
+ * @return The 64-bit hash value
+ */
+uint64_t hash_bytes(const void *key, size_t len) {
+    if (HASH_ALGO == HASH_WYHASH)
+        return wy_hash(key, len);
+    return murmur_hash(key, len);
+}
@@ -0,0 +1,40 @@
+#ifndef HASH_H
+#define HASH_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The hash functions that can back the hashmaps, sets and
+ * HLLs. Murmur is the default, and matches the hashes of
+ * earlier versions.
+ */
+typedef enum {
+    HASH_MURMUR,        // 64 bits of MurmurHash3_x64_128
+    HASH_WYHASH,        // A wyhash style 64-bit hash, faster on short keys
+} hash_algo;
+
+/**
+ * Selects the hash function. The sketches and maps depend
+ * on it, so it may only be changed before any are built.
+ * The hashes are deterministic for a given function, so
+ * sketches agree across restarts and nodes that use it.
+ * @notes This method is not thread safe.
+ * @arg algo The hash function to use
+ * @return 0 on success.
+ */
+int hash_select(hash_algo algo);
+
+/**
+ * Returns the selected hash function
+ */
+hash_algo hash_selected(void);
+
+/**
+ * Hashes a key with the selected hash function
+ * @arg key The key to hash
+ * @arg len The key length
+ * @return The 64-bit hash value
+ */
+uint64_t hash_bytes(const void *key, size_t len);
+
+#endif
@@ -1,35 +1,342 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "hashmap.h"
+#include "hash.h"
+
+/*
+ * The map is an open addressing table in the style of a
+ * Swiss table. Each slot has a control byte, which marks it
+ * as empty or deleted, or holds a 7 bit fingerprint from the
+ * top of the hash of its key. The low bits of the hash pick
+ * the home slot, as in a chained table. Lookups compare the
+ * control bytes of a group of 16 slots against the fingerprint
+ * at once, so only the entries that match are loaded, and the
+ * key is only read when the full hash matches as well. The
+ * control bytes are kept apart from the entries, so they stay
+ * in cache even for large tables. Groups are probed in
+ * triangular order, which visits every group of a table with
+ * a power of 2 number of groups.
+ *
+ * Resizes are incremental. A new table is allocated, and the
+ * old one is kept until every entry has been migrated. Each
+ * call that modifies the map migrates a few slots, so no
+ * single call pays for moving the whole table. New keys always
+ * go to the new table, and lookups check both.
+ */
 
-#define MAX_CAPACITY 0.75
+#define MAX_CAPACITY 0.875
 #define DEFAULT_CAPACITY 128
+#define GROUP_SIZE 16
+
+/**
+ * The number of slots of the old table migrated per call.
+ * The new table has room for at least as many new keys as
+ * the old table has slots, so this finishes the migration
+ * well before the new table fills up.
+ */
+#define MIGRATE_SLOTS 32
+
+/**
+ * Tables of at least this many bytes are mapped directly.
+ * The allocator would place them on the heap once a large
+ * table has been freed, where they are not backed lazily
+ * and leave holes that the heap can't give back.
+ */
+#define MMAP_TABLE_BYTES (1 << 20)
+
+// Control bytes of the free slots. A zeroed table is empty, so
+// a new table is allocated without touching its pages.
+#define CTRL_EMPTY 0x00
+#define CTRL_DELETED 0x01
+
+// Used slots have the high bit set
+#define CTRL_USED 0x80
+
+// The control byte of a used slot
+#define FINGERPRINT(hash) ((uint8_t)(((hash) >> 57) | CTRL_USED))
+
+// The group of the home slot of a hash
+#define HOME_GROUP(hash, table_size) (((hash) & ((table_size) - 1)) / GROUP_SIZE)
 
 // Basic hash entry.
-typedef struct hashmap_entry {
+typedef struct {
     char *key;
+    uint64_t hash;  // Hash of the key, saves rehashing on resize
     void *value;
-    struct hashmap_entry *next; // Support linking.
 } hashmap_entry;
 
+// The slots of a table
+typedef struct {
+    uint8_t *ctrl;          // Control byte of each slot
+    hashmap_entry *entries; // Pointer to an arry of hashmap_entry objects
+    int size;               // Size of table in slots, 0 if not allocated
+} hashmap_table;
+
 struct hashmap {
-    int count;      // Number of entries
-    int table_size; // Size of table in nodes
-    int max_size;   // Max size before we resize
-    hashmap_entry *table; // Pointer to an arry of hashmap_entry objects
+    int copy_keys;      // Should keys be copied, or borrowed from the caller
+    int count;          // Number of entries
+    int deleted;        // Number of deleted slots in the table
+    int max_size;       // Max used and deleted slots before we resize
+    hashmap_table table;    // The table new keys go to
+    hashmap_table old;      // The table being migrated, if resizing
+    int old_count;      // Number of entries left in the old table
+    int migrate_pos;    // The next slot of the old table to migrate
 };
 
-// Link the external murmur hash in
-extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
+/**
+ * Hashes a key for the prehashed methods
+ * @arg key The key to hash
+ * @arg key_len The key length
+ * @return The hash value
+ */
+uint64_t hashmap_hash(const char *key, int key_len) {
+    return hash_bytes(key, key_len);
+}
 
 /**
- * Creates a new hashmap and allocates space for it.
- * @arg initial_size The minimim initial size. 0 for default (64).
+ * Returns a bit mask of the slots in a group
+ * whose control byte equals the given byte.
+ */
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for (int i=0; i < GROUP_SIZE; i++)
+        mask |= (uint32_t)(ctrl[i] == byte) << i;
+    return mask;
+#endif
+}
+
+/**
+ * Returns a bit mask of the empty or deleted slots in a group
+ */
+static inline uint32_t group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return ~_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl)) & 0xFFFF;
+#else
+    uint32_t mask = 0;
+    for (int i=0; i < GROUP_SIZE; i++)
+        mask |= (uint32_t)!(ctrl[i] & CTRL_USED) << i;
+    return mask;
+#endif
+}
+
+/**
+ * Returns the bytes used by the slots of a table
+ */
+static inline size_t table_bytes(int size) {
+    return (size_t)size * (1 + sizeof(hashmap_entry));
+}
+
+/**
+ * Internal method to allocate the slots of a table. Neither
+ * array is written, so large tables are only backed by memory
+ * as their slots get used.
+ * @arg table The table to set up. Left untouched on failure.
+ * @arg size The number of slots
+ * @return 0 on success, -1 if the memory could not be allocated.
+ */
+static int table_alloc(hashmap_table *table, int size) {
+    if (table_bytes(size) >= MMAP_TABLE_BYTES) {
+        // The entries follow the control bytes, which are a
+        // multiple of the group size, so they stay aligned
+        void *slots = mmap(NULL, table_bytes(size), PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (slots == MAP_FAILED) return -1;
+        table->ctrl = slots;
+        table->entries = (hashmap_entry*)(table->ctrl + size);
+        table->size = size;
+        return 0;
+    }
+    uint8_t *ctrl = calloc(size, 1);
+    hashmap_entry *entries = malloc(size * sizeof(hashmap_entry));
+    if (!ctrl || !entries) {
+        free(ctrl);
+        free(entries);
+        return -1;
+    }
+    table->ctrl = ctrl;
+    table->entries = entries;
+    table->size = size;
+    return 0;
+}
+
+/**
+ * Internal method to free the slots of a table, and the keys if owned
+ */
+static void table_destroy(hashmap_table *table, int free_keys) {
+    for (int i=0; i < table->size && free_keys; i++) {
+        if (table->ctrl[i] & CTRL_USED)
+            free(table->entries[i].key);
+    }
+    if (table_bytes(table->size) >= MMAP_TABLE_BYTES) {
+        if (table->ctrl) munmap(table->ctrl, table_bytes(table->size));
+    } else {
+        free(table->ctrl);
+        free(table->entries);
+    }
+    memset(table, 0, sizeof(hashmap_table));
+}
+
+/**
+ * Internal method to find the slot of a key in a table
+ * @arg key The key to look for
+ * @arg hash The hash of the key
+ * @return The index of the slot, or -1 if not found.
+ */
+static int table_find(hashmap_table *table, const char *key, uint64_t hash) {
+    uint8_t fingerprint = FINGERPRINT(hash);
+    uint32_t group_mask = table->size / GROUP_SIZE - 1;
+    uint32_t group = HOME_GROUP(hash, table->size);
+
+    // Most keys sit at or right after their home slot, so start
+    // loading the entry while the control bytes are checked
+    __builtin_prefetch(table->entries + (hash & (table->size - 1)));
+
+    for (uint32_t step=1; ; step++) {
+        uint8_t *ctrl = table->ctrl + group * GROUP_SIZE;
+        uint32_t matches = group_match(ctrl, fingerprint);
+        while (matches) {
+            int idx = group * GROUP_SIZE + __builtin_ctz(matches);
+            hashmap_entry *entry = table->entries + idx;
+            if (entry->hash == hash && strcmp(entry->key, key) == 0)
+                return idx;
+            matches &= matches - 1;
+        }
+
+        // An empty slot ends the probe, the key would have been placed there
+        if (group_match(ctrl, CTRL_EMPTY))
+            return -1;
+        group = (group + step) & group_mask;
+    }
+}
+
+/**
+ * Internal method to find the free slot for a hash. Within
+ * a group, the first free slot from the home slot on is used.
+ * @arg hash The hash to place
+ * @return The index of the slot.
+ */
+static int table_find_free(hashmap_table *table, uint64_t hash) {
+    uint32_t group_mask = table->size / GROUP_SIZE - 1;
+    uint32_t group = HOME_GROUP(hash, table->size);
+    int offset = hash & (GROUP_SIZE - 1);
+    for (uint32_t step=1; ; step++) {
+        uint32_t free_slots = group_match_free(table->ctrl + group * GROUP_SIZE);
+        if (free_slots) {
+            // Rotate the mask so the home slot is the lowest bit
+            free_slots = (free_slots >> offset) | (free_slots << (GROUP_SIZE - offset));
+            return group * GROUP_SIZE + ((offset + __builtin_ctz(free_slots)) & (GROUP_SIZE - 1));
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+/**
+ * Internal method to take a free slot of the table
+ * @arg hash The hash to place
+ * @return The entry of the slot.
+ */
+static hashmap_entry* hashmap_take_slot(hashmap *map, uint64_t hash) {
+    int idx = table_find_free(&map->table, hash);
+    if (map->table.ctrl[idx] == CTRL_DELETED)
+        map->deleted -= 1;
+    map->table.ctrl[idx] = FINGERPRINT(hash);
+    return map->table.entries + idx;
+}
+
+/**
+ * Internal method to migrate the next slots of the old table.
+ * The stored hashes are used, so no key is hashed again.
+ * Frees the old table once it is empty.
+ */
+static void hashmap_migrate(hashmap *map) {
+    hashmap_table *old = &map->old;
+    int end = map->migrate_pos + MIGRATE_SLOTS;
+    if (end > old->size) end = old->size;
+
+    for (int i=map->migrate_pos; i < end; i++) {
+        if (!(old->ctrl[i] & CTRL_USED)) continue;
+        *hashmap_take_slot(map, old->entries[i].hash) = old->entries[i];
+
+        // Keep the probes of the old table going past the slot
+        old->ctrl[i] = CTRL_DELETED;
+        map->old_count -= 1;
+    }
+    map->migrate_pos = end;
+
+    // The keys were moved, only the slots are left
+    if (!map->old_count || end == old->size)
+        table_destroy(old, 0);
+}
+
+/**
+ * Internal method to start moving the entries to a new
+ * table of a given size. This also drops the deleted slots.
+ * @return 0 on success, -1 if the new table could not be
+ * allocated. The current table is kept in that case.
+ */
+static int hashmap_resize(hashmap *map, int new_size) {
+    // Finish the previous resize first
+    while (map->old.size) {
+        hashmap_migrate(map);
+    }
+
+    hashmap_table table = {0};
+    if (table_alloc(&table, new_size)) {
+        syslog(LOG_ERR, "Failed to grow hashmap to %d slots!", new_size);
+        return -1;
+    }
+
+    map->old = map->table;
+    map->old_count = map->count;
+    map->migrate_pos = 0;
+    map->table = table;
+    map->deleted = 0;
+    map->max_size = MAX_CAPACITY * new_size;
+    return 0;
+}
+
+/**
+ * Internal method to find the entry of a key in either table
+ * @arg key The key to look for
+ * @arg hash The hash of the key
+ * @arg table Output. If not NULL, set to the table of the entry
+ * @arg idx Output. If not NULL, set to the slot of the entry
+ * @return The entry, or NULL if not found.
+ */
+static hashmap_entry* hashmap_find(hashmap *map, const char *key, uint64_t hash,
+                                   hashmap_table **table, int *idx) {
+    hashmap_table *t = &map->table;
+    int i = table_find(t, key, hash);
+    if (i == -1 && map->old.size) {
+        t = &map->old;
+        i = table_find(t, key, hash);
+    }
+    if (i == -1) return NULL;
+
+    if (table) *table = t;
+    if (idx) *idx = i;
+    return t->entries + i;
+}
+
+/**
+ * Internal method to create a hashmap
+ * @arg initial_size The minimim initial size. 0 for default.
+ * @arg copy_keys Should the keys be copied
  * @arg map Output. Set to the address of the map
- * @return 0 on success.
+ * @return 0 on success, -1 if the memory could not be allocated.
  */
-int hashmap_init(int initial_size, hashmap **map) {
+static int hashmap_create(int initial_size, int copy_keys, hashmap **map) {
     // Default to 64 if no size
     if (initial_size <= 0) {
        initial_size = DEFAULT_CAPACITY;
@@ -49,49 +356,55 @@ int hashmap_init(int initial_size, hashmap **map) {
         initial_size = 1 << most_sig_bit;
     }
 
-    // Allocate the map
+    // The table has at least one group
+    if (initial_size < GROUP_SIZE) {
+        initial_size = GROUP_SIZE;
+    }
+
+    // Allocate the map and the table
     hashmap *m = calloc(1, sizeof(hashmap));
-    m->table_size = initial_size;
+    if (!m) return -1;
+    if (table_alloc(&m->table, initial_size)) {
+        free(m);
+        return -1;
+    }
+    m->copy_keys = copy_keys;
     m->max_size = MAX_CAPACITY * initial_size;
 
-    // Allocate the table
-    m->table = (hashmap_entry*)calloc(initial_size, sizeof(hashmap_entry));
-
     // Return the table
     *map = m;
     return 0;
 }
 
+/**
+ * Creates a new hashmap and allocates space for it.
+ * @arg initial_size The minimim initial size. 0 for default (64).
+ * @arg map Output. Set to the address of the map
+ * @return 0 on success, -1 if the memory could not be allocated.
+ */
+int hashmap_init(int initial_size, hashmap **map) {
+    return hashmap_create(initial_size, 1, map);
+}
+
+/**
+ * Creates a new hashmap that stores the keys it is given,
+ * instead of copies. The keys must outlive the map.
+ * @arg initial_size The minimim initial size. 0 for default (64).
+ * @arg map Output. Set to the address of the map
+ * @return 0 on success, -1 if the memory could not be allocated.
+ */
+int hashmap_init_borrowed(int initial_size, hashmap **map) {
+    return hashmap_create(initial_size, 0, map);
+}
+
 /**
  * Destroys a map and cleans up all associated memory
  * @arg map The hashmap to destroy. Frees memory.
  */
 int hashmap_destroy(hashmap *map) {
-    // Free each entry
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        while (entry && entry->key) {
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Clear the objects
-            free(old->key);
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            }
-            in_table = 0;
-        }
-    }
-
-    // Free the table and hash map
-    free(map->table);
+    // Free the tables and hash map
+    table_destroy(&map->table, map->copy_keys);
+    table_destroy(&map->old, map->copy_keys);
     free(map);
     return 0;
 }
@@ -107,147 +420,112 @@ int hashmap_size(hashmap *map) {
  * Returns the max size of the hashmap in terms of sltos
  */
 int hashmap_tablesize(hashmap *map) {
-    return map->table_size;
-}
-
-/**
- * Gets a value.
- * @arg key The key to look for
- * @arg key_len The key length
- * @arg value Output. Set to the value of th key.
- * 0 on success. -1 if not found.
- */
-int hashmap_get(hashmap *map, char *key, void **value) {
-    // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, strlen(key), 0, &out);
-
-    // Mod the lower 64bits of the hash function with the table
-    // size to get the index
-    unsigned int index = out[1] % map->table_size;
-
-    // Look for an entry
-    hashmap_entry *entry = map->table+index;
-
-    // Scan the keys
-    while (entry && entry->key) {
-        // Found it
-        if (strcmp(entry->key, key) == 0) {
-            *value = entry->value;
-            return 0;
-        }
-
-        // Walk the chain
-        entry = entry->next;
-    }
-
-    // Not found
-    return -1;
+    return map->table.size;
 }
 
 /**
- * Internal method to insert into a hash table
- * @arg table The table to insert into
- * @arg table_size The size of the table
- * @arg key The key to insert
+ * Internal method to insert a key that is not in the map
+ * @arg key The key to insert, which is copied if the map owns its keys
  * @arg key_len The length of the key
+ * @arg hash The hash of the key
  * @arg value The value to associate
- * @arg should_cmp Should keys be compared to existing ones.
- * @arg should_dup Should duplicate keys
- * @return 1 if the key is new, 0 if updated.
- */
-static int hashmap_insert_table(hashmap_entry *table, int table_size, char *key, int key_len,
-                                void *value, int should_cmp, int should_dup) {
-    // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, key_len, 0, &out);
-
-    // Mod the lower 64bits of the hash function with the table
-    // size to get the index
-    unsigned int index = out[1] % table_size;
-
-    // Look for an entry
-    hashmap_entry *entry = table+index;
-    // last_entry governs if we saw any nodes with keys
-    hashmap_entry *last_entry = NULL;
-
-    // Scan the keys
-    while (entry && entry->key) {
-        // Found it, update the value
-        if (should_cmp && (strcmp(entry->key, key) == 0)) {
-            entry->value = value;
-            return 0;
-        }
-
-        // Walk the chain
-        last_entry = entry;
-        entry = entry->next;
+ * @return The new entry, or NULL if the table is full
+ * and could not be grown.
+ */
+static hashmap_entry* hashmap_insert(hashmap *map, char *key, int key_len,
+                                     uint64_t hash, void *value) {
+    // Check if we need to make room. Double the size, unless
+    // most of the used slots are only deleted ones.
+    int used = map->count - map->old_count + map->deleted;
+    if (used + 1 > map->max_size) {
+        int new_size = map->table.size;
+        if (map->count + 1 > map->max_size / 2)
+            new_size *= 2;
+
+        // Without a new table, fill the current one, but keep
+        // an empty slot so the probes still end
+        if (hashmap_resize(map, new_size) && used + 1 >= map->table.size)
+            return NULL;
     }
 
-    // If last entry is NULL, we can just insert directly into the
-    // table slot since it is empty
-    if (entry && last_entry == NULL) {
-        entry->key = (should_dup) ? strdup(key) : key;
-        entry->value = value;
+    hashmap_entry *entry = hashmap_take_slot(map, hash);
+    map->count += 1;
 
-    // We have a last value, need to link against it with our new
-    // value.
-    } else if (last_entry) {
-        entry = calloc(1, sizeof(hashmap_entry));
-        entry->key = (should_dup) ? strdup(key) : key;
-        entry->value = value;
-        last_entry->next = entry;
+    if (map->copy_keys) {
+        entry->key = malloc(key_len + 1);
+        memcpy(entry->key, key, key_len);
+        entry->key[key_len] = '\0';
     } else {
-        return -1;
+        entry->key = key;
     }
-    return 1;
+    entry->hash = hash;
+    entry->value = value;
+    return entry;
 }
 
-
 /**
- * Internal method to double the size of a hashmap
+ * Internal method to remove the entry of a slot. Frees the key.
  */
-static void hashmap_double_size(hashmap *map) {
-    // Calculate the new sizes
-    int new_size = map->table_size * 2;
-    int new_max_size = map->max_size * 2;
-
-    // Allocate the table
-    hashmap_entry *new_table = (hashmap_entry*)calloc(new_size, sizeof(hashmap_entry));
-
-    // Move each entry
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        while (entry && entry->key) {
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Insert the value in the new map
-            // Do not compare keys or duplicate since we are just doubling our
-            // size, and we have unique keys and duplicates already.
-            hashmap_insert_table(new_table, new_size, old->key, strlen(old->key),
-                    old->value, 0, 0);
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            }
-            in_table = 0;
-        }
+static void hashmap_erase(hashmap *map, hashmap_table *table, int idx) {
+    if (map->copy_keys)
+        free(table->entries[idx].key);
+    map->count -= 1;
+
+    // Entries of the old table are never placed again
+    if (table == &map->old) {
+        table->ctrl[idx] = CTRL_DELETED;
+        map->old_count -= 1;
+
+    // A group with an empty slot has never been full, so no
+    // probe has passed it and the slot can be emptied again.
+    // Otherwise it must stay a tombstone to keep probes going.
+    } else if (group_match(table->ctrl + (idx & ~(GROUP_SIZE - 1)), CTRL_EMPTY)) {
+        table->ctrl[idx] = CTRL_EMPTY;
+    } else {
+        table->ctrl[idx] = CTRL_DELETED;
+        map->deleted += 1;
     }
+}
+
+/**
+ * Gets a value.
+ * @arg key The key to look for
+ * @arg key_len The key length
+ * @arg value Output. Set to the value of th key.
+ * 0 on success. -1 if not found.
+ */
+int hashmap_get(hashmap *map, char *key, void **value) {
+    hashmap_entry *entry = hashmap_find(map, key, hashmap_hash(key, strlen(key)), NULL, NULL);
+    if (!entry) return -1;
+    *value = entry->value;
+    return 0;
+}
 
-    // Free the old table
-    free(map->table);
+/**
+ * Gets the value slot of a key with a precomputed hash.
+ * The slot is valid until the map is next modified. Keys
+ * match on the full hash as well as the key, so callers may
+ * mix their own bits into the hash to keep equal keys apart.
+ * @arg key The key to look for. Must be null terminated.
+ * @arg hash The hash of the key from hashmap_hash
+ * @arg value Output. Set to the address of the value.
+ * @return 0 on success. -1 if not found.
+ */
+int hashmap_get_slot(hashmap *map, char *key, uint64_t hash, void ***value) {
+    hashmap_entry *entry = hashmap_find(map, key, hash, NULL, NULL);
+    if (!entry) return -1;
+    *value = &entry->value;
+    return 0;
+}
 
-    // Update the pointers
-    map->table = new_table;
-    map->table_size = new_size;
-    map->max_size = new_max_size;
+/**
+ * Returns the key stored with a value slot
+ * @arg value A slot from hashmap_get_slot or hashmap_get_or_insert
+ * @return The key, as stored in the map
+ */
+char* hashmap_slot_key(void **value) {
+    hashmap_entry *entry = (hashmap_entry*)((char*)value - offsetof(hashmap_entry, value));
+    return entry->key;
 }
 
 /**
@@ -257,21 +535,53 @@ static void hashmap_double_size(hashmap *map) {
  * @notes This method is not thread safe.
  * @arg key_len The key length
  * @arg value The value to set.
- * 0 if updated, 1 if added.
+ * 0 if updated, 1 if added. -1 if the map is full
+ * and could not be grown.
  */
 int hashmap_put(hashmap *map, char *key, void *value) {
-    // Check if we need to double the size
-    if (map->count + 1 > map->max_size) {
-        // Doubles the size of the hashmap, re-try the insert
-        hashmap_double_size(map);
-        return hashmap_put(map, key, value);
+    if (map->old.size) hashmap_migrate(map);
+    int key_len = strlen(key);
+    uint64_t hash = hashmap_hash(key, key_len);
+
+    // Update the existing value
+    hashmap_entry *entry = hashmap_find(map, key, hash, NULL, NULL);
+    if (entry) {
+        entry->value = value;
+        return 0;
     }
 
-    // Insert into the map, comparing keys and duplicating keys
-    int new = hashmap_insert_table(map->table, map->table_size, key, strlen(key), value, 1, 1);
-    if (new) map->count += 1;
+    if (!hashmap_insert(map, key, key_len, hash, value))
+        return -1;
+    return 1;
+}
+
+/**
+ * Gets the value slot of a key with a precomputed hash,
+ * inserting the key with a NULL value if it is missing.
+ * The slot is valid until the map is next modified.
+ * @notes This method is not thread safe.
+ * @arg key The key to look for. Must be null terminated,
+ * and is copied if inserted, unless the keys are borrowed.
+ * @arg key_len The key length
+ * @arg hash The hash of the key from hashmap_hash
+ * @arg value Output. Set to the address of the value.
+ * @return 0 if found, 1 if added. -1 if the map is full
+ * and could not be grown.
+ */
+int hashmap_get_or_insert(hashmap *map, char *key, int key_len, uint64_t hash, void ***value) {
+    // Migrate first, the slot must not move before it is returned
+    if (map->old.size) hashmap_migrate(map);
+
+    hashmap_entry *entry = hashmap_find(map, key, hash, NULL, NULL);
+    if (entry) {
+        *value = &entry->value;
+        return 0;
+    }
 
-    return new;
+    entry = hashmap_insert(map, key, key_len, hash, NULL);
+    if (!entry) return -1;
+    *value = &entry->value;
+    return 1;
 }
 
 /**
@@ -281,91 +591,51 @@ int hashmap_put(hashmap *map, char *key, void *value) {
  * 0 on success. -1 if not found.
  */
 int hashmap_delete(hashmap *map, char *key) {
-    // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, strlen(key), 0, &out);
-
-    // Mod the lower 64bits of the hash function with the table
-    // size to get the index
-    unsigned int index = out[1] % map->table_size;
-
-    // Look for an entry
-    hashmap_entry *entry = map->table+index;
-    hashmap_entry *last_entry = NULL;
-
-    // Scan the keys
-    while (entry && entry->key) {
-        // Found it
-        if (strcmp(entry->key, key) == 0) {
-            // Free the key
-            free(entry->key);
-            map->count -= 1;
-
-            // Check if we are in the table
-            if (last_entry == NULL) {
-                // Copy the keys from the node, and free it
-                if (entry->next) {
-                    hashmap_entry *n = entry->next;
-                    entry->key = n->key;
-                    entry->value = n->value;
-                    entry->next = n->next;
-                    free(n);
-
-                // Zero everything out
-                } else {
-                    entry->key = NULL;
-                    entry->value = NULL;
-                }
-
-            } else {
-                // Skip us in the list
-                last_entry->next = entry->next;
-
-                // Free ourself
-                free(entry);
-            }
-            return 0;
-        }
-        // Walk the chain
-        entry = entry->next;
-    }
+    if (map->old.size) hashmap_migrate(map);
 
-    // Not found
-    return -1;
+    hashmap_table *table;
+    int idx;
+    if (!hashmap_find(map, key, hashmap_hash(key, strlen(key)), &table, &idx))
+        return -1;
+    hashmap_erase(map, table, idx);
+    return 0;
 }
 
 /**
- * Clears all the key/value pairs.
+ * Deletes the key/value pair of a value slot.
  * @notes This method is not thread safe.
+ * @arg value A slot from hashmap_get_slot or hashmap_get_or_insert
  * 0 on success. -1 if not found.
  */
+int hashmap_delete_slot(hashmap *map, void **value) {
+    hashmap_entry *entry = (hashmap_entry*)((char*)value - offsetof(hashmap_entry, value));
+    hashmap_table *table;
+    int idx;
+    if (!hashmap_find(map, entry->key, entry->hash, &table, &idx))
+        return -1;
+    hashmap_erase(map, table, idx);
+    return 0;
+}
+
+/**
+ * Clears all the key/value pairs.
+ * @notes This method is not thread safe.
+ * 0 on success. -1 if the memory could not be allocated,
+ * in which case the map is left as it was.
+ */
 int hashmap_clear(hashmap *map) {
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        while (entry && entry->key) {
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Clear the objects
-            free(old->key);
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            } else {
-                old->key = NULL;
-            }
-            in_table = 0;
-        }
-    }
+    // Allocate first, so a failure leaves the map as it was
+    hashmap_table table = {0};
+    if (table_alloc(&table, map->table.size))
+        return -1;
+    table_destroy(&map->table, map->copy_keys);
+    table_destroy(&map->old, map->copy_keys);
+    map->table = table;
 
     // Reset the sizes
     map->count = 0;
+    map->deleted = 0;
+    map->old_count = 0;
     return 0;
 }
 
@@ -380,14 +650,20 @@ int hashmap_clear(hashmap *map) {
  * @return 0 on success
  */
 int hashmap_iter(hashmap *map, hashmap_callback cb, void *data) {
-    hashmap_entry *entry;
+    // Visit the entries that are not migrated yet as well
+    hashmap_table *tables[] = {&map->table, &map->old};
     int should_break = 0;
-    for (int i=0; i < map->table_size && !should_break; i++) {
-        entry = map->table+i;
-        while (entry && entry->key && !should_break) {
-            // Invoke the callback
-            should_break = cb(data, entry->key, entry->value);
-            entry = entry->next;
+    for (int t=0; t < 2; t++) {
+        hashmap_table *table = tables[t];
+        for (int g=0; g < table->size && !should_break; g += GROUP_SIZE) {
+            // Skip the free slots a group at a time
+            uint32_t used = ~group_match_free(table->ctrl + g) & 0xFFFF;
+            while (used && !should_break) {
+                // Invoke the callback
+                hashmap_entry *entry = table->entries + g + __builtin_ctz(used);
+                should_break = cb(data, entry->key, entry->value);
+                used &= used - 1;
+            }
         }
     }
     return should_break;
@@ -405,49 +681,20 @@ int hashmap_iter(hashmap *map, hashmap_callback cb, void *data) {
  * @return 0 on success
  */
 int hashmap_filter(hashmap *map, hashmap_callback cb, void *data) {
-    // Allocate the table
-    hashmap_entry *new_table = (hashmap_entry*)calloc(map->table_size, sizeof(hashmap_entry));
-
-    // Move each entry
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        if (entry == NULL)
-            continue;
-        while (entry && entry->key) {
-            // Check this value for removal
-            int should_remove = cb(data, entry->key, entry->value);
-
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Insert the value in the new map
-            // Do not compare keys or duplicate since we are just moving values
-            if (!should_remove) {
-                hashmap_insert_table(new_table, map->table_size, old->key, strlen(old->key),
-                                     old->value, 0, 0);
-            } else {
-                free(old->key);
-                map->count--;
-                // Do not remove the value here - this is the responsibility of the callback function
-            }
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            }
-            in_table = 0;
-        }
+    // Every entry is visited anyway, so finish any resize
+    while (map->old.size) {
+        hashmap_migrate(map);
     }
 
-    // Free the old table
-    free(map->table);
+    hashmap_table *table = &map->table;
+    for (int i=0; i < table->size; i++) {
+        if (!(table->ctrl[i] & CTRL_USED)) continue;
 
-    // Update the pointers
-    map->table = new_table;
+        // Check this value for removal
+        // Do not remove the value here - this is the responsibility of the callback function
+        hashmap_entry *entry = table->entries + i;
+        if (cb(data, entry->key, entry->value))
+            hashmap_erase(map, table, i);
+    }
     return 0;
 }
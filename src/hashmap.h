@@ -1,5 +1,6 @@
 #ifndef HASHMAP_H
 #define HASHMAP_H
+#include <stdint.h>
 
 /**
  * Opaque hashmap reference
@@ -7,14 +8,31 @@
 typedef struct hashmap hashmap;
 typedef int(*hashmap_callback)(void *data, const char *key, void *value);
 
+/**
+ * Hashes a key for the prehashed methods
+ * @arg key The key to hash
+ * @arg key_len The key length
+ * @return The hash value
+ */
+uint64_t hashmap_hash(const char *key, int key_len);
+
 /**
  * Creates a new hashmap and allocates space for it.
  * @arg initial_size The minimim initial size. 0 for default (64).
  * @arg map Output. Set to the address of the map
- * @return 0 on success.
+ * @return 0 on success, -1 if the memory could not be allocated.
  */
 int hashmap_init(int initial_size, hashmap **map);
 
+/**
+ * Creates a new hashmap that stores the keys it is given,
+ * instead of copies. The keys must outlive the map.
+ * @arg initial_size The minimim initial size. 0 for default (64).
+ * @arg map Output. Set to the address of the map
+ * @return 0 on success, -1 if the memory could not be allocated.
+ */
+int hashmap_init_borrowed(int initial_size, hashmap **map);
+
 /**
  * Destroys a map and cleans up all associated memory
  * @arg map The hashmap to destroy. Frees memory.
@@ -46,10 +64,45 @@ int hashmap_get(hashmap *map, char *key, void **value);
  * @notes This method is not thread safe.
  * @arg key_len The key length
  * @arg value The value to set.
- * 0 if updated, 1 if added.
+ * 0 if updated, 1 if added. -1 if the map is full
+ * and could not be grown.
  */
 int hashmap_put(hashmap *map, char *key, void *value);
 
+/**
+ * Gets the value slot of a key with a precomputed hash.
+ * The slot is valid until the map is next modified. Keys
+ * match on the full hash as well as the key, so callers may
+ * mix their own bits into the hash to keep equal keys apart.
+ * @arg key The key to look for. Must be null terminated.
+ * @arg hash The hash of the key from hashmap_hash
+ * @arg value Output. Set to the address of the value.
+ * @return 0 on success. -1 if not found.
+ */
+int hashmap_get_slot(hashmap *map, char *key, uint64_t hash, void ***value);
+
+/**
+ * Returns the key stored with a value slot
+ * @arg value A slot from hashmap_get_slot or hashmap_get_or_insert
+ * @return The key, as stored in the map
+ */
+char* hashmap_slot_key(void **value);
+
+/**
+ * Gets the value slot of a key with a precomputed hash,
+ * inserting the key with a NULL value if it is missing.
+ * The slot is valid until the map is next modified.
+ * @notes This method is not thread safe.
+ * @arg key The key to look for. Must be null terminated,
+ * and is copied if inserted, unless the keys are borrowed.
+ * @arg key_len The key length
+ * @arg hash The hash of the key from hashmap_hash
+ * @arg value Output. Set to the address of the value.
+ * @return 0 if found, 1 if added. -1 if the map is full
+ * and could not be grown.
+ */
+int hashmap_get_or_insert(hashmap *map, char *key, int key_len, uint64_t hash, void ***value);
+
 /**
  * Deletes a key/value pair.
  * @notes This method is not thread safe.
@@ -60,10 +113,21 @@ int hashmap_put(hashmap *map, char *key, void *value);
 int hashmap_delete(hashmap *map, char *key);
 
 /**
- * Clears all the key/value pairs.
+ * Deletes the key/value pair of a value slot. The hash
+ * stored with the key is used, so keys put with a mixed
+ * hash are found.
  * @notes This method is not thread safe.
+ * @arg value A slot from hashmap_get_slot or hashmap_get_or_insert
  * 0 on success. -1 if not found.
  */
+int hashmap_delete_slot(hashmap *map, void **value);
+
+/**
+ * Clears all the key/value pairs.
+ * @notes This method is not thread safe.
+ * 0 on success. -1 if the memory could not be allocated,
+ * in which case the map is left as it was.
+ */
 int hashmap_clear(hashmap *map);
 
 /**
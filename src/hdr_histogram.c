@@ -0,0 +1,182 @@
+/**
+ * This module implements a log-linear histogram in the style of
+ * HdrHistogram. Each power of two range of values is split into
+ * the same number of linear buckets, so the relative error is
+ * fixed, and both recording and memory use are constant.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hdr_histogram.h"
+
+/*
+ * Values are scaled to an integer number of steps. With H buckets
+ * per power of two, the steps below 2H each have a bucket. Above
+ * that, the steps from H * 2^b up to 2H * 2^b share H buckets of
+ * width 2^b. A bucket is then at most 1/H of its values wide, and
+ * reporting its midpoint is within 1/2H of them. The step is set
+ * so that min_val is H steps, and has the same precision.
+ */
+
+// Returns the bucket of a number of steps
+static inline uint32_t hdr_index(hdr_histogram *hdr, uint64_t steps) {
+    uint32_t half_bits = hdr->half_bits;
+    uint64_t mask = (2ULL << half_bits) - 1;
+
+    // Find the power of two, treating the lowest 2H steps as one
+    int bucket = 63 - __builtin_clzll(steps | mask) - half_bits;
+    return (bucket << half_bits) + (steps >> bucket);
+}
+
+// Returns the value reported for a bucket, the midpoint of its steps
+static inline double hdr_value(hdr_histogram *hdr, uint32_t idx) {
+    uint32_t half_bits = hdr->half_bits;
+    int bucket = (idx >> half_bits) - 1;
+    uint64_t sub = (idx & ((1U << half_bits) - 1)) + (1U << half_bits);
+    if (bucket < 0) {
+        bucket = 0;
+        sub = idx;
+    }
+    return ((sub << bucket) + (1ULL << bucket) / 2.0) / hdr->scale;
+}
+
+/**
+ * Initializes the histogram
+ * @arg eps The relative error of the quantiles, on (0, 0.5)
+ * @arg min_val The smallest value recorded with full precision, must be positive
+ * @arg max_val The largest value recorded with full precision
+ * @arg hdr The hdr_histogram struct to initialize
+ * @return 0 on success.
+ */
+int init_hdr_histogram(double eps, double min_val, double max_val, hdr_histogram *hdr) {
+    if (eps <= 0 || eps >= 0.5) return -1;
+    if (min_val <= 0 || max_val <= min_val) return -1;
+
+    // Use enough buckets per power of two for the error
+    uint32_t half_bits = ceil(log2(1 / (2 * eps)));
+    double scale = (1U << half_bits) / min_val;
+
+    // The range must fit in the steps
+    if (max_val * scale >= (double)(1ULL << 62)) return -1;
+
+    hdr->min_val = min_val;
+    hdr->max_val = max_val;
+    hdr->scale = scale;
+    hdr->half_bits = half_bits;
+    hdr->len = hdr_index(hdr, max_val * scale) + 1;
+    hdr->counts = calloc(hdr->len, sizeof(uint64_t));
+    if (!hdr->counts) return -1;
+
+    hdr->count = 0;
+    hdr->lo_idx = 0;
+    hdr->hi_idx = 0;
+    hdr->min = 0;
+    hdr->max = 0;
+    return 0;
+}
+
+/**
+ * Destroy the histogram
+ * @arg hdr The hdr_histogram to destroy
+ * @return 0 on success.
+ */
+int destroy_hdr_histogram(hdr_histogram *hdr) {
+    free(hdr->counts);
+    hdr->counts = NULL;
+    return 0;
+}
+
+/**
+ * Adds a new sample to the histogram. Values outside
+ * of the range are counted in the first or last bucket.
+ * @arg hdr The hdr_histogram to add to
+ * @arg sample The new sample value
+ * @return 0 on success.
+ */
+int hdr_add_sample(hdr_histogram *hdr, double sample) {
+    uint32_t idx;
+    if (sample >= hdr->max_val)
+        idx = hdr->len - 1;
+    else if (sample > 0)
+        idx = hdr_index(hdr, sample * hdr->scale);
+    else
+        idx = 0;
+    hdr->counts[idx]++;
+
+    if (!hdr->count) {
+        hdr->lo_idx = hdr->hi_idx = idx;
+        hdr->min = hdr->max = sample;
+    } else {
+        if (idx < hdr->lo_idx) hdr->lo_idx = idx;
+        if (idx > hdr->hi_idx) hdr->hi_idx = idx;
+        if (sample < hdr->min) hdr->min = sample;
+        if (sample > hdr->max) hdr->max = sample;
+    }
+    hdr->count++;
+    return 0;
+}
+
+/**
+ * Merges another histogram into this one. The merge is exact,
+ * and both histograms must use the same error and range.
+ * @arg hdr The hdr_histogram to merge into
+ * @arg other The hdr_histogram to merge from, unchanged
+ * @return 0 on success, -1 if the histograms differ.
+ */
+int hdr_merge(hdr_histogram *hdr, hdr_histogram *other) {
+    if (hdr->scale != other->scale || hdr->len != other->len) return -1;
+    if (!other->count) return 0;
+    for (uint32_t i=other->lo_idx; i <= other->hi_idx; i++)
+        hdr->counts[i] += other->counts[i];
+
+    if (!hdr->count) {
+        hdr->lo_idx = other->lo_idx;
+        hdr->hi_idx = other->hi_idx;
+        hdr->min = other->min;
+        hdr->max = other->max;
+    } else {
+        if (other->lo_idx < hdr->lo_idx) hdr->lo_idx = other->lo_idx;
+        if (other->hi_idx > hdr->hi_idx) hdr->hi_idx = other->hi_idx;
+        if (other->min < hdr->min) hdr->min = other->min;
+        if (other->max > hdr->max) hdr->max = other->max;
+    }
+    hdr->count += other->count;
+    return 0;
+}
+
+/**
+ * Queries for a quantile value
+ * @arg hdr The hdr_histogram to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double hdr_query(hdr_histogram *hdr, double quantile) {
+    if (!hdr->count) return 0;
+    if (quantile <= 0) return hdr->min;
+    if (quantile >= 1) return hdr->max;
+
+    // Scan the counts up to the rank
+    double rank = quantile * (hdr->count - 1);
+    double value = hdr->max;
+    uint64_t seen = 0;
+    for (uint32_t i=hdr->lo_idx; i <= hdr->hi_idx; i++) {
+        seen += hdr->counts[i];
+        if (seen > rank) {
+            value = hdr_value(hdr, i);
+            break;
+        }
+    }
+
+    // The outer buckets may straddle the extremes, which are exact
+    if (value < hdr->min) value = hdr->min;
+    if (value > hdr->max) value = hdr->max;
+    return value;
+}
+
+/**
+ * Returns the memory used by the buckets of the histogram, in bytes
+ */
+size_t hdr_bytes(hdr_histogram *hdr) {
+    return hdr->len * sizeof(uint64_t);
+}
@@ -0,0 +1,82 @@
+/**
+ * This module implements a log-linear histogram in the style of
+ * HdrHistogram. Each power of two range of values is split into
+ * the same number of linear buckets, so the relative error is
+ * fixed, and both recording and memory use are constant.
+ */
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The default range of values, in milliseconds. This
+ * covers latencies from 1 microsecond to 1 minute.
+ */
+#define HDR_DEFAULT_MIN 0.001
+#define HDR_DEFAULT_MAX 60000
+
+typedef struct {
+    double min_val;         // Smallest value recorded with full precision
+    double max_val;         // Values above are counted in the last bucket
+    double scale;           // Steps of the lowest buckets per unit of value
+    uint32_t half_bits;     // Log2 of the buckets in each power of two
+    uint32_t len;           // Number of buckets
+    uint64_t *counts;       // Count of each bucket
+
+    uint64_t count;         // Number of values added
+    uint32_t lo_idx;        // Lowest bucket with a count
+    uint32_t hi_idx;        // Highest bucket with a count
+    double min;             // Smallest value added
+    double max;             // Largest value added
+} hdr_histogram;
+
+/**
+ * Initializes the histogram
+ * @arg eps The relative error of the quantiles, on (0, 0.5)
+ * @arg min_val The smallest value recorded with full precision, must be positive
+ * @arg max_val The largest value recorded with full precision
+ * @arg hdr The hdr_histogram struct to initialize
+ * @return 0 on success.
+ */
+int init_hdr_histogram(double eps, double min_val, double max_val, hdr_histogram *hdr);
+
+/**
+ * Destroy the histogram
+ * @arg hdr The hdr_histogram to destroy
+ * @return 0 on success.
+ */
+int destroy_hdr_histogram(hdr_histogram *hdr);
+
+/**
+ * Adds a new sample to the histogram. Values outside
+ * of the range are counted in the first or last bucket.
+ * @arg hdr The hdr_histogram to add to
+ * @arg sample The new sample value
+ * @return 0 on success.
+ */
+int hdr_add_sample(hdr_histogram *hdr, double sample);
+
+/**
+ * Merges another histogram into this one. The merge is exact,
+ * and both histograms must use the same error and range.
+ * @arg hdr The hdr_histogram to merge into
+ * @arg other The hdr_histogram to merge from, unchanged
+ * @return 0 on success, -1 if the histograms differ.
+ */
+int hdr_merge(hdr_histogram *hdr, hdr_histogram *other);
+
+/**
+ * Queries for a quantile value
+ * @arg hdr The hdr_histogram to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double hdr_query(hdr_histogram *hdr, double quantile);
+
+/**
+ * Returns the memory used by the buckets of the histogram, in bytes
+ */
+size_t hdr_bytes(hdr_histogram *hdr);
+
+#endif
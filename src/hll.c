@@ -16,6 +16,7 @@ State of The Art Cardinality Estimation Algorithm"
 #include <stdio.h>
 #include "hll.h"
 #include "hll_constants.h"
+#include "hash.h"
 
 #define REG_WIDTH 6     // Bits per register
 #define INT_WIDTH 32    // Bits in an int
@@ -23,10 +24,6 @@ State of The Art Cardinality Estimation Algorithm"
 
 #define NUM_REG(precision) ((1 << precision))
 
-// Link the external murmur hash in
-extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
-
-
 /**
  * Initializes a new HLL
  * @arg precision The digits of precision to use
@@ -88,11 +85,7 @@ static void set_register(hll_t *h, int idx, int val) {
  */
 void hll_add(hll_t *h, char *key) {
     // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, strlen(key), 0, &out);
-
-    // Add the hashed value
-    hll_add_hash(h, out[1]);
+    hll_add_hash(h, hash_bytes(key, strlen(key)));
 }
 
 /**
@@ -116,6 +109,28 @@ void hll_add_hash(hll_t *h, uint64_t hash) {
     }
 }
 
+/**
+ * Merges the registers of another HLL into this one.
+ * Both HLLs must use the same precision.
+ * @arg h The hll to merge into
+ * @arg other The hll to merge from. Left unchanged.
+ * @return 0 on success, -1 if the precisions differ.
+ */
+int hll_merge(hll_t *h, hll_t *other) {
+    if (h->precision != other->precision) return -1;
+
+    // The union keeps the maximum of each register
+    int num_reg = NUM_REG(h->precision);
+    int reg_val;
+    for (int i=0; i < num_reg; i++) {
+        reg_val = get_register(other, i);
+        if (reg_val > get_register(h, i)) {
+            set_register(h, i, reg_val);
+        }
+    }
+    return 0;
+}
+
 /*
  * Returns the bias correctors from the
  * hyperloglog paper
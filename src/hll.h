@@ -40,6 +40,15 @@ void hll_add(hll_t *h, char *key);
  */
 void hll_add_hash(hll_t *h, uint64_t hash);
 
+/**
+ * Merges the registers of another HLL into this one.
+ * Both HLLs must use the same precision.
+ * @arg h The hll to merge into
+ * @arg other The hll to merge from. Left unchanged.
+ * @return 0 on success, -1 if the precisions differ.
+ */
+int hll_merge(hll_t *h, hll_t *other);
+
 /**
  * Estimates the cardinality of the HLL
  * @arg h The hll to query
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+/*
+ * The intern table keeps the metric names across flush
+ * intervals, so a busy name is copied once rather than on
+ * the first sample of every interval. Names are reference
+ * counted by the metrics maps that use them. The table is
+ * only modified by its owner, but the references are given
+ * back by the flush threads, so the counts are atomic. A
+ * name without references can't be picked up again except
+ * through the owner, so the owner can safely expire it.
+ */
+
+#define DEFAULT_IDS 1024
+
+/**
+ * Initializes the intern table
+ * @arg idle_intervals The number of flush intervals a name
+ * can go unused before it is expired.
+ * @return 0 on success.
+ */
+int init_intern_table(int idle_intervals, intern_table *t) {
+    memset(t, 0, sizeof(intern_table));
+    t->idle_intervals = idle_intervals;
+    t->max_ids = DEFAULT_IDS;
+    t->by_id = malloc(t->max_ids * sizeof(interned_name*));
+    t->free_ids = malloc(t->max_ids * sizeof(uint32_t));
+    return hashmap_init_borrowed(0, &t->names);
+}
+
+/**
+ * Destroys the intern table and every name in it. No metrics
+ * may still reference the names.
+ * @return 0 on success.
+ */
+int destroy_intern_table(intern_table *t) {
+    for (uint32_t i=0; i < t->num_ids; i++) {
+        free(t->by_id[i]);
+    }
+    free(t->by_id);
+    free(t->free_ids);
+    hashmap_destroy(t->names);
+    return 0;
+}
+
+/**
+ * Internal method to hand out an id for a new name
+ */
+static uint32_t intern_alloc_id(intern_table *t, interned_name *n) {
+    uint32_t id;
+    if (t->num_free) {
+        id = t->free_ids[--t->num_free];
+    } else {
+        if (t->num_ids == t->max_ids) {
+            t->max_ids *= 2;
+            t->by_id = realloc(t->by_id, t->max_ids * sizeof(interned_name*));
+            t->free_ids = realloc(t->free_ids, t->max_ids * sizeof(uint32_t));
+        }
+        id = t->num_ids++;
+    }
+    t->by_id[id] = n;
+    return id;
+}
+
+/**
+ * Interns a name, and takes a reference to it for the
+ * current interval. The reference must be given back
+ * with intern_release.
+ * @notes This method is not thread safe.
+ * @arg name The name to intern, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @return The interned copy of the name.
+ */
+char* intern_name(intern_table *t, char *name, int name_len, uint64_t hash) {
+    interned_name **slot, *n;
+    if (hashmap_get_slot(t->names, name, hash, (void***)&slot)) {
+        // New name, the map borrows the key from the name itself
+        n = malloc(sizeof(interned_name) + name_len + 1);
+        n->refs = 0;
+        n->len = name_len;
+        memcpy(n->name, name, name_len);
+        n->name[name_len] = '\0';
+        n->id = intern_alloc_id(t, n);
+        hashmap_get_or_insert(t->names, n->name, name_len, hash, (void***)&slot);
+        *slot = n;
+    }
+    n = *slot;
+
+    __atomic_add_fetch(&n->refs, 1, __ATOMIC_RELAXED);
+    n->last_used = t->interval;
+    return n->name;
+}
+
+/**
+ * Gives back a reference taken by intern_name. This is
+ * safe to call from any thread.
+ * @arg name An interned name
+ */
+void intern_release(const char *name) {
+    __atomic_sub_fetch(&INTERNED_NAME(name)->refs, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Starts a new flush interval.
+ * @notes This method is not thread safe.
+ */
+void intern_next_interval(intern_table *t) {
+    t->interval++;
+}
+
+/**
+ * Expires the names that have gone unused for more than the
+ * idle intervals and are not referenced by any metrics. Only
+ * a limited number of ids are checked per call, so that the
+ * caller can release its locks in between.
+ * @notes This method is not thread safe.
+ * @arg cursor The first id to check. Updated to the next
+ * id to check, or 0 once every id is checked.
+ * @arg max_ids The maximum number of ids to check
+ * @return The number of names expired.
+ */
+int intern_expire(intern_table *t, uint32_t *cursor, uint32_t max_ids) {
+    int expired = 0;
+    uint32_t id = *cursor;
+    uint32_t end = (t->num_ids - id > max_ids) ? id + max_ids : t->num_ids;
+    for (; id < end; id++) {
+        interned_name *n = t->by_id[id];
+        if (!n || t->interval - n->last_used <= (uint64_t)t->idle_intervals)
+            continue;
+        if (__atomic_load_n(&n->refs, __ATOMIC_ACQUIRE))
+            continue;
+
+        hashmap_delete(t->names, n->name);
+        t->by_id[id] = NULL;
+        t->free_ids[t->num_free++] = id;
+        free(n);
+        expired++;
+    }
+    *cursor = (id < t->num_ids) ? id : 0;
+    return expired;
+}
+
+/**
+ * Returns the number of names in the table
+ */
+int intern_size(intern_table *t) {
+    return hashmap_size(t->names);
+}
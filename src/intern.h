@@ -0,0 +1,92 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include <stdint.h>
+#include <stddef.h>
+#include "hashmap.h"
+
+/**
+ * A metric name kept across flush intervals. The per interval
+ * maps store a pointer to the name instead of a copy, and hold
+ * a reference for as long as they use it.
+ */
+typedef struct {
+    uint32_t id;        // Stable id of the name, reused once expired
+    int refs;           // Number of metrics maps using the name
+    uint64_t last_used; // The last interval the name was used in
+    int len;            // Length of the name
+    char name[];        // The null terminated name
+} interned_name;
+
+typedef struct {
+    hashmap *names;             // Map of name -> interned_name, keys borrowed from the names
+    interned_name **by_id;      // Array of the names by id, NULL for free ids
+    uint32_t num_ids;           // Number of ids handed out
+    uint32_t max_ids;           // Size of the by_id array
+    uint32_t *free_ids;         // Stack of the ids of expired names
+    uint32_t num_free;          // Number of free ids
+    uint64_t interval;          // The current flush interval
+    int idle_intervals;         // Intervals a name can go unused before it expires
+} intern_table;
+
+// Recovers the interned name from the string handed out by intern_name
+#define INTERNED_NAME(str) ((interned_name*)((str) - offsetof(interned_name, name)))
+
+/**
+ * Initializes the intern table
+ * @arg idle_intervals The number of flush intervals a name
+ * can go unused before it is expired.
+ * @return 0 on success.
+ */
+int init_intern_table(int idle_intervals, intern_table *t);
+
+/**
+ * Destroys the intern table and every name in it. No metrics
+ * may still reference the names.
+ * @return 0 on success.
+ */
+int destroy_intern_table(intern_table *t);
+
+/**
+ * Interns a name, and takes a reference to it for the
+ * current interval. The reference must be given back
+ * with intern_release.
+ * @notes This method is not thread safe.
+ * @arg name The name to intern, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @return The interned copy of the name.
+ */
+char* intern_name(intern_table *t, char *name, int name_len, uint64_t hash);
+
+/**
+ * Gives back a reference taken by intern_name. This is
+ * safe to call from any thread.
+ * @arg name An interned name
+ */
+void intern_release(const char *name);
+
+/**
+ * Starts a new flush interval.
+ * @notes This method is not thread safe.
+ */
+void intern_next_interval(intern_table *t);
+
+/**
+ * Expires the names that have gone unused for more than the
+ * idle intervals and are not referenced by any metrics. Only
+ * a limited number of ids are checked per call, so that the
+ * caller can release its locks in between.
+ * @notes This method is not thread safe.
+ * @arg cursor The first id to check. Updated to the next
+ * id to check, or 0 once every id is checked.
+ * @arg max_ids The maximum number of ids to check
+ * @return The number of names expired.
+ */
+int intern_expire(intern_table *t, uint32_t *cursor, uint32_t max_ids);
+
+/**
+ * Returns the number of names in the table
+ */
+int intern_size(intern_table *t);
+
+#endif
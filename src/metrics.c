@@ -3,20 +3,95 @@
 #include <math.h>
 #include "metrics.h"
 #include "set.h"
+#include "hash.h"
 
-static int counter_delete_cb(void *data, const char *key, void *value);
+static int release_name_cb(void *data, const char *key, void *value);
 static int timer_delete_cb(void *data, const char *key, void *value);
 static int set_delete_cb(void *data, const char *key, void *value);
-static int gauge_delete_cb(void *data, const char *key, void *value);
-static int gauge_direct_delete_cb(void* data, const char* key, void* value);
+static int unified_delete_cb(void *data, const char *key, void *value);
 static int iter_cb(void *data, const char *key, void *value);
+static int merge_cb(void *data, const char *key, void *value);
+static int index_name_cb(void *data, const char *key, void *value);
+static int index_iter(metrics *m, metric_type type, hashmap_callback cb, void *data);
+static void* merge_value(metrics *m, metric_type type, const char *key, void *existing, void *value);
+
+/*
+ * The unified store keeps the metrics of every type in a single
+ * map. The type is mixed into the hash of the name, and the map
+ * matches keys on the full hash as well as the name, so the same
+ * name under two types is two separate keys. Each value is tagged
+ * with its type in the word before it, for iteration.
+ */
+#define UNIFIED_HASH(hash, type) ((hash) ^ ((uint64_t)(type) * 0x9E3779B97F4A7C15ULL))
+#define VALUE_TAG_SIZE 8
+#define VALUE_TYPE(value) (*(metric_type*)((char*)UNSTAGED(value) - VALUE_TAG_SIZE))
+
+/*
+ * With the admission filter, the first sample of a timer or set
+ * is staged rather than building the full timer or set, as many
+ * names are only seen once per interval. The staged value is
+ * marked in the low bit of its pointer, and is promoted to the
+ * full value on the second sample. A singleton is built on the
+ * fly when it is flushed, and freed right after.
+ */
+#define STAGED_BIT ((uintptr_t)1)
+#define IS_STAGED(value) ((uintptr_t)(value) & STAGED_BIT)
+#define STAGE(value) ((void*)((uintptr_t)(value) | STAGED_BIT))
+#define UNSTAGED(value) ((void*)((uintptr_t)(value) & ~STAGED_BIT))
+
+typedef union {
+    struct {
+        double value;
+        double sample_rate;
+    } timer;
+    uint64_t set_hash;
+} staged_sample;
+
+/*
+ * A small direct-mapped cache of values sits in front of the maps,
+ * so the hottest names skip the probe of a table that is mostly
+ * out of the cache. Values live in the arena, so the cache holds
+ * them rather than the slots, which move as a map grows. Staged
+ * values are replaced on their next sample, so they are not cached.
+ */
+static const int HOT_TYPE[METRIC_TYPES] = {
+    [GAUGE] = 0, [COUNTER] = 1, [TIMER] = 2, [SET] = 3, [GAUGE_DIRECT] = 4
+};
 
 struct cb_info {
     metric_type type;
     void *data;
     metric_callback cb;
+    metrics *m;
+};
+
+struct index_info {
+    metric_type type;   // UNKNOWN if the values are tagged
+    char **names;
+    uint64_t *hashes;
+    uint8_t *tags;
+    uint32_t num;
+};
+
+struct merge_info {
+    metric_type type;   // UNKNOWN if the values are tagged
+    hashmap *map;
+    void *interned;     // Set if the names are interned
+    metrics *m;         // The metrics merged into
 };
 
+/**
+ * Internal method to size a map for the metrics of a
+ * previous interval, leaving room to grow without a resize.
+ * The keys are interned or live in the arena, so they are
+ * borrowed by the map.
+ */
+static int interval_map_init(hashmap *prev, hashmap **map) {
+    int size = prev ? hashmap_size(prev) : 0;
+    size += size / 4;
+    return hashmap_init_borrowed(size, map);
+}
+
 /**
  * Initializes the metrics struct.
  * @arg eps The maximum error for the quantiles
@@ -28,24 +103,80 @@ struct cb_info {
  * @return 0 on success.
  */
 int init_metrics(double timer_eps, double *quantiles, uint32_t num_quants, radix_tree *histograms, unsigned char set_precision, metrics *m) {
+    return init_interval_metrics(timer_eps, quantiles, num_quants, histograms,
+            set_precision, NULL, NULL, false, NULL, NULL, false, m);
+}
+
+/**
+ * Initializes the metrics struct for a flush interval. The names
+ * are interned instead of copied, and the maps are sized for the
+ * metrics of the previous interval. The hot key cache starts empty,
+ * so it never outlives the interval.
+ * @arg eps The maximum error for the quantiles
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg histograms A radix tree with histogram settings. This is not owned
+ * by the metrics object. It is assumed to exist for the life of the metrics.
+ * @arg set_precision The precision to use for sets
+ * @arg names The table to intern the names in. This is not owned by
+ * the metrics object, and must outlive it. NULL to copy the names.
+ * @arg prev The metrics of the previous interval, or NULL
+ * @arg unified Should all the types be kept in a single map
+ * @arg limits A radix tree with cardinality limits, or NULL. This is
+ * not owned by the metrics object, and must outlive it.
+ * @arg admitted The keys admitted under the limits, required with
+ * limits. This is not owned by the metrics object, and must outlive it.
+ * @arg admission Should timers and sets be built on their second sample
+ * @return 0 on success.
+ */
+int init_interval_metrics(double timer_eps, double *quantiles, uint32_t num_quants,
+        radix_tree *histograms, unsigned char set_precision,
+        intern_table *names, metrics *prev, bool unified,
+        radix_tree *limits, admitted_keys *admitted, bool admission, metrics *m) {
+    if (limits && !admitted) return -1;
+
     // Copy the inputs
     m->timer_eps = timer_eps;
     m->num_quants = num_quants;
-    m->quantiles = malloc(num_quants * sizeof(double));
-    memcpy(m->quantiles, quantiles, num_quants * sizeof(double));
     m->histograms = histograms;
     m->set_precision = set_precision;
+    m->names = names;
+    arena_init(&m->arena);
+
+    // Timers use the quantiles without a copy of their own, so they
+    // live in the arena, and move along with the timers on a merge
+    m->quantiles = arena_alloc(&m->arena, num_quants * sizeof(double));
+    memcpy(m->quantiles, quantiles, num_quants * sizeof(double));
+    m->unified = NULL;
+    m->limits = limits;
+    m->admission = admission;
+    m->admitted = admitted;
+    m->rejected = limits ? arena_calloc(&m->arena, REJECTED_KEYS, sizeof(rejected_key)) : NULL;
+    m->hot_keys = NULL;
+    m->hot_lookups = 0;
+    m->hot_hits = 0;
+    m->index = NULL;
+    m->index_values = NULL;
+    m->engine = QUANTILE_CM;
+    m->engines = NULL;
+
+    // Allocate the single map
+    if (unified) {
+        m->counters = m->timers = m->sets = NULL;
+        m->gauges = m->gauges_direct = NULL;
+        return interval_map_init(prev ? prev->unified : NULL, &m->unified);
+    }
 
     // Allocate the hashmaps
-    int res = hashmap_init(0, &m->counters);
+    int res = interval_map_init(prev ? prev->counters : NULL, &m->counters);
     if (res) return res;
-    res = hashmap_init(0, &m->timers);
+    res = interval_map_init(prev ? prev->timers : NULL, &m->timers);
     if (res) return res;
-    res = hashmap_init(0, &m->sets);
+    res = interval_map_init(prev ? prev->sets : NULL, &m->sets);
     if (res) return res;
-    res = hashmap_init(0, &m->gauges);
+    res = interval_map_init(prev ? prev->gauges : NULL, &m->gauges);
     if (res) return res;
-    res = hashmap_init(0, &m->gauges_direct);
+    res = interval_map_init(prev ? prev->gauges_direct : NULL, &m->gauges_direct);
     if (res) return res;
 
     return 0;
@@ -68,92 +199,403 @@ int init_metrics_defaults(metrics *m) {
  * @return 0 on success.
  */
 int destroy_metrics(metrics *m) {
-    // Clear the copied quantiles array
-    free(m->quantiles);
+    // The callbacks give back the interned names
+    void *interned = m->names;
+
+    // The indexed names are not interned
+    if (m->index) {
+        if (m->unified)
+            index_iter(m, UNKNOWN, unified_delete_cb, NULL);
+        else {
+            index_iter(m, TIMER, timer_delete_cb, NULL);
+            index_iter(m, SET, set_delete_cb, NULL);
+        }
+        name_index_release(m->index);
+    }
+
+    if (m->unified) {
+        hashmap_iter(m->unified, unified_delete_cb, interned);
+        hashmap_destroy(m->unified);
+        arena_destroy(&m->arena);
+        return 0;
+    }
 
-    // Nuke the counters
-    hashmap_iter(m->counters, counter_delete_cb, NULL);
+    // Only the interned names of the counters and gauges
+    // need a pass, the values are all in the arena
+    if (interned) {
+        hashmap_iter(m->counters, release_name_cb, NULL);
+        hashmap_iter(m->gauges, release_name_cb, NULL);
+        hashmap_iter(m->gauges_direct, release_name_cb, NULL);
+    }
     hashmap_destroy(m->counters);
+    hashmap_destroy(m->gauges);
+    hashmap_destroy(m->gauges_direct);
 
     // Nuke the timers
-    hashmap_iter(m->timers, timer_delete_cb, NULL);
+    hashmap_iter(m->timers, timer_delete_cb, interned);
     hashmap_destroy(m->timers);
 
-    // Nuke the timers
-    hashmap_iter(m->sets, set_delete_cb, NULL);
+    // Nuke the sets
+    hashmap_iter(m->sets, set_delete_cb, interned);
     hashmap_destroy(m->sets);
 
-    // Nuke the gauges
-    hashmap_iter(m->gauges, gauge_delete_cb, NULL);
-    hashmap_destroy(m->gauges);
+    // Free the values and name copies at once
+    arena_destroy(&m->arena);
+    return 0;
+}
 
-    // Nuke the gauge_directs
-    hashmap_iter(m->gauges_direct, gauge_direct_delete_cb, NULL);
-    hashmap_destroy(m->gauges_direct);
+/**
+ * Internal method to get the map that holds a type
+ */
+static hashmap* metrics_map(metrics *m, metric_type type) {
+    if (m->unified) return m->unified;
+    switch (type) {
+        case COUNTER:
+            return m->counters;
+        case TIMER:
+            return m->timers;
+        case SET:
+            return m->sets;
+        case GAUGE:
+            return m->gauges;
+        case GAUGE_DIRECT:
+            return m->gauges_direct;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Internal method to add a new metric under a name. Interned
+ * names are added by pointer, so the name is only copied the
+ * first time it is seen. Otherwise the name is copied into
+ * the arena.
+ * @arg map The map of the type
+ * @arg name The name of the metric
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg key_hash The hash of the key in the map
+ * @arg slot Output. Set to the address of the value.
+ * @return 0 if found, 1 if added. -1 if the map could not grow.
+ */
+static int metrics_add_slot(metrics *m, hashmap *map, char *name, int name_len,
+        uint64_t hash, uint64_t key_hash, void ***slot) {
+    char *key;
+    if (m->names)
+        key = intern_name(m->names, name, name_len, hash);
+    else
+        key = arena_strndup(&m->arena, name, name_len);
+    int res = hashmap_get_or_insert(map, key, name_len, key_hash, slot);
+    if (res == -1 && m->names) intern_release(key);
+    return res;
+}
+
+/**
+ * Internal method to get the value slot of a metric,
+ * adding the name if it is new.
+ * @arg type The type of the metric
+ * @arg name The name of the metric
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg slot Output. Set to the address of the value.
+ * @return 0 if found, 1 if added. -1 if the map could not grow.
+ */
+static int metrics_lookup_slot(metrics *m, metric_type type, char *name, int name_len,
+        uint64_t hash, void ***slot) {
+    int pos;
+    if (m->index && (pos = name_index_find(m->index, name, UNIFIED_HASH(hash, type), type)) >= 0) {
+        *slot = m->index_values + pos;
+        return **slot == NULL;
+    }
+
+    hashmap *map = metrics_map(m, type);
+    uint64_t key_hash = m->unified ? UNIFIED_HASH(hash, type) : hash;
+    if (!hashmap_get_slot(map, name, key_hash, slot))
+        return 0;
+    return metrics_add_slot(m, map, name, name_len, hash, key_hash, slot);
+}
+
+/**
+ * Internal method to allocate the value of a new metric.
+ * Values in the unified store are tagged with their type.
+ * @arg type The type of the metric
+ * @arg size The size of the value
+ * @return The value.
+ */
+static void* metrics_alloc_value(metrics *m, metric_type type, size_t size) {
+    if (!m->unified)
+        return arena_alloc(&m->arena, size);
+    char *tagged = arena_alloc(&m->arena, VALUE_TAG_SIZE + size);
+    *(metric_type*)tagged = type;
+    return tagged + VALUE_TAG_SIZE;
+}
 
+/**
+ * Initializes the admitted keys of a flush interval
+ * @arg num_limits The number of cardinality limits
+ * @arg a The admitted_keys to initialize
+ * @return 0 on success.
+ */
+int init_admitted_keys(int num_limits, admitted_keys *a) {
+    a->counts = calloc(num_limits, sizeof(int));
+    if (!a->counts) return -1;
+    int res = hashmap_init(0, &a->keys);
+    if (res) {
+        free(a->counts);
+        return res;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    return 0;
+}
 
+/**
+ * Destroys the admitted keys. No shard may still use them.
+ * @return 0 on success.
+ */
+int destroy_admitted_keys(admitted_keys *a) {
+    pthread_mutex_destroy(&a->lock);
+    hashmap_destroy(a->keys);
+    free(a->counts);
     return 0;
 }
 
+/**
+ * Internal method to admit a new key under a cardinality limit.
+ * Keys admitted by another shard are admitted again without
+ * counting, so a limit holds across the shards of an interval.
+ * @arg limit The limit of the prefix of the key
+ * @arg name The name of the key, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name, with the type mixed in
+ * @return 1 if admitted, 0 if the limit is reached.
+ */
+static int metrics_admit_key(metrics *m, cardinality_config *limit, char *name,
+        int name_len, uint64_t hash) {
+    admitted_keys *a = m->admitted;
+    void **slot;
+    pthread_mutex_lock(&a->lock);
+    int admitted = !hashmap_get_slot(a->keys, name, hash, &slot);
+    if (!admitted && a->counts[limit->index] < limit->max_keys) {
+        admitted = hashmap_get_or_insert(a->keys, name, name_len, hash, &slot) == 1;
+        a->counts[limit->index] += admitted;
+    }
+    pthread_mutex_unlock(&a->lock);
+    return admitted;
+}
+
+/**
+ * Internal method to remove a new metric whose value could
+ * not be built, so its slot is not left empty.
+ * @arg type The type of the metric
+ * @arg slot The slot of the metric, from metrics_get_slot
+ */
+static void metrics_drop_slot(metrics *m, metric_type type, void **slot) {
+    // Slots of the index are empty until set
+    if (m->index && slot >= m->index_values && slot < m->index_values + m->index->size) {
+        *slot = NULL;
+        return;
+    }
+    char *key = hashmap_slot_key(slot);
+    hashmap_delete_slot(metrics_map(m, type), slot);
+    if (m->names) intern_release(key);
+}
+
+/**
+ * Internal method to get the value slot of the overflow metric
+ * of a prefix, for a key past the cardinality limit. The samples
+ * are counted as rejected.
+ * @arg type The type of the metric
+ * @arg limit The limit of the prefix
+ * @arg num The number of samples
+ * @arg slot Output. Set to the address of the value.
+ * @return 0 if found, 1 if added. -1 if the map could not grow.
+ */
+static int metrics_overflow_slot(metrics *m, metric_type type, cardinality_config *limit,
+        int num, void ***slot) {
+    // Count the rejection first, adding the counter may move the slots
+    counter **rejected;
+    int res = metrics_lookup_slot(m, COUNTER, limit->rejected_name, limit->rejected_len,
+            hashmap_hash(limit->rejected_name, limit->rejected_len), (void***)&rejected);
+    if (res == -1) return -1;
+    if (res) {
+        *rejected = metrics_alloc_value(m, COUNTER, sizeof(counter));
+        init_counter(*rejected);
+    }
+    for (int i=0; i < num; i++)
+        counter_add_sample(*rejected, 1, 1.0);
+
+    return metrics_lookup_slot(m, type, limit->overflow_name, limit->overflow_len,
+            hashmap_hash(limit->overflow_name, limit->overflow_len), slot);
+}
+
+/**
+ * Internal method to get the value slot of a metric, adding
+ * the name if it is new. New names are checked against the
+ * cardinality limits, and past the limit of their prefix are
+ * folded into its overflow metric. Those are remembered, so
+ * their later samples skip the maps. Existing names take a
+ * single lookup, or none if they are in the hot key cache.
+ * Names in the index have their slot there, even when new.
+ * @arg type The type of the metric
+ * @arg name The name of the metric
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg num The number of samples to add to the value
+ * @arg slot Output. Set to the address of the value.
+ * @return 0 if found, 1 if added. -1 if the map could not grow.
+ */
+static int metrics_get_slot(metrics *m, metric_type type, char *name, int name_len,
+        uint64_t hash, int num, void ***slot) {
+    // Cached values are never replaced, so the slot of the cache will do
+    hot_key *hot = NULL;
+    if (m->hot_keys) {
+        m->hot_lookups++;
+        hot = m->hot_keys[HOT_TYPE[type]] + (hash & (HOT_KEYS - 1));
+        if (hot->hash == hash && hot->name && !strcmp(hot->name, name)) {
+            m->hot_hits++;
+            *slot = &hot->value;
+            return 0;
+        }
+    }
+
+    // Keys past their limit are not in the maps. The limit of
+    // the key is never admitted again in the interval, so the
+    // rejection stays valid until the metrics are swapped.
+    rejected_key *rejected = NULL;
+    if (m->rejected) {
+        uint64_t limit_hash = UNIFIED_HASH(hash, type);
+        rejected = m->rejected + (limit_hash & (REJECTED_KEYS - 1));
+        if (rejected->hash == limit_hash && rejected->limit &&
+                !strncmp(name, rejected->limit->prefix, strlen(rejected->limit->prefix)))
+            return metrics_overflow_slot(m, type, rejected->limit, num, slot);
+    }
+
+    // Names of an earlier interval are found with a single probe
+    int pos = -1;
+    char *key = NULL;
+    if (m->index && (pos = name_index_find(m->index, name, UNIFIED_HASH(hash, type), type)) >= 0) {
+        *slot = m->index_values + pos;
+        if (**slot) key = name_index_name(m->index, pos);
+    }
+
+    hashmap *map = metrics_map(m, type);
+    uint64_t key_hash = m->unified ? UNIFIED_HASH(hash, type) : hash;
+    if (pos < 0 && !hashmap_get_slot(map, name, key_hash, slot))
+        key = hashmap_slot_key(*slot);
+
+    if (key) {
+        if (hot && !IS_STAGED(**slot)) {
+            hot->hash = hash;
+            hot->name = key;
+            hot->value = **slot;
+        }
+        return 0;
+    }
+
+    cardinality_config *limit;
+    if (m->limits && !radix_longest_prefix(m->limits, name, (void**)&limit)) {
+        uint64_t limit_hash = UNIFIED_HASH(hash, type);
+        if (!metrics_admit_key(m, limit, name, name_len, limit_hash)) {
+            rejected->hash = limit_hash;
+            rejected->limit = limit;
+            return metrics_overflow_slot(m, type, limit, num, slot);
+        }
+    }
+    if (pos >= 0) return 1;
+    return metrics_add_slot(m, map, name, name_len, hash, key_hash, slot);
+}
+
 /**
  * Increments the counter with the given name
- * by a value.
+ * by a run of values.
  * @arg name The name of the counter
- * @arg val The value to add
- * @arg sample_rate the sample rate of val
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg samples The values to add, with their sample rates
+ * @arg num The number of values
  * @return 0 on success
  */
-static int metrics_increment_counter(metrics *m, char *name, double val, double sample_rate) {
-    counter *c;
-    int res = hashmap_get(m->counters, name, (void**)&c);
+static int metrics_increment_counter(metrics *m, char *name, int name_len, uint64_t hash,
+        metric_sample *samples, int num) {
+    counter **slot, *c;
+    int res = metrics_get_slot(m, COUNTER, name, name_len, hash, num, (void***)&slot);
+    if (res == -1) return -1;
 
     // New counter
-    if (res == -1) {
-        c = malloc(sizeof(counter));
-        init_counter(c);
-        hashmap_put(m->counters, name, c);
+    if (res == 1) {
+        *slot = metrics_alloc_value(m, COUNTER, sizeof(counter));
+        init_counter(*slot);
     }
+    c = *slot;
 
-    // Add the sample value
-    return counter_add_sample(c, val, sample_rate);
+    // Add the sample values
+    for (int i=0; i < num; i++)
+        counter_add_sample(c, samples[i].value, samples[i].sample_rate);
+    return 0;
 }
 
 /**
- * Adds a new timer sample for the timer with a
- * given name.
+ * Internal method to initialize a timer, with the quantile
+ * engine and histogram of its name if they are configured.
  * @arg name The name of the timer
- * @arg val The sample to add
- * @return 0 on success.
+ * @arg t The timer to initialize
+ * @arg in_arena Should the histogram counts live in the arena,
+ * rather than the heap
+ * @return 0 on success, -1 if the engine could not be initialized.
  */
-static int metrics_add_timer_sample(metrics *m, char *name, double val, double sample_rate) {
-    if (isnan(val) || isinf(val)) {
-        syslog(LOG_ERR, "Invalid timer sample value supplied, name=%s", name);
+static int metrics_init_timer(metrics *m, const char *name, timer_hist *t, bool in_arena) {
+    quantile_config *qconf;
+    int res;
+    if (m->engines && !radix_longest_prefix(m->engines, (char*)name, (void**)&qconf)) {
+        if (qconf->algo == QUANTILE_HDR)
+            res = init_timer_hdr(m->timer_eps, qconf->min_val, qconf->max_val, &t->tm);
+        else
+            res = init_timer_engine(qconf->algo, m->timer_eps, m->quantiles, m->num_quants, &t->tm);
+    } else
+        res = init_timer_engine(m->engine, m->timer_eps, m->quantiles, m->num_quants, &t->tm);
+    if (res) {
+        syslog(LOG_ERR, "Failed to initialize timer, name=%s", name);
         return -1;
     }
 
-    timer_hist *t;
     histogram_config *conf;
-    int res = hashmap_get(m->timers, name, (void**)&t);
 
-    // New timer
-    if (res == -1) {
-        t = malloc(sizeof(timer_hist));
-        init_timer(m->timer_eps, m->quantiles, m->num_quants, &t->tm);
-        hashmap_put(m->timers, name, t);
-
-        // Check if we have any histograms configured
-        if (m->histograms && !radix_longest_prefix(m->histograms, name, (void**)&conf)) {
-            t->conf = conf;
+    // Check if we have any histograms configured
+    if (m->histograms && !radix_longest_prefix(m->histograms, (char*)name, (void**)&conf)) {
+        t->conf = conf;
+        if (in_arena)
+            t->counts = arena_calloc(&m->arena, conf->num_bins, sizeof(unsigned int));
+        else
             t->counts = calloc(conf->num_bins, sizeof(unsigned int));
-        } else {
-            t->conf = NULL;
-            t->counts = NULL;
-        }
+    } else {
+        t->conf = NULL;
+        t->counts = NULL;
     }
+    return 0;
+}
+
+/**
+ * Internal method to allocate and initialize a new timer
+ * @arg name The name of the timer
+ * @return The timer, or NULL if it could not be initialized.
+ */
+static timer_hist* metrics_new_timer(metrics *m, const char *name) {
+    timer_hist *t = metrics_alloc_value(m, TIMER, sizeof(timer_hist));
+    if (metrics_init_timer(m, name, t, true)) return NULL;
+    return t;
+}
 
+/**
+ * Internal method to add a sample to a timer and its histogram
+ * @arg t The timer to add to
+ * @arg val The sample to add
+ * @arg sample_rate The sample rate of val
+ * @return 0 on success.
+ */
+static int timer_hist_add_sample(timer_hist *t, double val, double sample_rate) {
     // Add the histogram value
     if (t->conf) {
-        conf = t->conf;
+        histogram_config *conf = t->conf;
         if (val < conf->min_val)
             t->counts[0]++;
         else if (val >= conf->max_val)
@@ -169,44 +611,164 @@ static int metrics_add_timer_sample(metrics *m, char *name, double val, double s
 }
 
 /**
- * Sets a gauge value
+ * Internal method to allocate and initialize a new set
+ * @return The set.
+ */
+static set_t* metrics_new_set(metrics *m) {
+    set_t *s = metrics_alloc_value(m, SET, sizeof(set_t));
+    set_init(m->set_precision, s);
+    return s;
+}
+
+/**
+ * Adds a run of timer samples for the timer with a
+ * given name. Invalid samples are skipped.
+ * @arg name The name of the timer
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg samples The samples to add
+ * @arg num The number of samples
+ * @return 0 on success, -1 if any sample was invalid.
+ */
+static int metrics_add_timer_samples(metrics *m, char *name, int name_len, uint64_t hash,
+        metric_sample *samples, int num) {
+    int valid = 0, first = -1;
+    for (int i=0; i < num; i++) {
+        if (isnan(samples[i].value) || isinf(samples[i].value)) {
+            syslog(LOG_ERR, "Invalid timer sample value supplied, name=%s", name);
+            continue;
+        }
+        if (first == -1) first = i;
+        valid++;
+    }
+    if (!valid) return -1;
+
+    timer_hist **slot, *t;
+    int res = metrics_get_slot(m, TIMER, name, name_len, hash, valid, (void***)&slot);
+    if (res == -1) return -1;
+
+    // Stage the first sample of a new timer
+    if (res == 1 && m->admission && valid == 1) {
+        staged_sample *staged = metrics_alloc_value(m, TIMER, sizeof(staged_sample));
+        staged->timer.value = samples[first].value;
+        staged->timer.sample_rate = samples[first].sample_rate;
+        *slot = STAGE(staged);
+        return (valid == num) ? 0 : -1;
+    }
+
+    // Report the samples that were skipped
+    int ret = (valid == num) ? 0 : -1;
+
+    // New timer, or a staged one on its second sample
+    if (res == 1 || IS_STAGED(*slot)) {
+        t = metrics_new_timer(m, name);
+        if (!t) {
+            if (res == 1) metrics_drop_slot(m, TIMER, (void**)slot);
+            return -1;
+        }
+        if (res == 0) {
+            staged_sample *staged = UNSTAGED(*slot);
+            timer_hist_add_sample(t, staged->timer.value, staged->timer.sample_rate);
+        }
+        *slot = t;
+    }
+    t = *slot;
+    for (int i=first; i < num; i++) {
+        if (isnan(samples[i].value) || isinf(samples[i].value)) continue;
+        if (timer_hist_add_sample(t, samples[i].value, samples[i].sample_rate))
+            ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * Sets a gauge value, from a run of values
+ * and deltas applied in order
  * @arg name The name of the gauge
- * @arg val The value to set
- * @arg delta Is this a delta update
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg samples The values to set, of type GAUGE or GAUGE_DELTA
+ * @arg num The number of values
  * @return 0 on success
  */
-static int metrics_set_gauge(metrics *m, char *name, double val, bool delta) {
-    gauge_t *g;
-    int res = hashmap_get(m->gauges, name, (void**)&g);
+static int metrics_set_gauge(metrics *m, char *name, int name_len, uint64_t hash,
+        metric_sample *samples, int num) {
+    gauge_t **slot;
+    int res = metrics_get_slot(m, GAUGE, name, name_len, hash, num, (void***)&slot);
+    if (res == -1) return -1;
 
     // New gauge
-    if (res == -1) {
-        g = malloc(sizeof(gauge_t));
-        init_gauge(g);
-        hashmap_put(m->gauges, name, g);
+    if (res == 1) {
+        *slot = metrics_alloc_value(m, GAUGE, sizeof(gauge_t));
+        init_gauge(*slot);
     }
 
-    return gauge_add_sample(g, val, delta);
+    for (int i=0; i < num; i++)
+        gauge_add_sample(*slot, samples[i].value, samples[i].type == GAUGE_DELTA);
+    return 0;
 }
 
 /**
- * Sets a direct gauge value
+ * Sets a direct gauge value, from a run of values
  * @arg name The name of the gauge
- * @arg val The value to set
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg samples The values to set
+ * @arg num The number of values
  * @return 0 on success
  */
-static int metrics_set_gauge_direct(metrics *m, char *name, double val) {
-    gauge_direct_t *g;
-    int res = hashmap_get(m->gauges_direct, name, (void**)&g);
+static int metrics_set_gauge_direct(metrics *m, char *name, int name_len, uint64_t hash,
+        metric_sample *samples, int num) {
+    gauge_direct_t **slot;
+    int res = metrics_get_slot(m, GAUGE_DIRECT, name, name_len, hash, num, (void***)&slot);
+    if (res == -1) return -1;
 
     // New gauge
-    if (res == -1) {
-        g = malloc(sizeof(gauge_direct_t));
-        init_gauge_direct(g);
-        hashmap_put(m->gauges_direct, name, g);
+    if (res == 1) {
+        *slot = metrics_alloc_value(m, GAUGE_DIRECT, sizeof(gauge_direct_t));
+        init_gauge_direct(*slot);
+    }
+
+    for (int i=0; i < num; i++)
+        gauge_direct_add_sample(*slot, samples[i].value);
+    return 0;
+}
+
+/**
+ * Adds a run of values to a named set
+ * @arg name The name of the set
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name
+ * @arg samples The samples with the values to add
+ * @arg num The number of values
+ * @return 0 on success
+ */
+static int metrics_update_set(metrics *m, char *name, int name_len, uint64_t hash,
+        metric_sample *samples, int num) {
+    set_t **slot;
+    int res = metrics_get_slot(m, SET, name, name_len, hash, num, (void***)&slot);
+    if (res == -1) return -1;
+
+    // Stage the first value of a new set
+    if (res == 1 && m->admission && num == 1) {
+        staged_sample *staged = metrics_alloc_value(m, SET, sizeof(staged_sample));
+        staged->set_hash = hash_bytes(samples[0].set_value, strlen(samples[0].set_value));
+        *slot = STAGE(staged);
+        return 0;
     }
 
-    return gauge_direct_add_sample(g, val);
+    // New set, or a staged one on its second value
+    if (res == 1 || IS_STAGED(*slot)) {
+        staged_sample *staged = UNSTAGED(*slot);
+        *slot = metrics_new_set(m);
+        if (res == 0)
+            set_add_hash(*slot, staged->set_hash);
+    }
+
+    // Add the sample values
+    for (int i=0; i < num; i++)
+        set_add(*slot, samples[i].set_value);
+    return 0;
 }
 
 /**
@@ -218,21 +780,60 @@ static int metrics_set_gauge_direct(metrics *m, char *name, double val) {
  * @return 0 on success.
  */
 int metrics_add_sample(metrics *m, metric_type type, char *name, double val, double sample_rate) {
+    int name_len = strlen(name);
+    return metrics_add_hashed_sample(m, type, name, name_len, hashmap_hash(name, name_len),
+            val, sample_rate);
+}
+
+/**
+ * Adds a new sampled value to a metric with a prehashed
+ * name, so the name is only hashed once per sample.
+ * arg type The type of the metrics
+ * @arg name The name of the metric, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @arg val The sample to add
+ * @arg sample_rate The sample rate of val
+ * @return 0 on success.
+ */
+int metrics_add_hashed_sample(metrics *m, metric_type type, char *name, int name_len,
+        uint64_t hash, double val, double sample_rate) {
+    if (type == SET) return -1;
+    metric_sample sample = {type, val, sample_rate, NULL};
+    return metrics_add_hashed_samples(m, (type == GAUGE_DELTA) ? GAUGE : type,
+            name, name_len, hash, &sample, 1);
+}
+
+/**
+ * Adds a run of samples to a metric with a prehashed name.
+ * The name is looked up once, and the samples are then
+ * added in order, so the result is the same as adding
+ * them one at a time.
+ * @arg type The type of the metric. Gauge deltas are GAUGE.
+ * @arg name The name of the metric, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @arg samples The samples to add, of the type of the metric
+ * @arg num The number of samples
+ * @return 0 on success, -1 if any sample was not added.
+ */
+int metrics_add_hashed_samples(metrics *m, metric_type type, char *name, int name_len,
+        uint64_t hash, metric_sample *samples, int num) {
     switch (type) {
         case GAUGE_DIRECT:
-            return metrics_set_gauge_direct(m, name, val);
+            return metrics_set_gauge_direct(m, name, name_len, hash, samples, num);
 
         case GAUGE:
-            return metrics_set_gauge(m, name, val, false);
-
-        case GAUGE_DELTA:
-            return metrics_set_gauge(m, name, val, true);
+            return metrics_set_gauge(m, name, name_len, hash, samples, num);
 
         case COUNTER:
-            return metrics_increment_counter(m, name, val, sample_rate);
+            return metrics_increment_counter(m, name, name_len, hash, samples, num);
 
         case TIMER:
-            return metrics_add_timer_sample(m, name, val, sample_rate);
+            return metrics_add_timer_samples(m, name, name_len, hash, samples, num);
+
+        case SET:
+            return metrics_update_set(m, name, name_len, hash, samples, num);
 
         default:
             return -1;
@@ -246,19 +847,21 @@ int metrics_add_sample(metrics *m, metric_type type, char *name, double val, dou
  * @return 0 on success
  */
 int metrics_set_update(metrics *m, char *name, char *value) {
-    set_t *s;
-    int res = hashmap_get(m->sets, name, (void**)&s);
-
-    // New set
-    if (res == -1) {
-        s = malloc(sizeof(set_t));
-        set_init(m->set_precision, s);
-        hashmap_put(m->sets, name, s);
-    }
+    int name_len = strlen(name);
+    return metrics_set_hashed_update(m, name, name_len, hashmap_hash(name, name_len), value);
+}
 
-    // Add the sample value
-    set_add(s, value);
-    return 0;
+/**
+ * Adds a value to a set with a prehashed name
+ * @arg name The name of the set, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @arg value The value to add
+ * @return 0 on success
+ */
+int metrics_set_hashed_update(metrics *m, char *name, int name_len, uint64_t hash, char *value) {
+    metric_sample sample = {SET, 0, 1.0, value};
+    return metrics_update_set(m, name, name_len, hash, &sample, 1);
 }
 
 /**
@@ -269,79 +872,422 @@ int metrics_set_update(metrics *m, char *name, char *value) {
  * and value. If the type is KEY_VAL, it is a pointer to a double,
  * for a counter, it is a pointer to a counter, and for a timer it is
  * a pointer to a timer. Return non-zero to stop iteration.
+ * The types are grouped, unless the store is unified.
  * @return 0 on success, or the return of the callback
  */
 int metrics_iter(metrics *m, void *data, metric_callback cb) {
 
     // Store our data in a small struct
-    struct cb_info info = {COUNTER, data, cb};
+    struct cb_info info = {COUNTER, data, cb, m};
+
+    // Send everything in one pass, the values carry their types
+    if (m->unified) {
+        info.type = UNKNOWN;
+        int res = hashmap_iter(m->unified, iter_cb, &info);
+        if (res) return res;
+        return index_iter(m, UNKNOWN, iter_cb, &info);
+    }
 
     // Send the counters
-    bool should_break = hashmap_iter(m->counters, iter_cb, &info);
+    bool should_break = hashmap_iter(m->counters, iter_cb, &info) ||
+        index_iter(m, COUNTER, iter_cb, &info);
     if (should_break) return should_break;
 
     // Send the timers
     info.type = TIMER;
-    should_break = hashmap_iter(m->timers, iter_cb, &info);
+    should_break = hashmap_iter(m->timers, iter_cb, &info) ||
+        index_iter(m, TIMER, iter_cb, &info);
     if (should_break) return should_break;
 
     // Send the gauges
     info.type = GAUGE;
-    should_break = hashmap_iter(m->gauges, iter_cb, &info);
+    should_break = hashmap_iter(m->gauges, iter_cb, &info) ||
+        index_iter(m, GAUGE, iter_cb, &info);
     if (should_break) return should_break;
 
     // Send the direct gauges
     info.type = GAUGE_DIRECT;
-    should_break = hashmap_iter(m->gauges_direct, iter_cb, &info);
+    should_break = hashmap_iter(m->gauges_direct, iter_cb, &info) ||
+        index_iter(m, GAUGE_DIRECT, iter_cb, &info);
     if (should_break) return should_break;
 
     // Send the sets
     info.type = SET;
-    should_break = hashmap_iter(m->sets, iter_cb, &info);
+    should_break = hashmap_iter(m->sets, iter_cb, &info) ||
+        index_iter(m, SET, iter_cb, &info);
 
     return should_break;
 }
 
-// Counter map cleanup
-static int counter_delete_cb(void *data, const char *key, void *value) {
-    free(value);
+/**
+ * Merges the metrics of another struct into this one.
+ * The other metrics are consumed: values that are not yet
+ * present are moved over, and the rest are merged and freed.
+ * Both structs must share the same timer, histogram and set
+ * settings. Either both or neither may intern their names,
+ * or use the unified store, and both must use the same index.
+ * @arg m The metrics to merge into
+ * @arg other The metrics to merge from. Destroyed on return.
+ * @return 0 on success.
+ */
+int metrics_merge(metrics *m, metrics *other) {
+    if (m->index != other->index) return -1;
+
+    // Merged values may replace the cached ones
+    if (m->hot_keys)
+        memset(m->hot_keys, 0, HOT_TYPES * sizeof(*m->hot_keys));
+
+    // The indexed values merge by position
+    if (other->index) {
+        for (uint32_t i=0; i < other->index->size; i++) {
+            void *value = other->index_values[i];
+            if (!value) continue;
+            if (!m->index_values[i])
+                m->index_values[i] = value;
+            else
+                m->index_values[i] = merge_value(m, name_index_tag(m->index, i),
+                        name_index_name(m->index, i), m->index_values[i], value);
+        }
+        name_index_release(other->index);
+    }
+
+    if (m->unified) {
+        struct merge_info info = {UNKNOWN, m->unified, other->names, m};
+        hashmap_iter(other->unified, merge_cb, &info);
+        arena_merge(&m->arena, &other->arena);
+        hashmap_destroy(other->unified);
+        return 0;
+    }
+
+    struct merge_info info = {COUNTER, m->counters, other->names, m};
+    hashmap_iter(other->counters, merge_cb, &info);
+
+    info.type = TIMER;
+    info.map = m->timers;
+    hashmap_iter(other->timers, merge_cb, &info);
+
+    info.type = GAUGE;
+    info.map = m->gauges;
+    hashmap_iter(other->gauges, merge_cb, &info);
+
+    info.type = GAUGE_DIRECT;
+    info.map = m->gauges_direct;
+    hashmap_iter(other->gauges_direct, merge_cb, &info);
+
+    info.type = SET;
+    info.map = m->sets;
+    hashmap_iter(other->sets, merge_cb, &info);
+
+    // The moved values and names live in the other arena
+    arena_merge(&m->arena, &other->arena);
+
+    // Every value was moved or freed, only the maps are left
+    hashmap_destroy(other->counters);
+    hashmap_destroy(other->timers);
+    hashmap_destroy(other->sets);
+    hashmap_destroy(other->gauges);
+    hashmap_destroy(other->gauges_direct);
     return 0;
 }
 
-// Timer map cleanup
+/**
+ * Installs an index of the names of an earlier interval.
+ * Indexed names are then found with a single probe, and
+ * their values are kept in a dense array rather than the
+ * maps, so only new names are added to the maps.
+ * @arg m The metrics to index, which must be empty
+ * @arg index The index. A reference is taken for the metrics.
+ * @return 0 on success.
+ */
+int metrics_use_index(metrics *m, name_index *index) {
+    if (m->index) return -1;
+    name_index_ref(index);
+    m->index = index;
+    m->index_values = arena_calloc(&m->arena, index->size, sizeof(void*));
+    return 0;
+}
+
+/**
+ * Sets the quantile engine of new timers. The longest
+ * matching prefix in the engines picks the engine of a
+ * name, and names without one use the default.
+ * @arg m The metrics to configure
+ * @arg engine The default quantile engine
+ * @arg engines A radix tree with quantile configs, or NULL. This
+ * is not owned by the metrics object, and must outlive it.
+ */
+void metrics_use_engines(metrics *m, quantile_engine engine, radix_tree *engines) {
+    m->engine = engine;
+    m->engines = engines;
+}
+
+/**
+ * Enables the hot key cache, a direct-mapped cache of the
+ * recently used names of each type. Lookups of cached names
+ * skip the maps, and are counted in the hit rate.
+ * @arg m The metrics to configure
+ */
+void metrics_use_hot_keys(metrics *m) {
+    if (!m->hot_keys)
+        m->hot_keys = arena_calloc(&m->arena, HOT_TYPES, sizeof(*m->hot_keys));
+}
+
+/**
+ * Builds an index over the names of the metrics, for use
+ * by a later interval. Names that were indexed but not
+ * used this interval are left out.
+ * @arg m The metrics to index
+ * @return The index, or NULL if there are no names or
+ * it could not be built.
+ */
+name_index* metrics_build_index(metrics *m) {
+    uint32_t num = 0;
+    if (m->unified)
+        num = hashmap_size(m->unified);
+    else
+        num = hashmap_size(m->counters) + hashmap_size(m->timers) + hashmap_size(m->sets) +
+            hashmap_size(m->gauges) + hashmap_size(m->gauges_direct);
+    if (m->index) {
+        for (uint32_t i=0; i < m->index->size; i++)
+            num += m->index_values[i] != NULL;
+    }
+
+    struct index_info info = {UNKNOWN, malloc(num * sizeof(char*)),
+        malloc(num * sizeof(uint64_t)), malloc(num * sizeof(uint8_t)), 0};
+    if (m->unified)
+        hashmap_iter(m->unified, index_name_cb, &info);
+    else {
+        info.type = COUNTER;
+        hashmap_iter(m->counters, index_name_cb, &info);
+        info.type = TIMER;
+        hashmap_iter(m->timers, index_name_cb, &info);
+        info.type = SET;
+        hashmap_iter(m->sets, index_name_cb, &info);
+        info.type = GAUGE;
+        hashmap_iter(m->gauges, index_name_cb, &info);
+        info.type = GAUGE_DIRECT;
+        hashmap_iter(m->gauges_direct, index_name_cb, &info);
+    }
+
+    // The tags are the types, so the indexed values need no tag
+    if (m->index) {
+        for (uint32_t i=0; i < m->index->size; i++) {
+            if (!m->index_values[i]) continue;
+            info.type = name_index_tag(m->index, i);
+            index_name_cb(&info, name_index_name(m->index, i), NULL);
+        }
+    }
+
+    name_index *index = name_index_build(info.names, info.hashes, info.tags, info.num);
+    free(info.names);
+    free(info.hashes);
+    free(info.tags);
+    return index;
+}
+
+// Gives back an interned name
+static int release_name_cb(void *data, const char *key, void *value) {
+    intern_release(key);
+    return 0;
+}
+
+// Timer map cleanup. The data is set if the names are interned.
+// The struct is in the arena, but the samples are not.
 static int timer_delete_cb(void *data, const char *key, void *value) {
+    if (data) intern_release(key);
+    if (IS_STAGED(value)) return 0;
     timer_hist *t = value;
     destroy_timer(&t->tm);
-    if (t->counts) free(t->counts);
-    free(t);
     return 0;
 }
 
 // Set map cleanup
 static int set_delete_cb(void *data, const char *key, void *value) {
-    set_t *s = value;
-    set_destroy(s);
-    free(s);
+    if (data) intern_release(key);
+    if (IS_STAGED(value)) return 0;
+    set_destroy(value);
     return 0;
 }
 
-// Gauge map cleanup
-static int gauge_delete_cb(void *data, const char *key, void *value) {
-    gauge_t *g = value;
-    free(g);
+// Unified map cleanup, by the type of each value
+static int unified_delete_cb(void *data, const char *key, void *value) {
+    switch (VALUE_TYPE(value)) {
+        case TIMER:
+            return timer_delete_cb(data, key, value);
+        case SET:
+            return set_delete_cb(data, key, value);
+        default:
+            if (data) intern_release(key);
+            return 0;
+    }
+}
+
+// Invokes a map callback for the indexed values of a type,
+// or of every type if UNKNOWN
+static int index_iter(metrics *m, metric_type type, hashmap_callback cb, void *data) {
+    if (!m->index) return 0;
+    for (uint32_t i=0; i < m->index->size; i++) {
+        void *value = m->index_values[i];
+        if (!value || (type && name_index_tag(m->index, i) != (int)type)) continue;
+        int res = cb(data, name_index_name(m->index, i), value);
+        if (res) return res;
+    }
     return 0;
 }
 
-// Gauge map cleanup
-static int gauge_direct_delete_cb(void *data, const char *key, void *value) {
-    gauge_direct_t *g = value;
-    free(g);
+// Adds a name to the names being indexed
+static int index_name_cb(void *data, const char *key, void *value) {
+    struct index_info *info = data;
+    metric_type type = info->type ? info->type : VALUE_TYPE(value);
+    info->names[info->num] = (char*)key;
+    info->hashes[info->num] = UNIFIED_HASH(hashmap_hash(key, strlen(key)), type);
+    info->tags[info->num++] = type;
     return 0;
 }
 
+// Builds a staged singleton for the user code, and frees it after
+static int iter_staged(struct cb_info *info, metric_type type, const char *key, staged_sample *staged) {
+    metrics *m = info->m;
+    int res;
+    if (type == TIMER) {
+        timer_hist t;
+        if (metrics_init_timer(m, key, &t, false)) return 0;
+        timer_hist_add_sample(&t, staged->timer.value, staged->timer.sample_rate);
+        res = info->cb(info->data, type, (char*)key, &t);
+        destroy_timer(&t.tm);
+        free(t.counts);
+    } else {
+        set_t s;
+        set_init(m->set_precision, &s);
+        set_add_hash(&s, staged->set_hash);
+        res = info->cb(info->data, type, (char*)key, &s);
+        set_destroy(&s);
+    }
+    return res;
+}
+
 // Callback to invoke the user code
 static int iter_cb(void *data, const char *key, void *value) {
     struct cb_info *info = data;
-    return info->cb(info->data, info->type, (char*)key, value);
+    metric_type type = info->type ? info->type : VALUE_TYPE(value);
+    if (IS_STAGED(value))
+        return iter_staged(info, type, key, UNSTAGED(value));
+    return info->cb(info->data, type, (char*)key, value);
 }
 
+// Merges two timers of a name, either of which may be staged.
+// Returns the timer to keep, the other is freed.
+static void* merge_timers(metrics *m, const char *key, void *existing, void *value) {
+    if (IS_STAGED(existing) && IS_STAGED(value)) {
+        staged_sample *staged = UNSTAGED(existing);
+        timer_hist *t = metrics_new_timer(m, key);
+        if (!t) return existing;
+        timer_hist_add_sample(t, staged->timer.value, staged->timer.sample_rate);
+        existing = t;
+    }
+
+    // Keep the full timer, and add the staged sample to it
+    if (IS_STAGED(existing)) {
+        void *tmp = existing;
+        existing = value;
+        value = tmp;
+    }
+    timer_hist *t = existing;
+    if (IS_STAGED(value)) {
+        staged_sample *staged = UNSTAGED(value);
+        timer_hist_add_sample(t, staged->timer.value, staged->timer.sample_rate);
+        return t;
+    }
+
+    timer_hist *o = value;
+    timer_merge(&t->tm, &o->tm);
+    if (t->conf && o->counts) {
+        for (int i=0; i < t->conf->num_bins; i++) {
+            t->counts[i] += o->counts[i];
+        }
+    }
+    timer_delete_cb(NULL, key, value);
+    return t;
+}
+
+// Merges two sets of a name, either of which may be staged.
+// Returns the set to keep, the other is freed.
+static void* merge_sets(metrics *m, const char *key, void *existing, void *value) {
+    if (IS_STAGED(existing) && IS_STAGED(value)) {
+        staged_sample *staged = UNSTAGED(existing);
+        set_t *s = metrics_new_set(m);
+        set_add_hash(s, staged->set_hash);
+        existing = s;
+    }
+
+    // Keep the full set, and add the staged value to it
+    if (IS_STAGED(existing)) {
+        void *tmp = existing;
+        existing = value;
+        value = tmp;
+    }
+    if (IS_STAGED(value)) {
+        staged_sample *staged = UNSTAGED(value);
+        set_add_hash(existing, staged->set_hash);
+        return existing;
+    }
+
+    set_merge(existing, value);
+    set_delete_cb(NULL, key, value);
+    return existing;
+}
+
+// Merges a value into the existing value of a name.
+// Returns the value to keep.
+static void* merge_value(metrics *m, metric_type type, const char *key, void *existing, void *value) {
+    switch (type) {
+        case COUNTER:
+            counter_merge(existing, value);
+            break;
+
+        case TIMER:
+            return merge_timers(m, key, existing, value);
+
+        case GAUGE:
+            gauge_merge(existing, value);
+            break;
+
+        case GAUGE_DIRECT:
+            // Direct gauges have no aggregation, the latest value wins
+            *(gauge_direct_t*)existing = *(gauge_direct_t*)value;
+            break;
+
+        case SET:
+            return merge_sets(m, key, existing, value);
+
+        default:
+            break;
+    }
+    return existing;
+}
+
+// Callback to merge a single value into the target map
+static int merge_cb(void *data, const char *key, void *value) {
+    struct merge_info *info = data;
+    void **slot;
+    metric_type type = info->type;
+    int key_len = strlen(key);
+    uint64_t hash = hashmap_hash(key, key_len);
+    if (!type) {
+        type = VALUE_TYPE(value);
+        hash = UNIFIED_HASH(hash, type);
+    }
+
+    // Move the value over if it is new. An interned name
+    // moves with it, along with its reference. The value
+    // stays in the arena of the other metrics.
+    if (hashmap_get_or_insert(info->map, (char*)key, key_len, hash, &slot)) {
+        *slot = value;
+        return 0;
+    }
+    *slot = merge_value(info->m, type, key, *slot, value);
+
+    // The merged value is dropped, along with its name
+    if (info->interned) intern_release(key);
+    return 0;
+}
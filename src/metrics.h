@@ -1,14 +1,18 @@
 #ifndef METRICS_H
 #define METRICS_H
 #include <stdint.h>
+#include <pthread.h>
 #include "config.h"
 #include "radix.h"
 #include "counter.h"
 #include "timer.h"
 #include "gauge.h"
 #include "gauge_direct.h"
+#include "arena.h"
 #include "hashmap.h"
+#include "intern.h"
 #include "set.h"
+#include "name_index.h"
 
 typedef struct {
     timer tm;
@@ -18,19 +22,84 @@ typedef struct {
     unsigned int *counts;
 } timer_hist;
 
+/**
+ * The number of names in the hot key cache of each
+ * type, a power of two
+ */
+#define HOT_KEYS 256
+
+/**
+ * The types with a hot key cache
+ */
+#define HOT_TYPES 5
+
+typedef struct {
+    uint64_t hash;  // The hash of the name
+    char *name;     // The name, as stored in the map
+    void *value;    // The value, never a staged one
+} hot_key;
+
+/**
+ * The number of keys past their limit remembered
+ * by each shard, a power of two
+ */
+#define REJECTED_KEYS 256
+
+typedef struct {
+    uint64_t hash;              // The hash of the name, with the type mixed in
+    cardinality_config *limit;  // The limit the key is past, NULL if empty
+} rejected_key;
+
+/**
+ * The keys admitted under the cardinality limits in a flush
+ * interval. It is shared by the shards of the interval, so a
+ * limit holds across the ingest threads, and a key admitted
+ * by one shard takes samples in all of them.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    hashmap *keys;      // The admitted names, hashed with their type
+    int *counts;        // Number of keys admitted under each limit
+} admitted_keys;
+
 typedef struct {
     hashmap *counters;           // Hashmap of name -> counter structs
     hashmap *timers;             // Map of name -> timer_hist structs
     hashmap *sets;               // Map of name -> set_t structs
     hashmap *gauges;             // Map of name -> gauge struct
     hashmap *gauges_direct;      // Map of name -> gauge_direct struct
+    hashmap *unified;            // Map of name -> any type, replacing the others if set
     double timer_eps;            // The error for timers
     double *quantiles;           // Array of quantiles
     uint32_t num_quants;         // Size of quantiles array
     radix_tree *histograms;      // Radix tree with histogram configs
     unsigned char set_precision; // The precision for sets
+    intern_table *names;         // Table the names are interned in, NULL to copy them
+    radix_tree *limits;          // Radix tree with cardinality limits
+    admitted_keys *admitted;     // Keys admitted under the limits, shared by the shards
+    rejected_key *rejected;      // Direct-mapped cache of the keys past their limit, or NULL
+    bool admission;              // Are timers and sets built on their second sample
+    hot_key (*hot_keys)[HOT_KEYS]; // Direct-mapped cache of the names of each type, NULL if disabled
+    uint64_t hot_lookups;        // Number of lookups of a name
+    uint64_t hot_hits;           // Number of lookups served by the hot key cache
+    name_index *index;           // Index of the names of an earlier interval, or NULL
+    void **index_values;         // The value of each indexed name, NULL until it is used
+    quantile_engine engine;      // The quantile engine of the timers
+    radix_tree *engines;         // Radix tree with the quantile engines of prefixes, or NULL
+    arena arena;                 // The metric structs and name copies
 } metrics;
 
+/**
+ * A single sample of a metric, used to add the samples
+ * of a name in a run.
+ */
+typedef struct {
+    metric_type type;   // The sample type, GAUGE_DELTA for gauge deltas
+    double value;       // The sample value
+    double sample_rate; // The sample rate of the value
+    char *set_value;    // The value added to a set, null terminated
+} metric_sample;
+
 typedef int(*metric_callback)(void *data, metric_type type, char *name, void *val);
 
 /**
@@ -45,6 +114,33 @@ typedef int(*metric_callback)(void *data, metric_type type, char *name, void *va
  */
 int init_metrics(double timer_eps, double *quantiles, uint32_t num_quants, radix_tree *histograms, unsigned char set_precision, metrics *m);
 
+/**
+ * Initializes the metrics struct for a flush interval. The names
+ * are interned instead of copied, and the maps are sized for the
+ * metrics of the previous interval. The hot key cache starts empty,
+ * so it never outlives the interval.
+ * @arg eps The maximum error for the quantiles
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg histograms A radix tree with histogram settings. This is not owned
+ * by the metrics object. It is assumed to exist for the life of the metrics.
+ * @arg set_precision The precision to use for sets
+ * @arg names The table to intern the names in. This is not owned by
+ * the metrics object, and must outlive it. NULL to copy the names.
+ * @arg prev The metrics of the previous interval, or NULL
+ * @arg unified Should all the types be kept in a single map
+ * @arg limits A radix tree with cardinality limits, or NULL. This is
+ * not owned by the metrics object, and must outlive it.
+ * @arg admitted The keys admitted under the limits, required with
+ * limits. This is not owned by the metrics object, and must outlive it.
+ * @arg admission Should timers and sets be built on their second sample
+ * @return 0 on success.
+ */
+int init_interval_metrics(double timer_eps, double *quantiles, uint32_t num_quants,
+        radix_tree *histograms, unsigned char set_precision,
+        intern_table *names, metrics *prev, bool unified,
+        radix_tree *limits, admitted_keys *admitted, bool admission, metrics *m);
+
 /**
  * Initializes the metrics struct, with preset configurations.
  * This defaults to a epsilon of 0.01 (1% error), and quantiles at
@@ -59,6 +155,20 @@ int init_metrics_defaults(metrics *m);
  */
 int destroy_metrics(metrics *m);
 
+/**
+ * Initializes the admitted keys of a flush interval
+ * @arg num_limits The number of cardinality limits
+ * @arg a The admitted_keys to initialize
+ * @return 0 on success.
+ */
+int init_admitted_keys(int num_limits, admitted_keys *a);
+
+/**
+ * Destroys the admitted keys. No shard may still use them.
+ * @return 0 on success.
+ */
+int destroy_admitted_keys(admitted_keys *a);
+
 /**
  * Adds a new sampled value
  * arg type The type of the metrics
@@ -69,6 +179,36 @@ int destroy_metrics(metrics *m);
  */
 int metrics_add_sample(metrics *m, metric_type type, char *name, double val, double sample_rate);
 
+/**
+ * Adds a new sampled value to a metric with a prehashed
+ * name, so the name is only hashed once per sample.
+ * arg type The type of the metrics
+ * @arg name The name of the metric, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @arg val The sample to add
+ * @arg sample_rate The sample rate of val
+ * @return 0 on success.
+ */
+int metrics_add_hashed_sample(metrics *m, metric_type type, char *name, int name_len,
+        uint64_t hash, double val, double sample_rate);
+
+/**
+ * Adds a run of samples to a metric with a prehashed name.
+ * The name is looked up once, and the samples are then
+ * added in order, so the result is the same as adding
+ * them one at a time.
+ * @arg type The type of the metric. Gauge deltas are GAUGE.
+ * @arg name The name of the metric, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @arg samples The samples to add, of the type of the metric
+ * @arg num The number of samples
+ * @return 0 on success, -1 if any sample was not added.
+ */
+int metrics_add_hashed_samples(metrics *m, metric_type type, char *name, int name_len,
+        uint64_t hash, metric_sample *samples, int num);
+
 /**
  * Adds a value to a named set.
  * @arg name The name of the set
@@ -77,6 +217,68 @@ int metrics_add_sample(metrics *m, metric_type type, char *name, double val, dou
  */
 int metrics_set_update(metrics *m, char *name, char *value);
 
+/**
+ * Adds a value to a set with a prehashed name
+ * @arg name The name of the set, null terminated
+ * @arg name_len The length of the name
+ * @arg hash The hash of the name from hashmap_hash
+ * @arg value The value to add
+ * @return 0 on success
+ */
+int metrics_set_hashed_update(metrics *m, char *name, int name_len, uint64_t hash, char *value);
+
+/**
+ * Merges the metrics of another struct into this one.
+ * The other metrics are consumed, and must share the same
+ * timer, histogram and set settings. Either both or neither
+ * may intern their names, or use the unified store, and both
+ * must use the same index.
+ * @arg m The metrics to merge into
+ * @arg other The metrics to merge from. Destroyed on return.
+ * @return 0 on success.
+ */
+int metrics_merge(metrics *m, metrics *other);
+
+/**
+ * Installs an index of the names of an earlier interval.
+ * Indexed names are then found with a single probe, and
+ * their values are kept in a dense array rather than the
+ * maps, so only new names are added to the maps.
+ * @arg m The metrics to index, which must be empty
+ * @arg index The index. A reference is taken for the metrics.
+ * @return 0 on success.
+ */
+int metrics_use_index(metrics *m, name_index *index);
+
+/**
+ * Sets the quantile engine of new timers. The longest
+ * matching prefix in the engines picks the engine of a
+ * name, and names without one use the default.
+ * @arg m The metrics to configure
+ * @arg engine The default quantile engine
+ * @arg engines A radix tree with quantile configs, or NULL. This
+ * is not owned by the metrics object, and must outlive it.
+ */
+void metrics_use_engines(metrics *m, quantile_engine engine, radix_tree *engines);
+
+/**
+ * Enables the hot key cache, a direct-mapped cache of the
+ * recently used names of each type. Lookups of cached names
+ * skip the maps, and are counted in the hit rate.
+ * @arg m The metrics to configure
+ */
+void metrics_use_hot_keys(metrics *m);
+
+/**
+ * Builds an index over the names of the metrics, for use
+ * by a later interval. Names that were indexed but not
+ * used this interval are left out.
+ * @arg m The metrics to index
+ * @return The index, or NULL if there are no names or
+ * it could not be built.
+ */
+name_index* metrics_build_index(metrics *m);
+
 /**
  * Iterates through all the metrics
  * @arg m The metrics to iterate through
@@ -85,6 +287,7 @@ int metrics_set_update(metrics *m, char *name, char *value);
  * and value. If the type is KEY_VAL, it is a pointer to a double,
  * for a counter, it is a pointer to a counter, and for a timer it is
  * a pointer to a timer. Return non-zero to stop iteration.
+ * The types are grouped, unless the store is unified.
  * @return 0 on success.
  */
 int metrics_iter(metrics *m, void *data, metric_callback cb);
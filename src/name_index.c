@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "name_index.h"
+
+/*
+ * The index is a hash and displace perfect hash, in the style of
+ * CHD and PTHash. The names are split into buckets of about four
+ * by their hash. Starting with the largest bucket, each is given
+ * the first pilot that sends all of its names to free positions.
+ * A lookup is then the bucket, its pilot and the one position,
+ * and costs a couple of bytes per name plus the entry.
+ */
+
+// Average number of names per bucket
+#define BUCKET_NAMES 4
+
+// The entries hold the offset of the name in 29 bits
+#define MAX_NAMES_LEN ((size_t)1 << 29)
+
+// Maps a hash onto [0, range) without a division
+static inline uint32_t fast_range(uint64_t hash, uint32_t range) {
+    return (uint32_t)(((__uint128_t)hash * range) >> 64);
+}
+
+// The position of a hash under a pilot
+static inline uint32_t pilot_position(uint64_t hash, uint16_t pilot, uint32_t size) {
+    uint64_t x = hash ^ ((uint64_t)(pilot + 1) * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return fast_range(x, size);
+}
+
+/**
+ * Internal method to place the names of a bucket.
+ * @arg hashes The hashes of the names in the bucket
+ * @arg num The number of names in the bucket
+ * @arg taken The positions in use
+ * @arg size The number of positions
+ * @arg pos Output. The position of each name.
+ * @return The pilot, or -1 if none fits.
+ */
+static int place_bucket(uint64_t *hashes, int num, uint8_t *taken, uint32_t size, uint32_t *pos) {
+    for (int pilot=0; pilot <= UINT16_MAX; pilot++) {
+        int i;
+        for (i=0; i < num; i++) {
+            pos[i] = pilot_position(hashes[i], pilot, size);
+            if (taken[pos[i]]) break;
+
+            // Names of a bucket may not collide with each other either
+            int j;
+            for (j=0; j < i && pos[j] != pos[i]; j++) ;
+            if (j < i) break;
+        }
+        if (i == num) {
+            for (i=0; i < num; i++)
+                taken[pos[i]] = 1;
+            return pilot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Builds an index over a set of names. The names are copied.
+ * The hashes must be distinct, and should mix in the tag if
+ * a name is indexed under several.
+ * @arg names The names to index, null terminated
+ * @arg hashes The hash of each name
+ * @arg tags The tag of each name, 1 to 7
+ * @arg num The number of names
+ * @return The index with a single reference, or NULL on failure.
+ */
+name_index* name_index_build(char **names, uint64_t *hashes, uint8_t *tags, uint32_t num) {
+    if (!num) return NULL;
+
+    // Leave the pilots of the last buckets a few free positions
+    name_index *idx = calloc(1, sizeof(name_index));
+    idx->num_names = num;
+    idx->size = num + num / 64 + 1;
+    idx->num_buckets = num / BUCKET_NAMES + 1;
+    idx->refs = 1;
+
+    // Group the names by bucket, with a counting sort
+    uint32_t *starts = calloc(idx->num_buckets + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(num * sizeof(uint32_t));
+    for (uint32_t i=0; i < num; i++)
+        starts[fast_range(hashes[i], idx->num_buckets) + 1]++;
+    int max_bucket = 0;
+    for (uint32_t b=0; b < idx->num_buckets; b++) {
+        if ((int)starts[b+1] > max_bucket) max_bucket = starts[b+1];
+        starts[b+1] += starts[b];
+    }
+    uint32_t *fill = malloc(idx->num_buckets * sizeof(uint32_t));
+    memcpy(fill, starts, idx->num_buckets * sizeof(uint32_t));
+    for (uint32_t i=0; i < num; i++)
+        order[fill[fast_range(hashes[i], idx->num_buckets)]++] = i;
+
+    // Order the buckets from the largest, again with a counting sort
+    uint32_t *by_size = malloc(idx->num_buckets * sizeof(uint32_t));
+    uint32_t *size_starts = calloc(max_bucket + 2, sizeof(uint32_t));
+    for (uint32_t b=0; b < idx->num_buckets; b++)
+        size_starts[max_bucket - (starts[b+1] - starts[b]) + 1]++;
+    for (int s=0; s <= max_bucket; s++)
+        size_starts[s+1] += size_starts[s];
+    for (uint32_t b=0; b < idx->num_buckets; b++)
+        by_size[size_starts[max_bucket - (starts[b+1] - starts[b])]++] = b;
+
+    // Place the buckets
+    idx->pilots = calloc(idx->num_buckets, sizeof(uint16_t));
+    uint32_t *positions = malloc(num * sizeof(uint32_t));
+    uint8_t *taken = calloc(idx->size, 1);
+    uint64_t *bucket_hashes = malloc(max_bucket * sizeof(uint64_t));
+    int failed = 0;
+    for (uint32_t i=0; i < idx->num_buckets && !failed; i++) {
+        uint32_t b = by_size[i];
+        int bucket_num = starts[b+1] - starts[b];
+        if (!bucket_num) break;
+        for (int j=0; j < bucket_num; j++)
+            bucket_hashes[j] = hashes[order[starts[b] + j]];
+        int pilot = place_bucket(bucket_hashes, bucket_num, taken, idx->size, positions + starts[b]);
+        if (pilot < 0) failed = 1;
+        idx->pilots[b] = pilot;
+    }
+
+    // Copy the names to their positions
+    size_t names_len = 0;
+    for (uint32_t i=0; i < num && !failed; i++)
+        names_len += strlen(names[i]) + 1;
+    if (names_len > MAX_NAMES_LEN) failed = 1;
+    if (!failed) {
+        idx->entries = calloc(idx->size, sizeof(uint32_t));
+        idx->names = malloc(names_len);
+        idx->names_len = names_len;
+        size_t offset = 0;
+        for (uint32_t i=0; i < num; i++) {
+            uint32_t n = order[i];
+            int len = strlen(names[n]) + 1;
+            memcpy(idx->names + offset, names[n], len);
+            idx->entries[positions[i]] = (offset << 3) | tags[n];
+            offset += len;
+        }
+    }
+
+    free(starts);
+    free(order);
+    free(fill);
+    free(by_size);
+    free(size_starts);
+    free(positions);
+    free(taken);
+    free(bucket_hashes);
+    if (failed) {
+        syslog(LOG_WARNING, "Failed to build the index of %u names", num);
+        free(idx->pilots);
+        free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+/**
+ * Finds the position of a name
+ * @arg idx The index to search
+ * @arg name The name to find, null terminated
+ * @arg hash The hash the name was indexed with
+ * @arg tag The tag the name was indexed with
+ * @return The position, or -1 if the name is not indexed.
+ */
+int name_index_find(name_index *idx, const char *name, uint64_t hash, int tag) {
+    uint16_t pilot = idx->pilots[fast_range(hash, idx->num_buckets)];
+    uint32_t pos = pilot_position(hash, pilot, idx->size);
+    uint32_t entry = idx->entries[pos];
+    if ((int)(entry & 7) != tag || strcmp(idx->names + (entry >> 3), name))
+        return -1;
+    return pos;
+}
+
+/**
+ * Returns the name at a position, or NULL if it is empty
+ */
+char* name_index_name(name_index *idx, uint32_t pos) {
+    uint32_t entry = idx->entries[pos];
+    return entry ? idx->names + (entry >> 3) : NULL;
+}
+
+/**
+ * Returns the tag of the name at a position, or 0 if it is empty
+ */
+int name_index_tag(name_index *idx, uint32_t pos) {
+    return idx->entries[pos] & 7;
+}
+
+/**
+ * Returns the memory used by the index, in bytes
+ */
+size_t name_index_bytes(name_index *idx) {
+    return sizeof(name_index) + idx->num_buckets * sizeof(uint16_t) +
+        idx->size * sizeof(uint32_t) + idx->names_len;
+}
+
+/**
+ * Takes another reference to an index
+ * @notes This method is thread safe.
+ */
+void name_index_ref(name_index *idx) {
+    __atomic_add_fetch(&idx->refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Gives back a reference to an index, and frees
+ * it when the last is given back
+ * @notes This method is thread safe.
+ */
+void name_index_release(name_index *idx) {
+    if (__atomic_sub_fetch(&idx->refs, 1, __ATOMIC_ACQ_REL)) return;
+    free(idx->pilots);
+    free(idx->entries);
+    free(idx->names);
+    free(idx);
+}
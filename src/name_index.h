@@ -0,0 +1,75 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A perfect hash index over a fixed set of names. Each name
+ * has its own position, found with a single probe, so a dense
+ * array can hold a value per name. The names are tagged, so the
+ * same name may be indexed under several tags. The index is
+ * immutable once built, and reference counted so it can be
+ * shared by several readers.
+ */
+typedef struct {
+    uint32_t num_names;     // Number of names indexed
+    uint32_t size;          // Number of positions, a few more than the names
+    uint32_t num_buckets;   // Number of buckets the names are hashed to
+    uint16_t *pilots;       // The pilot of each bucket, picks the positions of its names
+    uint32_t *entries;      // Offset of the name at each position << 3 | tag, 0 if empty
+    char *names;            // The null terminated names
+    size_t names_len;       // Size of the names
+    int refs;               // Number of references, freed on the last release
+} name_index;
+
+/**
+ * Builds an index over a set of names. The names are copied.
+ * The hashes must be distinct, and should mix in the tag if
+ * a name is indexed under several.
+ * @arg names The names to index, null terminated
+ * @arg hashes The hash of each name
+ * @arg tags The tag of each name, 1 to 7
+ * @arg num The number of names
+ * @return The index with a single reference, or NULL on failure.
+ */
+name_index* name_index_build(char **names, uint64_t *hashes, uint8_t *tags, uint32_t num);
+
+/**
+ * Finds the position of a name
+ * @arg idx The index to search
+ * @arg name The name to find, null terminated
+ * @arg hash The hash the name was indexed with
+ * @arg tag The tag the name was indexed with
+ * @return The position, or -1 if the name is not indexed.
+ */
+int name_index_find(name_index *idx, const char *name, uint64_t hash, int tag);
+
+/**
+ * Returns the name at a position, or NULL if it is empty
+ */
+char* name_index_name(name_index *idx, uint32_t pos);
+
+/**
+ * Returns the tag of the name at a position, or 0 if it is empty
+ */
+int name_index_tag(name_index *idx, uint32_t pos);
+
+/**
+ * Returns the memory used by the index, in bytes
+ */
+size_t name_index_bytes(name_index *idx);
+
+/**
+ * Takes another reference to an index
+ * @notes This method is thread safe.
+ */
+void name_index_ref(name_index *idx);
+
+/**
+ * Gives back a reference to an index, and frees
+ * it when the last is given back
+ * @notes This method is thread safe.
+ */
+void name_index_release(name_index *idx);
+
+#endif
@@ -4,16 +4,23 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "likely.h"
 #include "circqueue.h"
 #include "networking.h"
 #include "conn_handler.h"
+#include "binproto.h"
 #include "sink.h"
+#include "uring.h"
 
 // Length of string to represent maximum port of 65535
 #define MAX_PORT_LEN 6
@@ -37,13 +44,66 @@
  */
 #define BACKLOG_SIZE 64
 
+/**
+ * Each datagram of a UDP batch is received into its
+ * own slot of the connection buffer. The datagrams are
+ * then compacted to the front of the buffer, and the
+ * headroom leaves space for the newline appended to
+ * each GRO segment.
+ */
+#define UDP_SLOT_SIZE 65536
+#define UDP_SLOT_HEADROOM 256
+
+/**
+ * Sizes of the io_uring queues and provided buffers.
+ * TCP reads land in small buffers that are copied into
+ * the connection buffer, while each UDP datagram needs
+ * a buffer that fits the largest datagram.
+ */
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_TCP_BUFS 256
+#define URING_TCP_BUF_SIZE 16384
+#define URING_UDP_BUFS 64
+#define URING_UDP_BUF_SIZE (UDP_SLOT_SIZE - UDP_SLOT_HEADROOM)
+
+/**
+ * The provided buffer groups, and the kinds of requests.
+ * The kind is stored in the low bits of the user data,
+ * next to the connection pointer.
+ */
+#define URING_TCP_GROUP 0
+#define URING_UDP_GROUP 1
+#define URING_TAG_MASK 0x7
+#define URING_TAG_ACCEPT 1
+#define URING_TAG_RECV 2
+#define URING_TAG_UDP 3
+
 /**
  * Stores the thread specific user data.
  */
 typedef struct {
     statsite_networking *netconf;
+    int shard;      // Metrics shard updated by this thread
 } worker_ev_userdata;
 
+// Drives sockets of an event loop with io_uring
+typedef struct uring_backend uring_backend;
+
+/**
+ * Stores the state of an additional ingest thread.
+ * Each runs its own event loop over a UDP socket
+ * that shares the port using SO_REUSEPORT.
+ */
+typedef struct {
+    worker_ev_userdata data;
+    struct ev_loop* loop;
+    ev_io udp_client;
+    ev_async stop_watcher;
+    pthread_t thread;
+    uring_backend *uring;
+} ingest_worker;
+
 /**
  * Stores the connection specific data.
  * We initialize one of these per connection
@@ -51,9 +111,25 @@ typedef struct {
 struct conn_info {
     ev_io client;
     circular_buffer input;
+    int closing;    // Set while waiting for the io_uring receive to end
 };
 typedef struct conn_info conn_info;
 
+/**
+ * Stores the UDP connection specific data.
+ * The batch arrays have one entry per slot.
+ */
+typedef struct {
+    conn_info conn;
+    int batch_size;
+#ifdef __linux__
+    struct mmsghdr *msgs;
+    struct iovec *vectors;
+    char *control;
+#endif
+    int *seg_sizes;     // GRO segment size of each datagram, 0 if not coalesced
+} udp_conn_info;
+
 /**
  * Defines a structure that is
  * used to store the state of the networking
@@ -64,11 +140,33 @@ struct statsite_networking {
     struct ev_loop* loop;
     ev_io tcp_client;
     ev_io udp_client;
+    ev_io unix_stream_client;
+    ev_io unix_dgram_client;
     conn_info *stdin_client;
     ev_periodic flush_timer;
     sink* sinks;
+    ingest_worker *workers;
+    int num_workers;
+    uring_backend *uring;
 };
 
+#ifdef HAVE_IO_URING
+/**
+ * Stores the io_uring state of an event loop. The sockets
+ * it drives are taken off the event loop, and the loop
+ * only watches the ring for completions.
+ */
+struct uring_backend {
+    uring ring;
+    uring_buf_ring tcp_bufs;
+    uring_buf_ring udp_bufs;
+    struct msghdr udp_msg;  // Layout of the recvmsg results
+    ev_io watcher;          // Readable when completions are posted
+    ev_io *tcp_client;      // Listener driven by the ring, or NULL
+    ev_io *udp_client;      // UDP socket driven by the ring, or NULL
+};
+#endif
+
 
 // Static typedefs
 static void handle_flush_event(EV_P_ ev_periodic *watcher, int revents);
@@ -76,11 +174,17 @@ static void handle_new_client(EV_P_ ev_io *watcher, int ready_events);
 static void handle_udp_message(EV_P_ ev_io *watch, int ready_events);
 static void invoke_event_handler(EV_P_ ev_io *watch, int ready_events);
 static void close_client_connection(EV_P_ statsite_conn_info *conn);
+static void handle_worker_stop(EV_P_ ev_async *watcher, int revents);
+static void release_ingest_worker(ingest_worker *w);
+static uring_backend* setup_uring_backend(EV_P_ ev_io *tcp_client, ev_io *udp_client);
+static void release_uring_backend(EV_P_ uring_backend *b);
 
 
 // Utility methods
-static int set_client_sockopts(int client_fd);
+static int set_client_sockopts(int client_fd, int tcp);
 static conn_info* get_conn();
+static udp_conn_info* get_udp_conn(int batch_size);
+static void free_udp_conn(udp_conn_info *udp);
 
 /**
  * Initializes the TCP listener
@@ -151,15 +255,13 @@ static int setup_tcp_listener(statsite_networking *netconf) {
 }
 
 /**
- * Initializes the UDP Listener.
+ * Binds a non-blocking UDP socket, and allocates
+ * a connection object for it.
  * @arg netconf The network configuration
+ * @arg watcher The watcher to initialize for the socket
  * @return 0 on success.
  */
-static int setup_udp_listener(statsite_networking *netconf) {
-    if (netconf->config->udp_port == 0) {
-        syslog(LOG_INFO, "UDP port is disabled");
-        return 0;
-    }
+static int bind_udp_socket(statsite_networking *netconf, ev_io *watcher) {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
     int s;
@@ -192,6 +294,13 @@ static int setup_udp_listener(statsite_networking *netconf) {
             close(udp_listener_fd);
             continue;
         }
+        // Let the kernel balance datagrams across the ingest threads
+        if (netconf->config->ingest_threads > 1 &&
+            setsockopt(udp_listener_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval))) {
+            syslog(LOG_ERR, "Failed to set SO_REUSEPORT! Err: %s", strerror(errno));
+            close(udp_listener_fd);
+            continue;
+        }
         if (bind(udp_listener_fd, rp->ai_addr, rp->ai_addrlen) == 0)
             break;
         syslog(LOG_ERR, "Failed to bind on UDP socket! Err: %s", strerror(errno));
@@ -199,6 +308,7 @@ static int setup_udp_listener(statsite_networking *netconf) {
     }
     if (rp == NULL) {               /* No address succeeded */
         syslog(LOG_ERR, "Failed to bind on any UDP socket!\n");
+        freeaddrinfo(result);
         return 1;
     }
     freeaddrinfo(result);
@@ -206,24 +316,325 @@ static int setup_udp_listener(statsite_networking *netconf) {
     int flags = fcntl(udp_listener_fd, F_GETFL, 0);
     fcntl(udp_listener_fd, F_SETFL, flags | O_NONBLOCK);
 
+    // Let the kernel coalesce datagrams, we split them again
+    if (netconf->config->udp_gro) {
+#ifdef UDP_GRO
+        if (setsockopt(udp_listener_fd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval))) {
+            syslog(LOG_WARNING, "Failed to set UDP_GRO! Err: %s", strerror(errno));
+        }
+#else
+        syslog(LOG_WARNING, "UDP_GRO is not supported on this platform");
+#endif
+    }
+
     // Allocate a connection object for the UDP socket,
-    // ensure a min-buffer size of 64K
-    conn_info *conn = get_conn();
-    while (circbuf_avail_buf(&conn->input) < 65536) {
-        circbuf_grow_buf(&conn->input);
+    // with a slot in the buffer for each datagram of a batch
+    udp_conn_info *udp = get_udp_conn(netconf->config->udp_batch_size);
+    if (!udp) {
+        close(udp_listener_fd);
+        return 1;
+    }
+
+    // Create the libev objects
+    ev_io_init(watcher, handle_udp_message, udp_listener_fd, EV_READ);
+    watcher->data = udp;
+    return 0;
+}
+
+/**
+ * Initializes the UDP Listener.
+ * @arg netconf The network configuration
+ * @return 0 on success.
+ */
+static int setup_udp_listener(statsite_networking *netconf) {
+    if (netconf->config->udp_port == 0) {
+        syslog(LOG_INFO, "UDP port is disabled");
+        return 0;
+    }
+    if (bind_udp_socket(netconf, &netconf->udp_client)) {
+        return 1;
     }
-    netconf->udp_client.data = conn;
 
     syslog(LOG_INFO, "Listening on udp '%s:%d'.",
            netconf->config->bind_address, netconf->config->udp_port);
 
-    // Create the libev objects
-    ev_io_init(&netconf->udp_client, handle_udp_message,
-                udp_listener_fd, EV_READ);
     ev_io_start(netconf->loop, &netconf->udp_client);
     return 0;
 }
 
+/**
+ * Binds a non-blocking unix domain socket to a path.
+ * A socket left at the path by an earlier run is replaced.
+ * @arg path The path to bind
+ * @arg type SOCK_STREAM or SOCK_DGRAM
+ * @arg mode The permissions of the socket file
+ * @arg rcvbuf The receive buffer size, 0 for the default
+ * @return The socket, or -1 on error.
+ */
+static int bind_unix_socket(const char *path, int type, int mode, int rcvbuf) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        syslog(LOG_ERR, "Unix socket path is too long! Path: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, type, 0);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create unix socket! Err: %s", strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        syslog(LOG_ERR, "Failed to bind on unix socket '%s'! Err: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (chmod(path, mode)) {
+        syslog(LOG_ERR, "Failed to set permissions on unix socket '%s'! Err: %s", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    // Let bursts queue up in the kernel. Forcing the size past
+    // rmem_max needs privileges, so fall back to the capped size.
+    if (rcvbuf > 0) {
+        int res = -1;
+#ifdef SO_RCVBUFFORCE
+        res = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(int));
+#endif
+        if (res && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(int))) {
+            syslog(LOG_WARNING, "Failed to set SO_RCVBUF on unix socket '%s'! Err: %s", path, strerror(errno));
+        }
+    }
+
+    // Put the socket in non-blocking mode
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * Closes the unix domain sockets, and removes their paths
+ * @arg netconf The network configuration
+ */
+static void close_unix_listeners(statsite_networking *netconf) {
+    if (ev_is_active(&netconf->unix_stream_client)) {
+        ev_io_stop(netconf->loop, &netconf->unix_stream_client);
+        close(netconf->unix_stream_client.fd);
+        unlink(netconf->config->unix_stream_path);
+    }
+    if (ev_is_active(&netconf->unix_dgram_client)) {
+        ev_io_stop(netconf->loop, &netconf->unix_dgram_client);
+        close(netconf->unix_dgram_client.fd);
+        free_udp_conn(netconf->unix_dgram_client.data);
+        unlink(netconf->config->unix_dgram_path);
+    }
+}
+
+/**
+ * Closes all the listeners that were set up, and
+ * releases their connection state
+ * @arg netconf The network configuration
+ */
+static void close_listeners(statsite_networking *netconf) {
+    if (ev_is_active(&netconf->tcp_client)) {
+        ev_io_stop(netconf->loop, &netconf->tcp_client);
+        close(netconf->tcp_client.fd);
+    }
+    if (ev_is_active(&netconf->udp_client)) {
+        ev_io_stop(netconf->loop, &netconf->udp_client);
+        close(netconf->udp_client.fd);
+        free_udp_conn(netconf->udp_client.data);
+    }
+    close_unix_listeners(netconf);
+    if (netconf->stdin_client != NULL) {
+        close_client_connection(netconf->loop, netconf->stdin_client);
+        netconf->stdin_client = NULL;
+    }
+}
+
+/**
+ * Initializes the unix domain socket listeners. Stream
+ * clients are handled like TCP clients, and datagrams
+ * like UDP datagrams.
+ * @arg netconf The network configuration
+ * @return 0 on success.
+ */
+static int setup_unix_listeners(statsite_networking *netconf) {
+    statsite_config *config = netconf->config;
+    if (config->unix_stream_path) {
+        int fd = bind_unix_socket(config->unix_stream_path, SOCK_STREAM,
+                config->unix_socket_mode, config->unix_rcvbuf);
+        if (fd == -1) return 1;
+        if (listen(fd, BACKLOG_SIZE) != 0) {
+            syslog(LOG_ERR, "Failed to listen on unix socket! Err: %s", strerror(errno));
+            close(fd);
+            unlink(config->unix_stream_path);
+            return 1;
+        }
+        ev_io_init(&netconf->unix_stream_client, handle_new_client, fd, EV_READ);
+        ev_io_start(netconf->loop, &netconf->unix_stream_client);
+        syslog(LOG_INFO, "Listening on unix stream '%s'.", config->unix_stream_path);
+    }
+
+    if (config->unix_dgram_path) {
+        int fd = bind_unix_socket(config->unix_dgram_path, SOCK_DGRAM,
+                config->unix_socket_mode, config->unix_rcvbuf);
+        udp_conn_info *udp = (fd == -1) ? NULL : get_udp_conn(config->udp_batch_size);
+        if (!udp) {
+            if (fd != -1) {
+                close(fd);
+                unlink(config->unix_dgram_path);
+            }
+            close_unix_listeners(netconf);
+            return 1;
+        }
+        ev_io_init(&netconf->unix_dgram_client, handle_udp_message, fd, EV_READ);
+        netconf->unix_dgram_client.data = udp;
+        ev_io_start(netconf->loop, &netconf->unix_dgram_client);
+        syslog(LOG_INFO, "Listening on unix datagram '%s'.", config->unix_dgram_path);
+    }
+    return 0;
+}
+
+/**
+ * Prepares the additional ingest threads. Each gets its
+ * own event loop and UDP socket, but they are not started.
+ * @arg netconf The network configuration
+ * @return 0 on success.
+ */
+static int setup_ingest_workers(statsite_networking *netconf) {
+    int num_workers = netconf->config->ingest_threads - 1;
+    if (num_workers == 0) return 0;
+    if (netconf->config->udp_port == 0) {
+        syslog(LOG_WARNING, "UDP port is disabled, ignoring %d extra ingest threads", num_workers);
+        return 0;
+    }
+
+    netconf->workers = calloc(num_workers, sizeof(ingest_worker));
+    for (int i=0; i < num_workers; i++) {
+        ingest_worker *w = netconf->workers+i;
+        w->loop = ev_loop_new(ev_backend(netconf->loop));
+        if (!w->loop) {
+            syslog(LOG_CRIT, "Failed to initialize libev for ingest thread %d!", i+1);
+            return 1;
+        }
+        w->data.netconf = netconf;
+        w->data.shard = i+1;
+        ev_set_userdata(w->loop, &w->data);
+        netconf->num_workers++;
+
+        if (bind_udp_socket(netconf, &w->udp_client)) {
+            return 1;
+        }
+        ev_io_start(w->loop, &w->udp_client);
+        if (netconf->config->use_io_uring) {
+            w->uring = setup_uring_backend(w->loop, NULL, &w->udp_client);
+        }
+
+        ev_async_init(&w->stop_watcher, handle_worker_stop);
+        ev_async_start(w->loop, &w->stop_watcher);
+    }
+
+    syslog(LOG_INFO, "Using %d ingest threads for udp.", num_workers+1);
+    return 0;
+}
+
+/**
+ * Entry point of the additional ingest threads.
+ * Runs the event loop until stopped.
+ */
+static void* ingest_worker_main(void *arg) {
+    ingest_worker *w = arg;
+    ev_run(w->loop, 0);
+    return NULL;
+}
+
+/**
+ * Starts the additional ingest threads. Must be called
+ * after the connection handlers are initialized.
+ * @arg netconf The network configuration
+ * @return 0 on success.
+ */
+static int start_ingest_workers(statsite_networking *netconf) {
+    // Leave the signal handling to the main thread
+    sigset_t oldset;
+    sigset_t newset;
+    sigfillset(&newset);
+    pthread_sigmask(SIG_BLOCK, &newset, &oldset);
+
+    int err = 0;
+    for (int i=0; i < netconf->num_workers; i++) {
+        ingest_worker *w = netconf->workers+i;
+        err = pthread_create(&w->thread, NULL, ingest_worker_main, w);
+        if (err) {
+            // Close the remaining sockets so the kernel
+            // does not route datagrams to them
+            syslog(LOG_ERR, "Failed to spawn ingest thread: %s", strerror(err));
+            for (int j=i; j < netconf->num_workers; j++) {
+                release_ingest_worker(netconf->workers+j);
+            }
+            netconf->num_workers = i;
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    return err;
+}
+
+/**
+ * Releases the socket and event loop of an ingest thread.
+ * The thread must not be running.
+ */
+static void release_ingest_worker(ingest_worker *w) {
+    if (w->uring) {
+        release_uring_backend(w->loop, w->uring);
+        w->uring = NULL;
+    }
+    if (w->udp_client.data) {
+        ev_io_stop(w->loop, &w->udp_client);
+        close(w->udp_client.fd);
+        free_udp_conn(w->udp_client.data);
+    }
+    ev_async_stop(w->loop, &w->stop_watcher);
+    ev_loop_destroy(w->loop);
+}
+
+/**
+ * Stops and joins the additional ingest threads,
+ * and releases their sockets and event loops.
+ * @arg netconf The network configuration
+ * @arg started Were the threads started
+ */
+static void shutdown_ingest_workers(statsite_networking *netconf, int started) {
+    for (int i=0; i < netconf->num_workers; i++) {
+        ingest_worker *w = netconf->workers+i;
+        if (started) {
+            ev_async_send(w->loop, &w->stop_watcher);
+            pthread_join(w->thread, NULL);
+        }
+        release_ingest_worker(w);
+    }
+    free(netconf->workers);
+    netconf->workers = NULL;
+    netconf->num_workers = 0;
+}
+
+/**
+ * Invoked in an ingest thread when it should stop.
+ */
+static void handle_worker_stop(EV_P_ ev_async *watcher, int revents) {
+    ev_break(EV_A_ EVBREAK_ALL);
+}
+
 /**
  * Initializes the stdin listener.
  * @arg netconf The network configuration
@@ -240,6 +651,7 @@ static int setup_stdin_listener(statsite_networking *netconf) {
 
     // Create an associated conn object
     conn_info *conn = get_conn();
+    if (!conn) return 1;
     netconf->stdin_client = conn;
 
     // Initialize the libev stuff
@@ -287,6 +699,7 @@ int init_networking(statsite_config *config, statsite_networking **netconf_out,
     // Setup the TCP listener
     res = setup_tcp_listener(netconf);
     if (res != 0) {
+        close_listeners(netconf);
         free(netconf);
         return 1;
     }
@@ -294,14 +707,34 @@ int init_networking(statsite_config *config, statsite_networking **netconf_out,
     // Setup the UDP listener
     res = setup_udp_listener(netconf);
     if (res != 0) {
-        if (ev_is_active(&netconf->tcp_client)) {
-            ev_io_stop(netconf->loop, &netconf->tcp_client);
-            close(netconf->tcp_client.fd);
-        }
+        close_listeners(netconf);
+        free(netconf);
+        return 1;
+    }
+
+    // Setup the unix domain sockets
+    res = setup_unix_listeners(netconf);
+    if (res != 0) {
+        close_listeners(netconf);
         free(netconf);
         return 1;
     }
 
+    // Setup the additional ingest threads
+    res = setup_ingest_workers(netconf);
+    if (res != 0) {
+        shutdown_ingest_workers(netconf, 0);
+        close_listeners(netconf);
+        free(netconf);
+        return 1;
+    }
+
+    // Move the sockets to io_uring. If it is not
+    // available, libev keeps watching them.
+    if (config->use_io_uring) {
+        netconf->uring = setup_uring_backend(netconf->loop, &netconf->tcp_client, &netconf->udp_client);
+    }
+
     // Setup sinks
     netconf->sinks = sinks;
 
@@ -312,6 +745,10 @@ int init_networking(statsite_config *config, statsite_networking **netconf_out,
     // Prepare the conn handlers
     init_conn_handler(config);
 
+    // Start ingesting on the other threads. Any that
+    // failed to start are dropped, the rest keep running.
+    start_ingest_workers(netconf);
+
     // Success!
     *netconf_out = netconf;
     return 0;
@@ -337,7 +774,7 @@ static void handle_flush_event(EV_P_ ev_periodic *watcher, int revents) {
 static void handle_new_client(EV_P_ ev_io *watcher, int ready_events) {
     // Accept the client connection
     int listen_fd = watcher->fd;
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
     bzero(&client_addr, sizeof(client_addr));
 
@@ -352,16 +789,26 @@ static void handle_new_client(EV_P_ ev_io *watcher, int ready_events) {
     }
 
     // Setup the socket
-    if (set_client_sockopts(client_fd)) {
+    int is_unix = client_addr.ss_family == AF_UNIX;
+    if (set_client_sockopts(client_fd, !is_unix)) {
         return;
     }
 
     // Debug info
-    syslog(LOG_DEBUG, "Accepted client connection: %s %d [%d]",
-            inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), client_fd);
+    if (is_unix) {
+        syslog(LOG_DEBUG, "Accepted unix client connection [%d]", client_fd);
+    } else {
+        struct sockaddr_in *addr = (struct sockaddr_in*)&client_addr;
+        syslog(LOG_DEBUG, "Accepted client connection: %s %d [%d]",
+                inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), client_fd);
+    }
 
     // Get the associated conn object
     conn_info *conn = get_conn();
+    if (!conn) {
+        close(client_fd);
+        return;
+    }
 
     // Initialize the libev stuff
     ev_io_init(&conn->client, invoke_event_handler, client_fd, EV_READ);
@@ -382,12 +829,13 @@ static int read_client_data(conn_info *conn) {
      * a multiplier.
      */
     int avail_buf = circbuf_avail_buf(&conn->input);
-    if (avail_buf < conn->input.buf_size / 2) {
-        circbuf_grow_buf(&conn->input);
+    if (avail_buf < conn->input.buf_size / 2 && circbuf_grow_buf(&conn->input) && !avail_buf) {
+        syslog(LOG_ERR, "Failed to grow connection buffer! [%d]", conn->client.fd);
+        return 1;
     }
 
     // Build the IO vectors to perform the read
-    struct iovec vectors[2];
+    struct iovec vectors[1];
     int num_vectors;
     circbuf_setup_readv_iovec(&conn->input, (struct iovec*)&vectors, &num_vectors);
 
@@ -415,61 +863,198 @@ static int read_client_data(conn_info *conn) {
 
 
 /**
- * Invoked when a UDP connection has a message ready to be read.
- * We need to take care to add the data to our buffers, and then
- * invoke the connection handlers who have the business logic
- * of what to do.
+ * Receives a batch of datagrams, each into its own slot
+ * of the connection buffer.
+ * @arg udp The UDP connection
+ * @arg fd The socket to read from
+ * @arg lens Output. The length of each datagram.
+ * @return The number of datagrams, 0 if there are none.
  */
-static void handle_udp_message(EV_P_ ev_io *watch, int ready_events) {
-    while (1) {
-        // Get the associated connection struct
-        conn_info *conn = watch->data;
+static int recv_udp_batch(udp_conn_info *udp, int fd, int *lens) {
+    char *buffer = udp->conn.input.buffer;
+#ifdef __linux__
+    size_t control_len = CMSG_SPACE(sizeof(int));
+    for (int i=0; i < udp->batch_size; i++) {
+        struct msghdr *hdr = &udp->msgs[i].msg_hdr;
+        udp->vectors[i].iov_base = buffer + i * UDP_SLOT_SIZE + UDP_SLOT_HEADROOM;
+        udp->vectors[i].iov_len = UDP_SLOT_SIZE - UDP_SLOT_HEADROOM - 1;
+        hdr->msg_iov = udp->vectors + i;
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = udp->control + i * control_len;
+        hdr->msg_controllen = control_len;
+        hdr->msg_flags = 0;
+    }
 
-        // Clear the input buffer
-        circbuf_clear(&conn->input);
-
-        // Build the IO vectors to perform the read
-        struct iovec vectors[2];
-        int num_vectors;
-        circbuf_setup_readv_iovec(&conn->input, (struct iovec*)&vectors, &num_vectors);
-
-        /*
-         * Issue the read, always use the first vector.
-         * since we just cleared the buffer, and it should
-         * be a contiguous buffer.
-         */
-        assert(num_vectors == 1);
-        ssize_t read_bytes = recv(watch->fd, vectors[0].iov_base,
-                                    vectors[0].iov_len, 0);
-
-        // Make sure we actually read something
-        if (read_bytes == 0) {
-            syslog(LOG_DEBUG, "Got empty UDP packet. [%d]\n", watch->fd);
-            return;
-
-        } else if (read_bytes == -1) {
-            if (errno != EAGAIN && errno != EINTR) {
-                syslog(LOG_ERR, "Failed to recv() from connection [%d]! %s.",
-                        watch->fd, strerror(errno));
+    int num = recvmmsg(fd, udp->msgs, udp->batch_size, 0, NULL);
+    if (num == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            syslog(LOG_ERR, "Failed to recvmmsg() from connection [%d]! %s.",
+                    fd, strerror(errno));
+        }
+        return 0;
+    }
+
+    for (int i=0; i < num; i++) {
+        struct msghdr *hdr = &udp->msgs[i].msg_hdr;
+        lens[i] = udp->msgs[i].msg_len;
+        udp->seg_sizes[i] = 0;
+
+        // Drop anything that did not fit in the slot
+        if (hdr->msg_flags & MSG_TRUNC) {
+            syslog(LOG_WARNING, "Dropped truncated UDP packet. [%d]", fd);
+            lens[i] = 0;
+            continue;
+        }
+#ifdef UDP_GRO
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                memcpy(udp->seg_sizes+i, CMSG_DATA(cmsg), sizeof(int));
             }
-            return;
         }
+#endif
+    }
+    return num;
+#else
+    ssize_t read_bytes = recv(fd, buffer + UDP_SLOT_HEADROOM,
+                              UDP_SLOT_SIZE - UDP_SLOT_HEADROOM - 1, 0);
+    if (read_bytes == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            syslog(LOG_ERR, "Failed to recv() from connection [%d]! %s.",
+                    fd, strerror(errno));
+        }
+        return 0;
+    }
+    lens[0] = read_bytes;
+    udp->seg_sizes[0] = 0;
+    return 1;
+#endif
+}
 
-        // Update the write cursor
-        circbuf_advance_write(&conn->input, read_bytes);
+/**
+ * Returns the length of the whole binary messages at the start
+ * of a datagram segment. The datagrams are handled back to back,
+ * so after a bad or cut off message the rest of the segment can
+ * not be framed, and is dropped.
+ * @arg seg The segment, starting with the magic byte
+ * @arg len The length of the segment
+ * @return The length to keep.
+ */
+static int binary_segment_len(char *seg, int len) {
+    binproto_header header;
+    int off = 0, size;
+    while (off < len && (unsigned char)seg[off] == BINARY_MAGIC_BYTE) {
+        size = (len - off >= 2) ? binproto_header_size(seg[off + 1]) : -1;
+        if (size == -1 || len - off < size ||
+                binproto_decode_header((unsigned char*)seg + off, &header) == -1 ||
+                len - off < size + header.key_len + header.set_len) {
+            syslog(LOG_WARNING, "Dropped malformed binary message in UDP packet.");
+            return off;
+        }
+        off += size + header.key_len + header.set_len;
+    }
+    return len;
+}
+
+/**
+ * Appends a datagram at the write cursor of the connection
+ * buffer. Coalesced datagrams are split back into their
+ * segments, and every ASCII segment is terminated by a newline.
+ * The buffer must have room for the datagram and the headroom.
+ * @arg udp The UDP connection
+ * @arg data The datagram, may be in the connection buffer past the write cursor
+ * @arg len The length of the datagram
+ * @arg seg_size The GRO segment size, 0 if not coalesced
+ */
+static void append_udp_datagram(udp_conn_info *udp, char *data, int len, int seg_size) {
+    if (len == 0) return;
+    if (seg_size <= 0) seg_size = len;
+
+    // Each segment may grow by a newline, the headroom must cover it
+    if (unlikely(len / seg_size >= UDP_SLOT_HEADROOM)) {
+        syslog(LOG_WARNING, "Dropped UDP packet with too many segments.");
+        return;
+    }
+
+    char *buffer = udp->conn.input.buffer;
+    uint64_t start = udp->conn.input.write_cursor;
+    uint64_t out = start;
+    for (int off=0; off < len; off += seg_size) {
+        int seg_len = (len - off < seg_size) ? len - off : seg_size;
+        if ((unsigned char)data[off] == BINARY_MAGIC_BYTE) {
+            seg_len = binary_segment_len(data + off, seg_len);
+            if (seg_len == 0) continue;
+        }
+        memmove(buffer + out, data + off, seg_len);
+        out += seg_len;
 
         // UDP clients don't need to append newlines to the messages like
         // TCP clients do, but our parser requires them.  Append one if
-        // it's not present.
-        if (conn->input.buffer[conn->input.write_cursor - 1] != '\n')
-            circbuf_write(&conn->input, "\n", 1);
+        // it's not present. Binary messages are framed already.
+        if (buffer[out - 1] != '\n' && (unsigned char)buffer[out - seg_len] != BINARY_MAGIC_BYTE)
+            buffer[out++] = '\n';
+    }
+    circbuf_advance_write(&udp->conn.input, out - start);
+}
+
+/**
+ * Compacts a batch of datagrams to the front of the
+ * connection buffer.
+ * @arg udp The UDP connection
+ * @arg num The number of datagrams in the batch
+ * @arg lens The length of each datagram
+ */
+static void compact_udp_batch(udp_conn_info *udp, int num, int *lens) {
+    char *buffer = udp->conn.input.buffer;
+    for (int i=0; i < num; i++) {
+        char *slot = buffer + i * UDP_SLOT_SIZE + UDP_SLOT_HEADROOM;
+        append_udp_datagram(udp, slot, lens[i], udp->seg_sizes[i]);
+    }
+}
 
-        // Get the user data
-        worker_ev_userdata *data = ev_userdata(EV_A);
+/**
+ * Invokes the connection handler on a batch of datagrams
+ * in the connection buffer.
+ * @arg udp The UDP connection
+ * @arg num The number of datagrams in the batch
+ */
+static void handle_udp_batch(EV_P_ udp_conn_info *udp, int num) {
+    worker_ev_userdata *data = ev_userdata(EV_A);
+    statsite_config *config = data->netconf->config;
+    statsite_conn_handler handle = {config, &udp->conn, data->shard};
+
+    // Track how full our batches are
+    if (config->udp_batch_timer)
+        record_internal_sample(&handle, TIMER, config->udp_batch_timer, num);
+
+    // Invoke the connection handler on the whole batch. A bad
+    // line is skipped and only stops the handler, so resume
+    // after it. Stop if the input can not be framed anymore.
+    while (handle_client_connect(&handle) == 1 && available_bytes(&udp->conn));
+}
+
+/**
+ * Invoked when a UDP connection has messages ready to be read.
+ * We receive a batch of datagrams at a time into our buffers,
+ * and then invoke the connection handlers who have the business
+ * logic of what to do.
+ */
+static void handle_udp_message(EV_P_ ev_io *watch, int ready_events) {
+    // Get the associated connection struct
+    udp_conn_info *udp = watch->data;
+    int lens[udp->batch_size];
+
+    while (1) {
+        // Clear the input buffer
+        circbuf_clear(&udp->conn.input);
 
-        // Invoke the connection handler
-        statsite_conn_handler handle = {data->netconf->config, watch->data};
-        handle_client_connect(&handle);
+        int num = recv_udp_batch(udp, watch->fd, lens);
+        if (num == 0) return;
+
+        compact_udp_batch(udp, num, lens);
+        handle_udp_batch(EV_A_ udp, num);
+
+        // A partial batch means the socket is drained
+        if (num < udp->batch_size) return;
     }
 }
 
@@ -493,12 +1078,332 @@ static void invoke_event_handler(EV_P_ ev_io *watcher, int ready_events) {
     }
 
     // Invoke the connection handler, and close connection on error
-    statsite_conn_handler handle = {data->netconf->config, watcher->data};
+    statsite_conn_handler handle = {data->netconf->config, watcher->data, data->shard};
     if (handle_client_connect(&handle) && watcher->fd != STDIN_FILENO)
         close_client_connection(EV_A_ conn);
 }
 
 
+#ifdef HAVE_IO_URING
+/**
+ * Starts a multishot accept on the TCP listener. Falls
+ * back to libev if the ring is full.
+ */
+static void arm_uring_accept(EV_P_ uring_backend *b) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&b->ring);
+    if (!sqe) {
+        syslog(LOG_WARNING, "io_uring is full, accepting with libev.");
+        ev_io_start(EV_A_ b->tcp_client);
+        b->tcp_client = NULL;
+        return;
+    }
+    uring_prep_multishot_accept(sqe, b->tcp_client->fd, URING_TAG_ACCEPT);
+}
+
+/**
+ * Starts a multishot receive on a client connection.
+ * Falls back to libev if the ring is full.
+ */
+static void arm_uring_recv(EV_P_ uring_backend *b, conn_info *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&b->ring);
+    if (!sqe) {
+        ev_io_start(EV_A_ &conn->client);
+        return;
+    }
+    uring_prep_multishot_recv(sqe, conn->client.fd, URING_TCP_GROUP,
+            (uintptr_t)conn | URING_TAG_RECV);
+}
+
+/**
+ * Starts a multishot recvmsg on the UDP socket. Falls
+ * back to libev if the ring is full.
+ */
+static void arm_uring_udp(EV_P_ uring_backend *b) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&b->ring);
+    if (!sqe) {
+        syslog(LOG_WARNING, "io_uring is full, receiving UDP with libev.");
+        ev_io_start(EV_A_ b->udp_client);
+        b->udp_client = NULL;
+        return;
+    }
+    uring_prep_multishot_recvmsg(sqe, b->udp_client->fd, &b->udp_msg,
+            URING_UDP_GROUP, URING_TAG_UDP);
+}
+
+/**
+ * Handles the completion of an accept. Each accepted
+ * client gets a receive on the ring.
+ */
+static void handle_uring_accept(EV_P_ uring_backend *b, struct io_uring_cqe *cqe) {
+    if (cqe->res >= 0) {
+        int client_fd = cqe->res;
+        if (!set_client_sockopts(client_fd, 1)) {
+            syslog(LOG_DEBUG, "Accepted client connection. [%d]", client_fd);
+
+            // Keep the watcher ready in case we fall back to libev
+            conn_info *conn = get_conn();
+            if (conn) {
+                ev_io_init(&conn->client, invoke_event_handler, client_fd, EV_READ);
+                arm_uring_recv(EV_A_ b, conn);
+            } else {
+                close(client_fd);
+            }
+        }
+
+    } else if (cqe->res == -EINVAL) {
+        // Multishot accept needs Linux 5.19
+        syslog(LOG_WARNING, "io_uring can not accept, accepting with libev.");
+        ev_io_start(EV_A_ b->tcp_client);
+        b->tcp_client = NULL;
+        return;
+
+    } else {
+        syslog(LOG_ERR, "Failed to accept() connection! %s.", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) arm_uring_accept(EV_A_ b);
+}
+
+/**
+ * Handles a receive on a client connection. The data is
+ * copied into the connection buffer, and the buffer goes
+ * straight back to the kernel. A connection is only freed
+ * once its multishot receive has ended.
+ */
+static void handle_uring_recv(EV_P_ uring_backend *b, conn_info *conn, struct io_uring_cqe *cqe) {
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    if (cqe->res > 0) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn->closing) {
+            if (circbuf_write(&conn->input, uring_buf(&b->tcp_bufs, bid), cqe->res)) {
+                syslog(LOG_ERR, "Failed to grow connection buffer! [%d]", conn->client.fd);
+                conn->closing = 1;
+                if (more) shutdown(conn->client.fd, SHUT_RDWR);
+            }
+        }
+        uring_recycle_buf(&b->tcp_bufs, bid);
+
+        // Invoke the connection handler, and close connection on error
+        if (!conn->closing) {
+            worker_ev_userdata *data = ev_userdata(EV_A);
+            statsite_conn_handler handle = {data->netconf->config, conn, data->shard};
+            if (handle_client_connect(&handle)) {
+                // Ends the receive, it completes with a zero length
+                conn->closing = 1;
+                if (more) shutdown(conn->client.fd, SHUT_RDWR);
+            }
+        }
+
+    } else if (cqe->res == 0) {
+        syslog(LOG_DEBUG, "Closed client connection. [%d]\n", conn->client.fd);
+        conn->closing = 1;
+
+    } else if (cqe->res == -EINVAL && !conn->closing) {
+        // Multishot receive needs Linux 6.0
+        ev_io_start(EV_A_ &conn->client);
+        return;
+
+    } else if (cqe->res != -ENOBUFS) {
+        if (!conn->closing) {
+            syslog(LOG_ERR, "Failed to read() from connection [%d]! %s.",
+                    conn->client.fd, strerror(-cqe->res));
+        }
+        conn->closing = 1;
+    }
+
+    // The receive stops when it errors or runs out of buffers
+    if (!more) {
+        if (conn->closing)
+            close_client_connection(EV_A_ conn);
+        else
+            arm_uring_recv(EV_A_ b, conn);
+    }
+}
+
+/**
+ * Handles a datagram received on the UDP socket. Datagrams
+ * are gathered into the connection buffer, which is handed
+ * to the connection handler once it is full.
+ * @arg num The number of datagrams in the buffer. Updated.
+ */
+static void handle_uring_datagram(EV_P_ uring_backend *b, struct io_uring_cqe *cqe, int *num) {
+    udp_conn_info *udp = b->udp_client->data;
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char *buf = uring_buf(&b->udp_bufs, bid);
+
+        // The buffer holds a header, the control messages and the payload
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out*)buf;
+        char *control = buf + sizeof(struct io_uring_recvmsg_out) + b->udp_msg.msg_namelen;
+        char *payload = control + b->udp_msg.msg_controllen;
+
+        if (out->flags & MSG_TRUNC) {
+            syslog(LOG_WARNING, "Dropped truncated UDP packet. [%d]", b->udp_client->fd);
+        } else {
+            int seg_size = 0;
+#ifdef UDP_GRO
+            struct msghdr hdr = {.msg_control = control, .msg_controllen = out->controllen};
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    memcpy(&seg_size, CMSG_DATA(cmsg), sizeof(int));
+                }
+            }
+#endif
+            // Handle the gathered datagrams if this one does not fit
+            circular_buffer *input = &udp->conn.input;
+            if (input->buf_size - input->write_cursor < out->payloadlen + UDP_SLOT_HEADROOM) {
+                handle_udp_batch(EV_A_ udp, *num);
+                circbuf_clear(input);
+                *num = 0;
+            }
+            append_udp_datagram(udp, payload, out->payloadlen, seg_size);
+            (*num)++;
+        }
+        uring_recycle_buf(&b->udp_bufs, bid);
+
+    } else if (cqe->res == -EINVAL) {
+        // Multishot recvmsg needs Linux 6.0
+        syslog(LOG_WARNING, "io_uring can not receive, receiving UDP with libev.");
+        ev_io_start(EV_A_ b->udp_client);
+        b->udp_client = NULL;
+        return;
+
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+        syslog(LOG_ERR, "Failed to recvmsg() from connection [%d]! %s.",
+                b->udp_client->fd, strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) arm_uring_udp(EV_A_ b);
+}
+
+/**
+ * Invoked when completions are posted to the ring. Handles
+ * all of them, then submits the requests they started.
+ */
+static void handle_uring_completions(EV_P_ ev_io *watcher, int ready_events) {
+    uring_backend *b = watcher->data;
+    udp_conn_info *udp = (b->udp_client) ? b->udp_client->data : NULL;
+    int datagrams = 0;
+    if (udp) circbuf_clear(&udp->conn.input);
+
+    uring_flush_overflow(&b->ring);
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&b->ring))) {
+        void *ptr = (void*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_TAG_MASK);
+        switch (cqe->user_data & URING_TAG_MASK) {
+            case URING_TAG_ACCEPT:
+                if (b->tcp_client) handle_uring_accept(EV_A_ b, cqe);
+                break;
+            case URING_TAG_RECV:
+                handle_uring_recv(EV_A_ b, ptr, cqe);
+                break;
+            case URING_TAG_UDP:
+                if (b->udp_client) handle_uring_datagram(EV_A_ b, cqe, &datagrams);
+                break;
+        }
+        uring_cqe_seen(&b->ring);
+    }
+
+    // Handle the datagrams gathered from this round
+    if (datagrams) handle_udp_batch(EV_A_ udp, datagrams);
+
+    int res = uring_submit(&b->ring);
+    if (res < 0) {
+        syslog(LOG_ERR, "Failed to submit to io_uring! %s.", strerror(-res));
+    }
+}
+
+/**
+ * Moves the TCP listener and the UDP socket of an event
+ * loop to io_uring. The sockets stay with libev if the ring
+ * can not be set up.
+ * @arg tcp_client The TCP listener, or NULL
+ * @arg udp_client The UDP socket, or NULL
+ * @return The backend, or NULL if io_uring is not available.
+ */
+static uring_backend* setup_uring_backend(EV_P_ ev_io *tcp_client, ev_io *udp_client) {
+    if (tcp_client && !ev_is_active(tcp_client)) tcp_client = NULL;
+    if (udp_client && !ev_is_active(udp_client)) udp_client = NULL;
+    if (!tcp_client && !udp_client) return NULL;
+
+    uring_backend *b = calloc(1, sizeof(uring_backend));
+    int res = uring_init(&b->ring, URING_ENTRIES, URING_CQ_ENTRIES);
+    if (res) {
+        syslog(LOG_WARNING, "Failed to setup io_uring, using libev! %s.", strerror(-res));
+        free(b);
+        return NULL;
+    }
+
+    // Provided buffer rings need Linux 5.19
+    if (tcp_client)
+        res = uring_setup_buf_ring(&b->ring, &b->tcp_bufs, URING_TCP_GROUP,
+                URING_TCP_BUFS, URING_TCP_BUF_SIZE);
+    if (!res && udp_client)
+        res = uring_setup_buf_ring(&b->ring, &b->udp_bufs, URING_UDP_GROUP,
+                URING_UDP_BUFS, URING_UDP_BUF_SIZE);
+    if (res) {
+        syslog(LOG_WARNING, "Failed to setup io_uring buffers, using libev! %s.", strerror(-res));
+        uring_free_buf_ring(&b->ring, &b->tcp_bufs);
+        uring_destroy(&b->ring);
+        free(b);
+        return NULL;
+    }
+
+    // Take the sockets off the event loop
+    if (tcp_client) {
+        ev_io_stop(EV_A_ tcp_client);
+        b->tcp_client = tcp_client;
+        arm_uring_accept(EV_A_ b);
+    }
+    if (udp_client) {
+        ev_io_stop(EV_A_ udp_client);
+        b->udp_client = udp_client;
+        b->udp_msg.msg_controllen = CMSG_SPACE(sizeof(int));
+        arm_uring_udp(EV_A_ b);
+    }
+    uring_submit(&b->ring);
+
+    // Watch the ring for completions instead
+    ev_io_init(&b->watcher, handle_uring_completions, b->ring.fd, EV_READ);
+    b->watcher.data = b;
+    ev_io_start(EV_A_ &b->watcher);
+
+    syslog(LOG_INFO, "Using io_uring for %s%s%s.", (tcp_client) ? "tcp" : "",
+            (tcp_client && udp_client) ? " and " : "", (udp_client) ? "udp" : "");
+    return b;
+}
+
+/**
+ * Tears down a ring, and closes the sockets it drives.
+ * Sockets that fell back to libev are left to the caller.
+ */
+static void release_uring_backend(EV_P_ uring_backend *b) {
+    ev_io_stop(EV_A_ &b->watcher);
+    uring_free_buf_ring(&b->ring, &b->tcp_bufs);
+    uring_free_buf_ring(&b->ring, &b->udp_bufs);
+    uring_destroy(&b->ring);
+    if (b->tcp_client) {
+        close(b->tcp_client->fd);
+    }
+    if (b->udp_client) {
+        close(b->udp_client->fd);
+        free_udp_conn(b->udp_client->data);
+        b->udp_client->data = NULL;
+    }
+    free(b);
+}
+
+#else
+static uring_backend* setup_uring_backend(EV_P_ ev_io *tcp_client, ev_io *udp_client) {
+    syslog(LOG_WARNING, "io_uring is not supported on this platform, using libev.");
+    return NULL;
+}
+
+static void release_uring_backend(EV_P_ uring_backend *b) {
+}
+#endif
+
+
 /**
  * Entry point for main thread to enter the networking
  * stack. This method blocks indefinitely until the
@@ -531,20 +1436,18 @@ void enter_networking_loop(statsite_networking *netconf, volatile int *signum) {
  * @arg netconf The config for the networking stack.
  */
 int shutdown_networking(statsite_networking *netconf) {
-    // Stop listening for new connections
-    if (ev_is_active(&netconf->tcp_client)) {
-        ev_io_stop(netconf->loop, &netconf->tcp_client);
-        close(netconf->tcp_client.fd);
-    }
-    if (ev_is_active(&netconf->udp_client)) {
-        ev_io_stop(netconf->loop, &netconf->udp_client);
-        close(netconf->udp_client.fd);
-    }
-    if (netconf->stdin_client != NULL) {
-        close_client_connection(netconf->loop, netconf->stdin_client);
-        netconf->stdin_client = NULL;
+    // Stop the ingest threads first
+    shutdown_ingest_workers(netconf, 1);
+
+    // Release the sockets driven by io_uring
+    if (netconf->uring) {
+        release_uring_backend(netconf->loop, netconf->uring);
+        netconf->uring = NULL;
     }
 
+    // Stop listening for new connections
+    close_listeners(netconf);
+
     // Stop the other timers
     ev_periodic_stop(netconf->loop, &netconf->flush_timer);
 
@@ -591,97 +1494,28 @@ void close_client_connection(EV_P_ conn_info *conn) {
  * This method is used to conveniently extract commands from the
  * command buffer. It scans up to a terminator, and then sets the
  * buf to the start of the buffer, and buf_len to the length
- * of the buffer. The output param should_free indicates that
- * the caller should free the buffer pointed to by buf when it is finished.
+ * of the buffer. The command is always contiguous in the buffer.
  * This method consumes the bytes from the underlying buffer, freeing
  * space for later reads.
  * @arg conn The client connection
  * @arg terminator The terminator charactor to look for. Replaced by null terminator.
  * @arg buf Output parameter, sets the start of the buffer.
  * @arg buf_len Output parameter, the length of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if the terminator is not found.
  */
-int extract_to_terminator(statsite_conn_info *conn, char terminator, char **buf, int *buf_len, int *should_free) {
-    // First we need to find the terminator...
-    char *term_addr = NULL;
-    if (unlikely(conn->input.write_cursor < conn->input.read_cursor)) {
-        /*
-         * We need to scan from the read cursor to the end of
-         * the buffer, and then from the start of the buffer to
-         * the write cursor.
-        */
-        term_addr = memchr(conn->input.buffer+conn->input.read_cursor,
-                           terminator,
-                           conn->input.buf_size - conn->input.read_cursor);
-
-        // If we've found the terminator, we can just move up
-        // the read cursor
-        if (term_addr) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *buf_len = term_addr - *buf + 1;    // Difference between the terminator and location
-            *term_addr = '\0';              // Add a null terminator
-            *should_free = 0;               // No need to free, in the buffer
-
-            // Push the read cursor forward
-            conn->input.read_cursor = (term_addr - conn->input.buffer + 1) % conn->input.buf_size;
-            return 0;
-        }
-
-        // Wrap around
-        term_addr = memchr(conn->input.buffer,
-                           terminator,
-                           conn->input.write_cursor);
-
-        // If we've found the terminator, we need to allocate
-        // a contiguous buffer large enough to store everything
-        // and provide a linear buffer
-        if (term_addr) {
-            int start_size = term_addr - conn->input.buffer + 1;
-            int end_size = conn->input.buf_size - conn->input.read_cursor;
-            *buf_len = start_size + end_size;
-            *buf = malloc(*buf_len);
-
-            // Copy from the read cursor to the end
-            memcpy(*buf, conn->input.buffer+conn->input.read_cursor, end_size);
-
-            // Copy from the start to the terminator
-            *term_addr = '\0';              // Add a null terminator
-            memcpy(*buf+end_size, conn->input.buffer, start_size);
-
-            *should_free = 1;               // Must free, not in the buffer
-            conn->input.read_cursor = start_size; // Push the read cursor forward
-        }
-
-    } else {
-        /*
-         * We need to scan from the read cursor to write buffer.
-         */
-        term_addr = memchr(conn->input.buffer+conn->input.read_cursor,
-                           terminator,
-                           conn->input.write_cursor - conn->input.read_cursor);
-
-        // If we've found the terminator, we can just move up
-        // the read cursor
-        if (term_addr) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *buf_len = term_addr - *buf + 1; // Difference between the terminator and location
-            *term_addr = '\0';               // Add a null terminator
-            *should_free = 0;                // No need to free, in the buffer
-            conn->input.read_cursor = term_addr - conn->input.buffer + 1; // Push the read cursor forward
-        }
-    }
-
-    // Minor optimization, if our read-cursor has caught up
-    // with the write cursor, reset them to the beginning
-    // to avoid wrapping in the future
-    if (conn->input.read_cursor == conn->input.write_cursor) {
-        conn->input.read_cursor = 0;
-        conn->input.write_cursor = 0;
-    }
-
-    // Return success if we have a term address
-    return ((term_addr) ? 0 : -1);
+int extract_to_terminator(statsite_conn_info *conn, char terminator, char **buf, int *buf_len) {
+    // The mirrored mapping lets us scan past the end of the buffer
+    char *start = conn->input.buffer + conn->input.read_cursor;
+    char *term_addr = memchr(start, terminator, circbuf_used_buf(&conn->input));
+    if (!term_addr) return -1;
+
+    *buf = start;
+    *buf_len = term_addr - start + 1;   // Difference between the terminator and location
+    *term_addr = '\0';                  // Add a null terminator
+
+    // Push the read cursor forward
+    circbuf_advance_read(&conn->input, *buf_len);
+    return 0;
 }
 
 
@@ -708,41 +1542,34 @@ int peek_client_byte(statsite_conn_info *conn, unsigned char* byte) {
     return 0;
 }
 
+/**
+ * Provides all the unread data at the read cursor without
+ * consuming it. The data is contiguous, even if it wraps
+ * around the end of the buffer.
+ * @arg conn The client connection
+ * @arg buf Output parameter, sets the start of the region.
+ * @arg buf_len Output parameter, the length of the region.
+ * @return 0 on success, -1 if there is no data.
+ */
+int peek_client_region(statsite_conn_info *conn, char **buf, int *buf_len) {
+    *buf_len = circbuf_used_buf(&conn->input);
+    if (unlikely(!*buf_len)) return -1;
+    *buf = conn->input.buffer + conn->input.read_cursor;
+    return 0;
+}
+
 /**
  * This method is used to peek into the input buffer without
- * causing input to be consumed. It attempts to use the data
- * in-place, similar to read_client_bytes.
+ * causing input to be consumed. The data is used in-place,
+ * similar to read_client_bytes.
  * @arg conn The client connection
  * @arg bytes The number of bytes to peek
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free) {
+int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf) {
     if (unlikely(bytes > circbuf_used_buf(&conn->input))) return -1;
-
-    // Handle the wrap around case
-    if (unlikely(conn->input.write_cursor < conn->input.read_cursor)) {
-        // Check if we can use a contiguous chunk
-        int end_size = conn->input.buf_size - conn->input.read_cursor;
-        if (end_size >= bytes) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *should_free = 0;
-
-        // Otherwise, allocate a dynamic slab, and copy
-        } else {
-            *buf = malloc(bytes);
-            memcpy(*buf, conn->input.buffer + conn->input.read_cursor, end_size);
-            memcpy(*buf + end_size, conn->input.buffer, bytes - end_size);
-            *should_free = 1;
-        }
-
-    // Handle the contiguous case
-    } else {
-        *buf = conn->input.buffer + conn->input.read_cursor;
-        *should_free = 0;
-    }
-
+    *buf = conn->input.buffer + conn->input.read_cursor;
     return 0;
 }
 
@@ -762,37 +1589,17 @@ int seek_client_bytes(statsite_conn_info *conn, int bytes) {
 
 
 /**
- * This method is used to read and consume the input buffer
+ * This method is used to read and consume the input buffer.
+ * The data is used in-place, and stays valid until the next
+ * read from the connection.
  * @arg conn The client connection
  * @arg bytes The number of bytes to read
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free) {
+int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf) {
     if (unlikely(bytes > circbuf_used_buf(&conn->input))) return -1;
-
-    // Handle the wrap around case
-    if (unlikely(conn->input.write_cursor < conn->input.read_cursor)) {
-        // Check if we can use a contiguous chunk
-        int end_size = conn->input.buf_size - conn->input.read_cursor;
-        if (end_size >= bytes) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *should_free = 0;
-
-        // Otherwise, allocate a dynamic slab, and copy
-        } else {
-            *buf = malloc(bytes);
-            memcpy(*buf, conn->input.buffer + conn->input.read_cursor, end_size);
-            memcpy(*buf + end_size, conn->input.buffer, bytes - end_size);
-            *should_free = 1;
-        }
-
-    // Handle the contiguous case
-    } else {
-        *buf = conn->input.buffer + conn->input.read_cursor;
-        *should_free = 0;
-    }
+    *buf = conn->input.buffer + conn->input.read_cursor;
 
     // Advance the read cursor
     circbuf_advance_read(&conn->input, bytes);
@@ -802,9 +1609,11 @@ int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* shou
 
 /**
  * Sets the client socket options.
+ * @arg client_fd The client socket
+ * @arg tcp Set the TCP options, unix sockets do not have them
  * @return 0 on success, 1 on error.
  */
-static int set_client_sockopts(int client_fd) {
+static int set_client_sockopts(int client_fd, int tcp) {
     // Setup the socket to be non-blocking
     int sock_flags = fcntl(client_fd, F_GETFL, 0);
     if (sock_flags < 0) {
@@ -817,6 +1626,7 @@ static int set_client_sockopts(int client_fd) {
         close(client_fd);
         return 1;
     }
+    if (!tcp) return 0;
 
     /**
      * Set TCP_NODELAY. This will allow us to send small response packets more
@@ -839,15 +1649,69 @@ static int set_client_sockopts(int client_fd) {
 /**
  * Returns the conn_info* object associated with the FD
  * or allocates a new one as necessary.
+ * @return The connection, or NULL if the buffers can not be mapped.
  */
 static conn_info* get_conn() {
     // Allocate space
     conn_info *conn = malloc(sizeof(conn_info));
 
     // Prepare the buffers
-    circbuf_init(&conn->input);
+    if (circbuf_init(&conn->input)) {
+        syslog(LOG_ERR, "Failed to map connection buffer! %s.", strerror(errno));
+        free(conn);
+        return NULL;
+    }
+    conn->closing = 0;
 
     // Store a reference to the conn object
     conn->client.data = conn;
     return conn;
 }
+
+/**
+ * Allocates a UDP connection object, with a buffer
+ * large enough to receive a full batch of datagrams.
+ * @arg batch_size The number of datagrams per batch
+ * @return The connection, or NULL if the buffers can not be mapped.
+ */
+static udp_conn_info* get_udp_conn(int batch_size) {
+    udp_conn_info *udp = calloc(1, sizeof(udp_conn_info));
+    if (circbuf_init(&udp->conn.input)) {
+        syslog(LOG_ERR, "Failed to map UDP buffer! %s.", strerror(errno));
+        free(udp);
+        return NULL;
+    }
+    while (udp->conn.input.buf_size < (uint64_t)batch_size * UDP_SLOT_SIZE) {
+        if (circbuf_grow_buf(&udp->conn.input)) {
+            syslog(LOG_ERR, "Failed to grow UDP buffer! %s.", strerror(errno));
+            circbuf_free(&udp->conn.input);
+            free(udp);
+            return NULL;
+        }
+    }
+    udp->conn.client.data = udp;
+    udp->batch_size = batch_size;
+#ifdef __linux__
+    udp->msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    udp->vectors = calloc(batch_size, sizeof(struct iovec));
+    udp->control = calloc(batch_size, CMSG_SPACE(sizeof(int)));
+#else
+    udp->batch_size = 1;
+#endif
+    udp->seg_sizes = calloc(batch_size, sizeof(int));
+    return udp;
+}
+
+/**
+ * Frees a UDP connection object
+ */
+static void free_udp_conn(udp_conn_info *udp) {
+    circbuf_free(&udp->conn.input);
+#ifdef __linux__
+    free(udp->msgs);
+    free(udp->vectors);
+    free(udp->control);
+#endif
+    free(udp->seg_sizes);
+    free(udp);
+}
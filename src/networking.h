@@ -40,18 +40,16 @@ int shutdown_networking(statsite_networking *netconf);
  * This method is used to conveniently extract commands from the
  * command buffer. It scans up to a terminator, and then sets the
  * buf to the start of the buffer, and buf_len to the length
- * of the buffer. The output param should_free indicates that
- * the caller should free the buffer pointed to by buf when it is finished.
+ * of the buffer. The command is always contiguous in the buffer.
  * This method consumes the bytes from the underlying buffer, freeing
  * space for later reads.
  * @arg conn The client connection
  * @arg terminator The terminator charactor to look for. Included in buf.
  * @arg buf Output parameter, sets the start of the buffer.
  * @arg buf_len Output parameter, the length of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if the terminator is not found.
  */
-int extract_to_terminator(statsite_conn_info *conn, char terminator, char **buf, int *buf_len, int *should_free);
+int extract_to_terminator(statsite_conn_info *conn, char terminator, char **buf, int *buf_len);
 
 /**
  * This method is used to query how much data is available
@@ -69,17 +67,27 @@ uint64_t available_bytes(statsite_conn_info *conn);
  */
 int peek_client_byte(statsite_conn_info *conn, unsigned char* byte);
 
+/**
+ * Provides all the unread data at the read cursor without
+ * consuming it. The data is contiguous, even if it wraps
+ * around the end of the buffer.
+ * @arg conn The client connection
+ * @arg buf Output parameter, sets the start of the region.
+ * @arg buf_len Output parameter, the length of the region.
+ * @return 0 on success, -1 if there is no data.
+ */
+int peek_client_region(statsite_conn_info *conn, char **buf, int *buf_len);
+
 /**
  * This method is used to peek into the input buffer without
- * causing input to be consumed. It attempts to use the data
- * in-place, similar to read_client_bytes.
+ * causing input to be consumed. The data is used in-place,
+ * similar to read_client_bytes.
  * @arg conn The client connection
  * @arg bytes The number of bytes to peek
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free);
+int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf);
 
 /**
  * This method is used to seek the input buffer without
@@ -92,13 +100,14 @@ int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* shou
 int seek_client_bytes(statsite_conn_info *conn, int bytes);
 
 /**
- * This method is used to read and consume the input buffer
+ * This method is used to read and consume the input buffer.
+ * The data is used in-place, and stays valid until the next
+ * read from the connection.
  * @arg conn The client connection
  * @arg bytes The number of bytes to read
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free);
+int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf);
 
 #endif
@@ -0,0 +1,159 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "likely.h"
+#include "numparse.h"
+
+/*
+ * The largest mantissa a double holds exactly, and the
+ * largest power of ten that is exact. Any product or quotient
+ * of two exact values is correctly rounded by the FPU, which is
+ * Clinger's fast path.
+ */
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXACT_POW10 22
+
+// More digits than this may overflow the 64bit mantissa
+#define MAX_MANTISSA_DIGITS 19
+
+// Exponents past this are left to strtod
+#define MAX_EXPONENT 9999
+
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int is_digit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+/**
+ * Scales an exact mantissa by a power of ten
+ * @arg mantissa The mantissa, at most MAX_EXACT_MANTISSA
+ * @arg exp The power of ten
+ * @arg out Output. The correctly rounded result.
+ * @return 0 on success, -1 if the result may not be exact.
+ */
+static int clinger_scale(uint64_t mantissa, int exp, double *out) {
+#if FLT_EVAL_METHOD == 0
+    double val = (double)mantissa;
+    if (exp < 0) {
+        if (exp < -MAX_EXACT_POW10) return -1;
+        *out = val / POW10[-exp];
+        return 0;
+    }
+    if (exp > MAX_EXACT_POW10) {
+        // Move the excess into the mantissa, while it stays exact
+        while (exp > MAX_EXACT_POW10) {
+            if (mantissa > MAX_EXACT_MANTISSA / 10) return -1;
+            mantissa *= 10;
+            exp--;
+        }
+        val = (double)mantissa;
+    }
+    *out = val * POW10[exp];
+    return 0;
+#else
+    // Extended precision intermediates would round twice
+    return -1;
+#endif
+}
+
+/**
+ * Parses a double from a string, with the same result and
+ * end pointer as strtod in the C locale. Plain integers and
+ * short decimals are converted without calling into libc,
+ * everything else falls back to strtod.
+ * @arg str The null terminated string to parse
+ * @arg endptr Output. Set to the first unparsed character,
+ * or to str if no conversion was done.
+ * @return The parsed value
+ */
+double fast_parse_double(const char *str, char **endptr) {
+    const char *p = str;
+    int negative = 0;
+    switch (*p) {
+        case '-':
+            negative = 1;
+            // Fall through
+        case '+':
+            p++;
+    }
+
+    // Whitespace, inf, nan and hex are left to strtod
+    if (unlikely(!is_digit(*p) && *p != '.')) goto SLOW_PATH;
+    if (unlikely(p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))) goto SLOW_PATH;
+
+    // Integer digits
+    uint64_t mantissa = 0;
+    int digits = 0;
+    const char *start = p;
+    while (is_digit(*p)) {
+        mantissa = mantissa * 10 + (*p - '0');
+        p++;
+    }
+    digits = p - start;
+
+    // Fast path for plain integers, the common counter shape
+    if (likely(*p != '.' && *p != 'e' && *p != 'E')) {
+        if (unlikely(digits > MAX_MANTISSA_DIGITS || mantissa > MAX_EXACT_MANTISSA))
+            goto SLOW_PATH;
+        *endptr = (char*)p;
+        double val = (double)mantissa;
+        return (negative) ? -val : val;
+    }
+
+    // Fraction digits
+    int frac_digits = 0;
+    if (*p == '.') {
+        p++;
+        start = p;
+        while (is_digit(*p)) {
+            mantissa = mantissa * 10 + (*p - '0');
+            p++;
+        }
+        frac_digits = p - start;
+        digits += frac_digits;
+    }
+
+    // A lone dot is not a number
+    if (unlikely(digits == 0)) goto SLOW_PATH;
+    if (unlikely(digits > MAX_MANTISSA_DIGITS)) goto SLOW_PATH;
+
+    // The exponent only counts if it has digits
+    int exp = 0;
+    if (*p == 'e' || *p == 'E') {
+        const char *e = p + 1;
+        int exp_negative = 0;
+        switch (*e) {
+            case '-':
+                exp_negative = 1;
+                // Fall through
+            case '+':
+                e++;
+        }
+        if (is_digit(*e)) {
+            while (is_digit(*e)) {
+                exp = exp * 10 + (*e - '0');
+                if (unlikely(exp > MAX_EXPONENT)) goto SLOW_PATH;
+                e++;
+            }
+            if (exp_negative) exp = -exp;
+            p = e;
+        }
+    }
+
+    double val;
+    if (unlikely(mantissa > MAX_EXACT_MANTISSA)) goto SLOW_PATH;
+    if (mantissa == 0) {
+        val = 0;
+    } else if (unlikely(clinger_scale(mantissa, exp - frac_digits, &val))) {
+        goto SLOW_PATH;
+    }
+    *endptr = (char*)p;
+    return (negative) ? -val : val;
+
+SLOW_PATH:
+    return strtod(str, endptr);
+}
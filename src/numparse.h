@@ -0,0 +1,16 @@
+#ifndef NUMPARSE_H
+#define NUMPARSE_H
+
+/**
+ * Parses a double from a string, with the same result and
+ * end pointer as strtod in the C locale. Plain integers and
+ * short decimals are converted without calling into libc,
+ * everything else falls back to strtod.
+ * @arg str The null terminated string to parse
+ * @arg endptr Output. Set to the first unparsed character,
+ * or to str if no conversion was done.
+ * @return The parsed value
+ */
+double fast_parse_double(const char *str, char **endptr);
+
+#endif
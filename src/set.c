@@ -3,9 +3,7 @@
 #include <string.h>
 #include <strings.h>
 #include "set.h"
-
-// Link the external murmur hash in
-extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
+#include "hash.h"
 
 /**
  * Initializes a new set
@@ -47,13 +45,14 @@ static void convert_exact_to_approx(set_t *s) {
     // Store the hashes, as HLL initialization
     // will step on the pointer
     uint64_t *hashes = s->store.s.hashes;
+    uint32_t count = s->store.s.count;
 
     // Initialize the HLL
     s->type = APPROX;
     hll_init(s->store.s.precision, &s->store.h);
 
     // Add each hash to the HLL
-    for (int i=0; i < SET_MAX_EXACT; i++) {
+    for (uint32_t i=0; i < count; i++) {
         hll_add_hash(&s->store.h, hashes[i]);
     }
 
@@ -67,19 +66,26 @@ static void convert_exact_to_approx(set_t *s) {
  * @arg key The key to add
  */
 void set_add(set_t *s, char *key) {
+    set_add_hash(s, hash_bytes(key, strlen(key)));
+}
+
+/**
+ * Adds a pre-computed key hash to the set
+ * @arg s The set to add to
+ * @arg hash The hash of the key to add
+ */
+void set_add_hash(set_t *s, uint64_t hash) {
     uint32_t i;
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, strlen(key), 0, &out);
     switch (s->type) {
         case EXACT:
             // Check if this element is already added
             for (i=0; i < s->store.s.count; i++) {
-                if (out[1] == s->store.s.hashes[i]) return;
+                if (hash == s->store.s.hashes[i]) return;
             }
 
             // Check if we can fit this in the array
             if (i < SET_MAX_EXACT) {
-                s->store.s.hashes[i] = out[1];
+                s->store.s.hashes[i] = hash;
                 s->store.s.count++;
                 return;
             }
@@ -90,11 +96,33 @@ void set_add(set_t *s, char *key) {
             convert_exact_to_approx(s);
 
         case APPROX:
-            hll_add_hash(&s->store.h, out[1]);
+            hll_add_hash(&s->store.h, hash);
             break;
     }
 }
 
+/**
+ * Merges the members of another set into this one.
+ * Both sets must use the same precision.
+ * @arg s The set to merge into
+ * @arg other The set to merge from. Left unchanged.
+ * @return 0 on success.
+ */
+int set_merge(set_t *s, set_t *other) {
+    switch (other->type) {
+        case EXACT:
+            for (uint32_t i=0; i < other->store.s.count; i++) {
+                set_add_hash(s, other->store.s.hashes[i]);
+            }
+            return 0;
+
+        case APPROX:
+            if (s->type == EXACT) convert_exact_to_approx(s);
+            return hll_merge(&s->store.h, &other->store.h);
+    }
+    return 0;
+}
+
 /**
  * Returns the size of the set. May be approximate.
  * @arg s The set to query
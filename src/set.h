@@ -51,6 +51,22 @@ int set_destroy(set_t *s);
  */
 void set_add(set_t *s, char *key);
 
+/**
+ * Adds a pre-computed key hash to the set
+ * @arg s The set to add to
+ * @arg hash The hash of the key to add
+ */
+void set_add_hash(set_t *s, uint64_t hash);
+
+/**
+ * Merges the members of another set into this one.
+ * Both sets must use the same precision.
+ * @arg s The set to merge into
+ * @arg other The set to merge from. Left unchanged.
+ * @return 0 on success.
+ */
+int set_merge(set_t *s, set_t *other);
+
 /**
  * Returns the size of the set. May be approximate.
  * @arg s The set to query
@@ -18,6 +18,7 @@
 #include <signal.h>
 #include <curl/curl.h>
 #include "config.h"
+#include "hash.h"
 #include "conn_handler.h"
 #include "networking.h"
 #include "sink.h"
@@ -171,6 +172,9 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    // Select the hash function before any maps or sets are built
+    hash_select(config->hash_algo);
+
     // Set the syslog mask
     setlogmask(config->syslog_log_level);
 
@@ -2,24 +2,97 @@
 #include "timer.h"
 
 /* Static declarations */
+static int init_exact_timer(quantile_engine engine, double eps, double *quantiles,
+        uint32_t num_quants, double min_val, double max_val, timer *timer);
+static int convert_exact_to_engine(timer *timer);
+static int timer_store_sample(timer *timer, double sample);
+static double exact_query(exact_timer *s, double quantile);
 static void finalize_timer(timer *timer);
 
 /**
- * Initializes the timer struct
+ * Initializes the timer struct. The first samples are kept
+ * exactly, and the quantile engine is only built once there
+ * are more than TIMER_MAX_EXACT.
  * @arg eps The maximum error for the quantiles
- * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1).
+ * This is not copied until the engine is built, and must outlive the timer.
  * @arg num_quants The number of entries in the quantiles array
  * @arg timeer The timer struct to initialize
  * @return 0 on success.
  */
 int init_timer(double eps, double *quantiles, uint32_t num_quants, timer *timer) {
+    return init_timer_engine(QUANTILE_CM, eps, quantiles, num_quants, timer);
+}
+
+/**
+ * Initializes the timer struct with a given quantile engine
+ * @arg engine The quantile engine to use
+ * @arg eps The maximum error for the quantiles. This is the rank
+ * error for CM, and the relative error for DDSketch and HDR.
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1).
+ * This is not copied until the engine is built, and must outlive the timer.
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg timeer The timer struct to initialize
+ * @return 0 on success.
+ */
+int init_timer_engine(quantile_engine engine, double eps, double *quantiles,
+        uint32_t num_quants, timer *timer) {
+    return init_exact_timer(engine, eps, quantiles, num_quants,
+            HDR_DEFAULT_MIN, HDR_DEFAULT_MAX, timer);
+}
+
+/**
+ * Initializes the timer struct with a log-linear histogram
+ * @arg eps The relative error for the quantiles
+ * @arg min_val The smallest value recorded with full precision
+ * @arg max_val The largest value recorded with full precision
+ * @arg timeer The timer struct to initialize
+ * @return 0 on success.
+ */
+int init_timer_hdr(double eps, double min_val, double max_val, timer *timer) {
+    return init_exact_timer(QUANTILE_HDR, eps, NULL, 0, min_val, max_val, timer);
+}
+
+/**
+ * Initializes a timer that keeps its samples exactly, and
+ * checks the settings its engine will be built with.
+ */
+static int init_exact_timer(quantile_engine engine, double eps, double *quantiles,
+        uint32_t num_quants, double min_val, double max_val, timer *timer) {
+    switch (engine) {
+        case QUANTILE_CM:
+            if (eps <= 0 || eps >= 0.5 || !num_quants) return -1;
+            for (uint32_t i=0; i < num_quants; i++) {
+                if (quantiles[i] <= 0 || quantiles[i] >= 1) return -1;
+            }
+            break;
+        case QUANTILE_DDSKETCH:
+            if (eps <= 0 || eps >= 1) return -1;
+            break;
+        case QUANTILE_HDR:
+            if (eps <= 0 || eps >= 0.5) return -1;
+            if (min_val <= 0 || max_val <= min_val) return -1;
+            break;
+        default:
+            return -1;
+    }
+
     timer->actual_count = 0;
     timer->count = 0;
     timer->sum = 0;
     timer->squared_sum = 0;
     timer->finalized = 1;
-    int res = init_cm_quantile(eps, quantiles, num_quants, &timer->cm);
-    return res;
+    timer->exact = 1;
+    timer->engine = engine;
+
+    exact_timer *s = &timer->store.s;
+    s->eps = eps;
+    s->quantiles = quantiles;
+    s->num_quants = num_quants;
+    s->count = 0;
+    s->min_val = min_val;
+    s->max_val = max_val;
+    return 0;
 }
 
 /**
@@ -28,7 +101,79 @@ int init_timer(double eps, double *quantiles, uint32_t num_quants, timer *timer)
  * @return 0 on success.
  */
 int destroy_timer(timer *timer) {
-    return destroy_cm_quantile(&timer->cm);
+    if (timer->exact) return 0;
+    switch (timer->engine) {
+        case QUANTILE_DDSKETCH:
+            return destroy_ddsketch(&timer->store.dd);
+        case QUANTILE_HDR:
+            return destroy_hdr_histogram(&timer->store.hdr);
+        default:
+            return destroy_cm_quantile(&timer->store.cm);
+    }
+}
+
+/**
+ * Builds the quantile engine of a full exact timer,
+ * and adds the samples that were kept to it.
+ * @return 0 on success, -1 if the engine could not be
+ * built, in which case the timer is left exact.
+ */
+static int convert_exact_to_engine(timer *timer) {
+    // Copy the samples, as initializing the
+    // engine will step on them
+    exact_timer s = timer->store.s;
+
+    int res;
+    switch (timer->engine) {
+        case QUANTILE_DDSKETCH:
+            res = init_ddsketch(s.eps, DD_DEFAULT_BINS, &timer->store.dd);
+            break;
+        case QUANTILE_HDR:
+            res = init_hdr_histogram(s.eps, s.min_val, s.max_val, &timer->store.hdr);
+            break;
+        default:
+            res = init_cm_quantile(s.eps, s.quantiles, s.num_quants, &timer->store.cm);
+            break;
+    }
+    if (res) {
+        timer->store.s = s;
+        return -1;
+    }
+
+    // Add each sample to the engine
+    timer->exact = 0;
+    for (uint32_t i=0; i < s.count; i++) {
+        res = timer_store_sample(timer, s.samples[i]);
+        if (res) return res;
+    }
+    return 0;
+}
+
+/**
+ * Stores a sample for the quantiles, in the exact
+ * samples while they fit, and the engine otherwise.
+ */
+static int timer_store_sample(timer *timer, double sample) {
+    if (timer->exact) {
+        exact_timer *s = &timer->store.s;
+        if (s->count < TIMER_MAX_EXACT) {
+            s->samples[s->count++] = sample;
+            return 0;
+        }
+
+        // Otherwise, build the engine and
+        // add the sample to it below
+        if (convert_exact_to_engine(timer)) return -1;
+    }
+
+    switch (timer->engine) {
+        case QUANTILE_DDSKETCH:
+            return dd_add_sample(&timer->store.dd, sample);
+        case QUANTILE_HDR:
+            return hdr_add_sample(&timer->store.hdr, sample);
+        default:
+            return cm_add_sample(&timer->store.cm, sample);
+    }
 }
 
 /**
@@ -44,7 +189,41 @@ int timer_add_sample(timer *timer, double sample, double sample_rate) {
     timer->sum += sample;
     timer->squared_sum += pow(sample, 2);
     timer->finalized = 0;
-    return cm_add_sample(&timer->cm, sample);
+    return timer_store_sample(timer, sample);
+}
+
+/**
+ * Merges another timer into this one
+ * @arg tm The timer to merge into
+ * @arg other The timer to merge from
+ * @return 0 on success, -1 if the engines differ.
+ */
+int timer_merge(timer *tm, timer *other) {
+    if (tm->engine != other->engine) return -1;
+    if (!other->actual_count) return 0;
+    tm->actual_count += other->actual_count;
+    tm->count += other->count;
+    tm->sum += other->sum;
+    tm->squared_sum += other->squared_sum;
+    tm->finalized = 0;
+
+    // Exact samples are added one by one
+    if (other->exact) {
+        for (uint32_t i=0; i < other->store.s.count; i++) {
+            if (timer_store_sample(tm, other->store.s.samples[i])) return -1;
+        }
+        return 0;
+    }
+
+    if (tm->exact && convert_exact_to_engine(tm)) return -1;
+    switch (tm->engine) {
+        case QUANTILE_DDSKETCH:
+            return dd_merge(&tm->store.dd, &other->store.dd);
+        case QUANTILE_HDR:
+            return hdr_merge(&tm->store.hdr, &other->store.hdr);
+        default:
+            return cm_merge(&tm->store.cm, &other->store.cm);
+    }
 }
 
 /**
@@ -54,8 +233,64 @@ int timer_add_sample(timer *timer, double sample, double sample_rate) {
  * @return The value on success or 0.
  */
 double timer_query(timer *timer, double quantile) {
+    if (timer->exact) return exact_query(&timer->store.s, quantile);
+    switch (timer->engine) {
+        case QUANTILE_DDSKETCH:
+            return dd_query(&timer->store.dd, quantile);
+        case QUANTILE_HDR:
+            return hdr_query(&timer->store.hdr, quantile);
+        default:
+            break;
+    }
     finalize_timer(timer);
-    return cm_query(&timer->cm, quantile);
+    return cm_query(&timer->store.cm, quantile);
+}
+
+/**
+ * Returns the value of a given rank among the exact samples,
+ * using quickselect. The samples are partially reordered, so
+ * later calls only partition what is left around their rank.
+ */
+static double exact_select(double *samples, int num, int rank) {
+    int lo = 0, hi = num - 1;
+    while (lo < hi) {
+        // Partition around the median of the ends and middle
+        double a = samples[lo], b = samples[(lo + hi) / 2], c = samples[hi];
+        double pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a))
+                               : ((a < c) ? a : ((b < c) ? c : b));
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (samples[i] < pivot) i++;
+            while (samples[j] > pivot) j--;
+            if (i <= j) {
+                double tmp = samples[i];
+                samples[i++] = samples[j];
+                samples[j--] = tmp;
+            }
+        }
+
+        // Keep the side with the rank, or stop between them
+        if (rank <= j)
+            hi = j;
+        else if (rank >= i)
+            lo = i;
+        else
+            break;
+    }
+    return samples[rank];
+}
+
+/**
+ * Queries the exact samples for a quantile, using the
+ * nearest rank: the smallest sample that is at or
+ * above the quantile of the samples.
+ */
+static double exact_query(exact_timer *s, double quantile) {
+    if (!s->count) return 0;
+    int rank = ceil(quantile * s->count) - 1;
+    if (rank < 0) rank = 0;
+    if (rank >= (int)s->count) rank = s->count - 1;
+    return exact_select(s->samples, s->count, rank);
 }
 
 /**
@@ -73,9 +308,25 @@ uint64_t timer_count(timer *timer) {
  * @return The number of samples
  */
 double timer_min(timer *timer) {
+    if (timer->exact) {
+        exact_timer *s = &timer->store.s;
+        if (!s->count) return 0;
+        double min = s->samples[0];
+        for (uint32_t i=1; i < s->count; i++)
+            if (s->samples[i] < min) min = s->samples[i];
+        return min;
+    }
+    switch (timer->engine) {
+        case QUANTILE_DDSKETCH:
+            return timer->store.dd.min;
+        case QUANTILE_HDR:
+            return timer->store.hdr.min;
+        default:
+            break;
+    }
     finalize_timer(timer);
-    if (!timer->cm.samples) return 0;
-    return timer->cm.samples->value;
+    if (!timer->store.cm.num_samples) return 0;
+    return timer->store.cm.values[0];
 }
 
 /**
@@ -123,9 +374,25 @@ double timer_squared_sum(timer *timer) {
  * @return The maximum value
  */
 double timer_max(timer *timer) {
+    if (timer->exact) {
+        exact_timer *s = &timer->store.s;
+        if (!s->count) return 0;
+        double max = s->samples[0];
+        for (uint32_t i=1; i < s->count; i++)
+            if (s->samples[i] > max) max = s->samples[i];
+        return max;
+    }
+    switch (timer->engine) {
+        case QUANTILE_DDSKETCH:
+            return timer->store.dd.max;
+        case QUANTILE_HDR:
+            return timer->store.hdr.max;
+        default:
+            break;
+    }
     finalize_timer(timer);
-    if (!timer->cm.end) return 0;
-    return timer->cm.end->value;
+    if (!timer->store.cm.num_samples) return 0;
+    return timer->store.cm.values[timer->store.cm.num_samples - 1];
 }
 
 // Finalizes the timer for queries
@@ -134,7 +401,7 @@ static void finalize_timer(timer *timer) {
 
     // Force the quantile to flush internal
     // buffers so that queries are accurate.
-    cm_flush(&timer->cm);
+    cm_flush(&timer->store.cm);
 
     timer->finalized = 1;
 }
@@ -2,6 +2,35 @@
 #define TIMER_H
 #include <stdint.h>
 #include "cm_quantile.h"
+#include "ddsketch.h"
+#include "hdr_histogram.h"
+
+typedef enum {
+    QUANTILE_CM,        // Cormode-Muthukrishnan, bounded rank error
+    QUANTILE_DDSKETCH,  // DDSketch, bounded relative error and memory
+    QUANTILE_HDR        // Log-linear histogram over a fixed range
+} quantile_engine;
+
+/**
+ * This is the maximum number of samples
+ * we keep exactly before switching to
+ * the quantile engine
+ */
+#define TIMER_MAX_EXACT 32
+
+/*
+ * The samples of a timer that has not yet switched to its
+ * quantile engine, along with the settings of the engine.
+ */
+typedef struct {
+    double eps;             // Error of the quantile engine
+    double *quantiles;      // Quantiles of the CM engine, not copied
+    uint32_t num_quants;    // Number of quantiles
+    uint32_t count;         // Number of samples
+    double min_val;         // Range of the hdr engine
+    double max_val;
+    double samples[TIMER_MAX_EXACT];
+} exact_timer;
 
 typedef struct {
     uint64_t actual_count; // Actual items recieved
@@ -9,19 +38,53 @@ typedef struct {
     double sum;         // Sum of the values
     double squared_sum; // Sum of the squared values
     int finalized;      // Is the cm_quantile finalized
-    cm_quantile cm;     // Quantile we use
+    int exact;          // Are the samples kept exactly
+    quantile_engine engine; // The quantile engine in use
+    union {
+        cm_quantile cm;     // Quantile we use
+        ddsketch dd;
+        hdr_histogram hdr;
+        exact_timer s;
+    } store;
 } timer;
 
 /**
- * Initializes the timer struct
+ * Initializes the timer struct. The first samples are kept
+ * exactly, and the quantile engine is only built once there
+ * are more than TIMER_MAX_EXACT.
  * @arg eps The maximum error for the quantiles
- * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1).
+ * This is not copied until the engine is built, and must outlive the timer.
  * @arg num_quants The number of entries in the quantiles array
  * @arg timeer The timer struct to initialize
  * @return 0 on success.
  */
 int init_timer(double eps, double *quantiles, uint32_t num_quants, timer *timer);
 
+/**
+ * Initializes the timer struct with a given quantile engine
+ * @arg engine The quantile engine to use
+ * @arg eps The maximum error for the quantiles. This is the rank
+ * error for CM, and the relative error for DDSketch and HDR.
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1).
+ * This is not copied until the engine is built, and must outlive the timer.
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg timeer The timer struct to initialize
+ * @return 0 on success.
+ */
+int init_timer_engine(quantile_engine engine, double eps, double *quantiles,
+        uint32_t num_quants, timer *timer);
+
+/**
+ * Initializes the timer struct with a log-linear histogram
+ * @arg eps The relative error for the quantiles
+ * @arg min_val The smallest value recorded with full precision
+ * @arg max_val The largest value recorded with full precision
+ * @arg timeer The timer struct to initialize
+ * @return 0 on success.
+ */
+int init_timer_hdr(double eps, double min_val, double max_val, timer *timer);
+
 /**
  * Destroy the timer struct.
  * @arg timer The timer to destroy
@@ -38,6 +101,15 @@ int destroy_timer(timer *timer);
  */
 int timer_add_sample(timer *timer, double sample, double sample_rate);
 
+/**
+ * Merges another timer into this one. The counts and
+ * sums are added, and the quantile summaries are merged.
+ * @arg tm The timer to merge into
+ * @arg other The timer to merge from
+ * @return 0 on success, -1 if the engines differ.
+ */
+int timer_merge(timer *tm, timer *other);
+
 /**
  * Queries for a quantile value
  * @arg timer The timer to query
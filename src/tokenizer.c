@@ -0,0 +1,235 @@
+#include <string.h>
+#include "binproto.h"
+#include "likely.h"
+#include "tokenizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+/**
+ * The input is scanned in blocks of this many bytes.
+ * Each block produces a bitmask of the separator positions.
+ */
+#define BLOCK_SIZE 64
+
+typedef uint64_t(*block_scan)(const char *block);
+
+/**
+ * The state of a scan, carried across the blocks
+ */
+typedef struct {
+    char *buf;
+    statsd_span *spans;
+    int max_spans;
+    int num_spans;
+    int line_start; // Start of the current line
+    int colon;      // Last colon of the line, or -1
+    int pipe;       // First pipe after the colon, or -1
+    int at;         // First '@' after the pipe, or -1
+} scan_state;
+
+// Resets the state for a new line
+static inline void start_line(scan_state *st, int pos) {
+    st->line_start = pos;
+    st->colon = -1;
+    st->pipe = -1;
+    st->at = -1;
+}
+
+/**
+ * Records a newline, terminating the current line
+ * @return 1 if the scan should stop.
+ */
+static int end_line(scan_state *st, int pos, int len) {
+    char *buf = st->buf;
+    statsd_span *span = st->spans + st->num_spans++;
+    span->key = buf + st->line_start;
+    span->len = pos - st->line_start + 1;
+    buf[pos] = '\0';
+
+    span->value = NULL;
+    span->type = NULL;
+    span->rate = NULL;
+    if (st->colon >= 0) {
+        buf[st->colon] = '\0';
+        span->value = buf + st->colon + 1;
+    }
+    if (st->pipe >= 0) {
+        buf[st->pipe] = '\0';
+        span->type = buf + st->pipe + 1;
+    }
+    if (st->at >= 0) {
+        span->rate = buf + st->at + 1;
+    }
+
+    if (st->num_spans == st->max_spans) return 1;
+    start_line(st, pos + 1);
+    return (pos + 1 < len && (unsigned char)buf[pos + 1] == BINARY_MAGIC_BYTE);
+}
+
+/**
+ * Records a separator at a position
+ * @return 1 if the scan should stop.
+ */
+static inline int on_separator(scan_state *st, int pos, int len) {
+    switch (st->buf[pos]) {
+        case ':':
+            // Only the last colon counts, reset what followed an earlier one
+            st->colon = pos;
+            st->pipe = -1;
+            st->at = -1;
+            return 0;
+        case '|':
+            if (st->colon >= 0 && st->pipe < 0) st->pipe = pos;
+            return 0;
+        case '@':
+            if (st->pipe >= 0 && st->at < 0) st->at = pos;
+            return 0;
+        default:
+            return end_line(st, pos, len);
+    }
+}
+
+// Scans a block one byte at a time
+static inline uint64_t scan_block_scalar(const char *block) {
+    uint64_t mask = 0;
+    for (int i=0; i < BLOCK_SIZE; i++) {
+        switch (block[i]) {
+            case '\n':
+            case ':':
+            case '|':
+            case '@':
+                mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef TOKENIZER_X86
+// Scans a block with four 16 byte compares per separator
+static inline uint64_t scan_block_sse2(const char *block) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i at = _mm_set1_epi8('@');
+    uint64_t mask = 0;
+    for (int i=0; i < BLOCK_SIZE; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + i));
+        __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, colon)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, pipe), _mm_cmpeq_epi8(v, at)));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(m) << i;
+    }
+    return mask;
+}
+
+// Scans a block with two 32 byte compares per separator
+__attribute__((target("avx2")))
+static inline uint64_t scan_block_avx2(const char *block) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i pipe = _mm256_set1_epi8('|');
+    const __m256i at = _mm256_set1_epi8('@');
+    uint64_t mask = 0;
+    for (int i=0; i < BLOCK_SIZE; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(block + i));
+        __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, colon)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, pipe), _mm256_cmpeq_epi8(v, at)));
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) << i;
+    }
+    return mask;
+}
+#endif
+
+/**
+ * Returns the fastest implementation supported by the CPU
+ */
+tokenizer_impl tokenizer_detect() {
+#ifdef TOKENIZER_X86
+    if (__builtin_cpu_supports("avx2")) return TOKENIZER_AVX2;
+    return TOKENIZER_SSE2;
+#else
+    return TOKENIZER_SCALAR;
+#endif
+}
+
+/**
+ * Scans the buffer block by block. This is inlined into a
+ * driver per implementation, so the block scan is inlined
+ * into the loop as well.
+ */
+static inline __attribute__((always_inline))
+int scan_blocks(block_scan scan, char *buf, int len, statsd_span *spans, int max_spans) {
+    if (len <= 0 || max_spans <= 0 || (unsigned char)buf[0] == BINARY_MAGIC_BYTE) return 0;
+    scan_state st = {buf, spans, max_spans, 0};
+    start_line(&st, 0);
+
+    for (int base=0; base < len; base += BLOCK_SIZE) {
+        uint64_t mask;
+        if (likely(base + BLOCK_SIZE <= len)) {
+            mask = scan(buf + base);
+        } else {
+            // Pad the tail, so the scan never reads past the buffer
+            char tail[BLOCK_SIZE];
+            memset(tail, 0, BLOCK_SIZE);
+            memcpy(tail, buf + base, len - base);
+            mask = scan(tail);
+        }
+
+        // Visit the separators in order
+        while (mask) {
+            int pos = base + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            if (on_separator(&st, pos, len)) return st.num_spans;
+        }
+    }
+    return st.num_spans;
+}
+
+static int tokenize_scalar(char *buf, int len, statsd_span *spans, int max_spans) {
+    return scan_blocks(scan_block_scalar, buf, len, spans, max_spans);
+}
+
+#ifdef TOKENIZER_X86
+static int tokenize_sse2(char *buf, int len, statsd_span *spans, int max_spans) {
+    return scan_blocks(scan_block_sse2, buf, len, spans, max_spans);
+}
+
+__attribute__((target("avx2")))
+static int tokenize_avx2(char *buf, int len, statsd_span *spans, int max_spans) {
+    return scan_blocks(scan_block_avx2, buf, len, spans, max_spans);
+}
+#endif
+
+/**
+ * Same as tokenize_lines, using a specific implementation.
+ * The implementation must be supported by the CPU.
+ */
+int tokenize_lines_impl(tokenizer_impl impl, char *buf, int len, statsd_span *spans, int max_spans) {
+#ifdef TOKENIZER_X86
+    if (impl == TOKENIZER_AVX2)
+        return tokenize_avx2(buf, len, spans, max_spans);
+    else if (impl == TOKENIZER_SSE2)
+        return tokenize_sse2(buf, len, spans, max_spans);
+#endif
+    return tokenize_scalar(buf, len, spans, max_spans);
+}
+
+/**
+ * Splits a buffer into statsd lines in a single pass.
+ * Stops at the first incomplete line, at a line starting with
+ * the binary magic byte, or when the spans are exhausted.
+ * Only complete lines are modified.
+ * @arg buf The input buffer
+ * @arg len The length of the input buffer
+ * @arg spans Output. The spans of the lines.
+ * @arg max_spans The size of the spans array
+ * @return The number of spans.
+ */
+int tokenize_lines(char *buf, int len, statsd_span *spans, int max_spans) {
+    // The CPU check only reads a cached feature word
+    return tokenize_lines_impl(tokenizer_detect(), buf, len, spans, max_spans);
+}
@@ -0,0 +1,53 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+#include <stdint.h>
+
+/**
+ * The separators of a single statsd line, which has
+ * the form key:value|type[|@rate]. The key is split at the last
+ * colon, the type at the first pipe after it, and the rate at
+ * the first '@' after that. The tokenizer replaces the colon, the
+ * pipe and the newline with null terminators.
+ */
+typedef struct {
+    char *key;      // Start of the line, null terminated key
+    char *value;    // Null terminated value, NULL without a colon
+    char *type;     // Type string, NULL without a pipe
+    char *rate;     // Sample rate string, NULL without an '@'
+    int len;        // Length of the line including the newline
+} statsd_span;
+
+/**
+ * The available implementations of the block scan
+ */
+typedef enum {
+    TOKENIZER_SCALAR,
+    TOKENIZER_SSE2,
+    TOKENIZER_AVX2
+} tokenizer_impl;
+
+/**
+ * Returns the fastest implementation supported by the CPU
+ */
+tokenizer_impl tokenizer_detect();
+
+/**
+ * Splits a buffer into statsd lines in a single pass.
+ * Stops at the first incomplete line, at a line starting with
+ * the binary magic byte, or when the spans are exhausted.
+ * Only complete lines are modified.
+ * @arg buf The input buffer
+ * @arg len The length of the input buffer
+ * @arg spans Output. The spans of the lines.
+ * @arg max_spans The size of the spans array
+ * @return The number of spans.
+ */
+int tokenize_lines(char *buf, int len, statsd_span *spans, int max_spans);
+
+/**
+ * Same as tokenize_lines, using a specific implementation.
+ * The implementation must be supported by the CPU.
+ */
+int tokenize_lines_impl(tokenizer_impl impl, char *buf, int len, statsd_span *spans, int max_spans);
+
+#endif
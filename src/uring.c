@@ -0,0 +1,283 @@
+#include "uring.h"
+#ifdef HAVE_IO_URING
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * The kernel and the process share the ring indexes.
+ * Reads of indexes the kernel writes must acquire, and
+ * writes of indexes the kernel reads must release.
+ */
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Initializes a ring
+ * @arg ring The ring to initialize
+ * @arg entries The size of the submission queue, a power of 2
+ * @arg cq_entries The size of the completion queue, a power of 2
+ * @return 0 on success, a negative errno on failure.
+ */
+int uring_init(uring *ring, unsigned entries, unsigned cq_entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(uring));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) return -errno;
+
+    // Map the queues. Newer kernels share one mapping for both rings.
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto ERR;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) goto ERR;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto ERR;
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_flags = (unsigned*)(sq + params.sq_off.flags);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Use a fixed mapping from the array to the entries
+    for (unsigned i=0; i < params.sq_entries; i++) {
+        ring->sq_array[i] = i;
+    }
+    return 0;
+
+ERR:;
+    int err = -errno;
+    uring_destroy(ring);
+    return err;
+}
+
+/**
+ * Unmaps and closes a ring
+ */
+void uring_destroy(uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(uring));
+    ring->fd = -1;
+}
+
+/**
+ * Returns a cleared submission queue entry. Submits the
+ * pending entries first if the queue is full.
+ * @return The entry, or NULL if no entry is available.
+ */
+struct io_uring_sqe* uring_get_sqe(uring *ring) {
+    unsigned tail = ring->sqe_tail;
+    if (tail - load_acquire(ring->sq_head) > *ring->sq_mask) {
+        if (uring_submit(ring) < 0) return NULL;
+        if (tail - load_acquire(ring->sq_head) > *ring->sq_mask) return NULL;
+    }
+    struct io_uring_sqe *sqe = ring->sqes + (tail & *ring->sq_mask);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqe_tail = tail + 1;
+    ring->sq_pending++;
+    return sqe;
+}
+
+/**
+ * Submits the pending entries without waiting
+ * @return The number submitted, or a negative errno.
+ */
+int uring_submit(uring *ring) {
+    if (!ring->sq_pending) return 0;
+
+    // Publish the prepared entries to the kernel
+    store_release(ring->sq_tail, ring->sqe_tail);
+    int res;
+    do {
+        res = sys_io_uring_enter(ring->fd, ring->sq_pending, 0, 0);
+    } while (res < 0 && errno == EINTR);
+    if (res < 0) return -errno;
+    ring->sq_pending -= res;
+    return res;
+}
+
+/**
+ * Returns the next completion, or NULL if there are none.
+ * The completion must be released with uring_cqe_seen.
+ */
+struct io_uring_cqe* uring_peek_cqe(uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail)) return NULL;
+    return ring->cqes + (head & *ring->cq_mask);
+}
+
+/**
+ * Releases the completion returned by uring_peek_cqe
+ */
+void uring_cqe_seen(uring *ring) {
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+/**
+ * Moves completions the kernel had to hold back
+ * into the completion queue, if there are any.
+ */
+void uring_flush_overflow(uring *ring) {
+    if (load_acquire(ring->sq_flags) & IORING_SQ_CQ_OVERFLOW)
+        sys_io_uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+}
+
+/**
+ * Registers a provided buffer ring with all the
+ * buffers available to the kernel.
+ * @arg ring The ring to register with
+ * @arg bufs The buffer ring to initialize
+ * @arg group The buffer group id
+ * @arg num_bufs The number of buffers, a power of 2
+ * @arg buf_size The size of each buffer
+ * @return 0 on success, a negative errno on failure.
+ */
+int uring_setup_buf_ring(uring *ring, uring_buf_ring *bufs, int group, int num_bufs, int buf_size) {
+    memset(bufs, 0, sizeof(uring_buf_ring));
+    bufs->ring_size = num_bufs * sizeof(struct io_uring_buf);
+    bufs->ring = mmap(NULL, bufs->ring_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->ring == MAP_FAILED) {
+        bufs->ring = NULL;
+        return -errno;
+    }
+    bufs->buffers = mmap(NULL, (size_t)num_bufs * buf_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->buffers == MAP_FAILED) {
+        int err = -errno;
+        munmap(bufs->ring, bufs->ring_size);
+        bufs->ring = NULL;
+        bufs->buffers = NULL;
+        return err;
+    }
+    bufs->buf_size = buf_size;
+    bufs->num_bufs = num_bufs;
+    bufs->group = group;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufs->ring;
+    reg.ring_entries = num_bufs;
+    reg.bgid = group;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = -errno;
+        munmap(bufs->buffers, (size_t)num_bufs * buf_size);
+        munmap(bufs->ring, bufs->ring_size);
+        memset(bufs, 0, sizeof(uring_buf_ring));
+        return err;
+    }
+
+    for (int i=0; i < num_bufs; i++) {
+        uring_recycle_buf(bufs, i);
+    }
+    return 0;
+}
+
+/**
+ * Unregisters and frees a provided buffer ring
+ */
+void uring_free_buf_ring(uring *ring, uring_buf_ring *bufs) {
+    if (!bufs->ring) return;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufs->group;
+    sys_io_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufs->buffers, (size_t)bufs->num_bufs * bufs->buf_size);
+    munmap(bufs->ring, bufs->ring_size);
+    memset(bufs, 0, sizeof(uring_buf_ring));
+}
+
+/**
+ * Hands a buffer back to the kernel
+ * @arg bufs The buffer ring
+ * @arg bid The buffer id of a completion
+ */
+void uring_recycle_buf(uring_buf_ring *bufs, int bid) {
+    struct io_uring_buf *buf = bufs->ring->bufs + (bufs->tail & (bufs->num_bufs - 1));
+    buf->addr = (uint64_t)(uintptr_t)uring_buf(bufs, bid);
+    buf->len = bufs->buf_size;
+    buf->bid = bid;
+    bufs->tail++;
+    store_release(&bufs->ring->tail, bufs->tail);
+}
+
+// Prepares a multishot accept on a listening socket
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+// Prepares a multishot receive into a provided buffer group
+void uring_prep_multishot_recv(struct io_uring_sqe *sqe, int fd, int group, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+// Prepares a multishot recvmsg into a provided buffer group
+void uring_prep_multishot_recvmsg(struct io_uring_sqe *sqe, int fd, struct msghdr *msg,
+        int group, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+#endif
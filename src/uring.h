@@ -0,0 +1,149 @@
+#ifndef URING_H
+#define URING_H
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A minimal io_uring wrapper on top of the raw system calls.
+ * It only covers what the networking stack needs: multishot
+ * accept and receive with provided buffer rings.
+ */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/socket.h>
+
+/**
+ * The mapped submission and completion queues of a ring
+ */
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *sq_flags;
+    unsigned sqe_tail;      // Tail including the unpublished entries
+    unsigned sq_pending;    // Prepared, but not yet submitted entries
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+/**
+ * A ring of fixed size buffers the kernel picks
+ * from when a receive completes.
+ */
+typedef struct {
+    struct io_uring_buf_ring *ring;
+    size_t ring_size;
+    char *buffers;
+    int buf_size;
+    int num_bufs;
+    int group;
+    uint16_t tail;
+} uring_buf_ring;
+
+/**
+ * Initializes a ring
+ * @arg ring The ring to initialize
+ * @arg entries The size of the submission queue, a power of 2
+ * @arg cq_entries The size of the completion queue, a power of 2
+ * @return 0 on success, a negative errno on failure.
+ */
+int uring_init(uring *ring, unsigned entries, unsigned cq_entries);
+
+/**
+ * Unmaps and closes a ring
+ */
+void uring_destroy(uring *ring);
+
+/**
+ * Returns a cleared submission queue entry. Submits the
+ * pending entries first if the queue is full.
+ * @return The entry, or NULL if no entry is available.
+ */
+struct io_uring_sqe* uring_get_sqe(uring *ring);
+
+/**
+ * Submits the pending entries without waiting
+ * @return The number submitted, or a negative errno.
+ */
+int uring_submit(uring *ring);
+
+/**
+ * Returns the next completion, or NULL if there are none.
+ * The completion must be released with uring_cqe_seen.
+ */
+struct io_uring_cqe* uring_peek_cqe(uring *ring);
+
+/**
+ * Releases the completion returned by uring_peek_cqe
+ */
+void uring_cqe_seen(uring *ring);
+
+/**
+ * Moves completions the kernel had to hold back
+ * into the completion queue, if there are any.
+ */
+void uring_flush_overflow(uring *ring);
+
+/**
+ * Registers a provided buffer ring with all the
+ * buffers available to the kernel.
+ * @arg ring The ring to register with
+ * @arg bufs The buffer ring to initialize
+ * @arg group The buffer group id
+ * @arg num_bufs The number of buffers, a power of 2
+ * @arg buf_size The size of each buffer
+ * @return 0 on success, a negative errno on failure.
+ */
+int uring_setup_buf_ring(uring *ring, uring_buf_ring *bufs, int group, int num_bufs, int buf_size);
+
+/**
+ * Unregisters and frees a provided buffer ring
+ */
+void uring_free_buf_ring(uring *ring, uring_buf_ring *bufs);
+
+/**
+ * Returns a buffer of a provided buffer ring
+ * @arg bufs The buffer ring
+ * @arg bid The buffer id of a completion
+ */
+static inline char* uring_buf(uring_buf_ring *bufs, int bid) {
+    return bufs->buffers + (size_t)bid * bufs->buf_size;
+}
+
+/**
+ * Hands a buffer back to the kernel
+ * @arg bufs The buffer ring
+ * @arg bid The buffer id of a completion
+ */
+void uring_recycle_buf(uring_buf_ring *bufs, int bid);
+
+// Prepares a multishot accept on a listening socket
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+
+// Prepares a multishot receive into a provided buffer group
+void uring_prep_multishot_recv(struct io_uring_sqe *sqe, int fd, int group, uint64_t user_data);
+
+// Prepares a multishot recvmsg into a provided buffer group
+void uring_prep_multishot_recvmsg(struct io_uring_sqe *sqe, int fd, struct msghdr *msg,
+        int group, uint64_t user_data);
+
+#endif
+#endif
@@ -0,0 +1,74 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "cm_quantile.h"
+
+START_TEST(bench_cm_add)
+{
+    // A hot timer with latencies spread over a few decades
+    int num = 2000000;
+    double *samples = malloc(num * sizeof(double));
+    srandom(42);
+    for (int i=0; i < num; i++)
+        samples[i] = exp((random() % 100000) / 10000.0);
+
+    cm_quantile cm;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < num; i++)
+        cm_add_sample(&cm, samples[i]);
+    cm_flush(&cm);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fail_unless(cm.num_values == (uint64_t)num);
+
+    // The median of exp(U(0, 10)) is exp(5), and the threshold
+    // allows an error of 1% of the rank there
+    double val = cm_query(&cm, 0.5);
+    fail_unless(val >= exp(4.9) && val <= exp(5.1));
+    printf("cm_add_sample: %.1f M samples/sec, %llu tuples\n",
+            num / secs / 1e6, (unsigned long long)cm.num_samples);
+
+    fail_unless(destroy_cm_quantile(&cm) == 0);
+    free(samples);
+}
+END_TEST
+
+START_TEST(bench_cm_query)
+{
+    double quants[] = {0.5, 0.90, 0.99};
+    double eps[] = {0.01, 0.001};
+    int num = 1000000, queries = 100000;
+    srandom(42);
+    for (int e=0; e < 2; e++) {
+        cm_quantile cm;
+        fail_unless(init_cm_quantile(eps[e], (double*)&quants, 3, &cm) == 0);
+        for (int i=0; i < num; i++)
+            cm_add_sample(&cm, exp((random() % 100000) / 10000.0));
+        cm_flush(&cm);
+
+        double sum = 0;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i=0; i < queries; i++)
+            sum += cm_query(&cm, quants[i % 3]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fail_unless(sum > 0);
+        double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / queries;
+
+        // The summary, the batch and the quantiles
+        size_t bytes = sizeof(cm_quantile) + cm.size * (sizeof(double) + 2 * sizeof(uint64_t)) +
+            cm.batch_size * sizeof(double) + cm.num_quantiles * sizeof(double);
+        printf("cm_query: eps %g, %llu tuples, %zu bytes, %.1f ns/op\n",
+                eps[e], (unsigned long long)cm.num_samples, bytes, ns);
+        fail_unless(destroy_cm_quantile(&cm) == 0);
+    }
+}
+END_TEST
@@ -0,0 +1,57 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "ddsketch.h"
+#include "cm_quantile.h"
+
+START_TEST(bench_dd_compare)
+{
+    // Time both engines on the same streams
+    double quants[] = {0.5, 0.90, 0.99};
+    int num = 1000000;
+    double *samples = malloc(num * sizeof(double));
+    const char *names[] = {"uniform", "lognormal"};
+    srandom(42);
+
+    for (int s=0; s < 2; s++) {
+        for (int i=0; i < num; i++) {
+            if (s == 0) {
+                samples[i] = 1 + random() % 1000;
+            } else {
+                double u1 = (random() + 1.0) / (RAND_MAX + 2.0);
+                double u2 = (random() + 1.0) / (RAND_MAX + 2.0);
+                samples[i] = exp(3 + 1.5 * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2));
+            }
+        }
+
+        cm_quantile cm;
+        ddsketch dd;
+        fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+        fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &dd) == 0);
+
+        struct timespec start, mid, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i=0; i < num; i++)
+            cm_add_sample(&cm, samples[i]);
+        cm_flush(&cm);
+        clock_gettime(CLOCK_MONOTONIC, &mid);
+        for (int i=0; i < num; i++)
+            dd_add_sample(&dd, samples[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double cm_secs = (mid.tv_sec - start.tv_sec) + (mid.tv_nsec - start.tv_nsec) / 1e9;
+        double dd_secs = (end.tv_sec - mid.tv_sec) + (end.tv_nsec - mid.tv_nsec) / 1e9;
+
+        size_t cm_bytes = cm.size * (sizeof(double) + 2 * sizeof(uint64_t)) + cm.batch_size * sizeof(double);
+        printf("%s: cm %.1f M samples/sec, %zu bytes; ddsketch %.1f M samples/sec, %zu bytes\n",
+                names[s], num / cm_secs / 1e6, cm_bytes, num / dd_secs / 1e6, dd_bytes(&dd));
+
+        fail_unless(destroy_cm_quantile(&cm) == 0);
+        fail_unless(destroy_ddsketch(&dd) == 0);
+    }
+    free(samples);
+}
+END_TEST
@@ -0,0 +1,45 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "hash.h"
+
+static double bench_hash(hash_algo algo, char **keys, int *lens, int num_keys, int rounds) {
+    fail_unless(hash_select(algo) == 0);
+    uint64_t sum = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i < num_keys; i++)
+            sum += hash_bytes(keys[i], lens[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fail_unless(sum != 0);
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return ns / ((double)num_keys * rounds);
+}
+
+START_TEST(bench_hash_bytes)
+{
+    // Metric names of 20 to 120 bytes
+    int num_keys = 1024;
+    char *keys[num_keys];
+    int lens[num_keys];
+    for (int i=0; i < num_keys; i++) {
+        lens[i] = 20 + i % 101;
+        keys[i] = malloc(lens[i] + 1);
+        for (int j=0; j < lens[i]; j++)
+            keys[i][j] = (j % 8 == 7) ? '.' : 'a' + (i + j) % 26;
+        keys[i][lens[i]] = '\0';
+    }
+
+    double murmur_ns = bench_hash(HASH_MURMUR, keys, lens, num_keys, 2000);
+    double wyhash_ns = bench_hash(HASH_WYHASH, keys, lens, num_keys, 2000);
+    printf("hash_bytes: murmur %.1f ns/op, wyhash %.1f ns/op\n", murmur_ns, wyhash_ns);
+
+    fail_unless(hash_select(HASH_MURMUR) == 0);
+    for (int i=0; i < num_keys; i++)
+        free(keys[i]);
+}
+END_TEST
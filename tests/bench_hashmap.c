@@ -0,0 +1,95 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashmap.h"
+
+START_TEST(bench_map)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    // Prepare the keys up front, shaped like metric names
+    int num_keys = 1000000;
+    char **keys = malloc(num_keys * sizeof(char*));
+    int *lens = malloc(num_keys * sizeof(int));
+    for (int i=0; i < num_keys; i++) {
+        char buf[64];
+        lens[i] = snprintf(buf, sizeof(buf), "api.host%d.requests.%d", i % 97, i);
+        keys[i] = strdup(buf);
+    }
+
+    void **slot;
+    void *out;
+    struct timespec start, inserted, found, missed;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < num_keys; i++)
+        hashmap_get_or_insert(map, keys[i], lens[i], hashmap_hash(keys[i], lens[i]), &slot);
+    clock_gettime(CLOCK_MONOTONIC, &inserted);
+
+    // Look the keys up in a scattered order
+    for (int i=0; i < num_keys; i++) {
+        int idx = (i * 7919L) % num_keys;
+        fail_unless(hashmap_get_or_insert(map, keys[idx], lens[idx],
+                    hashmap_hash(keys[idx], lens[idx]), &slot) == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &found);
+    for (int i=0; i < num_keys; i++) {
+        keys[i][0] = 'x';
+        fail_unless(hashmap_get(map, keys[i], &out) == -1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &missed);
+
+    double insert_ns = (inserted.tv_sec - start.tv_sec) * 1e9 + (inserted.tv_nsec - start.tv_nsec);
+    double hit_ns = (found.tv_sec - inserted.tv_sec) * 1e9 + (found.tv_nsec - inserted.tv_nsec);
+    double miss_ns = (missed.tv_sec - found.tv_sec) * 1e9 + (missed.tv_nsec - found.tv_nsec);
+    printf("hashmap: insert %.1f ns/op, hit %.1f ns/op, miss %.1f ns/op\n",
+            insert_ns / num_keys, hit_ns / num_keys, miss_ns / num_keys);
+
+    for (int i=0; i < num_keys; i++)
+        free(keys[i]);
+    free(keys);
+    free(lens);
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+static int compare_latency(const void *a, const void *b) {
+    double x = *(double*)a, y = *(double*)b;
+    return (x > y) - (x < y);
+}
+
+START_TEST(bench_map_put_latency)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    // Time every put while the map grows through many resizes
+    int num_keys = 2000000;
+    double *latency = malloc(num_keys * sizeof(double));
+    char buf[64];
+    struct timespec start, end;
+    for (int i=0; i < num_keys; i++) {
+        snprintf(buf, sizeof(buf), "api.host%d.requests.%d", i % 97, i);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        hashmap_put(map, buf, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latency[i] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    }
+    fail_unless(hashmap_size(map) == num_keys);
+
+    qsort(latency, num_keys, sizeof(double), compare_latency);
+    printf("hashmap_put: p50 %.0f ns, p99 %.0f ns, p99.99 %.0f ns, max %.0f ns\n",
+            latency[num_keys / 2], latency[num_keys / 100 * 99],
+            latency[num_keys / 10000 * 9999], latency[num_keys - 1]);
+
+    free(latency);
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
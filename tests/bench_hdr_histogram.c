@@ -0,0 +1,57 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "hdr_histogram.h"
+#include "cm_quantile.h"
+
+START_TEST(bench_hdr_add)
+{
+    // The latency stream of the cm_add_sample benchmark
+    int num = 2000000;
+    double *samples = malloc(num * sizeof(double));
+    srandom(42);
+    for (int i=0; i < num; i++)
+        samples[i] = exp((random() % 100000) / 10000.0);
+
+    double quants[] = {0.5, 0.90, 0.99};
+    cm_quantile cm;
+    hdr_histogram hdr;
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+    fail_unless(init_hdr_histogram(0.01, HDR_DEFAULT_MIN, HDR_DEFAULT_MAX, &hdr) == 0);
+
+    struct timespec start, mid, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < num; i++)
+        cm_add_sample(&cm, samples[i]);
+    cm_flush(&cm);
+    clock_gettime(CLOCK_MONOTONIC, &mid);
+    for (int i=0; i < num; i++)
+        hdr_add_sample(&hdr, samples[i]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double cm_secs = (mid.tv_sec - start.tv_sec) + (mid.tv_nsec - start.tv_nsec) / 1e9;
+    double hdr_secs = (end.tv_sec - mid.tv_sec) + (end.tv_nsec - mid.tv_nsec) / 1e9;
+
+    // Scanning the counts is the cost of a query
+    double sum = 0;
+    int queries = 100000;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < queries; i++)
+        sum += hdr_query(&hdr, quants[i % 3]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fail_unless(sum > 0);
+    double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / queries;
+
+    double val = hdr_query(&hdr, 0.5);
+    fail_unless(val >= exp(4.9) && val <= exp(5.1));
+    printf("hdr_add_sample: %.1f M samples/sec, %zu bytes, %.1f ns/query; cm_add_sample: %.1f M samples/sec\n",
+            num / hdr_secs / 1e6, hdr_bytes(&hdr), ns, num / cm_secs / 1e6);
+
+    fail_unless(destroy_cm_quantile(&cm) == 0);
+    fail_unless(destroy_hdr_histogram(&hdr) == 0);
+    free(samples);
+}
+END_TEST
@@ -0,0 +1,176 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include "metrics.h"
+
+static int iter_bench_cb(void *data, metric_type type, char *key, void *val) {
+    // Touch the name and value, as the sinks do
+    uint64_t *sum = data;
+    *sum += type + key[0] + *(uint64_t*)val;
+    return 0;
+}
+
+static double bench_iter(bool unified, int num_metrics) {
+    metrics m;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, unified, NULL, NULL, false, &m) == 0);
+
+    // Mostly counters, as on a typical server
+    char name[64];
+    for (int i=0; i < num_metrics; i++) {
+        snprintf(name, sizeof(name), "api.host%d.requests.%d", i % 97, i);
+        switch (i % 10) {
+            case 0: metrics_add_sample(&m, TIMER, name, i, 1.0); break;
+            case 1:
+            case 2: metrics_add_sample(&m, GAUGE, name, i, 1.0); break;
+            default: metrics_add_sample(&m, COUNTER, name, i, 1.0); break;
+        }
+    }
+
+    uint64_t sum = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fail_unless(metrics_iter(&m, &sum, iter_bench_cb) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fail_unless(sum > 0);
+    fail_unless(destroy_metrics(&m) == 0);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / num_metrics;
+}
+
+START_TEST(bench_metrics_iter)
+{
+    // The timers are not flushed, so this is only the walk over the maps
+    int num_metrics = 1000000;
+    double typed_ns = bench_iter(false, num_metrics);
+    double unified_ns = bench_iter(true, num_metrics);
+    printf("metrics_iter: typed %.1f ns/op, unified %.1f ns/op\n", typed_ns, unified_ns);
+}
+END_TEST
+
+static size_t bench_admission(bool admission, int num_names) {
+    metrics m;
+    double quants[] = {0.5, 0.95, 0.99};
+    struct mallinfo2 before = mallinfo2();
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                NULL, NULL, admission, &m) == 0);
+
+    // Most names are seen once, the rest a few times
+    char name[64];
+    for (int i=0; i < num_names; i++) {
+        snprintf(name, sizeof(name), "api.host%d.request.%d", i % 97, i);
+        int samples = (i % 10 < 7) ? 1 : 5;
+        for (int j=0; j < samples; j++) {
+            if (i % 4)
+                metrics_add_sample(&m, TIMER, name, j, 1.0);
+            else
+                metrics_set_update(&m, name, name + j);
+        }
+    }
+
+    struct mallinfo2 after = mallinfo2();
+    size_t used = m.arena.used + (after.uordblks + after.hblkhd) - (before.uordblks + before.hblkhd);
+    fail_unless(destroy_metrics(&m) == 0);
+    return used;
+}
+
+START_TEST(bench_metrics_admission)
+{
+    int num_names = 50000;
+    double full_mb = bench_admission(false, num_names) / 1048576.0;
+    double admitted_mb = bench_admission(true, num_names) / 1048576.0;
+    printf("metrics_admission: full %.1f MB, admitted %.1f MB\n", full_mb, admitted_mb);
+}
+END_TEST
+
+static double bench_add_samples(bool runs, int rounds) {
+    metrics m;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                NULL, NULL, false, &m) == 0);
+
+    // Batches of 64 lines over 8 hot counters
+    char names[8][64];
+    uint64_t hashes[8];
+    for (int i=0; i < 8; i++) {
+        snprintf(names[i], sizeof(names[i]), "api.host%d.requests.count", i);
+        hashes[i] = hashmap_hash(names[i], strlen(names[i]));
+    }
+    metric_sample samples[8];
+    for (int i=0; i < 8; i++)
+        samples[i] = (metric_sample){COUNTER, i, 1.0, NULL};
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r=0; r < rounds; r++) {
+        for (int k=0; k < 8; k++) {
+            int len = strlen(names[k]);
+            if (runs)
+                metrics_add_hashed_samples(&m, COUNTER, names[k], len, hashes[k], samples, 8);
+            else {
+                for (int i=0; i < 8; i++)
+                    metrics_add_hashed_sample(&m, COUNTER, names[k], len, hashes[k], i, 1.0);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fail_unless(destroy_metrics(&m) == 0);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (rounds * 64.0);
+}
+
+START_TEST(bench_metrics_add_samples)
+{
+    int rounds = 100000;
+    double single_ns = bench_add_samples(false, rounds);
+    double runs_ns = bench_add_samples(true, rounds);
+    printf("metrics_add_samples: single %.1f ns/op, runs %.1f ns/op\n", single_ns, runs_ns);
+}
+END_TEST
+
+static double bench_hot_keys(bool cache, int num_metrics, int rounds) {
+    metrics m;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                NULL, NULL, false, &m) == 0);
+    if (cache) metrics_use_hot_keys(&m);
+
+    // A large map, with traffic on 16 of the names
+    char name[64];
+    char *hot[16];
+    int lens[16];
+    uint64_t hashes[16];
+    for (int i=0; i < num_metrics; i++) {
+        snprintf(name, sizeof(name), "api.host%d.requests.%d", i % 97, i);
+        metrics_add_sample(&m, COUNTER, name, 1, 1.0);
+    }
+    for (int i=0; i < 16; i++) {
+        snprintf(name, sizeof(name), "api.host%d.requests.%d", i % 97, i * 7919);
+        hot[i] = strdup(name);
+        lens[i] = strlen(name);
+        hashes[i] = hashmap_hash(name, lens[i]);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i < 16; i++)
+            metrics_add_hashed_sample(&m, COUNTER, hot[i], lens[i], hashes[i], 1, 1.0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fail_unless(destroy_metrics(&m) == 0);
+    for (int i=0; i < 16; i++)
+        free(hot[i]);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (rounds * 16.0);
+}
+
+START_TEST(bench_metrics_hot_keys)
+{
+    int num_metrics = 200000, rounds = 200000;
+    double map_ns = bench_hot_keys(false, num_metrics, rounds);
+    double cache_ns = bench_hot_keys(true, num_metrics, rounds);
+    printf("metrics_hot_keys: map %.1f ns/op, cache %.1f ns/op\n", map_ns, cache_ns);
+}
+END_TEST
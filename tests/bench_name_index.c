@@ -0,0 +1,88 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "name_index.h"
+#include "hashmap.h"
+
+// Mixes the tag into the hash, as the metrics do
+static uint64_t tagged_hash(char *name, int tag) {
+    return hashmap_hash(name, strlen(name)) ^ ((uint64_t)tag * 0x9E3779B97F4A7C15ULL);
+}
+
+static char** index_names(int num) {
+    char **names = malloc(num * sizeof(char*));
+    char buf[64];
+    for (int i=0; i < num; i++) {
+        snprintf(buf, sizeof(buf), "api.host%d.requests.%d", i % 97, i);
+        names[i] = strdup(buf);
+    }
+    return names;
+}
+
+START_TEST(bench_name_index)
+{
+    int num = 200000, rounds = 10;
+    char **names = index_names(num);
+    uint64_t *hashes = malloc(num * sizeof(uint64_t));
+    uint8_t *tags = malloc(num);
+    hashmap *map;
+    fail_unless(hashmap_init_borrowed(0, &map) == 0);
+    size_t names_len = 0;
+    for (int i=0; i < num; i++) {
+        tags[i] = 2;
+        hashes[i] = tagged_hash(names[i], tags[i]);
+        names_len += strlen(names[i]) + 1;
+        void **slot;
+        hashmap_get_or_insert(map, names[i], strlen(names[i]), hashes[i], &slot);
+        *slot = names[i];
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    name_index *idx = name_index_build(names, hashes, tags, num);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fail_unless(idx != NULL);
+    double build_ms = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e6;
+
+    // Look the names up in a scattered order
+    long sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i < num; i++) {
+            int n = (i * 7919L) % num;
+            sum += name_index_find(idx, names[n], hashes[n], 2);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double index_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)num * rounds);
+
+    void **slot;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i < num; i++) {
+            int n = (i * 7919L) % num;
+            sum += hashmap_get_slot(map, names[n], hashes[n], &slot);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double map_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)num * rounds);
+    fail_unless(sum > 0);
+
+    // The map slots hold an entry and a control byte
+    double index_bytes = (double)(name_index_bytes(idx) - names_len) / num;
+    double map_bytes = (double)hashmap_tablesize(map) * (sizeof(void*) * 3 + 1) / num;
+    printf("name_index: build %.1f ms, find %.1f ns/op, %.1f bytes/name; "
+            "hashmap: get %.1f ns/op, %.1f bytes/name\n",
+            build_ms, index_ns, index_bytes, map_ns, map_bytes);
+
+    name_index_release(idx);
+    hashmap_destroy(map);
+    for (int i=0; i < num; i++)
+        free(names[i]);
+    free(names);
+    free(hashes);
+    free(tags);
+}
+END_TEST
@@ -0,0 +1,30 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "numparse.h"
+
+START_TEST(bench_parse)
+{
+    const char *inputs[] = {"1", "42", "1234", "0.5", "12.25", "-3", "0.1", "250.125"};
+    int num_inputs = sizeof(inputs) / sizeof(inputs[0]);
+    int rounds = 1000000;
+    char *end;
+    volatile double sum = 0;
+    struct timespec start, fast_done, slow_done;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < rounds; i++)
+        sum += fast_parse_double(inputs[i % num_inputs], &end);
+    clock_gettime(CLOCK_MONOTONIC, &fast_done);
+    for (int i=0; i < rounds; i++)
+        sum += strtod(inputs[i % num_inputs], &end);
+    clock_gettime(CLOCK_MONOTONIC, &slow_done);
+
+    double fast_ns = (fast_done.tv_sec - start.tv_sec) * 1e9 + (fast_done.tv_nsec - start.tv_nsec);
+    double slow_ns = (slow_done.tv_sec - fast_done.tv_sec) * 1e9 + (slow_done.tv_nsec - fast_done.tv_nsec);
+    printf("fast_parse_double: %.1f ns/op, strtod: %.1f ns/op\n",
+            fast_ns / rounds, slow_ns / rounds);
+}
+END_TEST
@@ -0,0 +1,90 @@
+#include <check.h>
+#include <stdio.h>
+#include <syslog.h>
+#include "bench_hashmap.c"
+#include "bench_numparse.c"
+#include "bench_metrics.c"
+#include "bench_hash.c"
+#include "bench_name_index.c"
+#include "bench_cm_quantile.c"
+#include "bench_ddsketch.c"
+#include "bench_hdr_histogram.c"
+#include "bench_timer.c"
+
+/*
+ * The benchmarks print their timings rather than check them,
+ * so they are kept out of the test runner and built on demand.
+ */
+int main(void)
+{
+    setlogmask(LOG_UPTO(LOG_WARNING));
+
+    Suite *s1 = suite_create("Statsite Benchmarks");
+    TCase *tc1 = tcase_create("hashmap");
+    TCase *tc2 = tcase_create("numparse");
+    TCase *tc3 = tcase_create("metrics");
+    TCase *tc4 = tcase_create("hash");
+    TCase *tc5 = tcase_create("name_index");
+    TCase *tc6 = tcase_create("quantile");
+    TCase *tc7 = tcase_create("ddsketch");
+    TCase *tc8 = tcase_create("hdr_histogram");
+    TCase *tc9 = tcase_create("timer");
+    SRunner *sr = srunner_create(s1);
+    int nf;
+
+    // Add the hashmap benchmarks
+    suite_add_tcase(s1, tc1);
+    tcase_add_test(tc1, bench_map);
+    tcase_add_test(tc1, bench_map_put_latency);
+    tcase_set_timeout(tc1, 60);
+
+    // Add the numparse benchmarks
+    suite_add_tcase(s1, tc2);
+    tcase_add_test(tc2, bench_parse);
+    tcase_set_timeout(tc2, 60);
+
+    // Add the metrics benchmarks
+    suite_add_tcase(s1, tc3);
+    tcase_add_test(tc3, bench_metrics_iter);
+    tcase_add_test(tc3, bench_metrics_admission);
+    tcase_add_test(tc3, bench_metrics_add_samples);
+    tcase_add_test(tc3, bench_metrics_hot_keys);
+    tcase_set_timeout(tc3, 60);
+
+    // Add the hash benchmarks
+    suite_add_tcase(s1, tc4);
+    tcase_add_test(tc4, bench_hash_bytes);
+    tcase_set_timeout(tc4, 60);
+
+    // Add the name index benchmarks
+    suite_add_tcase(s1, tc5);
+    tcase_add_test(tc5, bench_name_index);
+    tcase_set_timeout(tc5, 60);
+
+    // Add the quantile benchmarks
+    suite_add_tcase(s1, tc6);
+    tcase_add_test(tc6, bench_cm_add);
+    tcase_add_test(tc6, bench_cm_query);
+    tcase_set_timeout(tc6, 60);
+
+    // Add the ddsketch benchmarks
+    suite_add_tcase(s1, tc7);
+    tcase_add_test(tc7, bench_dd_compare);
+    tcase_set_timeout(tc7, 60);
+
+    // Add the hdr histogram benchmarks
+    suite_add_tcase(s1, tc8);
+    tcase_add_test(tc8, bench_hdr_add);
+    tcase_set_timeout(tc8, 60);
+
+    // Add the timer benchmarks
+    suite_add_tcase(s1, tc9);
+    tcase_add_test(tc9, bench_timer_exact);
+    tcase_set_timeout(tc9, 60);
+
+    srunner_run_all(sr, CK_ENV);
+    nf = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return nf == 0 ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include "timer.h"
+
+START_TEST(bench_timer_exact)
+{
+  // Sparse timers, with a flush
+  double quants[] = {0.5, 0.95, 0.99};
+  int num = 10000, counts[] = {2, 8, 20, 32};
+  timer *timers = malloc(num * sizeof(timer));
+  cm_quantile *cms = malloc(num * sizeof(cm_quantile));
+  for (int c=0; c < 4; c++) {
+      struct timespec start, mid, end;
+      struct mallinfo2 before = mallinfo2();
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int i=0; i < num; i++) {
+          init_timer(0.01, (double*)&quants, 3, timers + i);
+          for (int j=0; j < counts[c]; j++)
+              timer_add_sample(timers + i, (i * 31 + j * 17) % 1000, 1.0);
+          for (int q=0; q < 3; q++)
+              timer_query(timers + i, quants[q]);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &mid);
+      struct mallinfo2 after = mallinfo2();
+      size_t exact_bytes = sizeof(timer) + (after.uordblks - before.uordblks) / num;
+
+      // The same samples in a CM summary, as timers kept them before
+      before = mallinfo2();
+      for (int i=0; i < num; i++) {
+          init_cm_quantile(0.01, (double*)&quants, 3, cms + i);
+          for (int j=0; j < counts[c]; j++)
+              cm_add_sample(cms + i, (i * 31 + j * 17) % 1000);
+          for (int q=0; q < 3; q++)
+              cm_query(cms + i, quants[q]);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      after = mallinfo2();
+      size_t cm_bytes = sizeof(timer) - sizeof(timers->store) + sizeof(cm_quantile) +
+          (after.uordblks - before.uordblks) / num;
+
+      double exact_ns = ((mid.tv_sec - start.tv_sec) * 1e9 + (mid.tv_nsec - start.tv_nsec)) / num;
+      double cm_ns = ((end.tv_sec - mid.tv_sec) * 1e9 + (end.tv_nsec - mid.tv_nsec)) / num;
+      printf("timer_exact: %d samples, exact %zu bytes %.0f ns, cm %zu bytes %.0f ns\n",
+              counts[c], exact_bytes, exact_ns, cm_bytes, cm_ns);
+
+      for (int i=0; i < num; i++) {
+          destroy_timer(timers + i);
+          destroy_cm_quantile(cms + i);
+      }
+  }
+  free(timers);
+  free(cms);
+}
+END_TEST
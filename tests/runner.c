@@ -16,6 +16,17 @@
 #include "test_lifoq.c"
 #include "test_strbuf.c"
 #include "test_utils.c"
+#include "test_binproto.c"
+#include "test_tokenizer.c"
+#include "test_numparse.c"
+#include "test_uring.c"
+#include "test_circqueue.c"
+#include "test_intern.c"
+#include "test_arena.c"
+#include "test_hash.c"
+#include "test_name_index.c"
+#include "test_ddsketch.c"
+#include "test_hdr_histogram.c"
 
 int main(void)
 {
@@ -37,6 +48,17 @@ int main(void)
     TCase *tc13 = tcase_create("lifoq");
     TCase *tc14 = tcase_create("strbuf");
     TCase *tc15 = tcase_create("utils");
+    TCase *tc16 = tcase_create("binproto");
+    TCase *tc17 = tcase_create("tokenizer");
+    TCase *tc18 = tcase_create("numparse");
+    TCase *tc19 = tcase_create("uring");
+    TCase *tc20 = tcase_create("circqueue");
+    TCase *tc21 = tcase_create("intern");
+    TCase *tc22 = tcase_create("arena");
+    TCase *tc23 = tcase_create("hash");
+    TCase *tc24 = tcase_create("name_index");
+    TCase *tc25 = tcase_create("ddsketch");
+    TCase *tc26 = tcase_create("hdr_histogram");
     SRunner *sr = srunner_create(s1);
     int nf;
 
@@ -54,6 +76,11 @@ int main(void)
     tcase_add_test(tc1, test_map_iter_no_keys);
     tcase_add_test(tc1, test_map_put_iter_break);
     tcase_add_test(tc1, test_map_put_grow);
+    tcase_add_test(tc1, test_map_get_or_insert);
+    tcase_add_test(tc1, test_map_get_or_insert_put);
+    tcase_add_test(tc1, test_map_delete_slot);
+    tcase_add_test(tc1, test_map_put_delete_churn);
+    tcase_add_test(tc1, test_map_alloc_fail);
 
     // Add the quantile tests
     suite_add_tcase(s1, tc2);
@@ -69,6 +96,9 @@ int main(void)
     tcase_add_test(tc2, test_cm_init_add_loop_query_destroy);
     tcase_add_test(tc2, test_cm_init_add_loop_rev_query_destroy);
     tcase_add_test(tc2, test_cm_init_add_loop_random_query_destroy);
+    tcase_add_test(tc2, test_cm_merge_query_destroy);
+    tcase_add_test(tc2, test_cm_merge_shards_rank_error);
+    tcase_add_test(tc2, test_cm_add_batches);
 
     // Add the heap tests
     suite_add_tcase(s1, tc3);
@@ -85,6 +115,11 @@ int main(void)
     tcase_add_test(tc4, test_timer_init_add_destroy);
     tcase_add_test(tc4, test_timer_add_loop);
     tcase_add_test(tc4, test_timer_sample_rate);
+    tcase_add_test(tc4, test_timer_ddsketch);
+    tcase_add_test(tc4, test_timer_hdr);
+    tcase_add_test(tc4, test_timer_exact);
+    tcase_add_test(tc4, test_timer_exact_bad_args);
+    tcase_add_test(tc4, test_timer_exact_merge);
 
     // Add the counter tests
     suite_add_tcase(s1, tc5);
@@ -92,6 +127,8 @@ int main(void)
     tcase_add_test(tc5, test_counter_init_add);
     tcase_add_test(tc5, test_counter_add_loop);
     tcase_add_test(tc5, test_counter_sample_rate);
+    tcase_add_test(tc5, test_counter_merge);
+    tcase_add_test(tc5, test_counter_merge_empty);
 
     // Add the gauge tests
     suite_add_tcase(s1, tc6);
@@ -107,7 +144,18 @@ int main(void)
     tcase_add_test(tc7, test_metrics_add_iter);
     tcase_add_test(tc7, test_metrics_add_all_iter);
     tcase_add_test(tc7, test_metrics_histogram);
+    tcase_add_test(tc7, test_metrics_quantile_engines);
+    tcase_add_test(tc7, test_metrics_timer_init_fails);
     tcase_add_test(tc7, test_metrics_gauges);
+    tcase_add_test(tc7, test_metrics_merge);
+    tcase_add_test(tc7, test_metrics_interned);
+    tcase_add_test(tc7, test_metrics_unified);
+    tcase_add_test(tc7, test_metrics_cardinality);
+    tcase_add_test(tc7, test_metrics_cardinality_shards);
+    tcase_add_test(tc7, test_metrics_admission);
+    tcase_add_test(tc7, test_metrics_add_samples);
+    tcase_add_test(tc7, test_metrics_hot_keys);
+    tcase_add_test(tc7, test_metrics_index);
 
     // Add the streaming tests
     suite_add_tcase(s1, tc8);
@@ -131,10 +179,18 @@ int main(void)
     tcase_add_test(tc9, test_sane_log_facility);
     tcase_add_test(tc9, test_sane_timer_eps);
     tcase_add_test(tc9, test_sane_flush_interval);
+    tcase_add_test(tc9, test_sane_ingest_threads);
+    tcase_add_test(tc9, test_sane_udp_batch_size);
+    tcase_add_test(tc9, test_sane_name_idle_intervals);
+    tcase_add_test(tc9, test_sane_hash_function);
     tcase_add_test(tc9, test_sane_histograms);
     tcase_add_test(tc9, test_sane_set_eps);
     tcase_add_test(tc9, test_config_histograms);
     tcase_add_test(tc9, test_build_radix);
+    tcase_add_test(tc9, test_config_cardinality);
+    tcase_add_test(tc9, test_sane_cardinality_limits);
+    tcase_add_test(tc9, test_config_quantile_engines);
+    tcase_add_test(tc9, test_sane_quantile_engine);
     tcase_add_test(tc9, test_sane_prefixes);
     tcase_add_test(tc9, test_sane_global_prefix);
     tcase_add_test(tc9, test_sane_quantiles);
@@ -166,6 +222,8 @@ int main(void)
     tcase_add_test(tc12, test_set_add_size_exact);
     tcase_add_test(tc12, test_set_add_size_exact_dedup);
     tcase_add_test(tc12, test_set_error_bound);
+    tcase_add_test(tc12, test_set_merge_exact);
+    tcase_add_test(tc12, test_set_merge_approx);
 
     // Add the lifoq tests
     suite_add_tcase(s1, tc13);
@@ -184,6 +242,84 @@ int main(void)
     suite_add_tcase(s1, tc15);
     tcase_add_test(tc15, test_percentile_convertion);
 
+    // Add the binary protocol tests
+    suite_add_tcase(s1, tc16);
+    tcase_add_test(tc16, test_binproto_encode_wire_format);
+    tcase_add_test(tc16, test_binproto_encode_decode);
+    tcase_add_test(tc16, test_binproto_encode_decode_sample_rate);
+    tcase_add_test(tc16, test_binproto_encode_decode_set);
+    tcase_add_test(tc16, test_binproto_encode_too_small);
+    tcase_add_test(tc16, test_binproto_decode_bad);
+
+    // Add the tokenizer tests
+    suite_add_tcase(s1, tc17);
+    tcase_add_test(tc17, test_tokenize_basic);
+    tcase_add_test(tc17, test_tokenize_malformed);
+    tcase_add_test(tc17, test_tokenize_last_colon);
+    tcase_add_test(tc17, test_tokenize_incomplete);
+    tcase_add_test(tc17, test_tokenize_max_spans);
+    tcase_add_test(tc17, test_tokenize_binary_stop);
+    tcase_add_test(tc17, test_tokenize_random);
+
+    // Add the numeric parser tests
+    suite_add_tcase(s1, tc18);
+    tcase_add_test(tc18, test_parse_integers);
+    tcase_add_test(tc18, test_parse_edge_cases);
+    tcase_add_test(tc18, test_parse_random);
+
+    // Add the io_uring tests
+    suite_add_tcase(s1, tc19);
+#ifdef HAVE_IO_URING
+    tcase_add_test(tc19, test_uring_multishot_recv);
+#endif
+
+    // Add the circular buffer tests
+    suite_add_tcase(s1, tc20);
+    tcase_add_test(tc20, test_circbuf_init_free);
+    tcase_add_test(tc20, test_circbuf_mirrored_wrap);
+    tcase_add_test(tc20, test_circbuf_grow_wrapped);
+
+    // Add the intern table tests
+    suite_add_tcase(s1, tc21);
+    tcase_add_test(tc21, test_intern_init_destroy);
+    tcase_add_test(tc21, test_intern_same_name);
+    tcase_add_test(tc21, test_intern_expire);
+
+    // Add the arena tests
+    suite_add_tcase(s1, tc22);
+    tcase_add_test(tc22, test_arena_init_destroy);
+    tcase_add_test(tc22, test_arena_alloc);
+    tcase_add_test(tc22, test_arena_merge);
+
+    // Add the hash tests
+    suite_add_tcase(s1, tc23);
+    tcase_add_test(tc23, test_hash_murmur_default);
+    tcase_add_test(tc23, test_hash_select);
+    tcase_add_test(tc23, test_hash_hll_error);
+
+    // Add the name index tests
+    suite_add_tcase(s1, tc24);
+    tcase_add_test(tc24, test_name_index_build);
+    tcase_add_test(tc24, test_name_index_large);
+
+    // Add the ddsketch tests
+    suite_add_tcase(s1, tc25);
+    tcase_add_test(tc25, test_dd_init_and_destroy);
+    tcase_add_test(tc25, test_dd_init_bad_args);
+    tcase_add_test(tc25, test_dd_relative_error);
+    tcase_add_test(tc25, test_dd_negative_and_zero);
+    tcase_add_test(tc25, test_dd_merge);
+    tcase_add_test(tc25, test_dd_collapse);
+    tcase_add_test(tc25, test_dd_compare_cm);
+
+    // Add the hdr histogram tests
+    suite_add_tcase(s1, tc26);
+    tcase_add_test(tc26, test_hdr_init_and_destroy);
+    tcase_add_test(tc26, test_hdr_init_bad_args);
+    tcase_add_test(tc26, test_hdr_relative_error);
+    tcase_add_test(tc26, test_hdr_out_of_range);
+    tcase_add_test(tc26, test_hdr_merge);
+
     srunner_run_all(sr, CK_ENV);
     nf = srunner_ntests_failed(sr);
     srunner_free(sr);
@@ -0,0 +1,78 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+START_TEST(test_arena_init_destroy)
+{
+    arena a;
+    fail_unless(arena_init(&a) == 0);
+    fail_unless(a.used == 0);
+    fail_unless(arena_destroy(&a) == 0);
+}
+END_TEST
+
+START_TEST(test_arena_alloc)
+{
+    arena a;
+    fail_unless(arena_init(&a) == 0);
+
+    // Enough small allocations to span several chunks
+    uint64_t *prev = NULL;
+    for (int i=0; i < 100000; i++) {
+        uint64_t *v = arena_alloc(&a, 1 + (i % 24));
+        fail_unless(v != NULL);
+        fail_unless(((uintptr_t)v & 7) == 0);
+        fail_unless(v != prev);
+        *v = i;
+        prev = v;
+    }
+
+    // Zeroed memory and allocations larger than a chunk
+    unsigned int *counts = arena_calloc(&a, 1 << 20, sizeof(unsigned int));
+    fail_unless(counts != NULL);
+    fail_unless(counts[0] == 0 && counts[(1 << 20) - 1] == 0);
+    counts[(1 << 20) - 1] = 1;
+
+    char *s = arena_strndup(&a, "foo.bar.baz", 7);
+    fail_unless(strcmp(s, "foo.bar") == 0);
+    fail_unless(arena_destroy(&a) == 0);
+}
+END_TEST
+
+START_TEST(test_arena_merge)
+{
+    arena a, b;
+    fail_unless(arena_init(&a) == 0);
+    fail_unless(arena_init(&b) == 0);
+
+    char *in_a = arena_strndup(&a, "in a", 4);
+    char *in_b[1000];
+    char buf[32];
+    for (int i=0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "in b %d", i);
+        in_b[i] = arena_strndup(&b, buf, strlen(buf));
+    }
+    size_t used = a.used + b.used;
+
+    // The memory of b lives on in a
+    fail_unless(arena_merge(&a, &b) == 0);
+    fail_unless(a.used == used);
+    fail_unless(b.used == 0 && b.chunks == NULL);
+    fail_unless(arena_destroy(&b) == 0);
+
+    char *after = arena_strndup(&a, "after", 5);
+    fail_unless(strcmp(in_a, "in a") == 0);
+    fail_unless(strcmp(in_b[999], "in b 999") == 0);
+    fail_unless(strcmp(after, "after") == 0);
+
+    // Merging into an empty arena
+    arena c;
+    fail_unless(arena_init(&c) == 0);
+    fail_unless(arena_merge(&c, &a) == 0);
+    fail_unless(strcmp(in_b[0], "in b 0") == 0);
+    fail_unless(arena_strndup(&c, "more", 4) != NULL);
+    fail_unless(arena_destroy(&c) == 0);
+}
+END_TEST
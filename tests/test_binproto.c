@@ -0,0 +1,94 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include "binproto.h"
+
+START_TEST(test_binproto_encode_wire_format)
+{
+    // ("Conns", "c", 200) from the README
+    unsigned char expected[] = {0xaa, 0x02, 0x06, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x69, 0x40,
+        'C', 'o', 'n', 'n', 's', 0x00};
+    char buf[64];
+    int len = binproto_encode((char*)&buf, sizeof(buf), COUNTER, "Conns", 200, 1.0);
+    fail_unless(len == sizeof(expected));
+    fail_unless(memcmp(buf, expected, len) == 0);
+}
+END_TEST
+
+START_TEST(test_binproto_encode_decode)
+{
+    char buf[64];
+    binproto_header h;
+    metric_type types[] = {GAUGE_DIRECT, GAUGE, GAUGE_DELTA, COUNTER, TIMER};
+    for (int i=0; i < 5; i++) {
+        int len = binproto_encode((char*)&buf, sizeof(buf), types[i], "foo.bar", -12.5, 1.0);
+        fail_unless(len == BIN_VALUE_HEADER_SIZE + 8);
+        fail_unless(binproto_header_size(buf[1]) == BIN_VALUE_HEADER_SIZE);
+        fail_unless(binproto_decode_header((unsigned char*)&buf, &h) == BIN_VALUE_HEADER_SIZE);
+        fail_unless(h.type == types[i]);
+        fail_unless(h.key_len == 8);
+        fail_unless(h.value == -12.5);
+        fail_unless(h.sample_rate == 1.0);
+        fail_unless(strcmp(buf + BIN_VALUE_HEADER_SIZE, "foo.bar") == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_binproto_encode_decode_sample_rate)
+{
+    char buf[64];
+    binproto_header h;
+    int len = binproto_encode((char*)&buf, sizeof(buf), TIMER, "foo", 42, 0.25);
+    fail_unless(len == BIN_RATE_HEADER_SIZE + 4);
+    fail_unless((unsigned char)buf[1] == (BIN_TYPE_TIMER | BIN_FLAG_SAMPLE_RATE));
+    fail_unless(binproto_decode_header((unsigned char*)&buf, &h) == BIN_RATE_HEADER_SIZE);
+    fail_unless(h.type == TIMER);
+    fail_unless(h.value == 42);
+    fail_unless(h.sample_rate == 0.25);
+    fail_unless(strcmp(buf + BIN_RATE_HEADER_SIZE, "foo") == 0);
+}
+END_TEST
+
+START_TEST(test_binproto_encode_decode_set)
+{
+    char buf[64];
+    binproto_header h;
+    int len = binproto_encode_set((char*)&buf, sizeof(buf), "users", "bob");
+    fail_unless(len == BIN_SET_HEADER_SIZE + 6 + 4);
+    fail_unless(binproto_decode_header((unsigned char*)&buf, &h) == BIN_SET_HEADER_SIZE);
+    fail_unless(h.type == SET);
+    fail_unless(h.key_len == 6);
+    fail_unless(h.set_len == 4);
+    fail_unless(strcmp(buf + BIN_SET_HEADER_SIZE, "users") == 0);
+    fail_unless(strcmp(buf + BIN_SET_HEADER_SIZE + h.key_len, "bob") == 0);
+
+    // Sets cannot be encoded with a value
+    fail_unless(binproto_encode((char*)&buf, sizeof(buf), SET, "users", 1, 1.0) == -1);
+}
+END_TEST
+
+START_TEST(test_binproto_encode_too_small)
+{
+    char buf[16];
+    fail_unless(binproto_encode((char*)&buf, sizeof(buf), COUNTER, "a.long.key", 1, 1.0) == -1);
+    fail_unless(binproto_encode_set((char*)&buf, sizeof(buf), "a.long.key", "value") == -1);
+    fail_unless(binproto_encode((char*)&buf, sizeof(buf), COUNTER, "abc", 1, 1.0) == 16);
+}
+END_TEST
+
+START_TEST(test_binproto_decode_bad)
+{
+    binproto_header h;
+    unsigned char bad_magic[] = {0xab, 0x02, 0x01, 0x00, 0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned char bad_type[] = {0xaa, 0x07, 0x01, 0x00, 0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned char sampled_set[] = {0xaa, 0x84, 0x01, 0x00, 0x01, 0x00};
+    unsigned char empty_key[] = {0xaa, 0x02, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0};
+    fail_unless(binproto_decode_header((unsigned char*)&bad_magic, &h) == -1);
+    fail_unless(binproto_decode_header((unsigned char*)&bad_type, &h) == -1);
+    fail_unless(binproto_decode_header((unsigned char*)&sampled_set, &h) == -1);
+    fail_unless(binproto_decode_header((unsigned char*)&empty_key, &h) == -1);
+    fail_unless(binproto_header_size(0) == -1);
+    fail_unless(binproto_header_size(0x7f) == -1);
+}
+END_TEST
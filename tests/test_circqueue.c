@@ -0,0 +1,70 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include "circqueue.h"
+
+START_TEST(test_circbuf_init_free)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+    fail_unless(circbuf_used_buf(&buf) == 0);
+    fail_unless(circbuf_avail_buf(&buf) == buf.buf_size - 1);
+    circbuf_free(&buf);
+    fail_unless(buf.buffer == NULL);
+}
+END_TEST
+
+START_TEST(test_circbuf_mirrored_wrap)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+
+    // Move the cursors close to the end
+    buf.read_cursor = buf.write_cursor = buf.buf_size - 4;
+
+    // A write across the end wraps, and reads back contiguous
+    fail_unless(circbuf_write(&buf, "foo:1|c\n", 8) == 0);
+    fail_unless(buf.write_cursor == 4);
+    fail_unless(circbuf_used_buf(&buf) == 8);
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, "foo:1|c\n", 8) == 0);
+    fail_unless(memcmp(buf.buffer, "1|c\n", 4) == 0);
+
+    // The available space is contiguous too
+    struct iovec vectors[1];
+    int num_vectors;
+    circbuf_setup_readv_iovec(&buf, (struct iovec*)&vectors, &num_vectors);
+    fail_unless(num_vectors == 1);
+    fail_unless(vectors[0].iov_base == buf.buffer + 4);
+    fail_unless(vectors[0].iov_len == circbuf_avail_buf(&buf));
+    circbuf_free(&buf);
+}
+END_TEST
+
+START_TEST(test_circbuf_grow_wrapped)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+    uint32_t size = buf.buf_size;
+    buf.read_cursor = buf.write_cursor = size - 100;
+
+    // Fill the buffer across the end with a known pattern
+    char data[4096];
+    for (int i=0; i < (int)sizeof(data); i++) data[i] = i % 251;
+    fail_unless(circbuf_write(&buf, data, sizeof(data)) == 0);
+    fail_unless(buf.write_cursor < buf.read_cursor);
+
+    fail_unless(circbuf_grow_buf(&buf) == 0);
+    fail_unless(buf.buf_size == 2 * size);
+    fail_unless(circbuf_used_buf(&buf) == sizeof(data));
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, data, sizeof(data)) == 0);
+
+    // Writes larger than the buffer grow it
+    char big[100000];
+    memset(big, 'x', sizeof(big));
+    fail_unless(circbuf_write(&buf, big, sizeof(big)) == 0);
+    fail_unless(circbuf_used_buf(&buf) == sizeof(data) + sizeof(big));
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, data, sizeof(data)) == 0);
+    fail_unless(memcmp(buf.buffer + buf.read_cursor + sizeof(data), big, sizeof(big)) == 0);
+    circbuf_free(&buf);
+}
+END_TEST
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 #include "cm_quantile.h"
 
 START_TEST(test_cm_init_and_destroy)
@@ -129,10 +130,8 @@ START_TEST(test_cm_init_add_negative_query_destroy)
 END_TEST
 
 void print_cm(cm_quantile *cm) {
-    cm_sample *samp = cm->samples;
-    while (samp) {
-        printf("%f - %lld %lld\n", samp->value, samp->width, samp->delta);
-        samp = samp->next;
+    for (uint64_t i=0; i < cm->num_samples; i++) {
+        printf("%f - %lld %lld\n", cm->values[i], (long long)cm->widths[i], (long long)cm->deltas[i]);
     }
 }
 
@@ -225,3 +224,123 @@ START_TEST(test_cm_init_add_loop_random_query_destroy)
 END_TEST
 
 
+START_TEST(test_cm_merge_query_destroy)
+{
+    cm_quantile cm1, cm2;
+    double quants[] = {0.5, 0.90, 0.99};
+    int res = init_cm_quantile(0.01, (double*)&quants, 3, &cm1);
+    fail_unless(res == 0);
+    res = init_cm_quantile(0.01, (double*)&quants, 3, &cm2);
+    fail_unless(res == 0);
+
+    // Interleave the values across the summaries
+    for (int i=0; i < 100000; i++) {
+        res = cm_add_sample((i % 2) ? &cm1 : &cm2, i);
+        fail_unless(res == 0);
+    }
+
+    res = cm_merge(&cm1, &cm2);
+    fail_unless(res == 0);
+    fail_unless(cm1.num_values == 100000);
+
+    double val = cm_query(&cm1, 0.5);
+    fail_unless(val >= 50000.0 - 2000 && val <= 50000 + 2000);
+
+    val = cm_query(&cm1, 0.9);
+    fail_unless(val >= 90000.0 - 2000 && val <= 90000 + 2000);
+
+    val = cm_query(&cm1, 0.99);
+    fail_unless(val >= 99000.0 - 2000 && val <= 99000 + 2000);
+
+    fail_unless(destroy_cm_quantile(&cm1) == 0);
+    fail_unless(destroy_cm_quantile(&cm2) == 0);
+}
+END_TEST
+
+START_TEST(test_cm_add_batches)
+{
+    cm_quantile cm;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+
+    // Negative, zero and repeated values over many batches
+    for (int i=0; i < 10000; i++) {
+        int n = (i * 7919) % 10000;
+        fail_unless(cm_add_sample(&cm, n % 2001 - 1000) == 0);
+    }
+    fail_unless(cm_flush(&cm) == 0);
+    fail_unless(cm.num_values == 10000);
+    fail_unless(cm.batch_len == 0);
+
+    // The extremes are kept exactly
+    fail_unless(cm.values[0] == -1000);
+    fail_unless(cm.values[cm.num_samples - 1] == 1000);
+    uint64_t width = cm.widths[0];
+    for (uint64_t i=1; i < cm.num_samples; i++) {
+        fail_unless(cm.values[i-1] <= cm.values[i]);
+        width += cm.widths[i];
+    }
+    fail_unless(width == 10000);
+
+    double val = cm_query(&cm, 0.5);
+    fail_unless(val >= -50 && val <= 50);
+    val = cm_query(&cm, 0.9);
+    fail_unless(val >= 750 && val <= 850);
+
+    fail_unless(destroy_cm_quantile(&cm) == 0);
+}
+END_TEST
+
+static int cmp_cm_double(const void *a, const void *b) {
+    double x = *(double*)a, y = *(double*)b;
+    return (x > y) - (x < y);
+}
+
+// Returns how far the ranks of a value are from the rank of a quantile
+static double cm_rank_error(double *sorted, int num, double val, double quantile) {
+    int first = 0, last = 0;
+    while (first < num && sorted[first] < val) first++;
+    last = first;
+    while (last < num && sorted[last] <= val) last++;
+    double rank = quantile * num;
+    if (rank < first) return first - rank;
+    if (rank > last) return rank - last;
+    return 0;
+}
+
+START_TEST(test_cm_merge_shards_rank_error)
+{
+    double quants[] = {0.5, 0.90, 0.99};
+    int shards = 8, per = 20000, num = shards * per;
+    double *sorted = malloc(num * sizeof(double));
+
+    // Shards of the same stream, disjoint shards, and shards of skewed streams
+    for (int s=0; s < 3; s++) {
+        cm_quantile cms[shards];
+        srandom(42);
+        for (int i=0; i < shards; i++) {
+            fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, cms + i) == 0);
+            for (int j=0; j < per; j++) {
+                double u = (random() % 1000000) / 1000000.0;
+                double val = (s == 0) ? u : (s == 1) ? i + u : (i % 2) ? u * u * u : exp(u * 5);
+                sorted[i * per + j] = val;
+                fail_unless(cm_add_sample(cms + i, val) == 0);
+            }
+        }
+
+        // Fold the shards in turn, as the flush does
+        for (int i=1; i < shards; i++)
+            fail_unless(cm_merge(cms, cms + i) == 0);
+        fail_unless(cms[0].num_values == (uint64_t)num);
+
+        qsort(sorted, num, sizeof(double), cmp_cm_double);
+        for (int q=0; q < 3; q++) {
+            double val = cm_query(cms, quants[q]);
+            fail_unless(cm_rank_error(sorted, num, val, quants[q]) <= 0.01 * num);
+        }
+        for (int i=0; i < shards; i++)
+            fail_unless(destroy_cm_quantile(cms + i) == 0);
+    }
+    free(sorted);
+}
+END_TEST
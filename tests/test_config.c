@@ -7,6 +7,8 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include "config.h"
+#include "hash.h"
+#include "timer.h"
 
 START_TEST(test_config_get_default)
 {
@@ -31,6 +33,30 @@ START_TEST(test_config_get_default)
     fail_unless(config.quantiles[0] == 0.5);
     fail_unless(config.quantiles[1] == 0.95);
     fail_unless(config.quantiles[2] == 0.99);
+    fail_unless(config.ingest_threads == 1);
+    fail_unless(config.udp_batch_size == 16);
+    fail_unless(config.udp_gro == false);
+    fail_unless(config.udp_batch_timer == NULL);
+    fail_unless(config.use_io_uring == false);
+    fail_unless(config.unix_dgram_path == NULL);
+    fail_unless(config.unix_stream_path == NULL);
+    fail_unless(config.unix_socket_mode == 0660);
+    fail_unless(config.unix_rcvbuf == 0);
+    fail_unless(config.name_idle_intervals == 3);
+    fail_unless(config.unified_store == false);
+    fail_unless(strcmp(config.hash_function, "murmur") == 0);
+    fail_unless(config.hash_algo == HASH_MURMUR);
+    fail_unless(config.cardinality_configs == NULL);
+    fail_unless(config.cardinality_limits == NULL);
+    fail_unless(config.admission_filter == false);
+    fail_unless(config.coalesce_batches == false);
+    fail_unless(config.hot_key_gauge == NULL);
+    fail_unless(config.perfect_hash_index == false);
+    fail_unless(strcmp(config.quantile_engine, "cm") == 0);
+    fail_unless(config.quantile_algo == QUANTILE_CM);
+    fail_unless(config.quantile_configs == NULL);
+    fail_unless(config.quantile_engines == NULL);
+    fail_unless(config.hot_key_cache == true);
 }
 END_TEST
 
@@ -113,6 +139,24 @@ daemonize = true\n\
 input_counter = foobar\n\
 pid_file = /tmp/statsite.pid\n\
 extended_counters = true\n\
+ingest_threads = 4\n\
+udp_batch_size = 32\n\
+udp_gro = true\n\
+udp_batch_timer = statsite.batch\n\
+use_io_uring = true\n\
+unix_dgram_path = /tmp/statsite.dgram\n\
+unix_stream_path = /tmp/statsite.sock\n\
+unix_socket_mode = 0666\n\
+unix_rcvbuf = 4194304\n\
+name_idle_intervals = 10\n\
+unified_store = true\n\
+hash_function = wyhash\n\
+admission_filter = true\n\
+coalesce_batches = true\n\
+hot_key_cache = false\n\
+hot_key_gauge = statsite.hot_keys\n\
+perfect_hash_index = true\n\
+quantile_engine = ddsketch\n\
 quantiles = 0.5, 0.90, 0.95, 0.99\n";
     write(fh, buf, strlen(buf));
     fchmod(fh, 777);
@@ -145,6 +189,24 @@ quantiles = 0.5, 0.90, 0.95, 0.99\n";
     fail_unless(config.percentiles[1] == 90);
     fail_unless(config.percentiles[2] == 95);
     fail_unless(config.percentiles[3] == 99);
+    fail_unless(config.ingest_threads == 4);
+    fail_unless(config.udp_batch_size == 32);
+    fail_unless(config.udp_gro == true);
+    fail_unless(strcmp(config.udp_batch_timer, "statsite.batch") == 0);
+    fail_unless(config.use_io_uring == true);
+    fail_unless(strcmp(config.unix_dgram_path, "/tmp/statsite.dgram") == 0);
+    fail_unless(strcmp(config.unix_stream_path, "/tmp/statsite.sock") == 0);
+    fail_unless(config.unix_socket_mode == 0666);
+    fail_unless(config.unix_rcvbuf == 4194304);
+    fail_unless(config.name_idle_intervals == 10);
+    fail_unless(config.unified_store == true);
+    fail_unless(strcmp(config.hash_function, "wyhash") == 0);
+    fail_unless(config.admission_filter == true);
+    fail_unless(config.coalesce_batches == true);
+    fail_unless(config.hot_key_cache == false);
+    fail_unless(strcmp(config.hot_key_gauge, "statsite.hot_keys") == 0);
+    fail_unless(config.perfect_hash_index == true);
+    fail_unless(strcmp(config.quantile_engine, "ddsketch") == 0);
 
     unlink("/tmp/basic_config");
 }
@@ -283,6 +345,57 @@ START_TEST(test_sane_flush_interval)
 }
 END_TEST
 
+START_TEST(test_sane_ingest_threads)
+{
+    fail_unless(sane_ingest_threads(-1) == 1);
+    fail_unless(sane_ingest_threads(0) == 1);
+    fail_unless(sane_ingest_threads(1) == 0);
+    fail_unless(sane_ingest_threads(8) == 0);
+    fail_unless(sane_ingest_threads(65) == 1);
+}
+END_TEST
+
+START_TEST(test_sane_udp_batch_size)
+{
+    fail_unless(sane_udp_batch_size(-1) == 1);
+    fail_unless(sane_udp_batch_size(0) == 1);
+    fail_unless(sane_udp_batch_size(1) == 0);
+    fail_unless(sane_udp_batch_size(64) == 0);
+    fail_unless(sane_udp_batch_size(256) == 0);
+    fail_unless(sane_udp_batch_size(2048) == 1);
+}
+END_TEST
+
+START_TEST(test_sane_name_idle_intervals)
+{
+    fail_unless(sane_name_idle_intervals(-1) == 1);
+    fail_unless(sane_name_idle_intervals(0) == 0);
+    fail_unless(sane_name_idle_intervals(3) == 0);
+}
+END_TEST
+
+START_TEST(test_sane_hash_function)
+{
+    int algo = -1;
+    fail_unless(sane_hash_function("murmur", &algo) == 0);
+    fail_unless(algo == HASH_MURMUR);
+    fail_unless(sane_hash_function("WYHASH", &algo) == 0);
+    fail_unless(algo == HASH_WYHASH);
+    fail_unless(sane_hash_function("md5", &algo) == 1);
+}
+END_TEST
+
+START_TEST(test_sane_cardinality_limits)
+{
+    cardinality_config c1 = {"foo.", 100};
+    cardinality_config c2 = {"bar.", 0};
+    fail_unless(sane_cardinality_limits(NULL) == 0);
+    fail_unless(sane_cardinality_limits(&c1) == 0);
+    c1.next = &c2;
+    fail_unless(sane_cardinality_limits(&c1) == 1);
+}
+END_TEST
+
 START_TEST(test_sane_histograms)
 {
     histogram_config c = {"foo", 100, 200, 10, 0, NULL, 0};
@@ -442,6 +555,137 @@ START_TEST(test_build_radix)
 }
 END_TEST
 
+START_TEST(test_config_cardinality)
+{
+    int fh = open("/tmp/cardinality_basic", O_CREAT|O_RDWR, 0777);
+    char *buf = "[statsite]\n\
+port = 10000\n\
+\n\
+[cardinality_api]\n\
+prefix=api.\n\
+max_keys=1000\n\
+\n\
+[cardinality_requests]\n\
+prefix=api.requests\n\
+max_keys=50\n\
+\n\
+";
+    write(fh, buf, strlen(buf));
+    fchmod(fh, 777);
+    close(fh);
+
+    statsite_config config;
+    int res = config_from_filename("/tmp/cardinality_basic", &config);
+    fail_unless(res == 0);
+    fail_unless(validate_config(&config) == 0);
+    fail_unless(build_prefix_tree(&config) == 0);
+    fail_unless(config.num_cardinality_limits == 2);
+
+    // The longest prefix wins, and the overflow
+    // names have a single separator
+    cardinality_config *c = NULL;
+    fail_unless(radix_longest_prefix(config.cardinality_limits, "api.requests.abc", (void**)&c) == 0);
+    fail_unless(c->max_keys == 50);
+    fail_unless(strcmp(c->overflow_name, "api.requests.__overflow__") == 0);
+    fail_unless(c->overflow_len == (int)strlen(c->overflow_name));
+    fail_unless(radix_longest_prefix(config.cardinality_limits, "api.other", (void**)&c) == 0);
+    fail_unless(c->max_keys == 1000);
+    fail_unless(strcmp(c->overflow_name, "api.__overflow__") == 0);
+    fail_unless(strcmp(c->rejected_name, "api.__rejected__") == 0);
+    fail_unless(radix_longest_prefix(config.cardinality_limits, "site.foo", (void**)&c) == 1);
+
+    unlink("/tmp/cardinality_basic");
+}
+END_TEST
+
+START_TEST(test_config_quantile_engines)
+{
+    int fh = open("/tmp/quantile_engines", O_CREAT|O_RDWR, 0777);
+    char *buf = "[statsite]\n\
+quantile_engine = DDSketch\n\
+\n\
+[quantile_api]\n\
+prefix=api.\n\
+engine=cm\n\
+\n\
+[quantile_latency]\n\
+prefix=api.latency\n\
+engine=ddsketch\n\
+\n\
+[quantile_rpc]\n\
+prefix=rpc.\n\
+engine=hdr\n\
+min=0.01\n\
+max=5000\n\
+\n\
+[quantile_db]\n\
+min=0.1\n\
+prefix=db.\n\
+engine=HDR\n\
+\n\
+";
+    write(fh, buf, strlen(buf));
+    fchmod(fh, 777);
+    close(fh);
+
+    statsite_config config;
+    int res = config_from_filename("/tmp/quantile_engines", &config);
+    fail_unless(res == 0);
+    fail_unless(validate_config(&config) == 0);
+    fail_unless(config.quantile_algo == QUANTILE_DDSKETCH);
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    // The longest prefix wins
+    quantile_config *c = NULL;
+    fail_unless(radix_longest_prefix(config.quantile_engines, "api.latency.get", (void**)&c) == 0);
+    fail_unless(c->algo == QUANTILE_DDSKETCH);
+    fail_unless(radix_longest_prefix(config.quantile_engines, "api.requests", (void**)&c) == 0);
+    fail_unless(c->algo == QUANTILE_CM);
+    fail_unless(radix_longest_prefix(config.quantile_engines, "site.foo", (void**)&c) == 1);
+
+    // The range may follow or precede the required options
+    fail_unless(radix_longest_prefix(config.quantile_engines, "rpc.call", (void**)&c) == 0);
+    fail_unless(c->algo == QUANTILE_HDR);
+    fail_unless(c->min_val == 0.01);
+    fail_unless(c->max_val == 5000);
+    fail_unless(radix_longest_prefix(config.quantile_engines, "db.query", (void**)&c) == 0);
+    fail_unless(c->algo == QUANTILE_HDR);
+    fail_unless(c->min_val == 0.1);
+    fail_unless(c->max_val == HDR_DEFAULT_MAX);
+
+    unlink("/tmp/quantile_engines");
+}
+END_TEST
+
+START_TEST(test_sane_quantile_engine)
+{
+    int algo;
+    fail_unless(sane_quantile_engine("cm", &algo) == 0);
+    fail_unless(algo == QUANTILE_CM);
+    fail_unless(sane_quantile_engine("DDSKETCH", &algo) == 0);
+    fail_unless(algo == QUANTILE_DDSKETCH);
+    fail_unless(sane_quantile_engine("hdr", &algo) == 0);
+    fail_unless(algo == QUANTILE_HDR);
+    fail_unless(sane_quantile_engine("gk", &algo) == 1);
+
+    quantile_config c1 = {"foo.", "ddsketch"};
+    quantile_config c2 = {"bar.", "tdigest"};
+    fail_unless(sane_quantile_configs(NULL) == 0);
+    fail_unless(sane_quantile_configs(&c1) == 0);
+    fail_unless(c1.algo == QUANTILE_DDSKETCH);
+    c1.next = &c2;
+    fail_unless(sane_quantile_configs(&c1) == 1);
+
+    // The hdr engine needs a positive, increasing range
+    quantile_config c3 = {"baz.", "hdr", 0, 1, 100};
+    fail_unless(sane_quantile_configs(&c3) == 0);
+    c3.min_val = 0;
+    fail_unless(sane_quantile_configs(&c3) == 1);
+    c3.min_val = 100;
+    fail_unless(sane_quantile_configs(&c3) == 1);
+}
+END_TEST
+
 START_TEST(test_sane_prefixes)
 {
     int fh = open("/tmp/sane_prefixes_d", O_CREAT|O_RDWR, 0777);
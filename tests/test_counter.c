@@ -73,3 +73,44 @@ START_TEST(test_counter_sample_rate)
 
 }
 END_TEST
+
+START_TEST(test_counter_merge)
+{
+    counter c1, c2;
+    fail_unless(init_counter(&c1) == 0);
+    fail_unless(init_counter(&c2) == 0);
+
+    for (int i=1; i<=50; i++)
+        fail_unless(counter_add_sample(&c1, i, 1.0) == 0);
+    for (int i=51; i<=100; i++)
+        fail_unless(counter_add_sample(&c2, i, 1.0) == 0);
+
+    fail_unless(counter_merge(&c1, &c2) == 0);
+
+    fail_unless(counter_count(&c1) == 100);
+    fail_unless(counter_sum(&c1) == 5050);
+    fail_unless(counter_mean(&c1) == 50.5);
+    fail_unless(counter_squared_sum(&c1) == 338350);
+    fail_unless(counter_min(&c1) == 1);
+    fail_unless(counter_max(&c1) == 100);
+}
+END_TEST
+
+START_TEST(test_counter_merge_empty)
+{
+    counter c1, c2;
+    fail_unless(init_counter(&c1) == 0);
+    fail_unless(init_counter(&c2) == 0);
+
+    fail_unless(counter_add_sample(&c2, -5, 1.0) == 0);
+    fail_unless(counter_merge(&c1, &c2) == 0);
+    fail_unless(counter_count(&c1) == 1);
+    fail_unless(counter_min(&c1) == -5);
+    fail_unless(counter_max(&c1) == -5);
+
+    fail_unless(init_counter(&c2) == 0);
+    fail_unless(counter_merge(&c1, &c2) == 0);
+    fail_unless(counter_count(&c1) == 1);
+    fail_unless(counter_min(&c1) == -5);
+}
+END_TEST
@@ -0,0 +1,212 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "ddsketch.h"
+#include "cm_quantile.h"
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(double*)a, y = *(double*)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the exact quantile of sorted values, using the rank of dd_query
+static double exact_quantile(double *sorted, int num, double q) {
+    return sorted[(int)(q * (num - 1))];
+}
+
+START_TEST(test_dd_init_and_destroy)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &dd) == 0);
+    fail_unless(dd.count == 0);
+    fail_unless(dd_query(&dd, 0.5) == 0);
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_init_bad_args)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0, DD_DEFAULT_BINS, &dd) == -1);
+    fail_unless(init_ddsketch(1, DD_DEFAULT_BINS, &dd) == -1);
+    fail_unless(init_ddsketch(-0.5, DD_DEFAULT_BINS, &dd) == -1);
+    fail_unless(init_ddsketch(0.01, 0, &dd) == -1);
+}
+END_TEST
+
+START_TEST(test_dd_relative_error)
+{
+    double quants[] = {0.01, 0.25, 0.5, 0.9, 0.99, 0.999};
+    int num = 100000;
+    double *samples = malloc(num * sizeof(double));
+    srandom(42);
+
+    // Uniform, then latencies spread over a few decades
+    for (int s=0; s < 2; s++) {
+        ddsketch dd;
+        fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &dd) == 0);
+        for (int i=0; i < num; i++) {
+            samples[i] = (s == 0) ? 1 + random() % 1000 : exp((random() % 100000) / 10000.0);
+            fail_unless(dd_add_sample(&dd, samples[i]) == 0);
+        }
+        qsort(samples, num, sizeof(double), cmp_double);
+
+        fail_unless(dd.count == (uint64_t)num);
+        fail_unless(dd_query(&dd, 0) == samples[0]);
+        fail_unless(dd_query(&dd, 1) == samples[num-1]);
+        for (int i=0; i < 6; i++) {
+            double exact = exact_quantile(samples, num, quants[i]);
+            double val = dd_query(&dd, quants[i]);
+            fail_unless(fabs(val - exact) <= 0.01 * exact + 1e-9);
+        }
+        fail_unless(destroy_ddsketch(&dd) == 0);
+    }
+    free(samples);
+}
+END_TEST
+
+START_TEST(test_dd_negative_and_zero)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &dd) == 0);
+
+    // 100 negative values, 100 zeros, 100 positive values
+    for (int i=1; i <= 100; i++) {
+        fail_unless(dd_add_sample(&dd, -i) == 0);
+        fail_unless(dd_add_sample(&dd, 0) == 0);
+        fail_unless(dd_add_sample(&dd, i) == 0);
+    }
+    fail_unless(dd.count == 300);
+    fail_unless(dd.zero_count == 100);
+    fail_unless(dd_query(&dd, 0) == -100);
+    fail_unless(dd_query(&dd, 1) == 100);
+    fail_unless(dd_query(&dd, 0.5) == 0);
+
+    // The 10th percentile is about -70, the 90th about 70
+    double val = dd_query(&dd, 0.1);
+    fail_unless(val <= -70 * 0.99 && val >= -71 * 1.01);
+    val = dd_query(&dd, 0.9);
+    fail_unless(val >= 70 * 0.99 && val <= 71 * 1.01);
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_merge)
+{
+    ddsketch whole, a, b;
+    fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &whole) == 0);
+    fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &a) == 0);
+    fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &b) == 0);
+
+    // Each half covers a different range of bins
+    srandom(42);
+    for (int i=0; i < 10000; i++) {
+        double val = (i % 2) ? exp((random() % 50000) / 10000.0) : -exp((random() % 100000) / 10000.0);
+        dd_add_sample(&whole, val);
+        dd_add_sample((i < 5000) ? &a : &b, val);
+    }
+    fail_unless(dd_merge(&a, &b) == 0);
+    fail_unless(a.count == whole.count);
+    fail_unless(a.min == whole.min);
+    fail_unless(a.max == whole.max);
+
+    // The merge is exact, so every quantile agrees
+    for (int i=0; i <= 100; i++)
+        fail_unless(dd_query(&a, i / 100.0) == dd_query(&whole, i / 100.0));
+
+    // Sketches of another accuracy do not merge
+    ddsketch other;
+    fail_unless(init_ddsketch(0.02, DD_DEFAULT_BINS, &other) == 0);
+    fail_unless(dd_merge(&a, &other) == -1);
+
+    fail_unless(destroy_ddsketch(&whole) == 0);
+    fail_unless(destroy_ddsketch(&a) == 0);
+    fail_unless(destroy_ddsketch(&b) == 0);
+    fail_unless(destroy_ddsketch(&other) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_collapse)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, 64, &dd) == 0);
+
+    // Values over 20 orders of magnitude need far more than 64 bins
+    double samples[210];
+    for (int i=0; i < 210; i++) {
+        samples[i] = pow(10, i / 10 - 10) * (1 + (i % 10) / 10.0);
+        fail_unless(dd_add_sample(&dd, samples[i]) == 0);
+    }
+    fail_unless(dd.positive.len <= 64);
+    fail_unless(dd.positive.size <= 64);
+    fail_unless(dd_bytes(&dd) <= 64 * sizeof(uint64_t));
+
+    // The lowest values are collapsed, but the highest are accurate
+    double val = dd_query(&dd, 0.99);
+    double exact = exact_quantile(samples, 210, 0.99);
+    fail_unless(fabs(val - exact) <= 0.01 * exact);
+    fail_unless(dd_query(&dd, 0) == samples[0]);
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+// Returns how far the ranks of a value are from the rank of a quantile
+static double rank_error(double *sorted, int num, double val, double q) {
+    int first = 0, last;
+    while (first < num && sorted[first] < val) first++;
+    for (last = first; last < num && sorted[last] <= val; last++);
+    double rank = q * num;
+    return (rank < first) ? first - rank : (rank > last) ? rank - last : 0;
+}
+
+START_TEST(test_dd_compare_cm)
+{
+    // Both engines on the same streams, each held to its own bound
+    double quants[] = {0.5, 0.90, 0.99};
+    int num = 100000;
+    double *samples = malloc(num * sizeof(double));
+    srandom(42);
+
+    for (int s=0; s < 2; s++) {
+        cm_quantile cm;
+        ddsketch dd;
+        fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+        fail_unless(init_ddsketch(0.01, DD_DEFAULT_BINS, &dd) == 0);
+        for (int i=0; i < num; i++) {
+            if (s == 0) {
+                samples[i] = 1 + random() % 1000;
+            } else {
+                double u1 = (random() + 1.0) / (RAND_MAX + 2.0);
+                double u2 = (random() + 1.0) / (RAND_MAX + 2.0);
+                samples[i] = exp(3 + 1.5 * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2));
+            }
+            fail_unless(cm_add_sample(&cm, samples[i]) == 0);
+            fail_unless(dd_add_sample(&dd, samples[i]) == 0);
+        }
+        qsort(samples, num, sizeof(double), cmp_double);
+
+        // CM bounds the error of the rank, DDSketch that of the value
+        double cm_err = 0, dd_err = 0;
+        for (int i=0; i < 3; i++) {
+            double exact = exact_quantile(samples, num, quants[i]);
+            double val = cm_query(&cm, quants[i]);
+            fail_unless(rank_error(samples, num, val, quants[i]) <= 0.01 * num);
+            cm_err = fmax(cm_err, fabs(val - exact) / exact);
+
+            val = dd_query(&dd, quants[i]);
+            fail_unless(fabs(val - exact) <= 0.01 * exact + 1e-9);
+            dd_err = fmax(dd_err, fabs(val - exact) / exact);
+        }
+
+        // On the heavy tail, a rank error is a large error of the value
+        if (s == 1) fail_unless(cm_err > 10 * dd_err);
+
+        fail_unless(destroy_cm_quantile(&cm) == 0);
+        fail_unless(destroy_ddsketch(&dd) == 0);
+    }
+    free(samples);
+}
+END_TEST
@@ -0,0 +1,70 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "hash.h"
+#include "hll.h"
+
+extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
+
+START_TEST(test_hash_murmur_default)
+{
+    fail_unless(hash_selected() == HASH_MURMUR);
+
+    // The default matches the hashes of earlier versions
+    char *key = "api.host1.requests";
+    uint64_t out[2];
+    MurmurHash3_x64_128(key, strlen(key), 0, &out);
+    fail_unless(hash_bytes(key, strlen(key)) == out[1]);
+    fail_unless(hashmap_hash(key, strlen(key)) == out[1]);
+}
+END_TEST
+
+START_TEST(test_hash_select)
+{
+    fail_unless(hash_select(HASH_WYHASH) == 0);
+    fail_unless(hash_selected() == HASH_WYHASH);
+    fail_unless(hash_select((hash_algo)42) == -1);
+    fail_unless(hash_selected() == HASH_WYHASH);
+
+    // The hashes must not change between builds or nodes
+    fail_unless(hash_bytes("", 0) == 0x93228a4de0eec5a2ULL);
+    fail_unless(hash_bytes("foo", 3) == 0x7858d0763614e879ULL);
+    fail_unless(hash_bytes("api.host1.requests", 18) == 0x3a1b5440f2219f64ULL);
+
+    // Every prefix of a long key hashes differently, which
+    // covers each of the length cases
+    char key[130];
+    uint64_t hashes[sizeof(key)];
+    for (int i=0; i < (int)sizeof(key); i++)
+        key[i] = 'a' + i % 26;
+    for (int i=0; i < (int)sizeof(key); i++) {
+        hashes[i] = hash_bytes(key, i);
+        for (int j=0; j < i; j++)
+            fail_unless(hashes[i] != hashes[j]);
+    }
+
+    fail_unless(hash_select(HASH_MURMUR) == 0);
+}
+END_TEST
+
+START_TEST(test_hash_hll_error)
+{
+    // Precision 14 -> variance of 0.8%, allow three times that
+    hash_algo algos[] = {HASH_MURMUR, HASH_WYHASH};
+    char buf[128];
+    for (int a=0; a < 2; a++) {
+        fail_unless(hash_select(algos[a]) == 0);
+        hll_t h;
+        fail_unless(hll_init(14, &h) == 0);
+        for (int i=0; i < 100000; i++) {
+            snprintf(buf, sizeof(buf), "api.host%d.requests.%d", i % 97, i);
+            hll_add(&h, buf);
+        }
+        double s = hll_size(&h);
+        fail_unless(s > 97600 && s < 102400);
+        fail_unless(hll_destroy(&h) == 0);
+    }
+    fail_unless(hash_select(HASH_MURMUR) == 0);
+}
+END_TEST
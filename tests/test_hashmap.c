@@ -5,7 +5,9 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <errno.h>
+#include <string.h>
 #include "hashmap.h"
 
 START_TEST(test_map_init_and_destroy)
@@ -296,3 +298,175 @@ START_TEST(test_map_put_grow)
 }
 END_TEST
 
+
+START_TEST(test_map_get_or_insert)
+{
+    hashmap *map;
+    int res = hashmap_init(32, &map);  // Only 32 slots
+    fail_unless(res == 0);
+
+    char buf[100];
+    void **slot;
+    for (int i=0; i<1000;i++) {
+        int len = snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_get_or_insert(map, (char*)buf, len,
+                    hashmap_hash(buf, len), &slot) == 1);
+        fail_unless(*slot == NULL);
+        *slot = (void*)(uintptr_t)(i + 1);
+    }
+    fail_unless(hashmap_size(map) == 1000);
+
+    // Existing keys are found after growing, by both methods
+    void *out;
+    for (int i=0; i<1000;i++) {
+        int len = snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_get_or_insert(map, (char*)buf, len,
+                    hashmap_hash(buf, len), &slot) == 0);
+        fail_unless(*slot == (void*)(uintptr_t)(i + 1));
+        fail_unless(hashmap_get(map, (char*)buf, &out) == 0);
+        fail_unless(out == *slot);
+    }
+    fail_unless(hashmap_size(map) == 1000);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_get_or_insert_put)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    // Keys put by name are found by their hash
+    void **slot;
+    fail_unless(hashmap_put(map, "foo", (void*)1) == 1);
+    fail_unless(hashmap_get_or_insert(map, "foo", 3, hashmap_hash("foo", 3), &slot) == 0);
+    fail_unless(*slot == (void*)1);
+
+    // Keys inserted by their hash are found by name
+    fail_unless(hashmap_get_or_insert(map, "bar", 3, hashmap_hash("bar", 3), &slot) == 1);
+    *slot = (void*)2;
+    void *out;
+    fail_unless(hashmap_get(map, "bar", &out) == 0);
+    fail_unless(out == (void*)2);
+    fail_unless(hashmap_delete(map, "bar") == 0);
+    fail_unless(hashmap_size(map) == 1);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_delete_slot)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    // Equal keys with their own hashes are deleted apart
+    void **slot, **other;
+    uint64_t hash = hashmap_hash("foo", 3);
+    fail_unless(hashmap_get_or_insert(map, "foo", 3, hash, &slot) == 1);
+    *slot = (void*)1;
+    fail_unless(hashmap_get_or_insert(map, "foo", 3, hash ^ 1, &other) == 1);
+    *other = (void*)2;
+    fail_unless(hashmap_delete_slot(map, other) == 0);
+    fail_unless(hashmap_size(map) == 1);
+    fail_unless(hashmap_get_slot(map, "foo", hash ^ 1, &other) == -1);
+    fail_unless(hashmap_get_slot(map, "foo", hash, &slot) == 0);
+    fail_unless(*slot == (void*)1);
+
+    fail_unless(hashmap_delete_slot(map, slot) == 0);
+    fail_unless(hashmap_size(map) == 0);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_put_delete_churn)
+{
+    hashmap *map;
+    int res = hashmap_init(32, &map);  // Only 32 slots
+    fail_unless(res == 0);
+
+    // Keep a sliding window of 20 keys, so deleted slots pile
+    // up and must be reused or dropped without growing forever
+    char buf[100];
+    void *out;
+    for (int i=0; i<10000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_put(map, (char*)buf, (void*)(uintptr_t)(i + 1)) == 1);
+        if (i >= 20) {
+            snprintf((char*)&buf, 100, "test%d", i - 20);
+            fail_unless(hashmap_delete(map, (char*)buf) == 0);
+        }
+    }
+    fail_unless(hashmap_size(map) == 20);
+    fail_unless(hashmap_tablesize(map) <= 64);
+
+    for (int i=0; i<10000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        if (i < 10000 - 20) {
+            fail_unless(hashmap_get(map, (char*)buf, &out) == -1);
+        } else {
+            fail_unless(hashmap_get(map, (char*)buf, &out) == 0);
+            fail_unless(out == (void*)(uintptr_t)(i + 1));
+        }
+    }
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_alloc_fail)
+{
+    // Large enough for the table to be mapped. The keys
+    // are borrowed, so only the tables need new memory.
+    int size = 1 << 16;
+    int num = size * 7 / 8 + 1;
+    hashmap *map, *other = NULL;
+    int res = hashmap_init_borrowed(size, &map);
+    fail_unless(res == 0);
+
+    char (*keys)[16] = malloc(num * sizeof(*keys));
+    for (int i=0; i < num; i++) {
+        snprintf(keys[i], sizeof(*keys), "test%d", i);
+        if (i < num - 1)
+            fail_unless(hashmap_put(map, keys[i], (void*)(uintptr_t)(i + 1)) == 1);
+    }
+
+    // Cap the address space, so no new table can be mapped
+    struct rlimit old_limit, limit;
+    getrlimit(RLIMIT_AS, &old_limit);
+    limit = old_limit;
+    limit.rlim_cur = 1 << 20;
+    setrlimit(RLIMIT_AS, &limit);
+    int init_res = hashmap_init_borrowed(size, &other);
+    int put_res = hashmap_put(map, keys[num - 1], (void*)(uintptr_t)num);
+    setrlimit(RLIMIT_AS, &old_limit);
+
+    // The map can not be made, and the full map keeps its table
+    fail_unless(init_res == -1);
+    fail_unless(put_res == 1);
+    fail_unless(hashmap_tablesize(map) == size);
+    fail_unless(hashmap_size(map) == num);
+
+    void *out;
+    for (int i=0; i < num; i++) {
+        fail_unless(hashmap_get(map, keys[i], &out) == 0);
+        fail_unless(out == (void*)(uintptr_t)(i + 1));
+    }
+
+    // The next insert grows the table again
+    fail_unless(hashmap_put(map, "extra", NULL) == 1);
+    fail_unless(hashmap_tablesize(map) == size * 2);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+    free(keys);
+}
+END_TEST
@@ -0,0 +1,134 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "hdr_histogram.h"
+
+static int cmp_hdr_double(const void *a, const void *b) {
+    double x = *(double*)a, y = *(double*)b;
+    return (x > y) - (x < y);
+}
+
+START_TEST(test_hdr_init_and_destroy)
+{
+    hdr_histogram hdr;
+    fail_unless(init_hdr_histogram(0.01, HDR_DEFAULT_MIN, HDR_DEFAULT_MAX, &hdr) == 0);
+    fail_unless(hdr.count == 0);
+    fail_unless(hdr.len > 0);
+    fail_unless(hdr_query(&hdr, 0.5) == 0);
+
+    // 1 microsecond to 1 minute at 1% is a fixed, modest array
+    fail_unless(hdr_bytes(&hdr) <= 16 * 1024);
+    fail_unless(destroy_hdr_histogram(&hdr) == 0);
+}
+END_TEST
+
+START_TEST(test_hdr_init_bad_args)
+{
+    hdr_histogram hdr;
+    fail_unless(init_hdr_histogram(0, 1, 100, &hdr) == -1);
+    fail_unless(init_hdr_histogram(0.5, 1, 100, &hdr) == -1);
+    fail_unless(init_hdr_histogram(0.01, 0, 100, &hdr) == -1);
+    fail_unless(init_hdr_histogram(0.01, -1, 100, &hdr) == -1);
+    fail_unless(init_hdr_histogram(0.01, 100, 100, &hdr) == -1);
+    fail_unless(init_hdr_histogram(0.01, 1e-20, 1e20, &hdr) == -1);
+}
+END_TEST
+
+START_TEST(test_hdr_relative_error)
+{
+    double quants[] = {0.01, 0.25, 0.5, 0.9, 0.99, 0.999};
+    double eps[] = {0.01, 0.001};
+    int num = 100000;
+    double *samples = malloc(num * sizeof(double));
+    srandom(42);
+
+    // Latencies from 1 microsecond to 20 seconds
+    for (int e=0; e < 2; e++) {
+        hdr_histogram hdr;
+        fail_unless(init_hdr_histogram(eps[e], HDR_DEFAULT_MIN, HDR_DEFAULT_MAX, &hdr) == 0);
+        for (int i=0; i < num; i++) {
+            samples[i] = 0.001 * exp((random() % 1000000) / 1000000.0 * log(2e7));
+            fail_unless(hdr_add_sample(&hdr, samples[i]) == 0);
+        }
+        qsort(samples, num, sizeof(double), cmp_hdr_double);
+
+        fail_unless(hdr.count == (uint64_t)num);
+        fail_unless(hdr_query(&hdr, 0) == samples[0]);
+        fail_unless(hdr_query(&hdr, 1) == samples[num-1]);
+        for (int i=0; i < 6; i++) {
+            double exact = samples[(int)(quants[i] * (num - 1))];
+            double val = hdr_query(&hdr, quants[i]);
+            fail_unless(fabs(val - exact) <= eps[e] * exact);
+        }
+        fail_unless(destroy_hdr_histogram(&hdr) == 0);
+    }
+    free(samples);
+}
+END_TEST
+
+START_TEST(test_hdr_out_of_range)
+{
+    hdr_histogram hdr;
+    fail_unless(init_hdr_histogram(0.01, 1, 1000, &hdr) == 0);
+
+    // Values outside the range land in the outer buckets
+    fail_unless(hdr_add_sample(&hdr, -5) == 0);
+    fail_unless(hdr_add_sample(&hdr, 0) == 0);
+    fail_unless(hdr_add_sample(&hdr, 0.001) == 0);
+    for (int i=0; i < 97; i++)
+        fail_unless(hdr_add_sample(&hdr, 500) == 0);
+    fail_unless(hdr_add_sample(&hdr, 1e9) == 0);
+    fail_unless(hdr.count == 101);
+    fail_unless(hdr.counts[0] == 3);
+    fail_unless(hdr.counts[hdr.len - 1] == 1);
+    fail_unless(hdr.hi_idx == hdr.len - 1);
+
+    // The extremes are exact, the rest is clamped to them
+    fail_unless(hdr_query(&hdr, 0) == -5);
+    fail_unless(hdr_query(&hdr, 1) == 1e9);
+    fail_unless(hdr_query(&hdr, 0.01) >= -5 && hdr_query(&hdr, 0.01) < 1);
+    double val = hdr_query(&hdr, 0.5);
+    fail_unless(val >= 495 && val <= 505);
+    fail_unless(destroy_hdr_histogram(&hdr) == 0);
+}
+END_TEST
+
+START_TEST(test_hdr_merge)
+{
+    hdr_histogram whole, a, b;
+    fail_unless(init_hdr_histogram(0.01, 0.01, 10000, &whole) == 0);
+    fail_unless(init_hdr_histogram(0.01, 0.01, 10000, &a) == 0);
+    fail_unless(init_hdr_histogram(0.01, 0.01, 10000, &b) == 0);
+
+    // Each half covers a different range of buckets
+    srandom(42);
+    for (int i=0; i < 10000; i++) {
+        double val = (i < 5000) ? (random() % 1000) / 10.0 : 100 + random() % 5000;
+        hdr_add_sample(&whole, val);
+        hdr_add_sample((i < 5000) ? &a : &b, val);
+    }
+    fail_unless(hdr_merge(&a, &b) == 0);
+    fail_unless(a.count == whole.count);
+    fail_unless(a.min == whole.min);
+    fail_unless(a.max == whole.max);
+    fail_unless(a.lo_idx == whole.lo_idx);
+    fail_unless(a.hi_idx == whole.hi_idx);
+
+    // The merge is exact, so every quantile agrees
+    for (int i=0; i <= 100; i++)
+        fail_unless(hdr_query(&a, i / 100.0) == hdr_query(&whole, i / 100.0));
+
+    // Histograms of another range do not merge
+    hdr_histogram other;
+    fail_unless(init_hdr_histogram(0.01, 0.01, 100000, &other) == 0);
+    fail_unless(hdr_merge(&a, &other) == -1);
+
+    fail_unless(destroy_hdr_histogram(&whole) == 0);
+    fail_unless(destroy_hdr_histogram(&a) == 0);
+    fail_unless(destroy_hdr_histogram(&b) == 0);
+    fail_unless(destroy_hdr_histogram(&other) == 0);
+}
+END_TEST
@@ -0,0 +1,105 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+static char* intern_str(intern_table *t, char *name) {
+    int len = strlen(name);
+    return intern_name(t, name, len, hashmap_hash(name, len));
+}
+
+static int expire_all(intern_table *t) {
+    int expired = 0;
+    uint32_t cursor = 0;
+    do {
+        expired += intern_expire(t, &cursor, 3);
+    } while (cursor);
+    return expired;
+}
+
+START_TEST(test_intern_init_destroy)
+{
+    intern_table t;
+    fail_unless(init_intern_table(3, &t) == 0);
+    fail_unless(intern_size(&t) == 0);
+    fail_unless(destroy_intern_table(&t) == 0);
+}
+END_TEST
+
+START_TEST(test_intern_same_name)
+{
+    intern_table t;
+    fail_unless(init_intern_table(3, &t) == 0);
+
+    char buf[] = "foo.bar";
+    char *a = intern_str(&t, buf);
+    fail_unless(a != buf);
+    fail_unless(strcmp(a, "foo.bar") == 0);
+
+    // Interning again hands out the same copy and id
+    char *b = intern_str(&t, "foo.bar");
+    fail_unless(a == b);
+    fail_unless(INTERNED_NAME(a)->refs == 2);
+    fail_unless(INTERNED_NAME(a)->len == 7);
+
+    char *c = intern_str(&t, "foo.baz");
+    fail_unless(c != a);
+    fail_unless(INTERNED_NAME(c)->id != INTERNED_NAME(a)->id);
+    fail_unless(intern_size(&t) == 2);
+
+    intern_release(a);
+    intern_release(b);
+    intern_release(c);
+    fail_unless(INTERNED_NAME(a)->refs == 0);
+    fail_unless(destroy_intern_table(&t) == 0);
+}
+END_TEST
+
+START_TEST(test_intern_expire)
+{
+    intern_table t;
+    fail_unless(init_intern_table(2, &t) == 0);
+
+    char name[32];
+    for (int i=0; i < 10; i++) {
+        snprintf(name, sizeof(name), "name%d", i);
+        intern_release(intern_str(&t, name));
+    }
+    char *held = intern_str(&t, "held");
+    char *busy = intern_str(&t, "busy");
+    intern_release(busy);
+
+    // Nothing expires until the names are idle for 2 intervals
+    for (int i=0; i < 2; i++) {
+        intern_next_interval(&t);
+        intern_release(intern_str(&t, "busy"));
+        fail_unless(expire_all(&t) == 0);
+    }
+
+    // The unused names go, but not the busy or referenced ones
+    intern_next_interval(&t);
+    intern_release(intern_str(&t, "busy"));
+    fail_unless(expire_all(&t) == 10);
+    fail_unless(intern_size(&t) == 2);
+    fail_unless(strcmp(held, "held") == 0);
+
+    // Ids of the expired names are reused
+    uint32_t held_id = INTERNED_NAME(held)->id;
+    char *fresh = intern_str(&t, "fresh");
+    fail_unless(INTERNED_NAME(fresh)->id < 10);
+    fail_unless(INTERNED_NAME(fresh)->id != held_id);
+
+    // Once released, the held name expires as well
+    intern_release(held);
+    for (int i=0; i < 3; i++) {
+        intern_next_interval(&t);
+        intern_release(intern_str(&t, "busy"));
+    }
+    fail_unless(expire_all(&t) == 1);
+    fail_unless(intern_size(&t) == 2);
+
+    intern_release(fresh);
+    fail_unless(destroy_intern_table(&t) == 0);
+}
+END_TEST
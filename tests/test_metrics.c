@@ -201,6 +201,110 @@ START_TEST(test_metrics_histogram)
 }
 END_TEST
 
+static int iter_test_engines(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    timer_hist *t = val;
+    if (strcmp(key, "api.fast") == 0 && t->tm.engine == QUANTILE_DDSKETCH) {
+        *o = *o | 1;
+    } else if (strcmp(key, "api.slow") == 0 && t->tm.engine == QUANTILE_CM) {
+        *o = *o | 1 << 1;
+    } else if (strcmp(key, "db.query") == 0 && t->tm.engine == QUANTILE_CM) {
+        *o = *o | 1 << 2;
+    } else if (strcmp(key, "rpc.call") == 0 && t->tm.engine == QUANTILE_HDR &&
+            t->tm.store.hdr.max_val == 1000) {
+        *o = *o | 1 << 3;
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_quantile_engines)
+{
+    statsite_config config;
+    int res = config_from_filename(NULL, &config);
+
+    // The longest prefix selects the engine
+    quantile_config c1 = {"api.", "ddsketch", QUANTILE_DDSKETCH, 0, 0, NULL, 0};
+    quantile_config c2 = {"api.slow", "cm", QUANTILE_CM, 0, 0, NULL, 0};
+    quantile_config c3 = {"rpc.", "hdr", QUANTILE_HDR, 0.01, 1000, NULL, 0};
+    config.quantile_configs = &c1;
+    c1.next = &c2;
+    c2.next = &c3;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    metrics m;
+    double quants[] = {0.5, 0.90, 0.99};
+    res = init_metrics(0.01, (double*)&quants, 3, NULL, 12, &m);
+    fail_unless(res == 0);
+    metrics_use_engines(&m, QUANTILE_CM, config.quantile_engines);
+
+    for (int i=1; i <= 100; i++) {
+        fail_unless(metrics_add_sample(&m, TIMER, "api.fast", i, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "api.slow", i, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "db.query", i, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "rpc.call", i, 1.0) == 0);
+    }
+
+    int okay = 0;
+    fail_unless(metrics_iter(&m, (void*)&okay, iter_test_engines) == 0);
+    fail_unless(okay == 15);
+
+    res = destroy_metrics(&m);
+    fail_unless(res == 0);
+}
+END_TEST
+
+static int iter_test_bad_engine(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == TIMER && strcmp(key, "db.query") == 0)
+        *o = *o | 1;
+    else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_timer_init_fails)
+{
+    statsite_config config;
+    int res = config_from_filename(NULL, &config);
+
+    // A range the histogram can not be built with
+    quantile_config c1 = {"bad.", "hdr", QUANTILE_HDR, 1000, 10, NULL, 0};
+    config.quantile_configs = &c1;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    double quants[] = {0.5, 0.90, 0.99};
+    intern_table names;
+    fail_unless(init_intern_table(1, &names) == 0);
+
+    // The sample fails, and leaves no empty timer behind
+    for (int admission=0; admission < 2; admission++) {
+        metrics m;
+        res = init_interval_metrics(0.01, quants, 3, NULL, 12, &names, NULL, admission, NULL, NULL, admission, &m);
+        fail_unless(res == 0);
+        metrics_use_engines(&m, QUANTILE_CM, config.quantile_engines);
+
+        fail_unless(metrics_add_sample(&m, TIMER, "db.query", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "db.query", 2, 1.0) == 0);
+        if (admission)
+            fail_unless(metrics_add_sample(&m, TIMER, "bad.call", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "bad.call", 2, 1.0) == -1);
+        fail_unless(metrics_add_sample(&m, TIMER, "bad.call", 3, 1.0) == -1);
+
+        int okay = 0;
+        fail_unless(metrics_iter(&m, (void*)&okay, iter_test_bad_engine) == 0);
+        fail_unless(okay == 1);
+        fail_unless(destroy_metrics(&m) == 0);
+    }
+
+    // The names of the dropped timers were given back
+    char *bad = intern_name(&names, "bad.call", 8, hashmap_hash("bad.call", 8));
+    fail_unless(INTERNED_NAME(bad)->refs == 1);
+    intern_release(bad);
+    fail_unless(destroy_intern_table(&names) == 0);
+}
+END_TEST
+
 static int iter_test_gauge(void *data, metric_type type, char *key, void *val) {
     int *o = data;
     if (strcmp(key, "g1") == 0 && ((gauge_t*)val)->value == 42) {
@@ -235,3 +339,679 @@ START_TEST(test_metrics_gauges)
 }
 END_TEST
 
+
+static int iter_test_merge(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == COUNTER && strcmp(key, "foo") == 0 && counter_sum(val) == 15) {
+        *o = *o | 1;
+    } else if (type == COUNTER && strcmp(key, "bar") == 0 && counter_sum(val) == 7) {
+        *o = *o | (1 << 1);
+    } else if (type == TIMER && strcmp(key, "baz") == 0) {
+        timer_hist *t = val;
+        if (timer_count(&t->tm) == 4 && timer_min(&t->tm) == 1 && timer_max(&t->tm) == 40)
+            *o = *o | (1 << 2);
+    } else if (type == GAUGE && strcmp(key, "g1") == 0 && ((gauge_t*)val)->value == 5) {
+        *o = *o | (1 << 3);
+    } else if (type == GAUGE && strcmp(key, "g2") == 0 && ((gauge_t*)val)->value == 12) {
+        *o = *o | (1 << 4);
+    } else if (type == SET && strcmp(key, "s") == 0 && set_size(val) == 3) {
+        *o = *o | (1 << 5);
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_merge)
+{
+    metrics m1, m2;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+
+    fail_unless(metrics_add_sample(&m1, COUNTER, "foo", 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "foo", 5, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "bar", 7, 1.0) == 0);
+
+    fail_unless(metrics_add_sample(&m1, TIMER, "baz", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, TIMER, "baz", 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, TIMER, "baz", 20, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, TIMER, "baz", 40, 1.0) == 0);
+
+    // An absolute gauge in the other shard replaces the value,
+    // while a delta is applied on top of it
+    fail_unless(metrics_add_sample(&m1, GAUGE, "g1", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, GAUGE, "g1", 5, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, GAUGE, "g2", 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, GAUGE_DELTA, "g2", 2, 1.0) == 0);
+
+    fail_unless(metrics_set_update(&m1, "s", "a") == 0);
+    fail_unless(metrics_set_update(&m2, "s", "b") == 0);
+    fail_unless(metrics_set_update(&m2, "s", "c") == 0);
+
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+
+    int okay = 0;
+    fail_unless(metrics_iter(&m1, (void*)&okay, iter_test_merge) == 0);
+    fail_unless(okay == 63);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+}
+END_TEST
+
+static int iter_test_interned(void *data, metric_type type, char *name, void *value) {
+    intern_table *names = data;
+    int len = strlen(name);
+    char *interned = intern_name(names, name, len, hashmap_hash(name, len));
+    intern_release(interned);
+    return interned != name;
+}
+
+START_TEST(test_metrics_interned)
+{
+    intern_table n1, n2;
+    fail_unless(init_intern_table(1, &n1) == 0);
+    fail_unless(init_intern_table(1, &n2) == 0);
+
+    metrics m1, m2, next;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, &n1, NULL, false, NULL, NULL, false, &m1) == 0);
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, &n2, NULL, false, NULL, NULL, false, &m2) == 0);
+
+    char name[] = "foo";
+    fail_unless(metrics_add_sample(&m1, COUNTER, name, 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, TIMER, name, 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "foo", 5, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "bar", 7, 1.0) == 0);
+    fail_unless(metrics_set_update(&m2, "s", "a") == 0);
+
+    // The maps hold the interned names, once per type
+    fail_unless(intern_size(&n1) == 1);
+    fail_unless(intern_size(&n2) == 3);
+    fail_unless(metrics_iter(&m1, &n1, iter_test_interned) == 0);
+    char *foo = intern_name(&n1, "foo", 3, hashmap_hash("foo", 3));
+    fail_unless(INTERNED_NAME(foo)->refs == 3);
+    intern_release(foo);
+
+    // The next interval shares the names
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, &n1, &m1, false, NULL, NULL, false, &next) == 0);
+    fail_unless(metrics_add_sample(&next, COUNTER, "foo", 1, 1.0) == 0);
+    fail_unless(intern_size(&n1) == 1);
+
+    // Merging keeps the names of both tables, and the
+    // names are given back when the metrics go away
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(INTERNED_NAME(foo)->refs == 1);
+    fail_unless(destroy_metrics(&next) == 0);
+    fail_unless(INTERNED_NAME(foo)->refs == 0);
+
+    uint32_t cursor = 0;
+    intern_next_interval(&n2);
+    intern_next_interval(&n2);
+    fail_unless(intern_expire(&n2, &cursor, 16) == 3);
+    fail_unless(intern_size(&n2) == 0);
+
+    fail_unless(destroy_intern_table(&n1) == 0);
+    fail_unless(destroy_intern_table(&n2) == 0);
+}
+END_TEST
+
+static int iter_test_unified(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == COUNTER && strcmp(key, "foo") == 0 && counter_sum(val) == 15) {
+        *o = *o | 1;
+    } else if (type == TIMER && strcmp(key, "foo") == 0) {
+        timer_hist *t = val;
+        if (timer_count(&t->tm) == 3 && timer_max(&t->tm) == 40)
+            *o = *o | (1 << 1);
+    } else if (type == GAUGE && strcmp(key, "foo") == 0 && ((gauge_t*)val)->value == 12) {
+        *o = *o | (1 << 2);
+    } else if (type == SET && strcmp(key, "foo") == 0 && set_size(val) == 2) {
+        *o = *o | (1 << 3);
+    } else if (type == COUNTER && strcmp(key, "bar") == 0 && counter_sum(val) == 7) {
+        *o = *o | (1 << 4);
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_unified)
+{
+    metrics m;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, true, NULL, NULL, false, &m) == 0);
+
+    fail_unless(metrics_add_sample(&m, GAUGE_DIRECT, "test", 100, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, GAUGE_DIRECT, "test2", 42, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, GAUGE, "g1", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, GAUGE, "g1", 200, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, GAUGE, "g2", 42, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 4, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 6, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "bar", 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "bar", 20, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "baz", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "baz", 10, 1.0) == 0);
+    fail_unless(metrics_set_update(&m, "zip", "foo") == 0);
+    fail_unless(metrics_set_update(&m, "zip", "wow") == 0);
+
+    // The same callbacks see the same values as the typed maps
+    int okay = 0;
+    fail_unless(metrics_iter(&m, (void*)&okay, iter_test_all_cb) == 0);
+    fail_unless(okay == 255);
+    fail_unless(destroy_metrics(&m) == 0);
+
+    // The same name is kept apart for each type, also when
+    // merging shards that share interned names
+    intern_table names;
+    fail_unless(init_intern_table(1, &names) == 0);
+    metrics m1, m2;
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, &names, NULL, true, NULL, NULL, false, &m1) == 0);
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, &names, NULL, true, NULL, NULL, false, &m2) == 0);
+
+    fail_unless(metrics_add_sample(&m1, COUNTER, "foo", 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "foo", 5, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "bar", 7, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, TIMER, "foo", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, TIMER, "foo", 20, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, TIMER, "foo", 40, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, GAUGE, "foo", 10, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, GAUGE_DELTA, "foo", 2, 1.0) == 0);
+    fail_unless(metrics_set_update(&m1, "foo", "a") == 0);
+    fail_unless(metrics_set_update(&m2, "foo", "b") == 0);
+
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+    okay = 0;
+    fail_unless(metrics_iter(&m1, (void*)&okay, iter_test_unified) == 0);
+    fail_unless(okay == 31);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+    char *foo = intern_name(&names, "foo", 3, hashmap_hash("foo", 3));
+    fail_unless(INTERNED_NAME(foo)->refs == 1);
+    intern_release(foo);
+    fail_unless(destroy_intern_table(&names) == 0);
+}
+END_TEST
+
+static int iter_test_cardinality(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == COUNTER && strcmp(key, "api.0") == 0 && counter_sum(val) == 2) {
+        *o = *o | 1;
+    } else if (type == COUNTER && (strcmp(key, "api.1") == 0 || strcmp(key, "api.2") == 0)) {
+        *o = *o | (1 << 1);
+    } else if (type == COUNTER && strcmp(key, "api.__overflow__") == 0 && counter_sum(val) == 7) {
+        *o = *o | (1 << 2);
+    } else if (type == TIMER && strcmp(key, "api.__overflow__") == 0) {
+        timer_hist *t = val;
+        if (timer_count(&t->tm) == 1)
+            *o = *o | (1 << 3);
+    } else if (type == COUNTER && strcmp(key, "api.__rejected__") == 0 && counter_sum(val) == 3) {
+        *o = *o | (1 << 4);
+    } else if (type == COUNTER && strncmp(key, "site.", 5) == 0) {
+        *o = *o | (1 << 5);
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_cardinality)
+{
+    statsite_config config;
+    fail_unless(config_from_filename(NULL, &config) == 0);
+    cardinality_config limit = {"api.", 3};
+    config.cardinality_configs = &limit;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    metrics m;
+    admitted_keys admitted;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_admitted_keys(config.num_cardinality_limits, &admitted) == 0);
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                config.cardinality_limits, NULL, false, &m) == -1);
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                config.cardinality_limits, &admitted, false, &m) == 0);
+
+    // The first keys fill the limit, and keep taking samples after it
+    fail_unless(metrics_add_sample(&m, COUNTER, "api.0", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "api.1", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "api.2", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "api.3", 3, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "api.4", 4, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "api.0", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "api.5", 1, 1.0) == 0);
+
+    // Other prefixes are not limited
+    char name[32];
+    for (int i=0; i < 10; i++) {
+        snprintf(name, sizeof(name), "site.%d", i);
+        fail_unless(metrics_add_sample(&m, COUNTER, name, 1, 1.0) == 0);
+    }
+
+    int okay = 0;
+    fail_unless(metrics_iter(&m, (void*)&okay, iter_test_cardinality) == 0);
+    fail_unless(okay == 63);
+    fail_unless(hashmap_size(m.counters) == 15);
+    fail_unless(destroy_metrics(&m) == 0);
+    fail_unless(destroy_admitted_keys(&admitted) == 0);
+}
+END_TEST
+
+static int iter_test_cardinality_shards(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == COUNTER && strcmp(key, "api.0") == 0 && counter_sum(val) == 2) {
+        *o = *o | 1;
+    } else if (type == COUNTER && strcmp(key, "api.1") == 0 && counter_sum(val) == 2) {
+        *o = *o | (1 << 1);
+    } else if (type == COUNTER && strcmp(key, "api.2") == 0 && counter_sum(val) == 1) {
+        *o = *o | (1 << 2);
+    } else if (type == COUNTER && strcmp(key, "api.__overflow__") == 0 && counter_sum(val) == 5) {
+        *o = *o | (1 << 3);
+    } else if (type == TIMER && strcmp(key, "api.__overflow__") == 0) {
+        *o = *o | (1 << 4);
+    } else if (type == COUNTER && strcmp(key, "api.__rejected__") == 0 && counter_sum(val) == 6) {
+        *o = *o | (1 << 5);
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_cardinality_shards)
+{
+    statsite_config config;
+    fail_unless(config_from_filename(NULL, &config) == 0);
+    cardinality_config limit = {"api.", 3};
+    config.cardinality_configs = &limit;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    // Two shards of an interval share the admitted keys
+    metrics m1, m2;
+    admitted_keys admitted;
+    double quants[] = {0.5, 0.95, 0.99};
+    fail_unless(init_admitted_keys(1, &admitted) == 0);
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                config.cardinality_limits, &admitted, false, &m1) == 0);
+    fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL, false,
+                config.cardinality_limits, &admitted, false, &m2) == 0);
+
+    // A key admitted by one shard is not counted again by the other
+    fail_unless(metrics_add_sample(&m1, COUNTER, "api.0", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, COUNTER, "api.1", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "api.1", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "api.2", 1, 1.0) == 0);
+    fail_unless(admitted.counts[0] == 3);
+
+    // The limit holds across the shards, but admitted keys
+    // still take samples in either of them
+    fail_unless(metrics_add_sample(&m2, COUNTER, "api.3", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, COUNTER, "api.4", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "api.0", 1, 1.0) == 0);
+
+    // Each type of a name is a key of its own
+    fail_unless(metrics_add_sample(&m1, TIMER, "api.0", 1, 1.0) == 0);
+
+    // Rejected keys are remembered by the shard
+    uint64_t hash = hashmap_hash("api.3", 5) ^ ((uint64_t)COUNTER * 0x9E3779B97F4A7C15ULL);
+    fail_unless(m2.rejected[hash & (REJECTED_KEYS - 1)].hash == hash);
+    fail_unless(m2.rejected[hash & (REJECTED_KEYS - 1)].limit != NULL);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "api.3", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, COUNTER, "api.3", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, COUNTER, "api.3", 1, 1.0) == 0);
+    fail_unless(admitted.counts[0] == 3);
+    fail_unless(hashmap_size(admitted.keys) == 3);
+    fail_unless(hashmap_size(m1.counters) == 4);
+    fail_unless(hashmap_size(m2.counters) == 5);
+
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+    int okay = 0;
+    fail_unless(metrics_iter(&m1, (void*)&okay, iter_test_cardinality_shards) == 0);
+    fail_unless(okay == 63);
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_admitted_keys(&admitted) == 0);
+}
+END_TEST
+
+static int iter_test_admission(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == TIMER && strcmp(key, "once") == 0) {
+        timer_hist *t = val;
+        if (timer_count(&t->tm) == 1 && timer_sum(&t->tm) == 5 && t->counts && t->counts[1] == 1)
+            *o = *o | 1;
+    } else if (type == TIMER && strcmp(key, "twice") == 0) {
+        timer_hist *t = val;
+        if (timer_count(&t->tm) == 2 && timer_sum(&t->tm) == 11)
+            *o = *o | (1 << 1);
+    } else if (type == SET && strcmp(key, "s1") == 0 && set_size(val) == 1) {
+        *o = *o | (1 << 2);
+    } else if (type == SET && strcmp(key, "s2") == 0 && set_size(val) == 2) {
+        *o = *o | (1 << 3);
+    } else if (type == TIMER && strlen(key) == 1) {
+        // Merged from every mix of staged and built timers
+        timer_hist *t = val;
+        if (timer_count(&t->tm) == 2 + (key[0] != 'x'))
+            *o = *o | (1 << (4 + key[0] - 'x'));
+    } else if (type == SET && strncmp(key, "set", 3) == 0 && set_size(val) == 3) {
+        *o = *o | (1 << (7 + key[3] - 'x'));
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_admission)
+{
+    statsite_config config;
+    fail_unless(config_from_filename(NULL, &config) == 0);
+    histogram_config hist = {"once", 0, 20, 10, 4, NULL, 0};
+    config.hist_configs = &hist;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    double quants[] = {0.5, 0.95, 0.99};
+    for (int unified=0; unified < 2; unified++) {
+        metrics m, m2;
+        fail_unless(init_interval_metrics(0.01, quants, 3, config.histograms, 12, NULL, NULL,
+                    unified, NULL, NULL, true, &m) == 0);
+        fail_unless(init_interval_metrics(0.01, quants, 3, config.histograms, 12, NULL, NULL,
+                    unified, NULL, NULL, true, &m2) == 0);
+
+        // Singletons are built when flushed
+        fail_unless(metrics_add_sample(&m, TIMER, "once", 5, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "twice", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "twice", 10, 1.0) == 0);
+        fail_unless(metrics_set_update(&m, "s1", "a") == 0);
+        fail_unless(metrics_set_update(&m, "s2", "a") == 0);
+        fail_unless(metrics_set_update(&m, "s2", "b") == 0);
+
+        // Staged and built values on either side of a merge
+        fail_unless(metrics_add_sample(&m, TIMER, "x", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "x", 2, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "y", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "y", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "y", 2, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "z", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "z", 2, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "z", 2, 1.0) == 0);
+        fail_unless(metrics_set_update(&m, "setx", "a") == 0);
+        fail_unless(metrics_set_update(&m, "setx", "b") == 0);
+        fail_unless(metrics_set_update(&m2, "setx", "c") == 0);
+        fail_unless(metrics_set_update(&m, "sety", "a") == 0);
+        fail_unless(metrics_set_update(&m2, "sety", "b") == 0);
+        fail_unless(metrics_set_update(&m2, "sety", "c") == 0);
+        fail_unless(metrics_merge(&m, &m2) == 0);
+
+        int okay = 0;
+        fail_unless(metrics_iter(&m, (void*)&okay, iter_test_admission) == 0);
+        fail_unless(okay == 511);
+        fail_unless(destroy_metrics(&m) == 0);
+    }
+}
+END_TEST
+
+static int iter_test_dump(void *data, metric_type type, char *key, void *val) {
+    // Print every metric exactly, so two stores can be compared
+    char *out = data + strlen(data);
+    switch (type) {
+        case COUNTER:
+            sprintf(out, "c %s %lu %a %a %a %a\n", key, counter_count(val), counter_sum(val),
+                    counter_squared_sum(val), counter_min(val), counter_max(val));
+            break;
+        case TIMER: {
+            timer_hist *t = val;
+            sprintf(out, "t %s %lu %a %a %a %u\n", key, timer_count(&t->tm), timer_sum(&t->tm),
+                    timer_squared_sum(&t->tm), timer_query(&t->tm, 0.5),
+                    t->counts ? t->counts[1] : 0);
+            break;
+        }
+        case GAUGE:
+            sprintf(out, "g %s %lu %a %a %a %a\n", key, gauge_count(val), gauge_value(val),
+                    gauge_sum(val), gauge_min(val), gauge_max(val));
+            break;
+        case GAUGE_DIRECT:
+            sprintf(out, "k %s %a\n", key, gauge_direct_value(val));
+            break;
+        case SET:
+            sprintf(out, "s %s %lu\n", key, set_size(val));
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+START_TEST(test_metrics_add_samples)
+{
+    statsite_config config;
+    fail_unless(config_from_filename(NULL, &config) == 0);
+    histogram_config hist = {"t", 0, 20, 10, 4, NULL, 0};
+    config.hist_configs = &hist;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    metric_sample counters[] = {{COUNTER, 0.1, 1.0}, {COUNTER, 0.7, 0.1}, {COUNTER, 0.2, 1.0}};
+    metric_sample gauges[] = {{GAUGE, 0.3}, {GAUGE_DELTA, 0.1}, {GAUGE_DELTA, -0.7}, {GAUGE, 2}};
+    metric_sample directs[] = {{GAUGE_DIRECT, 4}, {GAUGE_DIRECT, 3}};
+    metric_sample timers[] = {{TIMER, 1.5, 1.0}, {TIMER, NAN, 1.0}, {TIMER, 7, 0.5}};
+    metric_sample single[] = {{TIMER, INFINITY, 1.0}, {TIMER, 3, 1.0}};
+    metric_sample sets[] = {{SET, 0, 1.0, "a"}, {SET, 0, 1.0, "b"}, {SET, 0, 1.0, "a"}};
+
+    double quants[] = {0.5, 0.95, 0.99};
+    for (int admission=0; admission < 2; admission++) {
+        // Adding a run matches adding the samples one at a time
+        metrics m, m2;
+        fail_unless(init_interval_metrics(0.01, quants, 3, config.histograms, 12, NULL, NULL,
+                    false, NULL, NULL, admission, &m) == 0);
+        fail_unless(init_interval_metrics(0.01, quants, 3, config.histograms, 12, NULL, NULL,
+                    false, NULL, NULL, admission, &m2) == 0);
+
+        for (int i=0; i < 3; i++)
+            fail_unless(metrics_add_sample(&m, COUNTER, "c", counters[i].value, counters[i].sample_rate) == 0);
+        for (int i=0; i < 4; i++)
+            fail_unless(metrics_add_sample(&m, gauges[i].type, "g", gauges[i].value, 1.0) == 0);
+        for (int i=0; i < 2; i++)
+            fail_unless(metrics_add_sample(&m, GAUGE_DIRECT, "k", directs[i].value, 1.0) == 0);
+        for (int i=0; i < 3; i++)
+            metrics_add_sample(&m, TIMER, "t", timers[i].value, timers[i].sample_rate);
+        for (int i=0; i < 2; i++)
+            metrics_add_sample(&m, TIMER, "t1", single[i].value, single[i].sample_rate);
+        for (int i=0; i < 3; i++)
+            fail_unless(metrics_set_update(&m, "s", sets[i].set_value) == 0);
+        fail_unless(metrics_set_update(&m, "s1", "a") == 0);
+
+        fail_unless(metrics_add_hashed_samples(&m2, COUNTER, "c", 1, hashmap_hash("c", 1), counters, 3) == 0);
+        fail_unless(metrics_add_hashed_samples(&m2, GAUGE, "g", 1, hashmap_hash("g", 1), gauges, 4) == 0);
+        fail_unless(metrics_add_hashed_samples(&m2, GAUGE_DIRECT, "k", 1, hashmap_hash("k", 1), directs, 2) == 0);
+        fail_unless(metrics_add_hashed_samples(&m2, TIMER, "t", 1, hashmap_hash("t", 1), timers, 3) == -1);
+        fail_unless(metrics_add_hashed_samples(&m2, TIMER, "t1", 2, hashmap_hash("t1", 2), single, 2) == -1);
+        fail_unless(metrics_add_hashed_samples(&m2, TIMER, "x", 1, hashmap_hash("x", 1), single, 1) == -1);
+        fail_unless(metrics_add_hashed_samples(&m2, SET, "s", 1, hashmap_hash("s", 1), sets, 3) == 0);
+        fail_unless(metrics_add_hashed_samples(&m2, SET, "s1", 2, hashmap_hash("s1", 2), sets, 1) == 0);
+
+        char out[1024] = "", out2[1024] = "";
+        fail_unless(metrics_iter(&m, out, iter_test_dump) == 0);
+        fail_unless(metrics_iter(&m2, out2, iter_test_dump) == 0);
+        fail_unless(strlen(out) > 0);
+        fail_unless(strcmp(out, out2) == 0);
+        fail_unless(strstr(out, "t x") == NULL);
+
+        fail_unless(destroy_metrics(&m) == 0);
+        fail_unless(destroy_metrics(&m2) == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_metrics_hot_keys)
+{
+    double quants[] = {0.5, 0.95, 0.99};
+    for (int unified=0; unified < 2; unified++) {
+        metrics m;
+        fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL,
+                    unified, NULL, NULL, true, &m) == 0);
+
+        // Lookups are only counted with the cache enabled
+        fail_unless(metrics_add_sample(&m, COUNTER, "warm", 1, 1.0) == 0);
+        fail_unless(m.hot_keys == NULL);
+        fail_unless(m.hot_lookups == 0);
+        metrics_use_hot_keys(&m);
+
+        // The second lookup of a name fills the cache
+        for (int i=0; i < 10; i++)
+            fail_unless(metrics_add_sample(&m, COUNTER, "hot", 1, 1.0) == 0);
+        fail_unless(m.hot_lookups == 10);
+        fail_unless(m.hot_hits == 8);
+
+        // Staged values are not cached until they are built
+        fail_unless(metrics_add_sample(&m, TIMER, "hot", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "hot", 2, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "hot", 3, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "hot", 4, 1.0) == 0);
+        fail_unless(m.hot_hits == 9);
+
+        // Names sharing an entry evict each other
+        char name[32];
+        uint64_t hot = hashmap_hash("hot", 3);
+        int evicted = 0;
+        for (int i=0; evicted < 2; i++) {
+            snprintf(name, sizeof(name), "cold%d", i);
+            if ((hashmap_hash(name, strlen(name)) ^ hot) & (HOT_KEYS - 1)) continue;
+            fail_unless(metrics_add_sample(&m, COUNTER, name, 1, 1.0) == 0);
+            fail_unless(metrics_add_sample(&m, COUNTER, name, 1, 1.0) == 0);
+            fail_unless(metrics_add_sample(&m, COUNTER, "hot", 1, 1.0) == 0);
+            evicted++;
+        }
+        fail_unless(m.hot_hits == 9);
+
+        counter *c = NULL;
+        timer_hist *t;
+        if (!unified) {
+            fail_unless(hashmap_get(m.counters, "hot", (void**)&c) == 0);
+            fail_unless(counter_sum(c) == 12);
+            fail_unless(hashmap_get(m.timers, "hot", (void**)&t) == 0);
+            fail_unless(timer_count(&t->tm) == 4);
+            fail_unless(timer_sum(&t->tm) == 10);
+        }
+
+        // Merging drops the cached values
+        metrics m2;
+        fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL,
+                    unified, NULL, NULL, true, &m2) == 0);
+        metrics_use_hot_keys(&m2);
+        fail_unless(metrics_add_sample(&m2, COUNTER, "hot", 1, 1.0) == 0);
+        fail_unless(metrics_merge(&m, &m2) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "hot", 1, 1.0) == 0);
+        fail_unless(m.hot_hits == 9);
+        if (!unified)
+            fail_unless(counter_sum(c) == 14);
+        fail_unless(destroy_metrics(&m) == 0);
+    }
+}
+END_TEST
+
+static int iter_test_index(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    if (type == COUNTER && strcmp(key, "a") == 0 && counter_sum(val) == 3)
+        *o = *o | 1;
+    else if (type == TIMER && strcmp(key, "a") == 0 && timer_count(&((timer_hist*)val)->tm) == 2)
+        *o = *o | (1 << 1);
+    else if (type == SET && strcmp(key, "s") == 0 && set_size(val) == 2)
+        *o = *o | (1 << 2);
+    else if (type == GAUGE && strcmp(key, "g") == 0 && gauge_value(val) == 5)
+        *o = *o | (1 << 3);
+    else if (type == COUNTER && strcmp(key, "new") == 0)
+        *o = *o | (1 << 4);
+    else if (type == COUNTER && strcmp(key, "api.0") == 0)
+        *o = *o | (1 << 5);
+    else if (type == COUNTER && strcmp(key, "api.2") == 0)
+        *o = *o | (1 << 6);
+    else if (type == COUNTER && strcmp(key, "api.__overflow__") == 0 && counter_sum(val) == 1)
+        *o = *o | (1 << 7);
+    else if (type == COUNTER && strcmp(key, "api.__rejected__") == 0 && counter_sum(val) == 1)
+        *o = *o | (1 << 8);
+    else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_index)
+{
+    statsite_config config;
+    fail_unless(config_from_filename(NULL, &config) == 0);
+    cardinality_config limit = {"api.", 2};
+    config.cardinality_configs = &limit;
+    fail_unless(build_prefix_tree(&config) == 0);
+    radix_tree *limits = config.cardinality_limits;
+
+    double quants[] = {0.5, 0.95, 0.99};
+    for (int unified=0; unified < 2; unified++) {
+        // The names of the first interval are indexed
+        metrics m, m2;
+        admitted_keys first, second;
+        fail_unless(init_admitted_keys(1, &first) == 0);
+        fail_unless(init_admitted_keys(1, &second) == 0);
+        fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL,
+                    unified, limits, &first, true, &m) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "a", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "a", 1, 1.0) == 0);
+        fail_unless(metrics_set_update(&m, "s", "x") == 0);
+        fail_unless(metrics_add_sample(&m, GAUGE, "g", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "idle", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "api.0", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "api.1", 1, 1.0) == 0);
+        name_index *idx = metrics_build_index(&m);
+        fail_unless(idx != NULL);
+        fail_unless(idx->num_names == 7);
+        fail_unless(destroy_metrics(&m) == 0);
+
+        // Two shards of the next interval share the index
+        fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL,
+                    unified, limits, &second, true, &m) == 0);
+        fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL,
+                    unified, limits, &second, true, &m2) == 0);
+        fail_unless(metrics_use_index(&m, idx) == 0);
+        fail_unless(metrics_use_index(&m, idx) == -1);
+        fail_unless(metrics_use_index(&m2, idx) == 0);
+        name_index_release(idx);
+
+        for (int i=0; i < 3; i++)
+            fail_unless(metrics_add_sample(i ? &m : &m2, COUNTER, "a", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, TIMER, "a", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "a", 2, 1.0) == 0);
+        fail_unless(metrics_set_update(&m, "s", "x") == 0);
+        fail_unless(metrics_set_update(&m2, "s", "y") == 0);
+        fail_unless(metrics_add_sample(&m2, GAUGE, "g", 5, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "new", 1, 1.0) == 0);
+
+        // Indexed names count against the limits on their first sample
+        fail_unless(metrics_add_sample(&m, COUNTER, "api.2", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "api.0", 1, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m, COUNTER, "api.1", 1, 1.0) == 0);
+
+        // Only the new names are in the maps
+        if (unified)
+            fail_unless(hashmap_size(m.unified) == 4);
+        else {
+            fail_unless(hashmap_size(m.counters) == 4);
+            fail_unless(hashmap_size(m.timers) == 0);
+            fail_unless(hashmap_size(m.sets) == 0);
+        }
+
+        // Shards with different indexes do not merge
+        metrics other;
+        fail_unless(init_interval_metrics(0.01, quants, 3, NULL, 12, NULL, NULL,
+                    unified, limits, &first, true, &other) == 0);
+        fail_unless(metrics_merge(&m, &other) == -1);
+        fail_unless(destroy_metrics(&other) == 0);
+
+        fail_unless(metrics_merge(&m, &m2) == 0);
+        int okay = 0;
+        fail_unless(metrics_iter(&m, (void*)&okay, iter_test_index) == 0);
+        fail_unless(okay == 511);
+
+        // The unused names drop out of the next index
+        idx = metrics_build_index(&m);
+        fail_unless(idx != NULL);
+        fail_unless(idx->num_names == 9);
+        fail_unless(name_index_find(idx, "idle", hashmap_hash("idle", 4) ^
+                    ((uint64_t)COUNTER * 0x9E3779B97F4A7C15ULL), COUNTER) == -1);
+        name_index_release(idx);
+        fail_unless(destroy_metrics(&m) == 0);
+        fail_unless(destroy_admitted_keys(&first) == 0);
+        fail_unless(destroy_admitted_keys(&second) == 0);
+    }
+}
+END_TEST
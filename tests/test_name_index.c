@@ -0,0 +1,96 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "name_index.h"
+#include "hashmap.h"
+
+// Mixes the tag into the hash, as the metrics do
+static uint64_t tagged_hash(char *name, int tag) {
+    return hashmap_hash(name, strlen(name)) ^ ((uint64_t)tag * 0x9E3779B97F4A7C15ULL);
+}
+
+static char** index_names(int num) {
+    char **names = malloc(num * sizeof(char*));
+    char buf[64];
+    for (int i=0; i < num; i++) {
+        snprintf(buf, sizeof(buf), "api.host%d.requests.%d", i % 97, i);
+        names[i] = strdup(buf);
+    }
+    return names;
+}
+
+START_TEST(test_name_index_build)
+{
+    fail_unless(name_index_build(NULL, NULL, NULL, 0) == NULL);
+
+    // The same name may be indexed under several tags
+    char *names[] = {"foo", "bar", "baz", "foo"};
+    uint8_t tags[] = {1, 2, 2, 2};
+    uint64_t hashes[4];
+    for (int i=0; i < 4; i++)
+        hashes[i] = tagged_hash(names[i], tags[i]);
+    name_index *idx = name_index_build(names, hashes, tags, 4);
+    fail_unless(idx != NULL);
+    fail_unless(idx->num_names == 4);
+
+    int seen = 0;
+    for (int i=0; i < 4; i++) {
+        int pos = name_index_find(idx, names[i], hashes[i], tags[i]);
+        fail_unless(pos >= 0 && pos < (int)idx->size);
+        fail_unless(strcmp(name_index_name(idx, pos), names[i]) == 0);
+        fail_unless(name_index_tag(idx, pos) == tags[i]);
+        fail_unless(!(seen & (1 << pos)));
+        seen |= 1 << pos;
+    }
+
+    // Unknown names and tags are not found
+    fail_unless(name_index_find(idx, "qux", tagged_hash("qux", 1), 1) == -1);
+    fail_unless(name_index_find(idx, "bar", tagged_hash("bar", 1), 1) == -1);
+    fail_unless(name_index_find(idx, "bar", tagged_hash("bar", 3), 3) == -1);
+
+    name_index_ref(idx);
+    name_index_release(idx);
+    fail_unless(idx->refs == 1);
+    name_index_release(idx);
+}
+END_TEST
+
+START_TEST(test_name_index_large)
+{
+    int num = 200000;
+    char **names = index_names(num);
+    uint64_t *hashes = malloc(num * sizeof(uint64_t));
+    uint8_t *tags = malloc(num);
+    size_t names_len = 0;
+    for (int i=0; i < num; i++) {
+        tags[i] = 1 + i % 5;
+        hashes[i] = tagged_hash(names[i], tags[i]);
+        names_len += strlen(names[i]) + 1;
+    }
+
+    name_index *idx = name_index_build(names, hashes, tags, num);
+    fail_unless(idx != NULL);
+    fail_unless(idx->size < num + num / 32);
+
+    // Every name has its own position
+    char *used = calloc(idx->size, 1);
+    for (int i=0; i < num; i++) {
+        int pos = name_index_find(idx, names[i], hashes[i], tags[i]);
+        fail_unless(pos >= 0);
+        fail_unless(!used[pos]);
+        used[pos] = 1;
+    }
+
+    // A few bytes per name besides the names themselves
+    fail_unless(name_index_bytes(idx) - names_len < (size_t)num * 6);
+
+    name_index_release(idx);
+    for (int i=0; i < num; i++)
+        free(names[i]);
+    free(names);
+    free(hashes);
+    free(tags);
+    free(used);
+}
+END_TEST
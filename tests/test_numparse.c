@@ -0,0 +1,98 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "numparse.h"
+
+/**
+ * Checks that a string parses to the same bits
+ * and end pointer as strtod.
+ */
+static void check_matches_strtod(const char *str) {
+    char *fast_end, *slow_end;
+    double fast = fast_parse_double(str, &fast_end);
+    double slow = strtod(str, &slow_end);
+    fail_unless(fast_end == slow_end && memcmp(&fast, &slow, sizeof(double)) == 0,
+            "Mismatch for '%s': %.17g (end %ld) vs strtod %.17g (end %ld)",
+            str, fast, (long)(fast_end - str), slow, (long)(slow_end - str));
+}
+
+START_TEST(test_parse_integers)
+{
+    char *end;
+    fail_unless(fast_parse_double("42", &end) == 42);
+    fail_unless(*end == '\0');
+    fail_unless(fast_parse_double("-17|c", &end) == -17);
+    fail_unless(*end == '|');
+    fail_unless(fast_parse_double("+3", &end) == 3);
+    fail_unless(fast_parse_double("9007199254740992", &end) == 9007199254740992.0);
+
+    // Every integer up to a million
+    char buf[32];
+    for (int i=-1000000; i <= 1000000; i++) {
+        snprintf(buf, sizeof(buf), "%d", i);
+        check_matches_strtod(buf);
+    }
+}
+END_TEST
+
+START_TEST(test_parse_edge_cases)
+{
+    const char *inputs[] = {
+        "", "-", "+", ".", "-.", "e5", ".e5", "1e", "1e+", "1e-", "1.e3",
+        ".5", "5.", "-0", "+0", "0.0", "-0.0", "00012", "1.5e", "1E5",
+        "1e-5", "1e22", "1e23", "1e-22", "1e-23", "1e308", "1e309",
+        "1e-320", "1e-400", "2e99999", "0e99999", "0.1", "0.2", "0.3",
+        "123456789012345678", "1234567890123456789", "12345678901234567890",
+        "9007199254740993", "18446744073709551615", "18446744073709551616",
+        "0.000000000000000000001", "0x10", "0X1p4", "0x", "inf", "-inf",
+        "nan", "NaN", "infinity", " 12", "\t1", "1 ", "1..2", "1.2.3",
+        "1e5e5", "--1", "+-1", "4.9406564584124654e-324",
+        "2.2250738585072014e-308", "1.7976931348623157e308", "1.3|ms",
+        "0.5|@0.1", "3.14159265358979323846", "1e0", "100e-2", "5e-1",
+        "123.456e-7", "9.999999999999999e22", NULL
+    };
+    for (int i=0; inputs[i]; i++) {
+        check_matches_strtod(inputs[i]);
+    }
+}
+END_TEST
+
+START_TEST(test_parse_random)
+{
+    // Random decimals in the shapes clients send, including
+    // exponents and long mantissas that take the slow path
+    char buf[64];
+    srandom(42);
+    for (int i=0; i < 1000000; i++) {
+        int len = 0;
+        if (random() % 4 == 0) buf[len++] = "+-"[random() % 2];
+        int int_digits = random() % 12;
+        for (int j=0; j < int_digits; j++)
+            buf[len++] = '0' + random() % 10;
+        if (random() % 2) {
+            buf[len++] = '.';
+            int frac_digits = random() % 12;
+            for (int j=0; j < frac_digits; j++)
+                buf[len++] = '0' + random() % 10;
+        }
+        if (random() % 4 == 0) {
+            buf[len++] = "eE"[random() % 2];
+            if (random() % 2) buf[len++] = "+-"[random() % 2];
+            len += snprintf(buf + len, 8, "%ld", random() % 40);
+        }
+        buf[len++] = "|@\0"[random() % 3];
+        buf[len] = '\0';
+        check_matches_strtod(buf);
+    }
+
+    // Round trips of random doubles
+    for (int i=0; i < 100000; i++) {
+        uint64_t bits = ((uint64_t)random() << 33) ^ ((uint64_t)random() << 2) ^ random();
+        double val;
+        memcpy(&val, &bits, sizeof(double));
+        snprintf(buf, sizeof(buf), "%.*g", (int)(random() % 17) + 1, val);
+        check_matches_strtod(buf);
+    }
+}
+END_TEST
@@ -72,3 +72,52 @@ START_TEST(test_set_error_bound)
 END_TEST
 
 
+
+START_TEST(test_set_merge_exact)
+{
+    set_t s1, s2;
+    fail_unless(set_init(14, &s1) == 0);
+    fail_unless(set_init(14, &s2) == 0);
+
+    char buf[100];
+    for (int i=0; i < 20; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        set_add((i < 15) ? &s1 : &s2, (char*)&buf);
+    }
+    set_add(&s2, "test0");
+
+    fail_unless(set_merge(&s1, &s2) == 0);
+    fail_unless(set_size(&s1) == 20);
+
+    fail_unless(set_destroy(&s1) == 0);
+    fail_unless(set_destroy(&s2) == 0);
+}
+END_TEST
+
+START_TEST(test_set_merge_approx)
+{
+    // Precision 14 -> variance of 1%
+    set_t s1, s2;
+    fail_unless(set_init(14, &s1) == 0);
+    fail_unless(set_init(14, &s2) == 0);
+
+    char buf[100];
+    for (int i=0; i < 10; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        set_add(&s1, (char*)&buf);
+    }
+    for (int i=0; i < 10000; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        set_add(&s2, (char*)&buf);
+    }
+
+    fail_unless(set_merge(&s1, &s2) == 0);
+
+    // Should be within 1 %
+    uint64_t size = set_size(&s1);
+    fail_unless(size > 9900 && size < 10100);
+
+    fail_unless(set_destroy(&s1) == 0);
+    fail_unless(set_destroy(&s2) == 0);
+}
+END_TEST
@@ -88,3 +88,159 @@ START_TEST(test_timer_sample_rate)
   fail_unless(res == 0);
 }
 END_TEST
+
+START_TEST(test_timer_ddsketch)
+{
+  timer t, cm;
+  double quants[] = {0.5, 0.90, 0.99};
+  int res = init_timer_engine(QUANTILE_DDSKETCH, 0.01, (double*)&quants, 3, &t);
+  fail_unless(res == 0);
+  fail_unless(t.engine == QUANTILE_DDSKETCH);
+
+  for (int i=1; i<=100; i++)
+      fail_unless(timer_add_sample(&t, i, 1.0) == 0);
+
+  fail_unless(timer_count(&t) == 100);
+  fail_unless(timer_min(&t) == 1);
+  fail_unless(timer_max(&t) == 100);
+  fail_unless(timer_mean(&t) == 50.5);
+  fail_unless(timer_query(&t, 0.5) >= 50 * 0.99 && timer_query(&t, 0.5) <= 50 * 1.01);
+  fail_unless(timer_query(&t, 0.99) >= 99 * 0.99 && timer_query(&t, 0.99) <= 99 * 1.01);
+
+  // Timers of different engines do not merge
+  fail_unless(init_timer(0.01, (double*)&quants, 3, &cm) == 0);
+  fail_unless(timer_add_sample(&cm, 1, 1.0) == 0);
+  fail_unless(timer_merge(&t, &cm) == -1);
+
+  fail_unless(destroy_timer(&t) == 0);
+  fail_unless(destroy_timer(&cm) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_hdr)
+{
+  timer t, other;
+  int res = init_timer_hdr(0.01, 0.01, 1000, &t);
+  fail_unless(res == 0);
+  fail_unless(t.engine == QUANTILE_HDR);
+
+  for (int i=1; i<=100; i++)
+      fail_unless(timer_add_sample(&t, i, 1.0) == 0);
+
+  fail_unless(timer_count(&t) == 100);
+  fail_unless(timer_min(&t) == 1);
+  fail_unless(timer_max(&t) == 100);
+  fail_unless(timer_mean(&t) == 50.5);
+  fail_unless(timer_query(&t, 0.5) >= 50 * 0.99 && timer_query(&t, 0.5) <= 50 * 1.01);
+  fail_unless(timer_query(&t, 0.99) >= 99 * 0.99 && timer_query(&t, 0.99) <= 99 * 1.01);
+
+  // The default range merges with itself, but not with another
+  fail_unless(init_timer_engine(QUANTILE_HDR, 0.01, NULL, 0, &other) == 0);
+  for (int i=1; i<=100; i++)
+      fail_unless(timer_add_sample(&other, i, 1.0) == 0);
+  fail_unless(other.store.hdr.max_val == HDR_DEFAULT_MAX);
+  fail_unless(timer_merge(&t, &other) == -1);
+
+  fail_unless(destroy_timer(&t) == 0);
+  fail_unless(destroy_timer(&other) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_exact)
+{
+  timer t;
+  double quants[] = {0.5, 0.90, 0.99};
+  fail_unless(init_timer(0.01, (double*)&quants, 3, &t) == 0);
+  fail_unless(t.exact);
+  fail_unless(timer_query(&t, 0.5) == 0);
+  fail_unless(timer_min(&t) == 0);
+  fail_unless(timer_max(&t) == 0);
+
+  // Shuffled values with duplicates
+  for (int i=0; i < 20; i++)
+      fail_unless(timer_add_sample(&t, (i * 7) % 20 + 1, 1.0) == 0);
+  fail_unless(timer_add_sample(&t, 5, 1.0) == 0);
+  fail_unless(timer_add_sample(&t, 5, 1.0) == 0);
+
+  // The quantiles are the exact nearest ranks of 22 values
+  fail_unless(t.exact);
+  fail_unless(timer_count(&t) == 22);
+  fail_unless(timer_min(&t) == 1);
+  fail_unless(timer_max(&t) == 20);
+  fail_unless(timer_query(&t, 0) == 1);
+  fail_unless(timer_query(&t, 0.2) == 5);
+  fail_unless(timer_query(&t, 0.25) == 5);
+  fail_unless(timer_query(&t, 0.5) == 9);
+  fail_unless(timer_query(&t, 0.9) == 18);
+  fail_unless(timer_query(&t, 0.99) == 20);
+  fail_unless(timer_query(&t, 1) == 20);
+
+  // The engine is built past the limit, with every sample
+  for (int i=0; i < TIMER_MAX_EXACT - 22; i++)
+      fail_unless(timer_add_sample(&t, 100, 1.0) == 0);
+  fail_unless(t.exact);
+  fail_unless(timer_add_sample(&t, 100, 1.0) == 0);
+  fail_unless(!t.exact);
+  fail_unless(t.store.cm.num_values + t.store.cm.batch_len == TIMER_MAX_EXACT + 1);
+  fail_unless(timer_min(&t) == 1);
+  fail_unless(timer_max(&t) == 100);
+
+  fail_unless(destroy_timer(&t) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_exact_bad_args)
+{
+  timer t;
+  double quants[] = {0.5, 0.90, 0.99};
+  double bad_quants[] = {0.5, 1.5};
+  fail_unless(init_timer(0, (double*)&quants, 3, &t) == -1);
+  fail_unless(init_timer(0.5, (double*)&quants, 3, &t) == -1);
+  fail_unless(init_timer(0.01, (double*)&quants, 0, &t) == -1);
+  fail_unless(init_timer(0.01, (double*)&bad_quants, 2, &t) == -1);
+  fail_unless(init_timer_engine(QUANTILE_DDSKETCH, 1, NULL, 0, &t) == -1);
+  fail_unless(init_timer_hdr(0.01, 0, 100, &t) == -1);
+  fail_unless(init_timer_hdr(0.01, 100, 10, &t) == -1);
+}
+END_TEST
+
+START_TEST(test_timer_exact_merge)
+{
+  timer a, b, c;
+  double quants[] = {0.5, 0.90, 0.99};
+  fail_unless(init_timer(0.01, (double*)&quants, 3, &a) == 0);
+  fail_unless(init_timer(0.01, (double*)&quants, 3, &b) == 0);
+  fail_unless(init_timer(0.01, (double*)&quants, 3, &c) == 0);
+
+  // Two exact timers stay exact while they fit
+  for (int i=1; i <= 10; i++) {
+      fail_unless(timer_add_sample(&a, i, 1.0) == 0);
+      fail_unless(timer_add_sample(&b, i + 10, 1.0) == 0);
+  }
+  fail_unless(timer_merge(&a, &b) == 0);
+  fail_unless(a.exact);
+  fail_unless(timer_count(&a) == 20);
+  fail_unless(timer_query(&a, 0.5) == 10);
+  fail_unless(timer_max(&a) == 20);
+
+  // Merging a full timer builds the engine of an exact one
+  for (int i=21; i <= 100; i++)
+      fail_unless(timer_add_sample(&c, i, 1.0) == 0);
+  fail_unless(!c.exact);
+  fail_unless(timer_merge(&a, &c) == 0);
+  fail_unless(!a.exact);
+  fail_unless(timer_count(&a) == 100);
+  fail_unless(timer_min(&a) == 1);
+  fail_unless(timer_max(&a) == 100);
+  fail_unless(timer_query(&a, 0.5) >= 49 && timer_query(&a, 0.5) <= 51);
+
+  // And the exact samples merge into a full timer
+  fail_unless(timer_merge(&c, &b) == 0);
+  fail_unless(timer_count(&c) == 90);
+  fail_unless(timer_min(&c) == 11);
+
+  fail_unless(destroy_timer(&a) == 0);
+  fail_unless(destroy_timer(&b) == 0);
+  fail_unless(destroy_timer(&c) == 0);
+}
+END_TEST
@@ -0,0 +1,179 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tokenizer.h"
+
+/**
+ * Splits a line the way the memchr based parser did,
+ * to compare the tokenizer against.
+ */
+static void reference_split(char *line, char **val, char **type, char **rate) {
+    int len = strlen(line);
+    char *colon = memrchr(line, ':', len);
+    *val = *type = *rate = NULL;
+    if (!colon) return;
+    *val = colon + 1;
+    char *pipe = memchr(colon, '|', line + len - colon);
+    if (!pipe) return;
+    *type = pipe + 1;
+    *rate = memchr(pipe, '@', line + len - pipe);
+    if (*rate) (*rate)++;
+}
+
+static int tokenizer_impls(tokenizer_impl *impls) {
+    int num = 0;
+    impls[num++] = TOKENIZER_SCALAR;
+    if (tokenizer_detect() >= TOKENIZER_SSE2) impls[num++] = TOKENIZER_SSE2;
+    if (tokenizer_detect() >= TOKENIZER_AVX2) impls[num++] = TOKENIZER_AVX2;
+    return num;
+}
+
+START_TEST(test_tokenize_basic)
+{
+    char buf[] = "foo:1|c\nbar.baz:2.5|ms|@0.1\nzip:-3|g\n";
+    statsd_span spans[8];
+    int num = tokenize_lines((char*)&buf, strlen(buf), (statsd_span*)&spans, 8);
+    fail_unless(num == 3);
+
+    fail_unless(strcmp(spans[0].key, "foo") == 0);
+    fail_unless(strcmp(spans[0].value, "1") == 0);
+    fail_unless(strcmp(spans[0].type, "c") == 0);
+    fail_unless(spans[0].rate == NULL);
+    fail_unless(spans[0].len == 8);
+
+    fail_unless(strcmp(spans[1].key, "bar.baz") == 0);
+    fail_unless(strcmp(spans[1].value, "2.5") == 0);
+    fail_unless(*spans[1].type == 'm');
+    fail_unless(strcmp(spans[1].rate, "0.1") == 0);
+
+    fail_unless(strcmp(spans[2].key, "zip") == 0);
+    fail_unless(strcmp(spans[2].value, "-3") == 0);
+    fail_unless(strcmp(spans[2].type, "g") == 0);
+    fail_unless(spans[2].key + spans[2].len == buf + strlen("foo:1|c\nbar.baz:2.5|ms|@0.1\nzip:-3|g\n"));
+}
+END_TEST
+
+START_TEST(test_tokenize_malformed)
+{
+    char buf[] = "nocolon\nnopipe:1\nempty:|\n";
+    statsd_span spans[8];
+    int num = tokenize_lines((char*)&buf, sizeof(buf) - 1, (statsd_span*)&spans, 8);
+    fail_unless(num == 3);
+
+    fail_unless(strcmp(spans[0].key, "nocolon") == 0);
+    fail_unless(spans[0].value == NULL);
+    fail_unless(spans[0].type == NULL);
+
+    fail_unless(strcmp(spans[1].key, "nopipe") == 0);
+    fail_unless(strcmp(spans[1].value, "1") == 0);
+    fail_unless(spans[1].type == NULL);
+
+    fail_unless(strcmp(spans[2].value, "") == 0);
+    fail_unless(strcmp(spans[2].type, "") == 0);
+}
+END_TEST
+
+START_TEST(test_tokenize_last_colon)
+{
+    // Keys may contain colons, and pipes before the last colon are ignored
+    char buf[] = "a|b:c@d:1|c|@0.5\n";
+    statsd_span spans[1];
+    int num = tokenize_lines((char*)&buf, sizeof(buf) - 1, (statsd_span*)&spans, 1);
+    fail_unless(num == 1);
+    fail_unless(strcmp(spans[0].key, "a|b:c@d") == 0);
+    fail_unless(strcmp(spans[0].value, "1") == 0);
+    fail_unless(*spans[0].type == 'c');
+    fail_unless(strcmp(spans[0].rate, "0.5") == 0);
+}
+END_TEST
+
+START_TEST(test_tokenize_incomplete)
+{
+    // The trailing partial line must not be modified
+    char buf[] = "foo:1|c\nbar:2|c";
+    statsd_span spans[4];
+    int num = tokenize_lines((char*)&buf, sizeof(buf) - 1, (statsd_span*)&spans, 4);
+    fail_unless(num == 1);
+    fail_unless(strcmp(buf + 8, "bar:2|c") == 0);
+
+    char none[] = "foo:1|c";
+    fail_unless(tokenize_lines((char*)&none, sizeof(none) - 1, (statsd_span*)&spans, 4) == 0);
+    fail_unless(strcmp(none, "foo:1|c") == 0);
+}
+END_TEST
+
+START_TEST(test_tokenize_max_spans)
+{
+    char buf[] = "a:1|c\nb:2|c\nc:3|c\n";
+    statsd_span spans[2];
+    int num = tokenize_lines((char*)&buf, sizeof(buf) - 1, (statsd_span*)&spans, 2);
+    fail_unless(num == 2);
+    fail_unless(strcmp(spans[1].key, "b") == 0);
+    fail_unless(strcmp(buf + 12, "c:3|c\n") == 0);
+}
+END_TEST
+
+START_TEST(test_tokenize_binary_stop)
+{
+    char buf[] = "a:1|c\n\xaa\x02";
+    statsd_span spans[4];
+    int num = tokenize_lines((char*)&buf, sizeof(buf) - 1, (statsd_span*)&spans, 4);
+    fail_unless(num == 1);
+    fail_unless(tokenize_lines(buf + 6, 2, (statsd_span*)&spans, 4) == 0);
+}
+END_TEST
+
+START_TEST(test_tokenize_random)
+{
+    // Compare every implementation against the reference on
+    // random lines that cross the block boundaries
+    const char alphabet[] = "ab1.:|@-";
+    tokenizer_impl impls[3];
+    int num_impls = tokenizer_impls((tokenizer_impl*)&impls);
+    statsd_span spans[512];
+
+    srandom(42);
+    for (int round=0; round < 200; round++) {
+        char input[4096];
+        int len = 0;
+        while (len < (int)sizeof(input) - 80) {
+            int line_len = random() % 70;
+            for (int i=0; i < line_len; i++)
+                input[len++] = alphabet[random() % (sizeof(alphabet) - 1)];
+            input[len++] = '\n';
+        }
+        int partial = random() % 10;
+        for (int i=0; i < partial; i++)
+            input[len++] = 'x';
+
+        for (int k=0; k < num_impls; k++) {
+            char buf[4096], ref[4096];
+            memcpy(buf, input, len);
+            memcpy(ref, input, len);
+            int num = tokenize_lines_impl(impls[k], (char*)&buf, len, (statsd_span*)&spans, 512);
+
+            int offset = 0;
+            for (int i=0; i < num; i++) {
+                char *line = ref + offset;
+                char *nl = memchr(line, '\n', len - offset);
+                fail_unless(nl != NULL);
+                *nl = '\0';
+                fail_unless(spans[i].key == buf + offset);
+                fail_unless(spans[i].len == nl - line + 1);
+
+                char *val, *type, *rate;
+                reference_split(line, &val, &type, &rate);
+                fail_unless((val == NULL) == (spans[i].value == NULL));
+                fail_unless((type == NULL) == (spans[i].type == NULL));
+                fail_unless((rate == NULL) == (spans[i].rate == NULL));
+                if (val) fail_unless(spans[i].value - buf == val - ref);
+                if (type) fail_unless(spans[i].type - buf == type - ref);
+                if (rate) fail_unless(spans[i].rate - buf == rate - ref);
+                offset += spans[i].len;
+            }
+            fail_unless(memchr(ref + offset, '\n', len - offset) == NULL);
+        }
+    }
+}
+END_TEST
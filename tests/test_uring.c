@@ -0,0 +1,76 @@
+#include <check.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+START_TEST(test_uring_multishot_recv)
+{
+    uring ring;
+    if (uring_init(&ring, 8, 64)) {
+        // io_uring may be disabled, e.g. in containers
+        printf("Skipping io_uring test, it is not available\n");
+        return;
+    }
+    uring_buf_ring bufs;
+    if (uring_setup_buf_ring(&ring, &bufs, 0, 4, 64)) {
+        printf("Skipping io_uring test, provided buffers are not available\n");
+        uring_destroy(&ring);
+        return;
+    }
+
+    int fds[2];
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+    fail_unless(sqe != NULL);
+    uring_prep_multishot_recv(sqe, fds[0], 0, 42);
+    fail_unless(uring_submit(&ring) == 1);
+
+    // More writes than buffers, the buffers must be recycled
+    char received[1024];
+    int received_len = 0;
+    for (int i=0; i < 16; i++) {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "foo:%d|c\n", i);
+        fail_unless(write(fds[1], msg, len) == len);
+
+        struct io_uring_cqe *cqe = NULL;
+        for (int tries=0; !cqe && tries < 1000; tries++) {
+            cqe = uring_peek_cqe(&ring);
+            if (!cqe) usleep(1000);
+        }
+        fail_unless(cqe != NULL);
+        fail_unless(cqe->user_data == 42);
+        fail_unless(cqe->res == len);
+        fail_unless(cqe->flags & IORING_CQE_F_BUFFER);
+        fail_unless(cqe->flags & IORING_CQE_F_MORE);
+
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        memcpy(received + received_len, uring_buf(&bufs, bid), cqe->res);
+        received_len += cqe->res;
+        uring_recycle_buf(&bufs, bid);
+        uring_cqe_seen(&ring);
+    }
+    fail_unless(memcmp(received, "foo:0|c\nfoo:1|c\n", 16) == 0);
+
+    // Closing the peer ends the receive
+    close(fds[1]);
+    struct io_uring_cqe *cqe = NULL;
+    for (int tries=0; !cqe && tries < 1000; tries++) {
+        cqe = uring_peek_cqe(&ring);
+        if (!cqe) usleep(1000);
+    }
+    fail_unless(cqe != NULL);
+    fail_unless(cqe->res == 0);
+    fail_unless(!(cqe->flags & IORING_CQE_F_MORE));
+    uring_cqe_seen(&ring);
+
+    close(fds[0]);
+    uring_free_buf_ring(&ring, &bufs);
+    uring_destroy(&ring);
+}
+END_TEST
+#endif